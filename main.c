@@ -1,25 +1,40 @@
 #include "tutorials/gio-example/notification-sender.h"
 #include "tutorials/gobject-example/example-person.h"
+#include "tutorials/gstreamer-example/fast-convert-check.h"
+#include "tutorials/gstreamer-example/pipeline-bench.h"
+#include "tutorials/gstreamer-example/portal-check.h"
 #include "tutorials/gstreamer-example/screencast-webrtc.h"
 #include "tutorials/gstreamer-example/screencast.h"
+#include "tutorials/gstreamer-example/webrtc-check.h"
 #include "tutorials/timeout-example/timeout.h"
+#include "tutorials/sound-exclusion/pulse_check.h"
 #include "tutorials/sound-exclusion/sound_exclusion.h"
 #include <gio/gio.h>
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
 
-typedef void (*TutorialFunc)(int, char **);
+// Returns the exit status: the checks and `bench` are non-zero when they fail.
+typedef int (*TutorialFunc)(int, char **);
 
 typedef struct {
   const char *name; // command name
   TutorialFunc func;
 } Tutorial;
 
-void screencast_webrtc_with_sound_exclusion(int argc, char *argv[]){
-    get_excluded_sound();
-    screencast_webrtc_tutorial(2,argv);
+int screencast_webrtc_with_sound_exclusion(int argc, char *argv[]){
+    // Forward the user's options and mark the stream as sound excluded.
+    char **args = g_new0(char *, argc + 2);
+    args[0] = argv[0];
+    args[1] = "--sound-excluded";
+    for (int i = 1; i < argc; i++) args[i + 1] = argv[i];
+
+    // Rules keep running next to the stream; 'exclude ...' adds more.
+    int status = 1;
+    if (sound_exclusion_start()) status = screencast_webrtc_tutorial(argc + 1, args);
     restore_system();
+    g_free(args);
+    return status;
 }
 
 Tutorial tutorials[] = {
@@ -29,6 +44,13 @@ Tutorial tutorials[] = {
     {"screencast", screencast_tutorial},
     {"screencast-webrtc", screencast_webrtc_tutorial},
     {"screencast-webrtc-with-sound-exclusion", screencast_webrtc_with_sound_exclusion},
+    {"fastconvert-check", fast_convert_check_tutorial},
+    {"bench", pipeline_bench_tutorial},
+    {"portal-check", portal_check_tutorial},
+    {"mock-portal", mock_portal_tutorial},
+    {"pulse-check", pulse_check_tutorial},
+    {"webrtc-check", webrtc_check_tutorial},
+    {"webrtc-viewers", webrtc_viewers_tutorial},
     {NULL, NULL} // end of the array
 };
 
@@ -47,24 +69,17 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  gboolean found = FALSE;
-
   for (int i = 0; tutorials[i].name != NULL; i++) {
     if (strcmp(argv[1], tutorials[i].name) == 0) {
-      printf("Running tutorial: %s\n", tutorials[i].name);
+      // stderr, so stdout carries nothing but the tutorial's output, e.g.
+      // the JSON of `bench`.
+      fprintf(stderr, "Running tutorial: %s\n", tutorials[i].name);
 
-      tutorials[i].func(argc - 1, argv + 1);
-
-      found = TRUE;
-      break;
+      return tutorials[i].func(argc - 1, argv + 1);
     }
   }
 
-  if (!found) {
-    printf("Error: Command '%s' not found.\n", argv[1]);
-    print_help(argv[0]);
-    return 1;
-  }
-
-  return 0;
+  printf("Error: Command '%s' not found.\n", argv[1]);
+  print_help(argv[0]);
+  return 1;
 }
@@ -1,6 +1,6 @@
 #include "notification-sender.h"
 
-void send_notification(int argc, char *argv[]) {
+int send_notification(int argc, char *argv[]) {
   G_GNUC_UNUSED int _argc = argc;
   G_GNUC_UNUSED char **_argv = argv;
   GError *error = NULL;
@@ -10,7 +10,7 @@ void send_notification(int argc, char *argv[]) {
   if (!connection) {
     g_printerr("Error connecting to the dbus: %s", error->message);
     g_error_free(error);
-    return;
+    return 1;
   }
 
   GVariant *params = g_variant_new(
@@ -32,7 +32,7 @@ void send_notification(int argc, char *argv[]) {
   if (error) {
     g_printerr("Failed to send notifications: %s", error->message);
     g_error_free(error);
-    return;
+    return 1;
   }
 
   guint32 id;
@@ -41,4 +41,5 @@ void send_notification(int argc, char *argv[]) {
 
   g_object_unref(connection);
   g_variant_unref(results);
+  return 0;
 }
@@ -3,6 +3,6 @@
 
 #include <gio/gio.h>
 
-void send_notification(int argc, char *argv[]);
+int send_notification(int argc, char *argv[]);
 
 #endif // !NOTIFICATION_SENDER_H
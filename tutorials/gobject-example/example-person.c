@@ -83,7 +83,7 @@ void example_person_set_name(ExamplePerson *self, const gchar *name) {
 
 void example_person_set_age(ExamplePerson *self, gint age) { self->age = age; }
 
-void gobject_tutorial_get_set(int argc, char *argv[]) {
+int gobject_tutorial_get_set(int argc, char *argv[]) {
   G_GNUC_UNUSED int _argc = argc;
   G_GNUC_UNUSED char **_argv = argv;
   ExamplePerson *ahmet = example_person_new();
@@ -97,4 +97,5 @@ void gobject_tutorial_get_set(int argc, char *argv[]) {
           example_person_get_name(ahmet));
   g_print("The age of the ExamplePerson variable is: %d\n",
           example_person_get_age(ahmet));
+  return 0;
 }
@@ -0,0 +1,340 @@
+#include "adaptive-controller.h"
+
+#define DOWN_AFTER_SECONDS 3
+#define UP_AFTER_SECONDS 15
+#define UP_AFTER_MAX_SECONDS 120
+#define HOLD_SECONDS 5       // no decision while the last step settles
+#define PROBATION_SECONDS 10 // a step down this soon after a step up backs off
+#define LATE_FRAMES 2        // encode p95 above this many frame intervals
+#define MAX_PENDING 512
+
+typedef struct {
+  gint size_percent; // of the size the pipeline was started with
+  gint fps;
+  guint bitrate_kbps;
+} AdaptivePreset;
+
+// Level 0 is what screencast.c starts with; at 1080p the sizes are 900p,
+// 720p and 540p.
+static const AdaptivePreset ladder[] = {
+    {100, 60, 10000},
+    {100, 30, 7000},
+    {83, 30, 5000},
+    {67, 30, 3500},
+    {50, 24, 2000},
+};
+
+struct _AdaptiveController {
+  const VideoEncoder *encoder;
+  GstElement *queue;
+  GstElement *venc;
+  GstElement *capsfilter; // NULL unless resizing
+  gint width;             // configured output size, 0 in native mode
+  gint height;
+  GstPad *sink_pad;
+  GstPad *src_pad;
+  gulong sink_probe;
+  gulong src_probe;
+  guint max_buffers;
+  guint tick_id;
+
+  guint level;
+  gint fps;                 // atomic, read by the streaming thread
+  GstClockTime last_pts;    // streaming thread only
+  gint overruns;            // atomic
+  gint reported_overruns;
+  guint64 qos_dropped;      // running total from the encoder's QoS messages
+  guint64 reported_qos_dropped;
+
+  GMutex lock;
+  GHashTable *pending;      // PTS -> monotonic time it entered venc, in us
+  GArray *samples;          // gint64 encode times this second, in us
+
+  guint overloaded;         // consecutive seconds
+  guint healthy;            // consecutive seconds
+  guint up_after;
+  gint64 last_change;
+  gint64 last_up;
+};
+
+static void on_overrun(GstElement *queue, gpointer user_data) {
+  AdaptiveController *controller = user_data;
+  g_atomic_int_inc(&controller->overruns);
+}
+
+// Drops frames that come in faster than the current preset's rate, then
+// remembers when the survivors entered the encoder.
+static GstPadProbeReturn on_input(GstPad *pad, GstPadProbeInfo *info,
+                                  gpointer user_data) {
+  AdaptiveController *controller = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (!GST_BUFFER_PTS_IS_VALID(buffer)) return GST_PAD_PROBE_OK;
+
+  GstClockTime pts = GST_BUFFER_PTS(buffer);
+  gint fps = g_atomic_int_get(&controller->fps);
+  if (fps < ladder[0].fps && GST_CLOCK_TIME_IS_VALID(controller->last_pts)) {
+    // An eighth of slack, or capture jitter would halve the rate again.
+    GstClockTime interval = GST_SECOND / fps;
+    if (pts >= controller->last_pts &&
+        pts < controller->last_pts + interval - interval / 8) {
+      return GST_PAD_PROBE_DROP;
+    }
+  }
+  controller->last_pts = pts;
+
+  gint64 *key = g_new(gint64, 1);
+  gint64 *now = g_new(gint64, 1);
+  *key = pts;
+  *now = g_get_monotonic_time();
+  g_mutex_lock(&controller->lock);
+  if (g_hash_table_size(controller->pending) >= MAX_PENDING) {
+    g_hash_table_remove_all(controller->pending);
+  }
+  g_hash_table_replace(controller->pending, key, now);
+  g_mutex_unlock(&controller->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn on_output(GstPad *pad, GstPadProbeInfo *info,
+                                   gpointer user_data) {
+  AdaptiveController *controller = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (!GST_BUFFER_PTS_IS_VALID(buffer)) return GST_PAD_PROBE_OK;
+
+  gint64 pts = GST_BUFFER_PTS(buffer);
+  gint64 now = g_get_monotonic_time();
+  g_mutex_lock(&controller->lock);
+  gint64 *entered = g_hash_table_lookup(controller->pending, &pts);
+  if (entered) {
+    gint64 elapsed = now - *entered;
+    g_array_append_val(controller->samples, elapsed);
+    g_hash_table_remove(controller->pending, &pts);
+  }
+  g_mutex_unlock(&controller->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static gint compare_time(gconstpointer a, gconstpointer b) {
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return x < y ? -1 : x > y;
+}
+
+// p95 encode time of the last second in ms, -1 without samples.
+static gdouble take_encode_p95(AdaptiveController *controller) {
+  g_mutex_lock(&controller->lock);
+  GArray *samples = controller->samples;
+  controller->samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+  g_mutex_unlock(&controller->lock);
+
+  gdouble p95 = -1;
+  if (samples->len > 0) {
+    g_array_sort(samples, compare_time);
+    guint index = MIN(samples->len - 1, samples->len * 95 / 100);
+    p95 = g_array_index(samples, gint64, index) / 1000.0;
+  }
+  g_array_unref(samples);
+  return p95;
+}
+
+// Rounded down to even, which every encoder takes.
+static gint preset_size(AdaptiveController *controller, guint level, gint full) {
+  if (!controller->capsfilter) return full;
+  return full * ladder[level].size_percent / 100 & ~1;
+}
+
+static void describe_preset(AdaptiveController *controller, guint level,
+                            GString *out) {
+  const AdaptivePreset *preset = &ladder[level];
+  if (controller->width > 0) {
+    g_string_append_printf(out, "%dx%d",
+                           preset_size(controller, level, controller->width),
+                           preset_size(controller, level, controller->height));
+  } else {
+    g_string_append(out, "native");
+  }
+  g_string_append_printf(out, "@%d %u kbit/s", preset->fps, preset->bitrate_kbps);
+}
+
+static void apply(AdaptiveController *controller, guint level) {
+  const AdaptivePreset *preset = &ladder[level];
+  g_object_set(controller->venc, controller->encoder->bitrate_property,
+               preset->bitrate_kbps * controller->encoder->bitrate_scale, NULL);
+  g_atomic_int_set(&controller->fps, preset->fps);
+
+  if (controller->capsfilter) {
+    GstCaps *caps;
+    g_object_get(controller->capsfilter, "caps", &caps, NULL);
+    caps = gst_caps_make_writable(caps);
+    gst_caps_set_simple(caps, "width", G_TYPE_INT,
+                        preset_size(controller, level, controller->width), "height",
+                        G_TYPE_INT, preset_size(controller, level, controller->height),
+                        NULL);
+    g_object_set(controller->capsfilter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+  }
+  controller->level = level;
+}
+
+static void step(AdaptiveController *controller, guint level, const gchar *why) {
+  GString *line = g_string_new("[adaptive] ");
+  g_string_append_printf(line, "%s: ", why);
+  describe_preset(controller, controller->level, line);
+  g_string_append(line, " -> ");
+  describe_preset(controller, level, line);
+  g_print("%s\n", line->str);
+  g_string_free(line, TRUE);
+
+  // Higher levels are lower quality.
+  gint64 now = g_get_monotonic_time();
+  if (level > controller->level) {
+    if (now - controller->last_up < PROBATION_SECONDS * G_USEC_PER_SEC) {
+      controller->up_after = MIN(controller->up_after * 2, UP_AFTER_MAX_SECONDS);
+    }
+  } else {
+    controller->last_up = now;
+  }
+  controller->last_change = now;
+  controller->overloaded = 0;
+  controller->healthy = 0;
+  apply(controller, level);
+}
+
+static gboolean tick(gpointer user_data) {
+  AdaptiveController *controller = user_data;
+  guint fill;
+  g_object_get(controller->queue, "current-level-buffers", &fill, NULL);
+  gint overruns = g_atomic_int_get(&controller->overruns);
+  guint dropped = overruns - controller->reported_overruns;
+  controller->reported_overruns = overruns;
+  guint64 late = controller->qos_dropped - controller->reported_qos_dropped;
+  controller->reported_qos_dropped = controller->qos_dropped;
+  gdouble p95 = take_encode_p95(controller);
+
+  gint64 now = g_get_monotonic_time();
+  if (now - controller->last_change < HOLD_SECONDS * G_USEC_PER_SEC) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  // Healthy means the next level up would still fit, not just this one.
+  gdouble interval_ms = 1000.0 / ladder[controller->level].fps;
+  gdouble up_interval_ms =
+      1000.0 / ladder[controller->level ? controller->level - 1 : 0].fps;
+  gboolean overloaded = dropped > 0 || late > 0 ||
+                        fill * 3 >= controller->max_buffers * 2 ||
+                        p95 > interval_ms * LATE_FRAMES;
+  gboolean healthy = !overloaded && fill * 3 <= controller->max_buffers &&
+                     p95 < up_interval_ms;
+
+  controller->overloaded = overloaded ? controller->overloaded + 1 : 0;
+  controller->healthy = healthy ? controller->healthy + 1 : 0;
+
+  if (controller->overloaded >= DOWN_AFTER_SECONDS &&
+      controller->level + 1 < G_N_ELEMENTS(ladder)) {
+    gchar *why = g_strdup_printf(
+        "overload (queue %u/%u, dropped %u, encoder late %" G_GUINT64_FORMAT
+        ", encode p95 %.1f ms)",
+        fill, controller->max_buffers, dropped, late, p95);
+    step(controller, controller->level + 1, why);
+    g_free(why);
+  } else if (controller->healthy >= controller->up_after && controller->level > 0) {
+    gchar *why = g_strdup_printf("healthy for %u s", controller->healthy);
+    step(controller, controller->level - 1, why);
+    g_free(why);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+AdaptiveController *adaptive_controller_new(GstElement *pipeline,
+                                            const VideoEncoder *encoder,
+                                            gboolean resize) {
+  GstElement *queue = gst_bin_get_by_name(GST_BIN(pipeline), "capture_queue");
+  GstElement *venc = gst_bin_get_by_name(GST_BIN(pipeline), "venc");
+  if (!queue || !venc) {
+    g_printerr("Adaptive mode needs capture_queue and venc in the pipeline.\n");
+    if (queue) gst_object_unref(queue);
+    if (venc) gst_object_unref(venc);
+    return NULL;
+  }
+
+  AdaptiveController *controller = g_new0(AdaptiveController, 1);
+  controller->encoder = encoder;
+  controller->queue = queue;
+  controller->venc = venc;
+  controller->fps = ladder[0].fps;
+  controller->last_pts = GST_CLOCK_TIME_NONE;
+  controller->up_after = UP_AFTER_SECONDS;
+  controller->last_up = G_MININT64 / 2;
+  g_mutex_init(&controller->lock);
+  controller->pending = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
+  controller->samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+  g_object_get(queue, "max-size-buffers", &controller->max_buffers, NULL);
+  g_signal_connect(queue, "overrun", G_CALLBACK(on_overrun), controller);
+
+  controller->sink_pad = gst_element_get_static_pad(venc, "sink");
+  controller->src_pad = gst_element_get_static_pad(venc, "src");
+  controller->sink_probe = gst_pad_add_probe(
+      controller->sink_pad, GST_PAD_PROBE_TYPE_BUFFER, on_input, controller, NULL);
+  controller->src_probe = gst_pad_add_probe(
+      controller->src_pad, GST_PAD_PROBE_TYPE_BUFFER, on_output, controller, NULL);
+
+  // Native mode leaves the size to the source, so there is nothing to scale.
+  GstPad *peer = gst_pad_get_peer(controller->sink_pad);
+  GstElement *capsfilter = peer ? gst_pad_get_parent_element(peer) : NULL;
+  if (peer) gst_object_unref(peer);
+  if (capsfilter) {
+    GstCaps *caps;
+    g_object_get(capsfilter, "caps", &caps, NULL);
+    GstStructure *s = caps && !gst_caps_is_empty(caps) ? gst_caps_get_structure(caps, 0) : NULL;
+    if (s) {
+      gst_structure_get_int(s, "width", &controller->width);
+      gst_structure_get_int(s, "height", &controller->height);
+    }
+    if (caps) gst_caps_unref(caps);
+  }
+  if (resize && controller->width > 0) {
+    controller->capsfilter = capsfilter;
+  } else if (capsfilter) {
+    gst_object_unref(capsfilter);
+  }
+
+  controller->last_change = g_get_monotonic_time();
+  controller->tick_id = g_timeout_add_seconds(1, tick, controller);
+
+  GString *line = g_string_new("Adaptive mode:");
+  for (guint i = 0; i < G_N_ELEMENTS(ladder); i++) {
+    g_string_append(line, i ? " > " : " ");
+    describe_preset(controller, i, line);
+  }
+  g_print("%s\n", line->str);
+  g_string_free(line, TRUE);
+  return controller;
+}
+
+void adaptive_controller_handle_message(AdaptiveController *controller,
+                                        GstMessage *msg) {
+  if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_QOS ||
+      GST_MESSAGE_SRC(msg) != GST_OBJECT(controller->venc)) {
+    return;
+  }
+  GstFormat format;
+  guint64 processed, dropped;
+  gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+  if (dropped != (guint64)-1) controller->qos_dropped = dropped;
+}
+
+void adaptive_controller_free(AdaptiveController *controller) {
+  g_source_remove(controller->tick_id);
+  gst_pad_remove_probe(controller->sink_pad, controller->sink_probe);
+  gst_pad_remove_probe(controller->src_pad, controller->src_probe);
+  gst_object_unref(controller->sink_pad);
+  gst_object_unref(controller->src_pad);
+  g_signal_handlers_disconnect_by_data(controller->queue, controller);
+  gst_object_unref(controller->queue);
+  gst_object_unref(controller->venc);
+  if (controller->capsfilter) gst_object_unref(controller->capsfilter);
+  g_mutex_clear(&controller->lock);
+  g_hash_table_unref(controller->pending);
+  g_array_unref(controller->samples);
+  g_free(controller);
+}
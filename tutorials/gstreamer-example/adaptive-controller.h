@@ -0,0 +1,33 @@
+#ifndef ADAPTIVE_CONTROLLER_H
+#define ADAPTIVE_CONTROLLER_H
+
+#include "video-encoder.h"
+#include <glib.h>
+#include <gst/gst.h>
+
+// Feedback controller for the recorder's encode path. Once a second it looks
+// at the capture queue (fill level and leaky drops), the encoder's QoS drops
+// and its per-frame latency, and moves through a small ladder of presets
+// (bitrate, frame rate, output size). A level is left downwards after a few
+// overloaded seconds in a row and upwards only after a much longer healthy
+// stretch; a step up that is undone right away makes the next one wait longer.
+typedef struct _AdaptiveController AdaptiveController;
+
+// Expects "capture_queue" and "venc" in `pipeline`, with the raw capsfilter
+// right in front of venc. The frame rate is lowered by dropping frames at the
+// encoder's input, so caps never change for that. The output size is only
+// touched when `resize` is TRUE and the capsfilter has a fixed size (not in
+// native mode): the muxer has to accept size changes in the middle of the
+// stream, and a scaler has to be in the chain.
+AdaptiveController *adaptive_controller_new(GstElement *pipeline,
+                                            const VideoEncoder *encoder,
+                                            gboolean resize);
+
+// Feed every bus message; the encoder's QoS messages are accounted.
+void adaptive_controller_handle_message(AdaptiveController *controller,
+                                        GstMessage *msg);
+
+// Call once the pipeline is back in NULL.
+void adaptive_controller_free(AdaptiveController *controller);
+
+#endif // !ADAPTIVE_CONTROLLER_H
@@ -0,0 +1,90 @@
+#include "audio-latency.h"
+
+#define REPORT_INTERVAL_SECONDS 10
+
+struct _AudioLatency {
+  GstElement *pipeline;
+  GstPad *pad;
+  gulong probe_id;
+  guint report_id;
+  gchar *profile;
+  GMutex lock;
+  GArray *samples; // gint64 capture-to-packet times this interval, in us
+};
+
+static GstPadProbeReturn on_packet(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  AudioLatency *latency = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (!GST_BUFFER_PTS_IS_VALID(buffer)) return GST_PAD_PROBE_OK;
+
+  GstClock *clock = gst_element_get_clock(latency->pipeline);
+  if (!clock) return GST_PAD_PROBE_OK;
+  GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(latency->pipeline);
+  gst_object_unref(clock);
+
+  // Packets sent before the source caught up can carry a later PTS.
+  if (now < GST_BUFFER_PTS(buffer)) return GST_PAD_PROBE_OK;
+  gint64 age = (gint64)GST_TIME_AS_USECONDS(now - GST_BUFFER_PTS(buffer));
+  g_mutex_lock(&latency->lock);
+  g_array_append_val(latency->samples, age);
+  g_mutex_unlock(&latency->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static gint compare_time(gconstpointer a, gconstpointer b) {
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return x < y ? -1 : x > y;
+}
+
+static gdouble percentile_ms(GArray *sorted, guint p) {
+  guint index = MIN(sorted->len - 1, sorted->len * p / 100);
+  return g_array_index(sorted, gint64, index) / 1000.0;
+}
+
+static gboolean report(gpointer user_data) {
+  AudioLatency *latency = user_data;
+  g_mutex_lock(&latency->lock);
+  GArray *samples = latency->samples;
+  latency->samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+  g_mutex_unlock(&latency->lock);
+
+  if (samples->len > 0) {
+    g_array_sort(samples, compare_time);
+    g_print("[audio] capture to packet p50 %.1f ms, p95 %.1f ms, max %.1f ms, %.1f packets/s | %s\n",
+            percentile_ms(samples, 50), percentile_ms(samples, 95),
+            percentile_ms(samples, 100), samples->len / (gdouble)REPORT_INTERVAL_SECONDS,
+            latency->profile);
+  }
+  g_array_unref(samples);
+  return G_SOURCE_CONTINUE;
+}
+
+AudioLatency *audio_latency_new(GstElement *pipeline, const AudioProfile *profile) {
+  GstElement *last = gst_bin_get_by_name(GST_BIN(pipeline), "apay");
+  if (!last) last = gst_bin_get_by_name(GST_BIN(pipeline), "aenc");
+  if (!last) return NULL;
+
+  AudioLatency *latency = g_new0(AudioLatency, 1);
+  latency->pipeline = gst_object_ref(pipeline);
+  latency->pad = gst_element_get_static_pad(last, "src");
+  latency->profile = audio_profile_describe(profile);
+  g_mutex_init(&latency->lock);
+  latency->samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+  latency->probe_id = gst_pad_add_probe(latency->pad, GST_PAD_PROBE_TYPE_BUFFER, on_packet,
+                                        latency, NULL);
+  latency->report_id = g_timeout_add_seconds(REPORT_INTERVAL_SECONDS, report, latency);
+  gst_object_unref(last);
+  return latency;
+}
+
+void audio_latency_free(AudioLatency *latency) {
+  if (!latency) return;
+  g_source_remove(latency->report_id);
+  gst_pad_remove_probe(latency->pad, latency->probe_id);
+  gst_object_unref(latency->pad);
+  gst_object_unref(latency->pipeline);
+  g_free(latency->profile);
+  g_mutex_clear(&latency->lock);
+  g_array_unref(latency->samples);
+  g_free(latency);
+}
@@ -0,0 +1,21 @@
+#ifndef AUDIO_LATENCY_H
+#define AUDIO_LATENCY_H
+
+#include "audio-profile.h"
+#include <glib.h>
+#include <gst/gst.h>
+
+// Capture-to-packet latency of the audio branch. pulsesrc stamps each buffer
+// with the running time its first sample was captured at, so the running
+// time at which the encoded packet leaves "apay" (or "aenc" without RTP)
+// minus its PTS is how old that sample is by then: ring buffer, conversion,
+// frame accumulation and encoding together. p50/p95/max are printed every
+// few seconds next to the profile that produced them.
+typedef struct _AudioLatency AudioLatency;
+
+// NULL if the pipeline has no audio encoder.
+AudioLatency *audio_latency_new(GstElement *pipeline, const AudioProfile *profile);
+
+void audio_latency_free(AudioLatency *latency);
+
+#endif // !AUDIO_LATENCY_H
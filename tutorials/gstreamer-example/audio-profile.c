@@ -0,0 +1,69 @@
+#include "audio-profile.h"
+
+static const AudioProfile profiles[] = {
+    {"default", 200000, 10000, "20", "generic", FALSE},
+    {"low-latency", 20000, 5000, "10", "restricted-lowdelay", FALSE},
+};
+
+static const gchar *frame_sizes[] = {"2.5", "5", "10", "20", "40", "60", NULL};
+static const gchar *audio_types[] = {"generic", "voice", "restricted-lowdelay", NULL};
+
+static const gchar *find_nick(const gchar *const *nicks, const gchar *value) {
+  for (guint i = 0; nicks[i]; i++) {
+    if (g_strcmp0(nicks[i], value) == 0) return nicks[i];
+  }
+  return NULL;
+}
+
+gboolean audio_profile_parse(const gchar *name, const gchar *frame_ms, const gchar *type,
+                             gboolean dtx, AudioProfile *profile) {
+  const AudioProfile *found = NULL;
+  for (guint i = 0; i < G_N_ELEMENTS(profiles) && !found; i++) {
+    if (g_strcmp0(profiles[i].name, name ? name : "default") == 0) found = &profiles[i];
+  }
+  if (!found) {
+    g_printerr("Invalid audio profile '%s' (default or low-latency)\n", name);
+    return FALSE;
+  }
+  *profile = *found;
+
+  if (frame_ms) {
+    profile->frame_size = find_nick(frame_sizes, frame_ms);
+    if (!profile->frame_size) {
+      g_printerr("Invalid audio frame '%s' (2.5, 5, 10, 20, 40 or 60 ms)\n", frame_ms);
+      return FALSE;
+    }
+  }
+  if (type) {
+    profile->audio_type = find_nick(audio_types, type);
+    if (!profile->audio_type) {
+      g_printerr("Invalid audio type '%s' (generic, voice or restricted-lowdelay)\n", type);
+      return FALSE;
+    }
+  }
+  if (dtx) profile->dtx = TRUE;
+  return TRUE;
+}
+
+void audio_profile_apply(const AudioProfile *profile, GstElement *source,
+                         GstElement *encoder, GstElement *payloader) {
+  if (source) {
+    g_object_set(source, "buffer-time", (gint64)profile->buffer_time_us, "latency-time",
+                 (gint64)profile->latency_time_us, NULL);
+  }
+  gst_util_set_object_arg(G_OBJECT(encoder), "frame-size", profile->frame_size);
+  gst_util_set_object_arg(G_OBJECT(encoder), "audio-type", profile->audio_type);
+  g_object_set(encoder, "dtx", profile->dtx, NULL);
+  // Only newer payloaders can drop the empty DTX packets themselves.
+  if (payloader && profile->dtx &&
+      g_object_class_find_property(G_OBJECT_GET_CLASS(payloader), "dtx")) {
+    g_object_set(payloader, "dtx", TRUE, NULL);
+  }
+}
+
+gchar *audio_profile_describe(const AudioProfile *profile) {
+  return g_strdup_printf("%s (buffer %u ms, period %u ms, %s ms %s frames%s)", profile->name,
+                         profile->buffer_time_us / 1000, profile->latency_time_us / 1000,
+                         profile->frame_size, profile->audio_type,
+                         profile->dtx ? ", dtx" : "");
+}
@@ -0,0 +1,35 @@
+#ifndef AUDIO_PROFILE_H
+#define AUDIO_PROFILE_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+// How the audio branch trades latency for CPU: the pulsesrc ring buffer and
+// period, and the Opus frame length, content type and DTX.
+typedef struct {
+  const gchar *name;
+  guint buffer_time_us;    // pulsesrc buffer-time, the latency floor
+  guint latency_time_us;   // pulsesrc latency-time, one period
+  const gchar *frame_size; // opusenc frame-size nick, in ms
+  const gchar *audio_type; // opusenc audio-type nick
+  gboolean dtx;            // send almost nothing during silence
+} AudioProfile;
+
+// "default" is what the pipelines always used: a 200 ms buffer and 20 ms
+// generic frames. "low-latency" uses a 20 ms buffer with 5 ms periods and
+// 10 ms restricted-lowdelay frames, which skip Opus' speech coder and its
+// look-ahead. `frame_ms` ("2.5" to "60"), `type` ("generic", "voice",
+// "restricted-lowdelay") and `dtx` override the profile; any may be NULL or
+// FALSE. Prints the problem and returns FALSE if unparsable.
+gboolean audio_profile_parse(const gchar *name, const gchar *frame_ms, const gchar *type,
+                             gboolean dtx, AudioProfile *profile);
+
+// Sets the profile on the pulsesrc and rtpopuspay, each if not NULL, and
+// on opusenc.
+void audio_profile_apply(const AudioProfile *profile, GstElement *source,
+                         GstElement *encoder, GstElement *payloader);
+
+// e.g. "low-latency (buffer 20 ms, period 5 ms, 10 ms restricted-lowdelay frames, dtx)"
+gchar *audio_profile_describe(const AudioProfile *profile);
+
+#endif // !AUDIO_PROFILE_H
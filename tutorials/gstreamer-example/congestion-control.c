@@ -0,0 +1,280 @@
+#include "congestion-control.h"
+#include "pipeline-builder.h"
+#include <gst/rtp/rtp.h>
+#include <gst/webrtc/webrtc.h>
+
+#define TWCC_URI "http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01"
+#define TWCC_ID 1
+#define AUDIO_KBPS 64 // Opus and RTCP, left out of the video's share
+#define MIN_KBPS 300
+#define MIN_CHANGE_PERCENT 5 // smaller corrections are not worth a reconfigure
+#define LOG_INTERVAL_SECONDS 5
+#define TOP_LAYER_WEIGHT 16 // a layer below weighs a quarter of the one above
+
+// One per webrtcbin. Shared by the estimator's signal handler and stats
+// promises on streaming threads, and by the controller on the main thread.
+typedef struct {
+  CongestionControl *control;
+  GstElement *webrtcbin; // main thread, NULL once unwatched
+  gchar *name;
+  gchar *netsim;
+  gint estimate_kbps; // atomic, 0 until the first estimate
+} Watch;
+
+struct _CongestionControl {
+  const VideoEncoder *encoder;
+  guint max_kbps;
+  gchar *netsim;
+  GPtrArray *encoders; // "venc", "venc_1", ..., and "venc_m", "venc_l" with simulcast
+  GArray *layers;      // simulcast layer of each encoder, 0 for the top one
+  GMutex lock;
+  guint weight;       // all the encoders send, in TOP_LAYER_WEIGHT units; set under lock
+  GPtrArray *watches; // guarded by lock
+  guint bitrate_kbps; // per stream (its top layer), as last set
+  guint tick_id;
+  guint ticks;
+};
+
+static void watch_clear(gpointer data) {
+  Watch *watch = data;
+  g_free(watch->name);
+  g_free(watch->netsim);
+}
+
+static void watch_release(gpointer watch) {
+  g_rc_box_release_full(watch, watch_clear);
+}
+
+static void on_estimate(GObject *bwe, GParamSpec *pspec, gpointer user_data) {
+  guint bps = 0;
+  g_object_get(bwe, "estimated-bitrate", &bps, NULL);
+  g_atomic_int_set(&((Watch *)user_data)->estimate_kbps, (gint)(bps / 1000));
+}
+
+// webrtcbin puts this between its RTP session, where the TWCC numbers are
+// written, and DTLS, so a simulated link here looks like the real network.
+static GstElement *on_request_aux_sender(GstElement *webrtcbin, GObject *transport,
+                                         gpointer user_data) {
+  Watch *watch = user_data;
+  gchar *desc = watch->netsim ? g_strdup_printf("rtpgccbwe name=bwe ! netsim %s", watch->netsim)
+                              : g_strdup("rtpgccbwe name=bwe");
+  GError *error = NULL;
+  GstElement *bin = gst_parse_bin_from_description(desc, TRUE, &error);
+  g_free(desc);
+  if (!bin) {
+    g_printerr("[congestion] %s: %s\n", watch->name, error->message);
+    g_error_free(error);
+    return NULL;
+  }
+  // The estimate covers every stream and layer and the audio on the
+  // transport. The encoders are known by now even if the webrtcbin was
+  // watched before they were attached.
+  CongestionControl *control = watch->control;
+  g_mutex_lock(&control->lock);
+  guint weight = MAX(control->weight, TOP_LAYER_WEIGHT);
+  g_mutex_unlock(&control->lock);
+  guint min_bps = (MIN_KBPS + AUDIO_KBPS) * 1000;
+  guint max_bps = (control->max_kbps * weight / TOP_LAYER_WEIGHT + AUDIO_KBPS) * 1000;
+  GstElement *bwe = gst_bin_get_by_name(GST_BIN(bin), "bwe");
+  g_object_set(bwe, "min-bitrate", min_bps, "max-bitrate", max_bps, NULL);
+  g_signal_connect_data(bwe, "notify::estimated-bitrate", G_CALLBACK(on_estimate),
+                        g_rc_box_acquire(watch), (GClosureNotify)watch_release, 0);
+  gst_object_unref(bwe);
+  return bin;
+}
+
+CongestionControl *congestion_control_new(const VideoEncoder *encoder, guint max_kbps,
+                                          const gchar *netsim) {
+  GstElementFactory *factory = gst_element_factory_find("rtpgccbwe");
+  if (!factory) {
+    g_print("[congestion] no rtpgccbwe (gst-plugins-rs), the bitrate stays at %u kbit/s\n",
+            max_kbps);
+    return NULL;
+  }
+  gst_object_unref(factory);
+
+  CongestionControl *control = g_new0(CongestionControl, 1);
+  control->encoder = encoder;
+  control->max_kbps = MAX(max_kbps, MIN_KBPS);
+  control->netsim = g_strdup(netsim);
+  control->encoders = g_ptr_array_new_with_free_func(gst_object_unref);
+  control->layers = g_array_new(FALSE, FALSE, sizeof(guint));
+  g_mutex_init(&control->lock);
+  control->watches = g_ptr_array_new();
+  control->bitrate_kbps = control->max_kbps;
+  return control;
+}
+
+// Lower simulcast layers follow the top one at the builder's ratios.
+static void set_bitrate(CongestionControl *control, guint kbps) {
+  for (guint i = 0; i < control->encoders->len; i++) {
+    guint layer = g_array_index(control->layers, guint, i);
+    guint layer_kbps = pipeline_builder_layer_bitrate(kbps, layer);
+    gchar *value = g_strdup_printf("%u", layer_kbps * control->encoder->bitrate_scale);
+    gst_util_set_object_arg(control->encoders->pdata[i], control->encoder->bitrate_property,
+                            value);
+    g_free(value);
+  }
+  control->bitrate_kbps = kbps;
+}
+
+typedef struct {
+  gdouble rtt_ms;
+  gdouble loss; // fraction of the last report interval, worst stream
+  gint lost;
+} LinkStats;
+
+static gboolean collect_remote_inbound(GQuark field, const GValue *value, gpointer user_data) {
+  LinkStats *stats = user_data;
+  if (!GST_VALUE_HOLDS_STRUCTURE(value)) return TRUE;
+  const GstStructure *s = gst_value_get_structure(value);
+  gint type;
+  if (!gst_structure_get_enum(s, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type) ||
+      type != GST_WEBRTC_STATS_REMOTE_INBOUND_RTP) {
+    return TRUE;
+  }
+  gdouble rtt, fraction;
+  gint lost;
+  if (gst_structure_get_double(s, "round-trip-time", &rtt)) {
+    stats->rtt_ms = MAX(stats->rtt_ms, rtt * 1000);
+  }
+  if (gst_structure_get_double(s, "fraction-lost", &fraction)) {
+    stats->loss = MAX(stats->loss, fraction);
+  }
+  if (gst_structure_get_int(s, "packets-lost", &lost)) stats->lost += lost;
+  return TRUE;
+}
+
+static void on_stats(GstPromise *promise, gpointer user_data) {
+  Watch *watch = user_data;
+  if (gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED) {
+    LinkStats stats = {0, 0, 0};
+    gst_structure_foreach(gst_promise_get_reply(promise), collect_remote_inbound, &stats);
+    g_print("[congestion] %s: estimate %.2f Mbit/s, rtt %.1f ms, loss %.1f%% (%d lost)\n",
+            watch->name, g_atomic_int_get(&watch->estimate_kbps) / 1000.0, stats.rtt_ms,
+            stats.loss * 100, stats.lost);
+  }
+  gst_promise_unref(promise);
+}
+
+// The lowest estimate sets the encoders; everybody else gets the same stream.
+static gboolean on_tick(gpointer user_data) {
+  CongestionControl *control = user_data;
+  gboolean log = ++control->ticks % LOG_INTERVAL_SECONDS == 0;
+  gint lowest = 0;
+  gchar *limiting = NULL;
+  g_mutex_lock(&control->lock);
+  for (guint i = 0; i < control->watches->len; i++) {
+    Watch *watch = control->watches->pdata[i];
+    gint kbps = g_atomic_int_get(&watch->estimate_kbps);
+    if (kbps > 0 && (lowest == 0 || kbps < lowest)) {
+      lowest = kbps;
+      g_free(limiting);
+      limiting = g_strdup(watch->name);
+    }
+    if (log) {
+      GstPromise *promise = gst_promise_new_with_change_func(on_stats, g_rc_box_acquire(watch),
+                                                             watch_release);
+      g_signal_emit_by_name(watch->webrtcbin, "get-stats", NULL, promise);
+    }
+  }
+  g_mutex_unlock(&control->lock);
+
+  if (lowest > 0 && control->weight > 0) {
+    gint share = (lowest - AUDIO_KBPS) * TOP_LAYER_WEIGHT / (gint)control->weight;
+    guint target = (guint)CLAMP(share, MIN_KBPS, (gint)control->max_kbps);
+    guint current = control->bitrate_kbps;
+    guint change = target > current ? target - current : current - target;
+    if (change * 100 > current * MIN_CHANGE_PERCENT) {
+      g_print("[congestion] encoder %u -> %u kbit/s, %s estimates %.2f Mbit/s\n", current,
+              target, limiting, lowest / 1000.0);
+      set_bitrate(control, target);
+    }
+  }
+  g_free(limiting);
+  return G_SOURCE_CONTINUE;
+}
+
+static void take_encoder(CongestionControl *control, GstElement *pipeline, const gchar *name,
+                         guint layer) {
+  GstElement *venc = gst_bin_get_by_name(GST_BIN(pipeline), name);
+  if (!venc) return;
+  g_ptr_array_add(control->encoders, venc);
+  g_array_append_val(control->layers, layer);
+  g_mutex_lock(&control->lock);
+  control->weight += pipeline_builder_layer_bitrate(TOP_LAYER_WEIGHT, layer);
+  g_mutex_unlock(&control->lock);
+}
+
+void congestion_control_attach(CongestionControl *control, GstElement *pipeline,
+                               guint streams, guint layers) {
+  for (guint i = 0; i < streams; i++) {
+    gchar *name = pipeline_builder_element_name("venc", i);
+    take_encoder(control, pipeline, name, 0);
+    g_free(name);
+  }
+  for (guint i = 1; i < MIN(layers, PIPELINE_BUILDER_MAX_LAYERS); i++) {
+    take_encoder(control, pipeline, pipeline_builder_layer_encoder(i), i);
+  }
+  if (!control->tick_id) control->tick_id = g_timeout_add_seconds(1, on_tick, control);
+}
+
+void congestion_control_watch(CongestionControl *control, GstElement *webrtcbin) {
+  if (!g_signal_lookup("request-aux-sender", G_OBJECT_TYPE(webrtcbin))) {
+    g_printerr("[congestion] this webrtcbin has no aux senders (GStreamer 1.20 or later)\n");
+    return;
+  }
+  Watch *watch = g_rc_box_new0(Watch);
+  watch->control = control;
+  watch->webrtcbin = gst_object_ref(webrtcbin);
+  watch->name = gst_object_get_name(GST_OBJECT(webrtcbin));
+  watch->netsim = g_strdup(control->netsim);
+  g_signal_connect_data(webrtcbin, "request-aux-sender", G_CALLBACK(on_request_aux_sender),
+                        g_rc_box_acquire(watch), (GClosureNotify)watch_release, 0);
+  g_mutex_lock(&control->lock);
+  g_ptr_array_add(control->watches, watch);
+  g_mutex_unlock(&control->lock);
+}
+
+static void unwatch(Watch *watch) {
+  g_signal_handlers_disconnect_by_data(watch->webrtcbin, watch);
+  gst_object_unref(watch->webrtcbin);
+  watch->webrtcbin = NULL;
+  watch_release(watch);
+}
+
+void congestion_control_unwatch(CongestionControl *control, GstElement *webrtcbin) {
+  Watch *found = NULL;
+  g_mutex_lock(&control->lock);
+  for (guint i = 0; i < control->watches->len && !found; i++) {
+    Watch *watch = control->watches->pdata[i];
+    if (watch->webrtcbin == webrtcbin) found = g_ptr_array_steal_index(control->watches, i);
+  }
+  g_mutex_unlock(&control->lock);
+  if (found) unwatch(found);
+}
+
+guint congestion_control_get_bitrate(CongestionControl *control) {
+  return control->bitrate_kbps;
+}
+
+void congestion_control_free(CongestionControl *control) {
+  if (control->tick_id) g_source_remove(control->tick_id);
+  for (guint i = 0; i < control->watches->len; i++) unwatch(control->watches->pdata[i]);
+  g_ptr_array_unref(control->watches);
+  g_ptr_array_unref(control->encoders);
+  g_array_unref(control->layers);
+  g_mutex_clear(&control->lock);
+  g_free(control->netsim);
+  g_free(control);
+}
+
+gboolean congestion_control_add_twcc(GstElement *payloader) {
+  if (!g_signal_lookup("add-extension", G_OBJECT_TYPE(payloader))) return FALSE;
+  GstRTPHeaderExtension *twcc = gst_rtp_header_extension_create_from_uri(TWCC_URI);
+  if (!twcc) return FALSE;
+  gst_rtp_header_extension_set_id(twcc, TWCC_ID);
+  g_signal_emit_by_name(payloader, "add-extension", twcc);
+  gst_object_unref(twcc);
+  return TRUE;
+}
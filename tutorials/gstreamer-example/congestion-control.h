@@ -0,0 +1,48 @@
+#ifndef CONGESTION_CONTROL_H
+#define CONGESTION_CONTROL_H
+
+#include "video-encoder.h"
+#include <glib.h>
+#include <gst/gst.h>
+
+// Transport-wide congestion control for the WebRTC sender. The video
+// payloader stamps every packet with a transport-wide sequence number (the
+// TWCC header extension); each viewer's webrtcbin sends through an
+// rtpgccbwe, which turns the viewer's TWCC feedback into a bandwidth
+// estimate the GCC way (delay gradient and loss). There is one encode for all
+// viewers, so once a second the encoders are set to the lowest estimate,
+// minus room for audio, between a floor and the configured bitrate; lower
+// simulcast layers follow the top one. Every few seconds each viewer's
+// estimate, RTT and loss are printed.
+typedef struct _CongestionControl CongestionControl;
+
+// NULL if rtpgccbwe (gst-plugins-rs) is missing; the bitrate then stays
+// fixed. `max_kbps` is the bitrate of each encoder as configured. `netsim`,
+// if not NULL, are netsim properties ("max-kbps=1500 drop-probability=0.01")
+// for a simulated link behind every estimator, for testing on loopback.
+CongestionControl *congestion_control_new(const VideoEncoder *encoder, guint max_kbps,
+                                          const gchar *netsim);
+
+// Takes over "venc", "venc_1", ... of `pipeline` for `streams` streams, and
+// the lower layers of the first one if it is sent as `layers` simulcast
+// layers (0 or 1 for none). The estimate is split over everything they send.
+void congestion_control_attach(CongestionControl *control, GstElement *pipeline,
+                               guint streams, guint layers);
+
+// Gives the transports of `webrtcbin` an estimator. Must come before it
+// negotiates; may be called from any thread.
+void congestion_control_watch(CongestionControl *control, GstElement *webrtcbin);
+
+// Before `webrtcbin` is removed; its estimate no longer counts.
+void congestion_control_unwatch(CongestionControl *control, GstElement *webrtcbin);
+
+// What each encoder is set to now, in kbit/s.
+guint congestion_control_get_bitrate(CongestionControl *control);
+
+void congestion_control_free(CongestionControl *control);
+
+// Adds the TWCC header extension to an RTP payloader. FALSE if this
+// GStreamer cannot (before 1.20, or without rtpmanager).
+gboolean congestion_control_add_twcc(GstElement *payloader);
+
+#endif // !CONGESTION_CONTROL_H
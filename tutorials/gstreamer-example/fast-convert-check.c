@@ -0,0 +1,213 @@
+#include "fast-convert-check.h"
+#include "fast-convert-kernels.h"
+#include "fast-convert-scale.h"
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <math.h>
+
+#define RUN_TIMEOUT (120 * GST_SECOND)
+
+static gint src_width = 3840;
+static gint src_height = 2160;
+static gint frames = 120;
+static GOptionEntry entries[] = {
+    {"width", 'W', 0, G_OPTION_ARG_INT, &src_width, "Source width", "PIXELS"},
+    {"height", 'H', 0, G_OPTION_ARG_INT, &src_height, "Source height", "PIXELS"},
+    {"frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames per throughput run", "N"},
+    {NULL}};
+
+// Returns the wall time from PLAYING to EOS in microseconds, or -1.
+static gint64 run_pipeline(GstElement *pipeline) {
+  gint64 start = g_get_monotonic_time();
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(
+      bus, RUN_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gint64 elapsed = g_get_monotonic_time() - start;
+  gst_object_unref(bus);
+
+  if (!msg || GST_MESSAGE_TYPE(msg) != GST_MESSAGE_EOS) {
+    if (msg) {
+      GError *error = NULL;
+      gst_message_parse_error(msg, &error, NULL);
+      g_printerr("Pipeline Error: %s\n", error->message);
+      g_error_free(error);
+    }
+    elapsed = -1;
+  }
+  if (msg) gst_message_unref(msg);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  return elapsed;
+}
+
+static void on_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad,
+                       gpointer user_data) {
+  GstSample **slot = user_data;
+  if (*slot) return;
+  GstCaps *caps = gst_pad_get_current_caps(pad);
+  *slot = gst_sample_new(buffer, caps, NULL, NULL);
+  gst_caps_unref(caps);
+}
+
+static gdouble component_psnr(GstVideoFrame *a, GstVideoFrame *b, guint comp,
+                              guint *max_diff) {
+  gint width = GST_VIDEO_FRAME_COMP_WIDTH(a, comp);
+  gint height = GST_VIDEO_FRAME_COMP_HEIGHT(a, comp);
+  const guint8 *pa = GST_VIDEO_FRAME_COMP_DATA(a, comp);
+  const guint8 *pb = GST_VIDEO_FRAME_COMP_DATA(b, comp);
+  gint stride_a = GST_VIDEO_FRAME_COMP_STRIDE(a, comp);
+  gint stride_b = GST_VIDEO_FRAME_COMP_STRIDE(b, comp);
+  gint step_a = GST_VIDEO_FRAME_COMP_PSTRIDE(a, comp);
+  gint step_b = GST_VIDEO_FRAME_COMP_PSTRIDE(b, comp);
+
+  gdouble sum = 0;
+  for (gint y = 0; y < height; y++) {
+    for (gint x = 0; x < width; x++) {
+      gint d = pa[y * stride_a + x * step_a] - pb[y * stride_b + x * step_b];
+      sum += d * d;
+      *max_diff = MAX(*max_diff, (guint)ABS(d));
+    }
+  }
+  gdouble mse = sum / ((gdouble)width * height);
+  return mse == 0 ? 99.0 : 10 * log10(255.0 * 255.0 / mse);
+}
+
+static gboolean check_case(const gchar *kernel, const gchar *format,
+                           gint out_width, gint out_height) {
+  gchar *desc = g_strdup_printf(
+      "videotestsrc num-buffers=1 pattern=smpte ! "
+      "video/x-raw,format=BGRx,width=%d,height=%d,framerate=30/1 ! tee name=t "
+      "t. ! queue ! videoconvert ! videoscale ! "
+      "video/x-raw,format=%s,width=%d,height=%d,colorimetry=bt709 ! "
+      "fakesink name=ref signal-handoffs=true "
+      "t. ! queue ! fastconvertscale kernel=%s ! "
+      "video/x-raw,format=%s,width=%d,height=%d,colorimetry=bt709 ! "
+      "fakesink name=fast signal-handoffs=true",
+      src_width, src_height, format, out_width, out_height, kernel, format,
+      out_width, out_height);
+
+  GError *error = NULL;
+  GstElement *pipeline = gst_parse_launch(desc, &error);
+  g_free(desc);
+  if (error) {
+    g_printerr("Pipeline Error: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  GstSample *samples[2] = {NULL, NULL};
+  const gchar *names[2] = {"ref", "fast"};
+  for (guint i = 0; i < 2; i++) {
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), names[i]);
+    g_signal_connect(sink, "handoff", G_CALLBACK(on_handoff), &samples[i]);
+    gst_object_unref(sink);
+  }
+
+  gboolean ok = run_pipeline(pipeline) >= 0 && samples[0] && samples[1];
+  gst_object_unref(pipeline);
+
+  if (ok) {
+    GstVideoInfo info;
+    GstVideoFrame ref, fast;
+    gst_video_info_from_caps(&info, gst_sample_get_caps(samples[0]));
+    gst_video_frame_map(&ref, &info, gst_sample_get_buffer(samples[0]), GST_MAP_READ);
+    gst_video_frame_map(&fast, &info, gst_sample_get_buffer(samples[1]), GST_MAP_READ);
+
+    guint y_max = 0, uv_max = 0;
+    gdouble y_psnr = component_psnr(&ref, &fast, 0, &y_max);
+    gdouble uv_psnr = MIN(component_psnr(&ref, &fast, 1, &uv_max),
+                          component_psnr(&ref, &fast, 2, &uv_max));
+    gst_video_frame_unmap(&ref);
+    gst_video_frame_unmap(&fast);
+
+    // Box and bilinear filters disagree on edges once scaling is involved.
+    gboolean scaled = out_width != src_width || out_height != src_height;
+    ok = y_psnr >= (scaled ? 30 : 40) && uv_psnr >= (scaled ? 30 : 35);
+    g_print("  %-7s %-4s %4dx%-4d  Y %5.1f dB (max %3u)  UV %5.1f dB (max %3u)  %s\n",
+            kernel, format, out_width, out_height, y_psnr, y_max, uv_psnr,
+            uv_max, ok ? "ok" : "FAIL");
+  } else {
+    g_print("  %-7s %-4s %4dx%-4d  no output  FAIL\n", kernel, format, out_width,
+            out_height);
+  }
+
+  for (guint i = 0; i < 2; i++) {
+    if (samples[i]) gst_sample_unref(samples[i]);
+  }
+  return ok;
+}
+
+static void measure(const gchar *label, const gchar *chain, gint out_width,
+                    gint out_height) {
+  // imagefreeze repeats a single buffer, so only the chain under test costs.
+  gchar *desc = g_strdup_printf(
+      "videotestsrc num-buffers=1 ! "
+      "video/x-raw,format=BGRx,width=%d,height=%d,framerate=60/1 ! "
+      "imagefreeze num-buffers=%d ! %s ! "
+      "video/x-raw,format=NV12,width=%d,height=%d ! fakesink sync=false",
+      src_width, src_height, frames, chain, out_width, out_height);
+
+  GError *error = NULL;
+  GstElement *pipeline = gst_parse_launch(desc, &error);
+  g_free(desc);
+  if (error) {
+    g_printerr("Pipeline Error: %s\n", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  gint64 elapsed = run_pipeline(pipeline);
+  gst_object_unref(pipeline);
+  if (elapsed <= 0) return;
+
+  gdouble ms = elapsed / 1000.0 / frames;
+  g_print("  %4dx%-4d  %-40s %8.1f fps  %7.2f ms/frame\n", out_width, out_height,
+          label, 1000.0 / ms, ms);
+}
+
+int fast_convert_check_tutorial(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new("- fastconvertscale check");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_parse(context, &argc, &argv, NULL);
+  g_option_context_free(context);
+
+  gst_init(NULL, NULL);
+  fast_convert_scale_register();
+
+  const FastConvertKernel *const *kernels = fast_convert_kernel_list();
+  const gchar *formats[] = {"NV12", "I420"};
+  const gint divisors[] = {1, 2};
+
+  g_print("Correctness vs videoconvert ! videoscale, %dx%d BGRx source:\n",
+          src_width, src_height);
+  gboolean ok = TRUE;
+  for (guint k = 0; kernels[k]; k++) {
+    for (guint f = 0; f < G_N_ELEMENTS(formats); f++) {
+      for (guint d = 0; d < G_N_ELEMENTS(divisors); d++) {
+        ok &= check_case(kernels[k]->name, formats[f], src_width / divisors[d],
+                         src_height / divisors[d]);
+      }
+    }
+  }
+  g_print("%s\n", ok ? "PASS" : "FAIL");
+
+  g_print("\nThroughput, %d frames, %u cores:\n", frames, g_get_num_processors());
+  for (guint d = 0; d < G_N_ELEMENTS(divisors); d++) {
+    gint width = src_width / divisors[d];
+    gint height = src_height / divisors[d];
+    measure("videoconvert ! videoscale", "videoconvert ! videoscale", width,
+            height);
+    for (guint k = 0; kernels[k]; k++) {
+      gchar *single = g_strdup_printf("fastconvertscale kernel=%s n-threads=1",
+                                      kernels[k]->name);
+      gchar *sliced = g_strdup_printf("fastconvertscale kernel=%s",
+                                      kernels[k]->name);
+      measure(single, single, width, height);
+      measure(sliced, sliced, width, height);
+      g_free(single);
+      g_free(sliced);
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+#ifndef FAST_CONVERT_CHECK_H
+#define FAST_CONVERT_CHECK_H
+
+// Compares fastconvertscale against videoconvert ! videoscale for every
+// kernel this CPU supports, then measures throughput of both.
+int fast_convert_check_tutorial(int argc, char *argv[]);
+
+#endif // !FAST_CONVERT_CHECK_H
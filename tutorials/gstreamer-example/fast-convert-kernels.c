@@ -0,0 +1,373 @@
+#include "fast-convert-kernels.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define Y_BIAS (128 + (16 << 8))
+#define C_BIAS (512 + (128 << 10)) // chroma sums four pixels: >> 10
+
+typedef void (*PairFunc)(const guint8 *r0, const guint8 *r1, gint width,
+                         const FastConvertMatrix *m, guint8 *y0, guint8 *y1,
+                         guint8 *u, guint8 *v, gint uv_step);
+typedef void (*HalfFunc)(const guint8 *s0, const guint8 *s1, gint width,
+                         guint8 *dst);
+
+void fast_convert_matrix_init(FastConvertMatrix *matrix, gboolean bgr,
+                              gboolean bt601) {
+  // Limited range, R G B order.
+  static const gint16 bt709[3][3] = {
+      {47, 157, 16}, {-26, -86, 112}, {112, -102, -10}};
+  static const gint16 bt601_m[3][3] = {
+      {66, 129, 25}, {-38, -74, 112}, {112, -94, -18}};
+  const gint16(*c)[3] = bt601 ? bt601_m : bt709;
+
+  for (gint i = 0; i < 3; i++) {
+    gint byte = bgr ? 2 - i : i;
+    matrix->y[byte] = c[0][i];
+    matrix->u[byte] = c[1][i];
+    matrix->v[byte] = c[2][i];
+  }
+}
+
+static inline guint8 clamp_u8(gint value) {
+  return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static inline guint8 avg_u8(guint8 a, guint8 b) { return (a + b + 1) >> 1; }
+
+// --- Scalar ---
+
+static void convert_pair_from(gint x, const guint8 *r0, const guint8 *r1,
+                              gint width, const FastConvertMatrix *m,
+                              guint8 *y0, guint8 *y1, guint8 *u, guint8 *v,
+                              gint uv_step) {
+  for (; x < width; x += 2) {
+    gint n = x + 1 < width ? 2 : 1;
+    gint sum[3] = {0, 0, 0};
+    for (gint i = 0; i < n; i++) {
+      const guint8 *a = r0 + (x + i) * 4;
+      const guint8 *b = r1 + (x + i) * 4;
+      y0[x + i] = clamp_u8(
+          (m->y[0] * a[0] + m->y[1] * a[1] + m->y[2] * a[2] + Y_BIAS) >> 8);
+      y1[x + i] = clamp_u8(
+          (m->y[0] * b[0] + m->y[1] * b[1] + m->y[2] * b[2] + Y_BIAS) >> 8);
+      // A lone last column counts twice to keep the four-sample scale.
+      for (gint c = 0; c < 3; c++) sum[c] += (a[c] + b[c]) * (3 - n);
+    }
+    gint c = x / 2 * uv_step;
+    u[c] = clamp_u8(
+        (m->u[0] * sum[0] + m->u[1] * sum[1] + m->u[2] * sum[2] + C_BIAS) >> 10);
+    v[c] = clamp_u8(
+        (m->v[0] * sum[0] + m->v[1] * sum[1] + m->v[2] * sum[2] + C_BIAS) >> 10);
+  }
+}
+
+static void convert_pair_scalar(const guint8 *r0, const guint8 *r1, gint width,
+                                const FastConvertMatrix *m, guint8 *y0,
+                                guint8 *y1, guint8 *u, guint8 *v,
+                                gint uv_step) {
+  convert_pair_from(0, r0, r1, width, m, y0, y1, u, v, uv_step);
+}
+
+// Rounds exactly like two levels of _mm_avg_epu8 so all kernels agree.
+static void half_row_from(gint x, const guint8 *s0, const guint8 *s1,
+                          gint width, guint8 *dst) {
+  for (; x < width; x++) {
+    const guint8 *a = s0 + x * 8;
+    const guint8 *b = s1 + x * 8;
+    for (gint c = 0; c < 4; c++) {
+      dst[x * 4 + c] = avg_u8(avg_u8(a[c], b[c]), avg_u8(a[c + 4], b[c + 4]));
+    }
+  }
+}
+
+static void half_row_scalar(const guint8 *s0, const guint8 *s1, gint width,
+                            guint8 *dst) {
+  half_row_from(0, s0, s1, width, dst);
+}
+
+// Box filter for arbitrary ratios; also covers upscaling as nearest neighbour.
+static void box_row(const FastConvertFrame *f, gint row, const gint *xmap,
+                    guint8 *dst) {
+  gint ys = (gint)((gint64)row * f->src_height / f->height);
+  gint ye = (gint)((gint64)(row + 1) * f->src_height / f->height);
+  ye = CLAMP(ye, ys + 1, f->src_height);
+
+  for (gint x = 0; x < f->width; x++) {
+    gint xs = xmap[x];
+    gint xe = CLAMP(xmap[x + 1], xs + 1, f->src_width);
+    guint sum[4] = {0, 0, 0, 0};
+    for (gint sy = ys; sy < ye; sy++) {
+      const guint8 *p = f->src + (gsize)sy * f->src_stride + xs * 4;
+      for (gint sx = xs; sx < xe; sx++, p += 4) {
+        sum[0] += p[0];
+        sum[1] += p[1];
+        sum[2] += p[2];
+      }
+    }
+    guint count = (ye - ys) * (xe - xs);
+    for (gint c = 0; c < 3; c++) dst[x * 4 + c] = (sum[c] + count / 2) / count;
+    dst[x * 4 + 3] = 0xff;
+  }
+}
+
+// --- x86 SIMD ---
+
+#ifdef HAVE_X86_KERNELS
+
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+
+typedef struct {
+  __m128i y, u, v, y_bias, c_bias;
+} SseCoeffs;
+
+static inline SSE41 __m128i coeff_sse(const gint16 c[3]) {
+  return _mm_setr_epi16(c[0], c[1], c[2], 0, c[0], c[1], c[2], 0);
+}
+
+static inline SSE41 void coeffs_sse(const FastConvertMatrix *m, SseCoeffs *k) {
+  k->y = coeff_sse(m->y);
+  k->u = coeff_sse(m->u);
+  k->v = coeff_sse(m->v);
+  k->y_bias = _mm_set1_epi32(Y_BIAS);
+  k->c_bias = _mm_set1_epi32(C_BIAS);
+}
+
+// 4 pixels -> 4 x int32 weighted sums
+static inline SSE41 __m128i dot4_sse(__m128i lo, __m128i hi, __m128i coeff) {
+  return _mm_hadd_epi32(_mm_madd_epi16(lo, coeff), _mm_madd_epi16(hi, coeff));
+}
+
+static inline SSE41 __m128i luma4_sse(__m128i px, const SseCoeffs *k) {
+  __m128i lo = _mm_cvtepu8_epi16(px);
+  __m128i hi = _mm_unpackhi_epi8(px, _mm_setzero_si128());
+  return _mm_srai_epi32(_mm_add_epi32(dot4_sse(lo, hi, k->y), k->y_bias), 8);
+}
+
+// 8 pixels from each of two rows -> 4 U and 4 V samples.
+static inline SSE41 void chroma8_sse(__m128i a0, __m128i a1, __m128i b0,
+                                     __m128i b1, const SseCoeffs *k, guint8 *u,
+                                     guint8 *v, gint uv_step, gint c) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo0 = _mm_add_epi16(_mm_cvtepu8_epi16(a0), _mm_cvtepu8_epi16(b0));
+  __m128i hi0 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero),
+                              _mm_unpackhi_epi8(b0, zero));
+  __m128i lo1 = _mm_add_epi16(_mm_cvtepu8_epi16(a1), _mm_cvtepu8_epi16(b1));
+  __m128i hi1 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero),
+                              _mm_unpackhi_epi8(b1, zero));
+
+  __m128i u4 = _mm_hadd_epi32(dot4_sse(lo0, hi0, k->u), dot4_sse(lo1, hi1, k->u));
+  __m128i v4 = _mm_hadd_epi32(dot4_sse(lo0, hi0, k->v), dot4_sse(lo1, hi1, k->v));
+  u4 = _mm_srai_epi32(_mm_add_epi32(u4, k->c_bias), 10);
+  v4 = _mm_srai_epi32(_mm_add_epi32(v4, k->c_bias), 10);
+
+  // u0 u1 u2 u3 v0 v1 v2 v3
+  __m128i uv = _mm_packus_epi16(_mm_packs_epi32(u4, v4), zero);
+  if (uv_step == 2) {
+    uv = _mm_shuffle_epi8(
+        uv, _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1));
+    _mm_storel_epi64((__m128i *)(u + c * 2), uv);
+  } else {
+    gint32 u_bytes = _mm_cvtsi128_si32(uv);
+    gint32 v_bytes = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+    memcpy(u + c, &u_bytes, 4);
+    memcpy(v + c, &v_bytes, 4);
+  }
+}
+
+static SSE41 void convert_pair_sse41(const guint8 *r0, const guint8 *r1,
+                                     gint width, const FastConvertMatrix *m,
+                                     guint8 *y0, guint8 *y1, guint8 *u,
+                                     guint8 *v, gint uv_step) {
+  SseCoeffs k;
+  coeffs_sse(m, &k);
+
+  gint x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *)(r0 + x * 4));
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(r0 + x * 4 + 16));
+    __m128i b0 = _mm_loadu_si128((const __m128i *)(r1 + x * 4));
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(r1 + x * 4 + 16));
+
+    __m128i ya = _mm_packs_epi32(luma4_sse(a0, &k), luma4_sse(a1, &k));
+    __m128i yb = _mm_packs_epi32(luma4_sse(b0, &k), luma4_sse(b1, &k));
+    __m128i ys = _mm_packus_epi16(ya, yb);
+    _mm_storel_epi64((__m128i *)(y0 + x), ys);
+    _mm_storel_epi64((__m128i *)(y1 + x), _mm_srli_si128(ys, 8));
+
+    chroma8_sse(a0, a1, b0, b1, &k, u, v, uv_step, x / 2);
+  }
+  convert_pair_from(x, r0, r1, width, m, y0, y1, u, v, uv_step);
+}
+
+static SSE41 void half_row_sse41(const guint8 *s0, const guint8 *s1,
+                                 gint width, guint8 *dst) {
+  gint x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i v0 = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(s0 + x * 8)),
+                              _mm_loadu_si128((const __m128i *)(s1 + x * 8)));
+    __m128i v1 =
+        _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(s0 + x * 8 + 16)),
+                     _mm_loadu_si128((const __m128i *)(s1 + x * 8 + 16)));
+    __m128 f0 = _mm_castsi128_ps(v0);
+    __m128 f1 = _mm_castsi128_ps(v1);
+    __m128i even = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+    _mm_storeu_si128((__m128i *)(dst + x * 4), _mm_avg_epu8(even, odd));
+  }
+  half_row_from(x, s0, s1, width, dst);
+}
+
+// 8 pixels -> 8 x int32, in pixel order (hadd works per 128-bit lane).
+static inline AVX2 __m256i luma8_avx2(__m256i px, __m256i coeff, __m256i bias) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i lo = _mm256_unpacklo_epi8(px, zero); // p0 p1 | p4 p5
+  __m256i hi = _mm256_unpackhi_epi8(px, zero); // p2 p3 | p6 p7
+  __m256i sum = _mm256_hadd_epi32(_mm256_madd_epi16(lo, coeff),
+                                  _mm256_madd_epi16(hi, coeff));
+  return _mm256_srai_epi32(_mm256_add_epi32(sum, bias), 8);
+}
+
+static inline AVX2 void luma16_avx2(const guint8 *row, guint8 *dst,
+                                    __m256i coeff, __m256i bias) {
+  __m256i a = luma8_avx2(_mm256_loadu_si256((const __m256i *)row), coeff, bias);
+  __m256i b =
+      luma8_avx2(_mm256_loadu_si256((const __m256i *)(row + 32)), coeff, bias);
+  // 0-3 8-11 | 4-7 12-15 -> 0-3 4-7 8-11 12-15
+  __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+                                            _MM_SHUFFLE(3, 1, 2, 0));
+  __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(packed),
+                                   _mm256_extracti128_si256(packed, 1));
+  _mm_storeu_si128((__m128i *)dst, bytes);
+}
+
+static AVX2 void convert_pair_avx2(const guint8 *r0, const guint8 *r1,
+                                   gint width, const FastConvertMatrix *m,
+                                   guint8 *y0, guint8 *y1, guint8 *u, guint8 *v,
+                                   gint uv_step) {
+  SseCoeffs k;
+  coeffs_sse(m, &k);
+  __m256i coeff = _mm256_broadcastsi128_si256(k.y);
+  __m256i bias = _mm256_set1_epi32(Y_BIAS);
+
+  gint x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const guint8 *a = r0 + x * 4;
+    const guint8 *b = r1 + x * 4;
+    luma16_avx2(a, y0 + x, coeff, bias);
+    luma16_avx2(b, y1 + x, coeff, bias);
+
+    for (gint i = 0; i < 2; i++) {
+      chroma8_sse(_mm_loadu_si128((const __m128i *)(a + i * 32)),
+                  _mm_loadu_si128((const __m128i *)(a + i * 32 + 16)),
+                  _mm_loadu_si128((const __m128i *)(b + i * 32)),
+                  _mm_loadu_si128((const __m128i *)(b + i * 32 + 16)), &k, u, v,
+                  uv_step, x / 2 + i * 4);
+    }
+  }
+  convert_pair_from(x, r0, r1, width, m, y0, y1, u, v, uv_step);
+}
+
+#endif // HAVE_X86_KERNELS
+
+// --- Row driver ---
+
+static void convert_rows(const FastConvertFrame *f, gint row_begin,
+                         gint row_end, PairFunc pair, HalfFunc half) {
+  gint w = f->width;
+  gboolean same = f->src_width == w && f->src_height == f->height;
+  gboolean halve = f->src_width == 2 * w && f->src_height == 2 * f->height;
+
+  // Two scaled RGB rows plus a throwaway luma row for an odd last row.
+  guint8 *scratch = g_malloc((gsize)w * 9);
+  guint8 *rgb0 = scratch;
+  guint8 *rgb1 = scratch + (gsize)w * 4;
+  guint8 *y_spare = scratch + (gsize)w * 8;
+
+  gint *xmap = NULL;
+  if (!same && !halve) {
+    xmap = g_new(gint, w + 1);
+    for (gint x = 0; x <= w; x++) {
+      xmap[x] = (gint)((gint64)x * f->src_width / w);
+    }
+  }
+
+  for (gint row = row_begin; row < row_end; row += 2) {
+    gboolean last = row + 1 >= f->height;
+    const guint8 *r0, *r1;
+    if (same) {
+      r0 = f->src + (gsize)row * f->src_stride;
+      r1 = last ? r0 : r0 + f->src_stride;
+    } else if (halve) {
+      const guint8 *s = f->src + (gsize)row * 2 * f->src_stride;
+      half(s, s + f->src_stride, w, rgb0);
+      if (!last) half(s + 2 * f->src_stride, s + 3 * f->src_stride, w, rgb1);
+      r0 = rgb0;
+      r1 = last ? rgb0 : rgb1;
+    } else {
+      box_row(f, row, xmap, rgb0);
+      if (!last) box_row(f, row + 1, xmap, rgb1);
+      r0 = rgb0;
+      r1 = last ? rgb0 : rgb1;
+    }
+
+    guint8 *y0 = f->y + (gsize)row * f->y_stride;
+    guint8 *y1 = last ? y_spare : y0 + f->y_stride;
+    gint c = row / 2;
+    pair(r0, r1, w, f->matrix, y0, y1, f->u + (gsize)c * f->u_stride,
+         f->v + (gsize)c * f->v_stride, f->uv_step);
+  }
+
+  g_free(xmap);
+  g_free(scratch);
+}
+
+static void convert_scalar(const FastConvertFrame *f, gint begin, gint end) {
+  convert_rows(f, begin, end, convert_pair_scalar, half_row_scalar);
+}
+
+static const FastConvertKernel scalar_kernel = {"scalar", convert_scalar};
+
+#ifdef HAVE_X86_KERNELS
+static void convert_sse41(const FastConvertFrame *f, gint begin, gint end) {
+  convert_rows(f, begin, end, convert_pair_sse41, half_row_sse41);
+}
+
+static void convert_avx2(const FastConvertFrame *f, gint begin, gint end) {
+  convert_rows(f, begin, end, convert_pair_avx2, half_row_sse41);
+}
+
+static const FastConvertKernel sse41_kernel = {"sse4.1", convert_sse41};
+static const FastConvertKernel avx2_kernel = {"avx2", convert_avx2};
+#endif
+
+const FastConvertKernel *const *fast_convert_kernel_list(void) {
+  static const FastConvertKernel *kernels[4];
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized)) {
+    guint n = 0;
+    kernels[n++] = &scalar_kernel;
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("sse4.1")) kernels[n++] = &sse41_kernel;
+    if (__builtin_cpu_supports("avx2")) kernels[n++] = &avx2_kernel;
+#endif
+    kernels[n] = NULL;
+    g_once_init_leave(&initialized, 1);
+  }
+  return kernels;
+}
+
+const FastConvertKernel *fast_convert_kernel_get(const gchar *name) {
+  const FastConvertKernel *const *kernels = fast_convert_kernel_list();
+  const FastConvertKernel *best = NULL;
+  for (guint i = 0; kernels[i]; i++) {
+    if (name == NULL || g_strcmp0(name, "auto") == 0) best = kernels[i];
+    else if (g_strcmp0(name, kernels[i]->name) == 0) return kernels[i];
+  }
+  return best;
+}
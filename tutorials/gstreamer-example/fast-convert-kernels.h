@@ -0,0 +1,49 @@
+#ifndef FAST_CONVERT_KERNELS_H
+#define FAST_CONVERT_KERNELS_H
+
+#include <glib.h>
+
+// Fixed-point (x256) RGB -> YCbCr coefficients, indexed by source byte order.
+typedef struct {
+  gint16 y[3];
+  gint16 u[3];
+  gint16 v[3];
+} FastConvertMatrix;
+
+typedef struct {
+  const guint8 *src; // packed 32-bit RGB, alpha/padding byte last
+  gint src_stride;
+  gint src_width;
+  gint src_height;
+
+  guint8 *y;
+  gint y_stride;
+  guint8 *u;
+  gint u_stride;
+  guint8 *v;
+  gint v_stride;
+  gint uv_step; // 1 for planar I420, 2 for interleaved NV12
+
+  gint width; // output size
+  gint height;
+  const FastConvertMatrix *matrix;
+} FastConvertFrame;
+
+typedef struct {
+  const gchar *name;
+  // Converts (and box-downscales) output rows [row_begin, row_end); both
+  // bounds must be even except for a row_end equal to the frame height.
+  void (*convert)(const FastConvertFrame *frame, gint row_begin, gint row_end);
+} FastConvertKernel;
+
+void fast_convert_matrix_init(FastConvertMatrix *matrix, gboolean bgr,
+                              gboolean bt601);
+
+// NULL or "auto" picks the best kernel the CPU supports. Returns NULL for an
+// unknown or unsupported name.
+const FastConvertKernel *fast_convert_kernel_get(const gchar *name);
+
+// NULL-terminated list of the kernels this CPU can run, fastest last.
+const FastConvertKernel *const *fast_convert_kernel_list(void);
+
+#endif // !FAST_CONVERT_KERNELS_H
@@ -0,0 +1,299 @@
+#include "fast-convert-scale.h"
+#include "fast-convert-kernels.h"
+
+#define MAX_SLICES 16
+
+struct _FastConvertScale {
+  GstVideoFilter parent_instance;
+  guint n_threads; // 0: one slice per core
+  gchar *kernel_name;
+
+  const FastConvertKernel *kernel;
+  FastConvertMatrix matrix;
+  guint slices;
+  GThreadPool *pool; // runs all slices but the first
+};
+
+G_DEFINE_TYPE(FastConvertScale, fast_convert_scale, GST_TYPE_VIDEO_FILTER)
+
+enum { PROP_0, PROP_N_THREADS, PROP_KERNEL, LAST_PROP };
+
+static GParamSpec *properties[LAST_PROP];
+
+static const gchar *sink_formats[] = {"BGRx", "RGBx", "BGRA", "RGBA", NULL};
+static const gchar *src_formats[] = {"NV12", "I420", NULL};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE(
+    "sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE("{ BGRx, RGBx, BGRA, RGBA }")));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
+    "src", GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE("{ NV12, I420 }")));
+
+typedef struct {
+  GMutex lock;
+  GCond done;
+  guint pending;
+} SliceJob;
+
+typedef struct {
+  const FastConvertFrame *frame;
+  const FastConvertKernel *kernel;
+  gint begin;
+  gint end;
+  SliceJob *job;
+} Slice;
+
+static void run_slice(gpointer data, gpointer user_data) {
+  Slice *slice = data;
+  slice->kernel->convert(slice->frame, slice->begin, slice->end);
+
+  g_mutex_lock(&slice->job->lock);
+  if (--slice->job->pending == 0) g_cond_signal(&slice->job->done);
+  g_mutex_unlock(&slice->job->lock);
+}
+
+static void set_formats(GstStructure *s, const gchar **formats) {
+  GValue list = G_VALUE_INIT;
+  GValue value = G_VALUE_INIT;
+  gst_value_list_init(&list, 0);
+  g_value_init(&value, G_TYPE_STRING);
+  for (guint i = 0; formats[i]; i++) {
+    g_value_set_string(&value, formats[i]);
+    gst_value_list_append_value(&list, &value);
+  }
+  g_value_unset(&value);
+  gst_structure_take_value(s, "format", &list);
+}
+
+static GstCaps *fast_convert_scale_transform_caps(GstBaseTransform *trans,
+                                                  GstPadDirection direction,
+                                                  GstCaps *caps,
+                                                  GstCaps *filter) {
+  GstCaps *result = gst_caps_new_empty();
+  for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+    GstStructure *s = gst_structure_copy(gst_caps_get_structure(caps, i));
+    gst_structure_set(s, "width", GST_TYPE_INT_RANGE, 1, G_MAXINT, "height",
+                      GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+    gst_structure_remove_fields(s, "colorimetry", "chroma-site", NULL);
+    set_formats(s, direction == GST_PAD_SINK ? src_formats : sink_formats);
+    result = gst_caps_merge_structure(result, s);
+  }
+
+  if (filter) {
+    GstCaps *tmp =
+        gst_caps_intersect_full(filter, result, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref(result);
+    result = tmp;
+  }
+  return result;
+}
+
+// Keep the input size unless downstream asks for something else.
+static GstCaps *fast_convert_scale_fixate_caps(GstBaseTransform *trans,
+                                               GstPadDirection direction,
+                                               GstCaps *caps,
+                                               GstCaps *othercaps) {
+  othercaps = gst_caps_make_writable(gst_caps_truncate(othercaps));
+  GstStructure *in = gst_caps_get_structure(caps, 0);
+  GstStructure *out = gst_caps_get_structure(othercaps, 0);
+
+  gint width, height;
+  if (gst_structure_get_int(in, "width", &width)) {
+    gst_structure_fixate_field_nearest_int(out, "width", width);
+  }
+  if (gst_structure_get_int(in, "height", &height)) {
+    gst_structure_fixate_field_nearest_int(out, "height", height);
+  }
+  return gst_caps_fixate(othercaps);
+}
+
+static gboolean fast_convert_scale_start(GstBaseTransform *trans) {
+  FastConvertScale *self = FAST_CONVERT_SCALE(trans);
+  self->slices = self->n_threads ? self->n_threads : g_get_num_processors();
+  self->slices = CLAMP(self->slices, 1, MAX_SLICES);
+  if (self->slices > 1) {
+    self->pool = g_thread_pool_new(run_slice, NULL, self->slices - 1, FALSE, NULL);
+  }
+  return TRUE;
+}
+
+static gboolean fast_convert_scale_stop(GstBaseTransform *trans) {
+  FastConvertScale *self = FAST_CONVERT_SCALE(trans);
+  if (self->pool) {
+    g_thread_pool_free(self->pool, FALSE, TRUE);
+    self->pool = NULL;
+  }
+  return TRUE;
+}
+
+static gboolean fast_convert_scale_set_info(GstVideoFilter *filter,
+                                            GstCaps *incaps,
+                                            GstVideoInfo *in_info,
+                                            GstCaps *outcaps,
+                                            GstVideoInfo *out_info) {
+  FastConvertScale *self = FAST_CONVERT_SCALE(filter);
+
+  self->kernel = fast_convert_kernel_get(self->kernel_name);
+  if (!self->kernel) {
+    g_printerr("fastconvertscale: kernel '%s' is not supported here\n",
+               self->kernel_name);
+    return FALSE;
+  }
+
+  GstVideoFormat format = GST_VIDEO_INFO_FORMAT(in_info);
+  gboolean bgr = format == GST_VIDEO_FORMAT_BGRx || format == GST_VIDEO_FORMAT_BGRA;
+  gboolean bt601 = out_info->colorimetry.matrix == GST_VIDEO_COLOR_MATRIX_BT601;
+  fast_convert_matrix_init(&self->matrix, bgr, bt601);
+
+  g_print("[fastconvertscale] %s %dx%d -> %s %dx%d, %s kernel, %u slices\n",
+          gst_video_format_to_string(format), GST_VIDEO_INFO_WIDTH(in_info),
+          GST_VIDEO_INFO_HEIGHT(in_info),
+          gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(out_info)),
+          GST_VIDEO_INFO_WIDTH(out_info), GST_VIDEO_INFO_HEIGHT(out_info),
+          self->kernel->name, self->slices);
+  return TRUE;
+}
+
+static GstFlowReturn fast_convert_scale_transform_frame(GstVideoFilter *filter,
+                                                        GstVideoFrame *in,
+                                                        GstVideoFrame *out) {
+  FastConvertScale *self = FAST_CONVERT_SCALE(filter);
+  gboolean nv12 = GST_VIDEO_FRAME_FORMAT(out) == GST_VIDEO_FORMAT_NV12;
+  guint8 *u = GST_VIDEO_FRAME_PLANE_DATA(out, 1);
+
+  FastConvertFrame frame = {
+      .src = GST_VIDEO_FRAME_PLANE_DATA(in, 0),
+      .src_stride = GST_VIDEO_FRAME_PLANE_STRIDE(in, 0),
+      .src_width = GST_VIDEO_FRAME_WIDTH(in),
+      .src_height = GST_VIDEO_FRAME_HEIGHT(in),
+      .y = GST_VIDEO_FRAME_PLANE_DATA(out, 0),
+      .y_stride = GST_VIDEO_FRAME_PLANE_STRIDE(out, 0),
+      .u = u,
+      .u_stride = GST_VIDEO_FRAME_PLANE_STRIDE(out, 1),
+      .v = nv12 ? u + 1 : GST_VIDEO_FRAME_PLANE_DATA(out, 2),
+      .v_stride = GST_VIDEO_FRAME_PLANE_STRIDE(out, nv12 ? 1 : 2),
+      .uv_step = nv12 ? 2 : 1,
+      .width = GST_VIDEO_FRAME_WIDTH(out),
+      .height = GST_VIDEO_FRAME_HEIGHT(out),
+      .matrix = &self->matrix,
+  };
+
+  // Slices are whole row pairs so each one owns its chroma rows.
+  gint pairs = (frame.height + 1) / 2;
+  guint n = self->pool ? MIN(self->slices, (guint)pairs) : 1;
+
+  SliceJob job = {.pending = n - 1};
+  g_mutex_init(&job.lock);
+  g_cond_init(&job.done);
+
+  Slice slices[MAX_SLICES];
+  for (guint i = 0; i < n; i++) {
+    slices[i] = (Slice){
+        .frame = &frame,
+        .kernel = self->kernel,
+        .begin = 2 * (gint)(pairs * i / n),
+        .end = MIN(2 * (gint)(pairs * (i + 1) / n), frame.height),
+        .job = &job,
+    };
+  }
+  for (guint i = 1; i < n; i++) g_thread_pool_push(self->pool, &slices[i], NULL);
+
+  self->kernel->convert(&frame, slices[0].begin, slices[0].end);
+
+  g_mutex_lock(&job.lock);
+  while (job.pending > 0) g_cond_wait(&job.done, &job.lock);
+  g_mutex_unlock(&job.lock);
+  g_mutex_clear(&job.lock);
+  g_cond_clear(&job.done);
+  return GST_FLOW_OK;
+}
+
+static void fast_convert_scale_get_property(GObject *object, guint prop_id,
+                                            GValue *value, GParamSpec *pspec) {
+  FastConvertScale *self = FAST_CONVERT_SCALE(object);
+  switch (prop_id) {
+  case PROP_N_THREADS:
+    g_value_set_uint(value, self->n_threads);
+    break;
+  case PROP_KERNEL:
+    g_value_set_string(value, self->kernel_name);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+  }
+}
+
+static void fast_convert_scale_set_property(GObject *object, guint prop_id,
+                                            const GValue *value,
+                                            GParamSpec *pspec) {
+  FastConvertScale *self = FAST_CONVERT_SCALE(object);
+  switch (prop_id) {
+  case PROP_N_THREADS:
+    self->n_threads = g_value_get_uint(value);
+    break;
+  case PROP_KERNEL:
+    g_free(self->kernel_name);
+    self->kernel_name = g_value_dup_string(value);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+  }
+}
+
+static void fast_convert_scale_finalize(GObject *object) {
+  FastConvertScale *self = FAST_CONVERT_SCALE(object);
+  g_free(self->kernel_name);
+  G_OBJECT_CLASS(fast_convert_scale_parent_class)->finalize(object);
+}
+
+static void fast_convert_scale_class_init(FastConvertScaleClass *klass) {
+  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+  GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS(klass);
+  GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+  object_class->get_property = fast_convert_scale_get_property;
+  object_class->set_property = fast_convert_scale_set_property;
+  object_class->finalize = fast_convert_scale_finalize;
+
+  properties[PROP_N_THREADS] = g_param_spec_uint(
+      "n-threads", "Threads", "Row slices per frame (0 = one per core)", 0,
+      MAX_SLICES, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  properties[PROP_KERNEL] = g_param_spec_string(
+      "kernel", "Kernel", "SIMD kernel: auto, scalar, sse4.1 or avx2", "auto",
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_properties(object_class, LAST_PROP, properties);
+
+  gst_element_class_add_static_pad_template(element_class, &sink_template);
+  gst_element_class_add_static_pad_template(element_class, &src_template);
+  gst_element_class_set_static_metadata(
+      element_class, "Fast colour convert and scale",
+      "Filter/Converter/Video/Scaler",
+      "Converts packed RGB to NV12/I420 and box-downscales in one pass",
+      "glib-tutorials");
+
+  trans_class->transform_caps = fast_convert_scale_transform_caps;
+  trans_class->fixate_caps = fast_convert_scale_fixate_caps;
+  trans_class->start = fast_convert_scale_start;
+  trans_class->stop = fast_convert_scale_stop;
+  trans_class->passthrough_on_same_caps = FALSE;
+
+  filter_class->set_info = fast_convert_scale_set_info;
+  filter_class->transform_frame = fast_convert_scale_transform_frame;
+}
+
+static void fast_convert_scale_init(FastConvertScale *self) {
+  self->kernel_name = g_strdup("auto");
+}
+
+gboolean fast_convert_scale_register(void) {
+  return gst_element_register(NULL, "fastconvertscale", GST_RANK_NONE,
+                              FAST_CONVERT_SCALE_TYPE);
+}
+
+gboolean fast_convert_scale_accepts(GstVideoFormat format) {
+  return format == GST_VIDEO_FORMAT_BGRx || format == GST_VIDEO_FORMAT_RGBx ||
+         format == GST_VIDEO_FORMAT_BGRA || format == GST_VIDEO_FORMAT_RGBA;
+}
@@ -0,0 +1,18 @@
+#ifndef FAST_CONVERT_SCALE_H
+#define FAST_CONVERT_SCALE_H
+
+#include <gst/video/gstvideofilter.h>
+
+// "fastconvertscale": BGRx/RGBx/BGRA/RGBA -> NV12/I420 colour conversion and
+// box downscaling in a single pass, split into row slices across cores.
+#define FAST_CONVERT_SCALE_TYPE (fast_convert_scale_get_type())
+G_DECLARE_FINAL_TYPE(FastConvertScale, fast_convert_scale, FAST, CONVERT_SCALE,
+                     GstVideoFilter)
+
+// Registers the element with the static plugin registry, after gst_init().
+gboolean fast_convert_scale_register(void);
+
+// Whether the element can take frames of this format as input.
+gboolean fast_convert_scale_accepts(GstVideoFormat format);
+
+#endif // !FAST_CONVERT_SCALE_H
@@ -0,0 +1,178 @@
+#include "frame-dedup.h"
+#include <gst/video/video.h>
+#include <string.h>
+
+#define TILE_ROWS 16
+#define TILE_BYTES 256
+#define HASH_PRIME 0x9E3779B1u
+
+// GCC/Clang vector extension: SSE2 on x86-64, NEON on arm64.
+typedef guint32 HashVec __attribute__((vector_size(16)));
+
+struct _FrameDedup {
+  GstClockTime keepalive;
+  GstVideoInfo info;
+  gboolean have_info;
+
+  guint32 *hashes;  // one per tile, from the last changed frame
+  guint32 *scratch; // hashes of the frame being looked at
+  guint n_tiles;
+  GstClockTime last_forwarded;
+
+  gint captured; // atomic
+  gint dropped;  // atomic
+  gint encoded;  // atomic
+};
+
+static guint32 hash_tile(const guint8 *data, gint stride, gint rows, gint bytes) {
+  HashVec acc = {1, 2, 3, 4};
+  const HashVec prime = {HASH_PRIME, HASH_PRIME, HASH_PRIME, HASH_PRIME};
+
+  for (gint y = 0; y < rows; y++, data += stride) {
+    gint x = 0;
+    for (; x + 16 <= bytes; x += 16) {
+      HashVec word;
+      memcpy(&word, data + x, sizeof(word));
+      acc = (acc ^ word) * prime;
+      acc ^= acc >> 15;
+    }
+    if (x < bytes) {
+      HashVec word = {0, 0, 0, 0};
+      memcpy(&word, data + x, bytes - x);
+      acc = (acc ^ word) * prime;
+      acc ^= acc >> 15;
+    }
+  }
+  return (acc[0] * HASH_PRIME) ^ acc[1] ^ (acc[2] * HASH_PRIME) ^ acc[3];
+}
+
+static guint count_tiles(const GstVideoInfo *info) {
+  guint n = 0;
+  for (guint p = 0; p < GST_VIDEO_INFO_N_PLANES(info); p++) {
+    gint comp[GST_VIDEO_MAX_COMPONENTS];
+    gst_video_format_info_component(info->finfo, p, comp);
+    gint rows = GST_VIDEO_INFO_COMP_HEIGHT(info, comp[0]);
+    gint bytes = GST_VIDEO_INFO_COMP_WIDTH(info, comp[0]) *
+                 GST_VIDEO_INFO_COMP_PSTRIDE(info, comp[0]);
+    n += ((rows + TILE_ROWS - 1) / TILE_ROWS) *
+         ((bytes + TILE_BYTES - 1) / TILE_BYTES);
+  }
+  return n;
+}
+
+// Hashes every tile of the frame into `out`, returns how many changed.
+static guint hash_frame(FrameDedup *dedup, GstVideoFrame *frame, guint32 *out) {
+  guint changed = 0, t = 0;
+  for (guint p = 0; p < GST_VIDEO_FRAME_N_PLANES(frame); p++) {
+    gint comp[GST_VIDEO_MAX_COMPONENTS];
+    gst_video_format_info_component(frame->info.finfo, p, comp);
+    const guint8 *data = GST_VIDEO_FRAME_PLANE_DATA(frame, p);
+    gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, p);
+    gint rows = GST_VIDEO_FRAME_COMP_HEIGHT(frame, comp[0]);
+    gint bytes = GST_VIDEO_FRAME_COMP_WIDTH(frame, comp[0]) *
+                 GST_VIDEO_FRAME_COMP_PSTRIDE(frame, comp[0]);
+
+    for (gint y = 0; y < rows; y += TILE_ROWS) {
+      for (gint x = 0; x < bytes; x += TILE_BYTES, t++) {
+        out[t] = hash_tile(data + (gsize)y * stride + x, stride,
+                           MIN(TILE_ROWS, rows - y), MIN(TILE_BYTES, bytes - x));
+        changed += out[t] != dedup->hashes[t];
+      }
+    }
+  }
+  return changed;
+}
+
+static gboolean is_static(FrameDedup *dedup, GstBuffer *buffer) {
+  GstVideoFrame frame;
+  if (!dedup->have_info ||
+      !gst_video_frame_map(&frame, &dedup->info, buffer, GST_MAP_READ)) {
+    return FALSE;
+  }
+
+  guint changed = hash_frame(dedup, &frame, dedup->scratch);
+  gst_video_frame_unmap(&frame);
+
+  if (changed > 0) {
+    guint32 *tmp = dedup->hashes;
+    dedup->hashes = dedup->scratch;
+    dedup->scratch = tmp;
+  }
+  return changed == 0;
+}
+
+static GstPadProbeReturn on_raw_data(GstPad *pad, GstPadProbeInfo *info,
+                                     gpointer user_data) {
+  FrameDedup *dedup = user_data;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+      GstCaps *caps;
+      gst_event_parse_caps(event, &caps);
+      dedup->have_info = gst_video_info_from_caps(&dedup->info, caps);
+      g_free(dedup->hashes);
+      g_free(dedup->scratch);
+      dedup->n_tiles = dedup->have_info ? count_tiles(&dedup->info) : 0;
+      dedup->hashes = g_new0(guint32, dedup->n_tiles);
+      dedup->scratch = g_new0(guint32, dedup->n_tiles);
+      dedup->last_forwarded = GST_CLOCK_TIME_NONE;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  g_atomic_int_inc(&dedup->captured);
+
+  // Without timestamps the keep-alive cannot be honoured, so never drop.
+  GstClockTime pts = GST_BUFFER_PTS(buffer);
+  gboolean due = !GST_CLOCK_TIME_IS_VALID(pts) ||
+                 !GST_CLOCK_TIME_IS_VALID(dedup->last_forwarded) ||
+                 pts >= dedup->last_forwarded + dedup->keepalive;
+
+  if (is_static(dedup, buffer) && !due) {
+    g_atomic_int_inc(&dedup->dropped);
+    return GST_PAD_PROBE_DROP;
+  }
+  dedup->last_forwarded = pts;
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn on_encoded(GstPad *pad, GstPadProbeInfo *info,
+                                    gpointer user_data) {
+  FrameDedup *dedup = user_data;
+  g_atomic_int_inc(&dedup->encoded);
+  return GST_PAD_PROBE_OK;
+}
+
+FrameDedup *frame_dedup_new(guint keepalive_fps) {
+  FrameDedup *dedup = g_rc_box_new0(FrameDedup);
+  dedup->keepalive = GST_SECOND / MAX(keepalive_fps, 1);
+  dedup->last_forwarded = GST_CLOCK_TIME_NONE;
+  return dedup;
+}
+
+void frame_dedup_attach(FrameDedup *dedup, GstPad *pad, GstPad *encoded) {
+  gst_pad_add_probe(pad,
+                    GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                    on_raw_data, g_rc_box_acquire(dedup),
+                    (GDestroyNotify)frame_dedup_unref);
+  gst_pad_add_probe(encoded, GST_PAD_PROBE_TYPE_BUFFER, on_encoded,
+                    g_rc_box_acquire(dedup), (GDestroyNotify)frame_dedup_unref);
+}
+
+void frame_dedup_print_stats(FrameDedup *dedup) {
+  g_print("[vfr] captured %d, dropped %d (static), encoded %d\n",
+          g_atomic_int_get(&dedup->captured), g_atomic_int_get(&dedup->dropped),
+          g_atomic_int_get(&dedup->encoded));
+}
+
+static void frame_dedup_clear(gpointer data) {
+  FrameDedup *dedup = data;
+  g_free(dedup->hashes);
+  g_free(dedup->scratch);
+}
+
+void frame_dedup_unref(FrameDedup *dedup) {
+  g_rc_box_release_full(dedup, frame_dedup_clear);
+}
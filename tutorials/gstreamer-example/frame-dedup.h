@@ -0,0 +1,23 @@
+#ifndef FRAME_DEDUP_H
+#define FRAME_DEDUP_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+// Variable frame rate capture: drops raw frames whose content did not change
+// since the last forwarded frame, but still forwards at least one frame per
+// keep-alive interval. Forwarded buffers keep their original timestamps.
+typedef struct _FrameDedup FrameDedup;
+
+FrameDedup *frame_dedup_new(guint keepalive_fps);
+
+// `pad` carries raw video (the capture source pad); `encoded` is the encoder
+// source pad, only used for counting.
+void frame_dedup_attach(FrameDedup *dedup, GstPad *pad, GstPad *encoded);
+
+// "[vfr] captured N, dropped M (static), encoded K"
+void frame_dedup_print_stats(FrameDedup *dedup);
+
+void frame_dedup_unref(FrameDedup *dedup);
+
+#endif // !FRAME_DEDUP_H
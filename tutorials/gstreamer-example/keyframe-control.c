@@ -0,0 +1,126 @@
+#include "keyframe-control.h"
+#include <gst/video/video.h>
+
+// One per encoder. Shared by the probe, a pending timer and the controller.
+typedef struct {
+  gchar *name;
+  GstPad *pad; // the encoder's src pad
+  gulong probe_id;
+  gint64 min_interval_us;
+  GMutex lock;
+  gint64 last_request; // monotonic time of the last request let through
+  guint timer_id;      // a held-back request is pending
+  gboolean releasing;  // the next request is the held-back one, not a new one
+  guint requests;
+  guint forwarded;
+  guint held_back;
+} Limiter;
+
+struct _KeyframeControl {
+  GPtrArray *limiters;
+};
+
+static void limiter_clear(gpointer data) {
+  Limiter *limiter = data;
+  g_free(limiter->name);
+  gst_object_unref(limiter->pad);
+  g_mutex_clear(&limiter->lock);
+}
+
+static void limiter_release(gpointer limiter) {
+  g_rc_box_release_full(limiter, limiter_clear);
+}
+
+static void send_request(Limiter *limiter) {
+  GstEvent *event = gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0);
+  gst_pad_send_event(limiter->pad, event);
+}
+
+// The interval is over: the requests held back get their keyframe now.
+static gboolean on_held_back(gpointer user_data) {
+  Limiter *limiter = user_data;
+  g_mutex_lock(&limiter->lock);
+  limiter->timer_id = 0;
+  limiter->releasing = TRUE;
+  g_mutex_unlock(&limiter->lock);
+  send_request(limiter);
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn on_upstream_event(GstPad *pad, GstPadProbeInfo *info,
+                                           gpointer user_data) {
+  Limiter *limiter = user_data;
+  if (!gst_video_event_is_force_key_unit(GST_PAD_PROBE_INFO_EVENT(info))) {
+    return GST_PAD_PROBE_OK;
+  }
+  gint64 now = g_get_monotonic_time();
+  g_mutex_lock(&limiter->lock);
+  if (!limiter->releasing) limiter->requests++;
+  limiter->releasing = FALSE;
+  gint64 wait = limiter->last_request + limiter->min_interval_us - now;
+  gboolean pass = limiter->forwarded == 0 || wait <= 0;
+  if (pass) {
+    limiter->last_request = now;
+    limiter->forwarded++;
+  } else {
+    limiter->held_back++;
+    if (!limiter->timer_id) {
+      limiter->timer_id = g_timeout_add_full(G_PRIORITY_DEFAULT, (guint)(wait / 1000) + 1,
+                                             on_held_back, g_rc_box_acquire(limiter),
+                                             limiter_release);
+    }
+  }
+  g_mutex_unlock(&limiter->lock);
+  return pass ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+KeyframeControl *keyframe_control_new(GstElement *pipeline, guint min_interval_ms) {
+  KeyframeControl *control = g_new0(KeyframeControl, 1);
+  control->limiters = g_ptr_array_new();
+  GST_OBJECT_LOCK(pipeline);
+  for (GList *l = GST_BIN_CHILDREN(pipeline); l; l = l->next) {
+    if (!g_str_has_prefix(GST_OBJECT_NAME(l->data), "venc")) continue;
+    GstPad *pad = gst_element_get_static_pad(l->data, "src");
+    if (!pad) continue;
+    Limiter *limiter = g_rc_box_new0(Limiter);
+    limiter->name = g_strdup(GST_OBJECT_NAME(l->data));
+    limiter->pad = pad;
+    limiter->min_interval_us = (gint64)min_interval_ms * 1000;
+    g_mutex_init(&limiter->lock);
+    limiter->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+                                          on_upstream_event, g_rc_box_acquire(limiter),
+                                          limiter_release);
+    g_ptr_array_add(control->limiters, limiter);
+  }
+  GST_OBJECT_UNLOCK(pipeline);
+  return control;
+}
+
+void keyframe_control_request(KeyframeControl *control) {
+  for (guint i = 0; i < control->limiters->len; i++) send_request(control->limiters->pdata[i]);
+}
+
+void keyframe_control_print_stats(KeyframeControl *control) {
+  for (guint i = 0; i < control->limiters->len; i++) {
+    Limiter *limiter = control->limiters->pdata[i];
+    g_mutex_lock(&limiter->lock);
+    g_print("[keyframe] %s: %u requests, %u keyframes asked for, %u held back\n",
+            limiter->name, limiter->requests, limiter->forwarded, limiter->held_back);
+    g_mutex_unlock(&limiter->lock);
+  }
+}
+
+void keyframe_control_free(KeyframeControl *control) {
+  keyframe_control_print_stats(control);
+  for (guint i = 0; i < control->limiters->len; i++) {
+    Limiter *limiter = control->limiters->pdata[i];
+    gst_pad_remove_probe(limiter->pad, limiter->probe_id);
+    g_mutex_lock(&limiter->lock);
+    if (limiter->timer_id) g_source_remove(limiter->timer_id);
+    limiter->timer_id = 0;
+    g_mutex_unlock(&limiter->lock);
+    limiter_release(limiter);
+  }
+  g_ptr_array_unref(control->limiters);
+  g_free(control);
+}
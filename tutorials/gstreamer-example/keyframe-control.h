@@ -0,0 +1,29 @@
+#ifndef KEYFRAME_CONTROL_H
+#define KEYFRAME_CONTROL_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+// Keyframes on demand for encoders running with a long or infinite GOP.
+// Requests are upstream force-key-unit events: from webrtcbin when a viewer
+// sends RTCP PLI or FIR, from the fan-out when a viewer connects, or from
+// keyframe_control_request(). A probe on each encoder's output lets one
+// through per `min_interval_ms`; later ones are held back and answered by a
+// single keyframe once the interval is over, so a burst of PLIs from a lossy
+// viewer (or from many viewers at once) costs one keyframe, not a storm.
+typedef struct _KeyframeControl KeyframeControl;
+
+// Watches every encoder in `pipeline` whose name starts with "venc", which
+// covers additional streams and simulcast layers.
+KeyframeControl *keyframe_control_new(GstElement *pipeline, guint min_interval_ms);
+
+// Asks every encoder for a keyframe, subject to the same limit.
+void keyframe_control_request(KeyframeControl *control);
+
+// One line per encoder: requests, keyframes asked for and requests held back.
+void keyframe_control_print_stats(KeyframeControl *control);
+
+// Prints the stats a last time.
+void keyframe_control_free(KeyframeControl *control);
+
+#endif // !KEYFRAME_CONTROL_H
@@ -0,0 +1,224 @@
+#include "latency-tracer.h"
+
+#define REPORT_INTERVAL_SECONDS 5
+#define MAX_PENDING 512 // PTS values waiting for their output buffer
+
+typedef struct {
+  GstElement *element;
+  GMutex lock;
+  GHashTable *pending; // PTS -> monotonic time it entered, in us
+  GArray *samples;     // gint64 processing times this interval, in us
+  guint buffers;       // output buffers this interval
+} ElementTrace;
+
+typedef struct {
+  GstPad *pad;
+  gulong id;
+} Probe;
+
+struct _LatencyTracer {
+  GstElement *pipeline;
+  GPtrArray *traces; // ElementTrace, NULL while disabled
+  GArray *probes;
+  guint report_id;
+  gint64 interval_start;
+};
+
+static ElementTrace *element_trace_new(GstElement *element) {
+  ElementTrace *trace = g_rc_box_new0(ElementTrace);
+  trace->element = gst_object_ref(element);
+  g_mutex_init(&trace->lock);
+  trace->pending = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
+  trace->samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+  return trace;
+}
+
+static void element_trace_clear(gpointer data) {
+  ElementTrace *trace = data;
+  gst_object_unref(trace->element);
+  g_mutex_clear(&trace->lock);
+  g_hash_table_unref(trace->pending);
+  g_array_unref(trace->samples);
+}
+
+static void element_trace_unref(gpointer data) {
+  g_rc_box_release_full(data, element_trace_clear);
+}
+
+static GstBuffer *first_buffer(GstPadProbeInfo *info) {
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+    return gst_buffer_list_length(list) ? gst_buffer_list_get(list, 0) : NULL;
+  }
+  return GST_PAD_PROBE_INFO_BUFFER(info);
+}
+
+static GstPadProbeReturn on_input(GstPad *pad, GstPadProbeInfo *info,
+                                  gpointer user_data) {
+  ElementTrace *trace = user_data;
+  GstBuffer *buffer = first_buffer(info);
+  if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer)) return GST_PAD_PROBE_OK;
+
+  gint64 *pts = g_new(gint64, 1);
+  gint64 *now = g_new(gint64, 1);
+  *pts = GST_BUFFER_PTS(buffer);
+  *now = g_get_monotonic_time();
+
+  g_mutex_lock(&trace->lock);
+  // Elements that retime or drop buffers never match; do not let them grow.
+  if (g_hash_table_size(trace->pending) >= MAX_PENDING) {
+    g_hash_table_remove_all(trace->pending);
+  }
+  g_hash_table_replace(trace->pending, pts, now);
+  g_mutex_unlock(&trace->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn on_output(GstPad *pad, GstPadProbeInfo *info,
+                                   gpointer user_data) {
+  ElementTrace *trace = user_data;
+  GstBuffer *buffer = first_buffer(info);
+  guint count = 1;
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    count = gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+  }
+  gint64 now = g_get_monotonic_time();
+
+  g_mutex_lock(&trace->lock);
+  trace->buffers += count;
+  if (buffer && GST_BUFFER_PTS_IS_VALID(buffer)) {
+    // Payloaders emit several packets per frame; only the first one counts.
+    gint64 pts = GST_BUFFER_PTS(buffer);
+    gint64 *entered = g_hash_table_lookup(trace->pending, &pts);
+    if (entered) {
+      gint64 elapsed = now - *entered;
+      g_array_append_val(trace->samples, elapsed);
+      g_hash_table_remove(trace->pending, &pts);
+    }
+  }
+  g_mutex_unlock(&trace->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static void add_probes(LatencyTracer *tracer, ElementTrace *trace) {
+  GstPadProbeType mask = GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST;
+  GstElement *element = trace->element;
+
+  GST_OBJECT_LOCK(element);
+  GList *pads = g_list_copy_deep(element->pads, (GCopyFunc)gst_object_ref, NULL);
+  GST_OBJECT_UNLOCK(element);
+
+  for (GList *l = pads; l; l = l->next) {
+    GstPad *pad = l->data;
+    gboolean sink = GST_PAD_DIRECTION(pad) == GST_PAD_SINK;
+    Probe probe = {gst_object_ref(pad), 0};
+    probe.id = gst_pad_add_probe(pad, mask, sink ? on_input : on_output,
+                                 g_rc_box_acquire(trace), element_trace_unref);
+    g_array_append_val(tracer->probes, probe);
+  }
+  g_list_free_full(pads, gst_object_unref);
+}
+
+static gint compare_time(gconstpointer a, gconstpointer b) {
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return x < y ? -1 : x > y;
+}
+
+static gdouble percentile_ms(GArray *sorted, guint p) {
+  guint index = MIN(sorted->len - 1, sorted->len * p / 100);
+  return g_array_index(sorted, gint64, index) / 1000.0;
+}
+
+static gboolean report(gpointer user_data) {
+  LatencyTracer *tracer = user_data;
+  gint64 now = g_get_monotonic_time();
+  gdouble seconds = (now - tracer->interval_start) / (gdouble)G_USEC_PER_SEC;
+  tracer->interval_start = now;
+
+  g_print("[trace] %-24s %9s %9s %9s %10s\n", "element", "p50 ms", "p95 ms",
+          "p99 ms", "buf/s");
+  for (guint i = 0; i < tracer->traces->len; i++) {
+    ElementTrace *trace = g_ptr_array_index(tracer->traces, i);
+
+    g_mutex_lock(&trace->lock);
+    GArray *samples = trace->samples;
+    trace->samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    guint buffers = trace->buffers;
+    trace->buffers = 0;
+    g_mutex_unlock(&trace->lock);
+
+    gchar *name = gst_element_get_name(trace->element);
+    if (samples->len > 0) {
+      g_array_sort(samples, compare_time);
+      g_print("[trace] %-24s %9.2f %9.2f %9.2f %10.1f\n", name,
+              percentile_ms(samples, 50), percentile_ms(samples, 95),
+              percentile_ms(samples, 99), buffers / seconds);
+    } else {
+      g_print("[trace] %-24s %9s %9s %9s %10.1f\n", name, "-", "-", "-",
+              buffers / seconds);
+    }
+    g_free(name);
+    g_array_unref(samples);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+LatencyTracer *latency_tracer_new(GstElement *pipeline) {
+  LatencyTracer *tracer = g_new0(LatencyTracer, 1);
+  tracer->pipeline = gst_object_ref(pipeline);
+  tracer->probes = g_array_new(FALSE, FALSE, sizeof(Probe));
+  return tracer;
+}
+
+void latency_tracer_set_enabled(LatencyTracer *tracer, gboolean enabled) {
+  if (enabled == (tracer->traces != NULL)) return;
+
+  if (enabled) {
+    // Top-level elements only; webrtcbin's internals would drown the rest.
+    tracer->traces = g_ptr_array_new_with_free_func(element_trace_unref);
+    GstIterator *it = gst_bin_iterate_elements(GST_BIN(tracer->pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+      ElementTrace *trace = element_trace_new(g_value_get_object(&item));
+      add_probes(tracer, trace);
+      g_ptr_array_add(tracer->traces, trace);
+      g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+
+    tracer->interval_start = g_get_monotonic_time();
+    tracer->report_id = g_timeout_add_seconds(REPORT_INTERVAL_SECONDS, report, tracer);
+    g_print("Latency tracing on for %u elements.\n", tracer->traces->len);
+    return;
+  }
+
+  g_source_remove(tracer->report_id);
+  tracer->report_id = 0;
+  for (guint i = 0; i < tracer->probes->len; i++) {
+    Probe *probe = &g_array_index(tracer->probes, Probe, i);
+    gst_pad_remove_probe(probe->pad, probe->id);
+    gst_object_unref(probe->pad);
+  }
+  g_array_set_size(tracer->probes, 0);
+  g_clear_pointer(&tracer->traces, g_ptr_array_unref);
+  g_print("Latency tracing off.\n");
+}
+
+gboolean latency_tracer_command(LatencyTracer *tracer, const gchar *command) {
+  if (g_strcmp0(command, "trace on") == 0) {
+    latency_tracer_set_enabled(tracer, TRUE);
+  } else if (g_strcmp0(command, "trace off") == 0) {
+    latency_tracer_set_enabled(tracer, FALSE);
+  } else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void latency_tracer_free(LatencyTracer *tracer) {
+  latency_tracer_set_enabled(tracer, FALSE);
+  g_array_unref(tracer->probes);
+  gst_object_unref(tracer->pipeline);
+  g_free(tracer);
+}
@@ -0,0 +1,25 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+// Per-element latency tracing for a running pipeline. While enabled, every
+// top-level element gets pad probes: a buffer's time from entering a sink pad
+// to leaving a src pad with the same PTS is its processing time (for queues,
+// the time spent waiting in them). p50/p95/p99 and the output buffer rate of
+// each element are printed every few seconds. Sources only report their rate.
+typedef struct _LatencyTracer LatencyTracer;
+
+LatencyTracer *latency_tracer_new(GstElement *pipeline);
+
+// Adds or removes the probes; the pipeline keeps running either way.
+void latency_tracer_set_enabled(LatencyTracer *tracer, gboolean enabled);
+
+// Handles "trace on" / "trace off" from the stdin command channel. Returns
+// FALSE if `command` is not a trace command.
+gboolean latency_tracer_command(LatencyTracer *tracer, const gchar *command);
+
+void latency_tracer_free(LatencyTracer *tracer);
+
+#endif // !LATENCY_TRACER_H
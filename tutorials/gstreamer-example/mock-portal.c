@@ -0,0 +1,281 @@
+#include "mock-portal.h"
+#include "../common/utils.h"
+
+#define PORTAL_BUS_NAME "org.freedesktop.portal.Desktop"
+#define PORTAL_OBJECT_PATH "/org/freedesktop/portal/desktop"
+#define SCREENCAST_INTERFACE "org.freedesktop.portal.ScreenCast"
+#define REQUEST_INTERFACE "org.freedesktop.portal.Request"
+#define SESSION_INTERFACE "org.freedesktop.portal.Session"
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.portal.ScreenCast'>"
+    "    <method name='CreateSession'>"
+    "      <arg type='a{sv}' name='options' direction='in'/>"
+    "      <arg type='o' name='handle' direction='out'/>"
+    "    </method>"
+    "    <method name='SelectSources'>"
+    "      <arg type='o' name='session_handle' direction='in'/>"
+    "      <arg type='a{sv}' name='options' direction='in'/>"
+    "      <arg type='o' name='handle' direction='out'/>"
+    "    </method>"
+    "    <method name='Start'>"
+    "      <arg type='o' name='session_handle' direction='in'/>"
+    "      <arg type='s' name='parent_window' direction='in'/>"
+    "      <arg type='a{sv}' name='options' direction='in'/>"
+    "      <arg type='o' name='handle' direction='out'/>"
+    "    </method>"
+    "    <property name='AvailableSourceTypes' type='u' access='read'/>"
+    "    <property name='AvailableCursorModes' type='u' access='read'/>"
+    "    <property name='version' type='u' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.freedesktop.portal.Session'>"
+    "    <method name='Close'/>"
+    "  </interface>"
+    "</node>";
+
+struct _MockPortal {
+  GDBusConnection *connection;
+  GDBusNodeInfo *info;
+  guint object_id;
+  guint owner_id;
+  gboolean ready;
+  guint32 node_id;
+  guint dialog_ms;
+  guint dialogs;
+  guint next_token;
+  GHashTable *sessions; // object path -> MockSession
+  GHashTable *tokens;   // restore tokens not used yet
+  GList *answers;       // dialogs still "open", as source ids
+};
+
+typedef struct {
+  guint object_id;
+  guint32 persist_mode;
+} MockSession;
+
+typedef struct {
+  MockPortal *mock;
+  gchar *destination;
+  gchar *path;
+  GVariant *results;
+  guint source_id;
+} Answer;
+
+static void answer_free(gpointer data) {
+  Answer *answer = data;
+  g_free(answer->destination);
+  g_free(answer->path);
+  g_variant_unref(answer->results);
+  g_free(answer);
+}
+
+static void respond(MockPortal *mock, const gchar *destination, const gchar *path,
+                    GVariant *results) {
+  g_dbus_connection_emit_signal(mock->connection, destination, path, REQUEST_INTERFACE,
+                                "Response", g_variant_new("(u@a{sv})", 0, results), NULL);
+}
+
+static gboolean on_dialog_done(gpointer user_data) {
+  Answer *answer = user_data;
+  answer->mock->answers = g_list_remove(answer->mock->answers,
+                                        GUINT_TO_POINTER(answer->source_id));
+  respond(answer->mock, answer->destination, answer->path, answer->results);
+  return G_SOURCE_REMOVE;
+}
+
+// The request path the client derives from its handle_token.
+static gchar *request_path(const gchar *sender, GVariant *options) {
+  const gchar *token = "t";
+  g_variant_lookup(options, "handle_token", "&s", &token);
+  gchar *name = sanitize_sender_name(sender);
+  gchar *path = g_strdup_printf("%s/request/%s/%s", PORTAL_OBJECT_PATH, name, token);
+  g_free(name);
+  return path;
+}
+
+static void handle_method_call(GDBusConnection *connection, const gchar *sender,
+                               const gchar *object_path, const gchar *interface_name,
+                               const gchar *method_name, GVariant *parameters,
+                               GDBusMethodInvocation *invocation, gpointer user_data);
+
+static const GDBusInterfaceVTable session_vtable = {handle_method_call, NULL, NULL, {0}};
+
+static void create_session(MockPortal *mock, const gchar *sender, GVariant *options,
+                           GVariantBuilder *results) {
+  const gchar *token = "s";
+  g_variant_lookup(options, "session_handle_token", "&s", &token);
+  gchar *name = sanitize_sender_name(sender);
+  gchar *path = g_strdup_printf("%s/session/%s/%s", PORTAL_OBJECT_PATH, name, token);
+  g_free(name);
+
+  MockSession *session = g_new0(MockSession, 1);
+  session->object_id = g_dbus_connection_register_object(
+      mock->connection, path, g_dbus_node_info_lookup_interface(mock->info, SESSION_INTERFACE),
+      &session_vtable, mock, NULL, NULL);
+  g_hash_table_replace(mock->sessions, g_strdup(path), session);
+  g_variant_builder_add(results, "{sv}", "session_handle", g_variant_new_string(path));
+  g_free(path);
+}
+
+// Returns FALSE when the selection needs the dialog.
+static gboolean select_sources(MockPortal *mock, MockSession *session, GVariant *options) {
+  g_variant_lookup(options, "persist_mode", "u", &session->persist_mode);
+  const gchar *token = NULL;
+  if (g_variant_lookup(options, "restore_token", "&s", &token) &&
+      g_hash_table_remove(mock->tokens, token)) {
+    return TRUE;
+  }
+  mock->dialogs++;
+  return FALSE;
+}
+
+static void start(MockPortal *mock, MockSession *session, GVariantBuilder *results) {
+  GVariantBuilder props;
+  g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+  g_variant_builder_add(&props, "{sv}", "position", g_variant_new("(ii)", 0, 0));
+  g_variant_builder_add(&props, "{sv}", "size", g_variant_new("(ii)", 1920, 1080));
+  g_variant_builder_add(&props, "{sv}", "source_type", g_variant_new_uint32(1));
+  GVariantBuilder streams;
+  g_variant_builder_init(&streams, G_VARIANT_TYPE("a(ua{sv})"));
+  g_variant_builder_add(&streams, "(ua{sv})", mock->node_id, &props);
+  g_variant_builder_add(results, "{sv}", "streams", g_variant_builder_end(&streams));
+
+  if (session->persist_mode == 2) {
+    gchar *token = g_strdup_printf("mock-token-%u", ++mock->next_token);
+    g_variant_builder_add(results, "{sv}", "restore_token", g_variant_new_string(token));
+    g_hash_table_add(mock->tokens, token);
+  }
+}
+
+static void handle_method_call(GDBusConnection *connection, const gchar *sender,
+                               const gchar *object_path, const gchar *interface_name,
+                               const gchar *method_name, GVariant *parameters,
+                               GDBusMethodInvocation *invocation, gpointer user_data) {
+  MockPortal *mock = user_data;
+  if (g_strcmp0(interface_name, SESSION_INTERFACE) == 0) {
+    MockSession *session = g_hash_table_lookup(mock->sessions, object_path);
+    if (session) {
+      g_dbus_connection_unregister_object(connection, session->object_id);
+      g_hash_table_remove(mock->sessions, object_path);
+    }
+    g_dbus_method_invocation_return_value(invocation, NULL);
+    return;
+  }
+
+  // The options are the last argument of every ScreenCast method.
+  GVariant *options = g_variant_get_child_value(parameters, g_variant_n_children(parameters) - 1);
+  MockSession *session = NULL;
+  if (g_strcmp0(method_name, "CreateSession") != 0) {
+    const gchar *session_path;
+    g_variant_get_child(parameters, 0, "&o", &session_path);
+    session = g_hash_table_lookup(mock->sessions, session_path);
+    if (!session) {
+      g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED,
+                                            "Invalid session");
+      g_variant_unref(options);
+      return;
+    }
+  }
+
+  gchar *path = request_path(sender, options);
+  GVariantBuilder results;
+  g_variant_builder_init(&results, G_VARIANT_TYPE("a{sv}"));
+  gboolean immediate = TRUE;
+  if (g_strcmp0(method_name, "CreateSession") == 0) {
+    create_session(mock, sender, options, &results);
+  } else if (g_strcmp0(method_name, "SelectSources") == 0) {
+    immediate = select_sources(mock, session, options);
+  } else {
+    start(mock, session, &results);
+  }
+  g_variant_unref(options);
+  g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", path));
+
+  GVariant *answer_results = g_variant_ref_sink(g_variant_builder_end(&results));
+  if (immediate) {
+    respond(mock, sender, path, answer_results);
+    g_variant_unref(answer_results);
+    g_free(path);
+    return;
+  }
+  Answer *answer = g_new0(Answer, 1);
+  answer->mock = mock;
+  answer->destination = g_strdup(sender);
+  answer->path = path;
+  answer->results = answer_results;
+  answer->source_id = g_timeout_add_full(G_PRIORITY_DEFAULT, mock->dialog_ms, on_dialog_done,
+                                         answer, answer_free);
+  mock->answers = g_list_prepend(mock->answers, GUINT_TO_POINTER(answer->source_id));
+}
+
+static GVariant *handle_get_property(GDBusConnection *connection, const gchar *sender,
+                                     const gchar *object_path, const gchar *interface_name,
+                                     const gchar *property_name, GError **error,
+                                     gpointer user_data) {
+  if (g_strcmp0(property_name, "AvailableSourceTypes") == 0) return g_variant_new_uint32(1 | 2);
+  if (g_strcmp0(property_name, "AvailableCursorModes") == 0) return g_variant_new_uint32(1 | 2 | 4);
+  return g_variant_new_uint32(5); // version; restore tokens need 4
+}
+
+static const GDBusInterfaceVTable screencast_vtable = {handle_method_call, handle_get_property,
+                                                       NULL, {0}};
+
+static void on_name_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data) {
+  MockPortal *mock = user_data;
+  mock->ready = TRUE;
+}
+
+static void on_name_lost(GDBusConnection *connection, const gchar *name, gpointer user_data) {
+  MockPortal *mock = user_data;
+  mock->ready = FALSE;
+  g_printerr("Mock portal: could not own %s\n", name);
+}
+
+MockPortal *mock_portal_new(GDBusConnection *connection, guint32 node_id, guint dialog_ms) {
+  MockPortal *mock = g_new0(MockPortal, 1);
+  mock->connection = g_object_ref(connection);
+  mock->node_id = node_id;
+  mock->dialog_ms = dialog_ms;
+  mock->sessions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  mock->tokens = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  mock->info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+  mock->object_id = g_dbus_connection_register_object(
+      connection, PORTAL_OBJECT_PATH,
+      g_dbus_node_info_lookup_interface(mock->info, SCREENCAST_INTERFACE), &screencast_vtable,
+      mock, NULL, NULL);
+  mock->owner_id = g_bus_own_name_on_connection(connection, PORTAL_BUS_NAME,
+                                                G_BUS_NAME_OWNER_FLAGS_NONE, on_name_acquired,
+                                                on_name_lost, mock, NULL);
+  return mock;
+}
+
+gboolean mock_portal_is_ready(MockPortal *mock) {
+  return mock->ready;
+}
+
+guint mock_portal_get_dialogs(MockPortal *mock) {
+  return mock->dialogs;
+}
+
+guint mock_portal_get_open_sessions(MockPortal *mock) {
+  return g_hash_table_size(mock->sessions);
+}
+
+void mock_portal_free(MockPortal *mock) {
+  for (GList *l = mock->answers; l; l = l->next) g_source_remove(GPOINTER_TO_UINT(l->data));
+  g_list_free(mock->answers);
+  GHashTableIter iter;
+  MockSession *session;
+  g_hash_table_iter_init(&iter, mock->sessions);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&session)) {
+    g_dbus_connection_unregister_object(mock->connection, session->object_id);
+  }
+  g_hash_table_unref(mock->sessions);
+  g_hash_table_unref(mock->tokens);
+  g_bus_unown_name(mock->owner_id);
+  g_dbus_connection_unregister_object(mock->connection, mock->object_id);
+  g_dbus_node_info_unref(mock->info);
+  g_object_unref(mock->connection);
+  g_free(mock);
+}
@@ -0,0 +1,25 @@
+#ifndef MOCK_PORTAL_H
+#define MOCK_PORTAL_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+// A stand-in for xdg-desktop-portal's ScreenCast interface, served on any
+// bus connection (usually a private one). SelectSources without a valid
+// restore token counts as a dialog and answers after a delay; with one it
+// answers at once. Start hands out a single-use restore token when
+// persist_mode 2 was asked for, and always returns the same PipeWire node.
+typedef struct _MockPortal MockPortal;
+
+MockPortal *mock_portal_new(GDBusConnection *connection, guint32 node_id, guint dialog_ms);
+
+// TRUE once org.freedesktop.portal.Desktop is owned.
+gboolean mock_portal_is_ready(MockPortal *mock);
+
+guint mock_portal_get_dialogs(MockPortal *mock);
+
+guint mock_portal_get_open_sessions(MockPortal *mock);
+
+void mock_portal_free(MockPortal *mock);
+
+#endif // !MOCK_PORTAL_H
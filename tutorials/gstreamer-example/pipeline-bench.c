@@ -0,0 +1,241 @@
+#include "pipeline-bench.h"
+#include "audio-profile.h"
+#include "fast-convert-scale.h"
+#include "pipeline-builder.h"
+#include "video-encoder.h"
+#include "video-fastpath.h"
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+#include <sys/resource.h>
+
+#define RUN_TIMEOUT (600 * GST_SECOND)
+#define AUDIO_BUFFERS_PER_SECOND 50 // the test source makes 20 ms buffers
+
+static gchar *topology = NULL;
+static gchar *encoder_name = NULL;
+static gint src_width = 1920;
+static gint src_height = 1080;
+static gint out_width = 1920;
+static gint out_height = 1080;
+static gint fps = 60;
+static gint frames = 600;
+static gboolean full_chain = FALSE;
+static GOptionEntry entries[] = {
+    {"topology", 't', 0, G_OPTION_ARG_STRING, &topology, "record, webrtc, simulcast or all (default)", "NAME"},
+    {"encoder", 'e', 0, G_OPTION_ARG_STRING, &encoder_name, "Video encoder (default x264enc)", "NAME"},
+    {"width", 'W', 0, G_OPTION_ARG_INT, &src_width, "Source width", "PIXELS"},
+    {"height", 'H', 0, G_OPTION_ARG_INT, &src_height, "Source height", "PIXELS"},
+    {"out-width", 0, 0, G_OPTION_ARG_INT, &out_width, "Encoded width", "PIXELS"},
+    {"out-height", 0, 0, G_OPTION_ARG_INT, &out_height, "Encoded height", "PIXELS"},
+    {"fps", 'r', 0, G_OPTION_ARG_INT, &fps, "Source frame rate", "FPS"},
+    {"frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames per run", "N"},
+    {"full-chain", 0, 0, G_OPTION_ARG_NONE, &full_chain, "Keep videoconvert, videoscale and videorate even where the fast path drops them, to measure what it saves", NULL},
+    {NULL}};
+
+typedef struct {
+  const gchar *name;
+  gdouble wall_seconds;
+  gdouble cpu_seconds;
+  gint encoded;
+} BenchResult;
+
+static gdouble cpu_seconds(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// The high-water mark of the whole process, not of one run: with --topology
+// all the later lines repeat it unless their pipeline needed more.
+static glong process_peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// The pipelines of screencast and screencast-webrtc, from the same builder
+// and encoder settings. Only the sources differ, test sources that run as
+// fast as the encoder takes them, and the Matroska file is a fakesink.
+// webrtcbin needs a peer, so the WebRTC topologies end in the fakesinks
+// screencast-webrtc's fan-out tees. simulcast is screencast-webrtc
+// --simulcast; its frames are counted at the top layer, so cpu_ms_per_frame
+// is what all three cost together.
+static GstElement *build(const gchar *topology_name, const VideoEncoder *encoder,
+                         const VideoFastPath *fastpath, const VideoTarget *target,
+                         GError **error) {
+  gboolean record = g_strcmp0(topology_name, "record") == 0;
+  guint layers = g_strcmp0(topology_name, "simulcast") == 0 ? PIPELINE_BUILDER_MAX_LAYERS : 1;
+  EncoderConfig video_encoder =
+      record ? pipeline_builder_record_encoder(encoder, FALSE, FALSE)
+             : pipeline_builder_webrtc_encoder(encoder, PIPELINE_BUILDER_WEBRTC_KBPS,
+                                               VIDEO_ENCODER_INFINITE_GOP, layers, target);
+  AudioProfile profile;
+  audio_profile_parse(NULL, NULL, NULL, FALSE, &profile);
+  AudioConfig audio = {NULL, &profile, !record, TRUE,
+                       frames * AUDIO_BUFFERS_PER_SECOND / MAX(fps, 1)};
+  SinkConfig sink = {NULL, NULL, NULL, NULL};
+  if (record) {
+    sink.element = gst_element_factory_make("matroskamux", "mux");
+    sink.video_pad = "video_%u";
+    sink.audio_pad = "audio_%u";
+    sink.output = gst_element_factory_make("fakesink", NULL);
+    if (!sink.element || !sink.output) {
+      g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+                  "no element \"%s\"", sink.element ? "fakesink" : "matroskamux");
+      if (sink.element) gst_object_unref(sink.element);
+      if (sink.output) gst_object_unref(sink.output);
+      return NULL;
+    }
+    g_object_set(sink.output, "sync", FALSE, NULL);
+  }
+
+  GstElement *pipeline = pipeline_builder_prepare(&video_encoder, &audio, &sink, error);
+  VideoConfig video = {0, fastpath, target, 3, 0, TRUE, frames};
+  if (pipeline && !pipeline_builder_attach_video(pipeline, &video, error)) {
+    gst_object_unref(pipeline);
+    return NULL;
+  }
+  return pipeline;
+}
+
+static GstPadProbeReturn count_frame(GstPad *pad, GstPadProbeInfo *info,
+                                     gpointer user_data) {
+  g_atomic_int_inc((gint *)user_data);
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean run(GstElement *pipeline, BenchResult *result) {
+  GstElement *venc = gst_bin_get_by_name(GST_BIN(pipeline), "venc");
+  GstPad *pad = gst_element_get_static_pad(venc, "src");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, count_frame,
+                    &result->encoded, NULL);
+  gst_object_unref(pad);
+  gst_object_unref(venc);
+
+  gdouble cpu_before = cpu_seconds();
+  gint64 start = g_get_monotonic_time();
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(
+      bus, RUN_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gst_object_unref(bus);
+
+  result->wall_seconds = (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC;
+  result->cpu_seconds = cpu_seconds() - cpu_before;
+
+  gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+  if (msg && !ok) {
+    GError *error = NULL;
+    gst_message_parse_error(msg, &error, NULL);
+    g_printerr("Pipeline Error: %s\n", error->message);
+    g_error_free(error);
+  } else if (!msg) {
+    g_printerr("Benchmark '%s' timed out\n", result->name);
+  }
+  if (msg) gst_message_unref(msg);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  return ok;
+}
+
+static void print_result(const BenchResult *result, const VideoEncoder *encoder) {
+  gint encoded = MAX(result->encoded, 1);
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "topology");
+  json_builder_add_string_value(builder, result->name);
+  json_builder_set_member_name(builder, "encoder");
+  json_builder_add_string_value(builder, encoder->name);
+  json_builder_set_member_name(builder, "chain");
+  json_builder_add_string_value(builder, full_chain ? "full" : "fast");
+  json_builder_set_member_name(builder, "source");
+  gchar *source = g_strdup_printf("%dx%d@%d", src_width, src_height, fps);
+  json_builder_add_string_value(builder, source);
+  g_free(source);
+  json_builder_set_member_name(builder, "output");
+  gchar *output = g_strdup_printf("%dx%d", out_width, out_height);
+  json_builder_add_string_value(builder, output);
+  g_free(output);
+  json_builder_set_member_name(builder, "frames");
+  json_builder_add_int_value(builder, result->encoded);
+  json_builder_set_member_name(builder, "wall_s");
+  json_builder_add_double_value(builder, result->wall_seconds);
+  json_builder_set_member_name(builder, "fps");
+  json_builder_add_double_value(builder, result->encoded / result->wall_seconds);
+  json_builder_set_member_name(builder, "cpu_ms_per_frame");
+  json_builder_add_double_value(builder, result->cpu_seconds * 1e3 / encoded);
+  json_builder_set_member_name(builder, "process_peak_rss_kb");
+  json_builder_add_int_value(builder, process_peak_rss_kb());
+  json_builder_end_object(builder);
+
+  JsonNode *root = json_builder_get_root(builder);
+  JsonGenerator *generator = json_generator_new();
+  json_generator_set_root(generator, root);
+  gchar *json = json_generator_to_data(generator, NULL);
+  g_print("%s\n", json);
+
+  g_free(json);
+  g_object_unref(generator);
+  json_node_unref(root);
+  g_object_unref(builder);
+}
+
+int pipeline_bench_tutorial(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new("- pipeline benchmark");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_parse(context, &argc, &argv, NULL);
+  g_option_context_free(context);
+
+  gst_init(NULL, NULL);
+  fast_convert_scale_register();
+
+  const VideoEncoder *encoder = video_encoder_select(encoder_name ? encoder_name : "x264enc");
+  g_free(encoder_name);
+  if (!encoder) {
+    g_free(topology);
+    return 1;
+  }
+
+  // What pipewiresrc would have negotiated for a screen of this size.
+  GstVideoInfo source;
+  gst_video_info_set_format(&source, GST_VIDEO_FORMAT_BGRx, src_width, src_height);
+  GST_VIDEO_INFO_FPS_N(&source) = fps;
+  GST_VIDEO_INFO_FPS_D(&source) = 1;
+  VideoTarget target = {out_width, out_height, fps, 1, NULL, NULL};
+  VideoFastPath fastpath;
+  video_fastpath_plan(&source, &target, encoder->name, &fastpath);
+  if (full_chain) {
+    fastpath.convert = fastpath.scale = fastpath.rate = TRUE;
+    fastpath.fused = FALSE;
+  }
+
+  const gchar *topologies[] = {"record", "webrtc", "simulcast"};
+
+  gboolean found = FALSE, ok = TRUE;
+  for (guint i = 0; i < G_N_ELEMENTS(topologies); i++) {
+    if (topology && g_strcmp0(topology, "all") != 0 &&
+        g_strcmp0(topology, topologies[i]) != 0) {
+      continue;
+    }
+    found = TRUE;
+
+    BenchResult result = {topologies[i], 0, 0, 0};
+    GError *error = NULL;
+    GstElement *pipeline = build(topologies[i], encoder, &fastpath, &target, &error);
+    if (!pipeline) {
+      g_printerr("Pipeline Error: %s\n", error->message);
+      g_error_free(error);
+      ok = FALSE;
+    } else if (run(pipeline, &result)) {
+      print_result(&result, encoder);
+    } else {
+      ok = FALSE;
+    }
+    if (pipeline) gst_object_unref(pipeline);
+  }
+  if (!found) g_printerr("Unknown topology '%s' (record, webrtc, simulcast or all)\n", topology);
+
+  g_free(topology);
+  return found && ok ? 0 : 1;
+}
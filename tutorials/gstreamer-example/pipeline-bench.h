@@ -0,0 +1,9 @@
+#ifndef PIPELINE_BENCH_H
+#define PIPELINE_BENCH_H
+
+// Runs the recording and WebRTC pipeline topologies against videotestsrc and
+// audiotestsrc with a software encoder, and prints one JSON object per
+// topology with sustained fps, CPU time per frame and peak RSS.
+int pipeline_bench_tutorial(int argc, char *argv[]);
+
+#endif // !PIPELINE_BENCH_H
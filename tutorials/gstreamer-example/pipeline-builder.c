@@ -0,0 +1,511 @@
+#include "pipeline-builder.h"
+#include "congestion-control.h"
+#include "startup-timeline.h"
+#include <gst/rtp/rtp.h>
+
+typedef struct {
+  GstBin *bin;
+  GstElement *last; // tail of the branch built so far
+  GError **error;
+} Branch;
+
+typedef struct {
+  StartupTimeline *timeline;
+  const VideoFastPath *fastpath;
+} FirstBuffer;
+
+static GstElement *make(Branch *branch, const gchar *factory, const gchar *name) {
+  GstElement *element = gst_element_factory_make(factory, name);
+  if (!element) {
+    g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+                "no element \"%s\"", factory);
+  }
+  return element;
+}
+
+static GstElement *make_capsfilter(Branch *branch, const gchar *name, GstCaps *caps) {
+  GstElement *element = make(branch, "capsfilter", name);
+  if (element) g_object_set(element, "caps", caps, NULL);
+  gst_caps_unref(caps);
+  return element;
+}
+
+// Adds `element` to the bin and links the branch's tail to it. A NULL
+// element means make() failed and already set the error.
+static gboolean append(Branch *branch, GstElement *element) {
+  if (!element) return FALSE;
+  gst_bin_add(branch->bin, element);
+  if (branch->last && !gst_element_link(branch->last, element)) {
+    g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+                "could not link %s to %s", GST_OBJECT_NAME(branch->last),
+                GST_OBJECT_NAME(element));
+    return FALSE;
+  }
+  branch->last = element;
+  return TRUE;
+}
+
+static gboolean append_caps(Branch *branch, const gchar *caps) {
+  GstCaps *parsed = gst_caps_from_string(caps);
+  if (!parsed) {
+    g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_CAPS,
+                "invalid caps \"%s\"", caps);
+    return FALSE;
+  }
+  return append(branch, make_capsfilter(branch, NULL, parsed));
+}
+
+static gboolean finish(Branch *branch, GstElement *sink, const gchar *pad_template,
+                       const gchar *ring) {
+  if (!sink) {
+    GstElement *fakesink = make(branch, "fakesink", ring);
+    if (fakesink) g_object_set(fakesink, "sync", FALSE, "async", FALSE, NULL);
+    return append(branch, fakesink);
+  }
+
+  GstPad *sinkpad = gst_element_request_pad_simple(sink, pad_template);
+  GstPad *srcpad = gst_element_get_static_pad(branch->last, "src");
+  gboolean ok = sinkpad && gst_pad_link(srcpad, sinkpad) == GST_PAD_LINK_OK;
+  if (!ok) {
+    g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+                "could not link %s to %s.%s", GST_OBJECT_NAME(branch->last),
+                GST_OBJECT_NAME(sink), pad_template);
+    // The sink outlives a failed branch, so give the pad back.
+    if (sinkpad) gst_element_release_request_pad(sink, sinkpad);
+  }
+  if (sinkpad) gst_object_unref(sinkpad);
+  gst_object_unref(srcpad);
+  return ok;
+}
+
+#define RID_URI "urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id"
+#define RID_ID 2 // 1 is TWCC
+
+static gboolean add_rid(GstElement *payloader, const gchar *rid) {
+  if (!g_signal_lookup("add-extension", G_OBJECT_TYPE(payloader))) return FALSE;
+  GstRTPHeaderExtension *ext = gst_rtp_header_extension_create_from_uri(RID_URI);
+  if (!ext) return FALSE;
+  gst_rtp_header_extension_set_id(ext, RID_ID);
+  g_object_set(ext, "rid", rid, NULL);
+  g_signal_emit_by_name(payloader, "add-extension", ext);
+  gst_object_unref(ext);
+  return TRUE;
+}
+
+static const gchar *encoding_name(VideoCodec codec) {
+  switch (codec) {
+  case VIDEO_CODEC_H264:
+    return "H264";
+  case VIDEO_CODEC_VP8:
+    return "VP8";
+  case VIDEO_CODEC_VP9:
+    return "VP9";
+  }
+  return NULL;
+}
+
+// make() with the stream's name for `base`.
+static GstElement *make_named(Branch *branch, const gchar *factory, const gchar *base,
+                              guint stream) {
+  gchar *name = pipeline_builder_element_name(base, stream);
+  GstElement *element = make(branch, factory, name);
+  g_free(name);
+  return element;
+}
+
+static gboolean build_capture(Branch *branch, const VideoConfig *video) {
+  GstElement *capture = NULL;
+  if (video->test_source) {
+    capture = make_named(branch, "videotestsrc", "capture", video->stream);
+    if (capture) {
+      if (video->test_frames) {
+        g_object_set(capture, "num-buffers", (gint)video->test_frames, NULL);
+      } else {
+        g_object_set(capture, "is-live", TRUE, NULL);
+      }
+      gst_util_set_object_arg(G_OBJECT(capture), "pattern", "ball");
+    }
+  } else {
+    capture = make_named(branch, "pipewiresrc", "capture", video->stream);
+    if (capture) {
+      gchar *path = g_strdup_printf("%u", video->node_id);
+      g_object_set(capture, "path", path, "do-timestamp", TRUE, NULL);
+      g_free(path);
+    }
+  }
+  if (!append(branch, capture)) return FALSE;
+  // What the fast path was planned for, as pipewiresrc would negotiate it.
+  if (video->test_source && video->fastpath->have_source &&
+      !append(branch, make_capsfilter(branch, NULL,
+                                      gst_video_info_to_caps(&video->fastpath->source)))) {
+    return FALSE;
+  }
+
+  GstElement *queue = make_named(branch, "queue", "capture_queue", video->stream);
+  if (queue) {
+    g_object_set(queue, "max-size-buffers", video->queue_buffers, NULL);
+    // A source that is not live would just be dropped.
+    if (!video->test_frames) gst_util_set_object_arg(G_OBJECT(queue), "leaky", "downstream");
+  }
+  if (!append(branch, queue)) return FALSE;
+
+  // -1 takes the rest from the capsfilter, so the crop survives resizes.
+  const VideoTarget *target = video->target;
+  if (target->crop_width > 0) {
+    GstElement *crop = make(branch, "videocrop", NULL);
+    if (!append(branch, crop)) return FALSE;
+    g_object_set(crop, "left", target->crop_x, "top", target->crop_y,
+                 "right", -1, "bottom", -1, NULL);
+    GstCaps *caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT,
+                                        target->crop_width, "height", G_TYPE_INT,
+                                        target->crop_height, NULL);
+    if (!append(branch, make_capsfilter(branch, NULL, caps))) return FALSE;
+  }
+
+  const gchar *factories[4];
+  guint n = video_fastpath_chain(video->fastpath, target, factories);
+  for (guint i = 0; i < n; i++) {
+    if (!append(branch, make(branch, factories[i], NULL))) return FALSE;
+  }
+  gchar *caps_name = pipeline_builder_element_name("video_caps", video->stream);
+  gboolean ok = append(branch, make_capsfilter(branch, caps_name, video_target_caps(target)));
+  g_free(caps_name);
+  return ok;
+}
+
+// venc [! parser] [! caps] [! pay ! rtp caps] for one encoding: the stream's
+// only one, or a simulcast layer with its RTP stream id.
+static gboolean build_layer(Branch *branch, const EncoderConfig *config, const gchar *name,
+                            guint bitrate_kbps, const gchar *rid) {
+  const VideoEncoder *encoder = config->encoder;
+  GstElement *venc = video_encoder_create(encoder, bitrate_kbps, config->gop_size);
+  if (!venc) {
+    g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+                "no element \"%s\"", encoder->name);
+    return FALSE;
+  }
+  gst_object_set_name(GST_OBJECT(venc), name);
+  if (!append(branch, venc)) return FALSE;
+  if (encoder->codec == VIDEO_CODEC_H264 &&
+      !append(branch, make(branch, "h264parse", NULL))) {
+    return FALSE;
+  }
+  if (config->caps && !append_caps(branch, config->caps)) return FALSE;
+  if (!config->rtp) return TRUE;
+
+  const gchar *payloader = encoder->codec == VIDEO_CODEC_H264  ? "rtph264pay"
+                           : encoder->codec == VIDEO_CODEC_VP8 ? "rtpvp8pay"
+                                                               : "rtpvp9pay";
+  GstElement *pay = make(branch, payloader, NULL);
+  if (pay) {
+    g_object_set(pay, "pt", 96, NULL);
+    if (encoder->codec == VIDEO_CODEC_H264) {
+      g_object_set(pay, "config-interval", -1, NULL);
+    }
+  }
+  // The feedback is asked for in the SDP; without the extension the
+  // bitrate just stays where it is.
+  gboolean twcc = pay && config->twcc && congestion_control_add_twcc(pay);
+  if (pay && rid && !add_rid(pay, rid)) {
+    g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+                "no RTP stream id header extension (rtpmanager, GStreamer 1.20)");
+    gst_object_unref(pay);
+    return FALSE;
+  }
+  if (!append(branch, pay)) return FALSE;
+  GstCaps *caps = gst_caps_new_simple(
+      "application/x-rtp", "media", G_TYPE_STRING, "video", "encoding-name",
+      G_TYPE_STRING, encoding_name(encoder->codec), "payload", G_TYPE_INT, 96, NULL);
+  if (twcc) gst_caps_set_simple(caps, "rtcp-fb-transport-cc", G_TYPE_BOOLEAN, TRUE, NULL);
+  return append(branch, make_capsfilter(branch, NULL, caps));
+}
+
+// Each layer has half the size of the one above it and a quarter of the
+// bitrate: 1080p at 8 Mbit/s, 540p at 2, 270p at 0.5.
+static const struct {
+  const gchar *rid;
+  const gchar *venc;
+} simulcast_layers[] = {{"h", "venc"}, {"m", "venc_m"}, {"l", "venc_l"}};
+
+EncoderConfig pipeline_builder_record_encoder(const VideoEncoder *encoder, gboolean resizable,
+                                              gboolean replay) {
+  EncoderConfig config = {encoder, 10000, 60, NULL, FALSE};
+  if (encoder->codec != VIDEO_CODEC_H264) return config;
+  if (replay) {
+    config.caps = "video/x-h264,stream-format=avc,alignment=au";
+  } else if (resizable) {
+    config.caps = "video/x-h264,stream-format=avc3,alignment=au";
+  }
+  return config;
+}
+
+EncoderConfig pipeline_builder_webrtc_encoder(const VideoEncoder *encoder, guint bitrate_kbps,
+                                              gint gop_size, guint layers,
+                                              const VideoTarget *target) {
+  const gchar *caps = encoder->codec == VIDEO_CODEC_H264
+                          ? "video/x-h264,stream-format=byte-stream,profile=constrained-baseline"
+                          : NULL;
+  EncoderConfig config = {encoder, bitrate_kbps, gop_size, caps, TRUE, TRUE, layers, target};
+  return config;
+}
+
+G_STATIC_ASSERT(G_N_ELEMENTS(simulcast_layers) == PIPELINE_BUILDER_MAX_LAYERS);
+
+const gchar *pipeline_builder_layer_encoder(guint layer) {
+  return simulcast_layers[MIN(layer, PIPELINE_BUILDER_MAX_LAYERS - 1)].venc;
+}
+
+guint pipeline_builder_layer_bitrate(guint bitrate_kbps, guint layer) {
+  return bitrate_kbps >> (2 * layer);
+}
+
+void pipeline_builder_layer_size(gint width, gint height, guint layer, gint *layer_width,
+                                 gint *layer_height) {
+  *layer_width = (width >> layer) & ~1;
+  *layer_height = (height >> layer) & ~1;
+}
+
+// tee "simulcast" ! queue ! venc ! ... ! rtpfunnel, and for every lower layer
+// a queue and videoscale off the tee of the layer above, so each frame is
+// scaled once per layer from the next bigger one. The queues give every
+// encoder (and every scaler) a thread of its own.
+static gboolean build_simulcast(Branch *branch, const EncoderConfig *config) {
+  guint layers = MIN(config->layers, PIPELINE_BUILDER_MAX_LAYERS);
+  if (!config->target || config->target->width <= 0 || config->target->height <= 0) {
+    g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_CAPS,
+                "simulcast needs a fixed output size");
+    return FALSE;
+  }
+  GstElement *funnel = make(branch, "rtpfunnel", NULL);
+  if (!funnel) return FALSE;
+  gst_bin_add(branch->bin, funnel);
+  branch->last = NULL;
+  if (!append(branch, make(branch, "tee", "simulcast"))) return FALSE;
+  GstElement *input = branch->last;
+
+  for (guint i = 0; i < layers; i++) {
+    branch->last = input;
+    gboolean lowest = i + 1 == layers;
+    if (i > 0) {
+      gint width, height;
+      pipeline_builder_layer_size(config->target->width, config->target->height, i, &width,
+                                  &height);
+      GstCaps *size = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, width, "height",
+                                          G_TYPE_INT, height, NULL);
+      if (!append(branch, make(branch, "queue", NULL)) ||
+          !append(branch, make(branch, "videoscale", NULL)) ||
+          !append(branch, make_capsfilter(branch, NULL, size))) {
+        return FALSE;
+      }
+      if (!lowest) {
+        if (!append(branch, make(branch, "tee", NULL))) return FALSE;
+        input = branch->last;
+      }
+    }
+    // The lowest layer's queue is already in front of its scaler.
+    if ((i == 0 || !lowest) && !append(branch, make(branch, "queue", NULL))) return FALSE;
+    if (!build_layer(branch, config, simulcast_layers[i].venc,
+                     pipeline_builder_layer_bitrate(config->bitrate_kbps, i),
+                     simulcast_layers[i].rid)) {
+      return FALSE;
+    }
+    if (!gst_element_link(branch->last, funnel)) {
+      g_set_error(branch->error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+                  "could not link %s to %s", GST_OBJECT_NAME(branch->last),
+                  GST_OBJECT_NAME(funnel));
+      return FALSE;
+    }
+  }
+
+  // rid-<id>=send on the caps is what makes webrtcbin offer a=rid and
+  // a=simulcast for this track.
+  branch->last = funnel;
+  GstCaps *caps = gst_caps_new_empty_simple("application/x-rtp");
+  for (guint i = 0; i < layers; i++) {
+    gchar *field = g_strconcat("rid-", simulcast_layers[i].rid, NULL);
+    gst_caps_set_simple(caps, field, G_TYPE_STRING, "send", NULL);
+    g_free(field);
+  }
+  return append(branch, make_capsfilter(branch, NULL, caps)) &&
+         append(branch, make(branch, "queue", NULL));
+}
+
+static gboolean build_encoder(Branch *branch, const EncoderConfig *config, guint stream) {
+  if (stream == 0 && config->rtp && config->layers > 1) return build_simulcast(branch, config);
+  gchar *name = pipeline_builder_element_name("venc", stream);
+  gboolean ok = build_layer(branch, config, name, config->bitrate_kbps, NULL);
+  g_free(name);
+  return ok && append(branch, make(branch, "queue", NULL));
+}
+
+static gboolean build_audio(Branch *branch, const AudioConfig *audio) {
+  GstElement *source = NULL;
+  if (audio->test_source) {
+    source = make(branch, "audiotestsrc", NULL);
+    if (source && audio->test_buffers) {
+      // 20 ms at 48 kHz, Opus' rate.
+      g_object_set(source, "num-buffers", (gint)audio->test_buffers, "samplesperbuffer", 960,
+                   NULL);
+    } else if (source) {
+      g_object_set(source, "is-live", TRUE, NULL);
+    }
+    if (source) gst_util_set_object_arg(G_OBJECT(source), "wave", "silence");
+  } else {
+    source = make(branch, "pulsesrc", NULL);
+    if (source) {
+      if (audio->device) g_object_set(source, "device", audio->device, NULL);
+      g_object_set(source, "do-timestamp", TRUE, NULL);
+    }
+  }
+  if (!append(branch, source) ||
+      !append(branch, make(branch, "audioconvert", NULL)) ||
+      !append(branch, make(branch, "audioresample", NULL)) ||
+      !append(branch, make(branch, "opusenc", "aenc"))) {
+    return FALSE;
+  }
+  GstElement *encoder = branch->last;
+  GstElement *pay = NULL;
+  if (audio->rtp) {
+    pay = make(branch, "rtpopuspay", "apay");
+    if (pay) g_object_set(pay, "pt", 97, NULL);
+    if (!append(branch, pay)) return FALSE;
+  }
+  audio_profile_apply(audio->profile, audio->test_source ? NULL : source, encoder, pay);
+  return append(branch, make(branch, "queue", NULL));
+}
+
+GstElement *pipeline_builder_prepare(const EncoderConfig *encoder,
+                                     const AudioConfig *audio,
+                                     const SinkConfig *sink, GError **error) {
+  GstElement *pipeline = gst_pipeline_new(NULL);
+  Branch branch = {GST_BIN(pipeline), NULL, error};
+
+  // The sink side first, so the pipeline owns it even if a branch fails.
+  gboolean ok = TRUE;
+  if (sink->element) ok = append(&branch, sink->element);
+  if (ok && sink->output) ok = append(&branch, sink->output);
+
+  branch.last = NULL;
+  ok = ok && build_encoder(&branch, encoder, 0) &&
+       finish(&branch, sink->element, sink->video_pad, "video_ring");
+  branch.last = NULL;
+  ok = ok && build_audio(&branch, audio) &&
+       finish(&branch, sink->element, sink->audio_pad, "audio_ring");
+
+  if (!ok) {
+    gst_object_unref(pipeline);
+    return NULL;
+  }
+  return pipeline;
+}
+
+static GList *list_children(GstElement *pipeline) {
+  GST_OBJECT_LOCK(pipeline);
+  GList *children = g_list_copy(GST_BIN_CHILDREN(pipeline));
+  GST_OBJECT_UNLOCK(pipeline);
+  return children;
+}
+
+// Catches the elements added since `before` up with a pre-warmed or running
+// pipeline, or takes them out again so the pipeline is left as it was.
+static void settle_children(GstElement *pipeline, GList *before, gboolean ok) {
+  GList *added = NULL;
+  GST_OBJECT_LOCK(pipeline);
+  for (GList *l = GST_BIN_CHILDREN(pipeline); l; l = l->next) {
+    if (!g_list_find(before, l->data)) added = g_list_prepend(added, l->data);
+  }
+  GST_OBJECT_UNLOCK(pipeline);
+  for (GList *l = added; l; l = l->next) {
+    if (ok) {
+      gst_element_sync_state_with_parent(l->data);
+    } else {
+      gst_bin_remove(GST_BIN(pipeline), l->data);
+    }
+  }
+  g_list_free(added);
+  g_list_free(before);
+}
+
+gboolean pipeline_builder_attach_video(GstElement *pipeline,
+                                       const VideoConfig *video, GError **error) {
+  Branch branch = {GST_BIN(pipeline), NULL, error};
+  gchar *venc_name = pipeline_builder_element_name("venc", video->stream);
+  GstElement *venc = video->stream == 0 ? gst_bin_get_by_name(GST_BIN(pipeline), "simulcast")
+                                        : NULL;
+  if (!venc) venc = gst_bin_get_by_name(GST_BIN(pipeline), venc_name);
+  g_free(venc_name);
+  if (!venc) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+                "no encoder for stream %u", video->stream);
+    return FALSE;
+  }
+  GList *before = list_children(pipeline);
+
+  gboolean ok = build_capture(&branch, video);
+  if (ok && !gst_element_link(branch.last, venc)) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+                "could not link %s to %s", GST_OBJECT_NAME(branch.last),
+                GST_OBJECT_NAME(venc));
+    ok = FALSE;
+  }
+  gst_object_unref(venc);
+  settle_children(pipeline, before, ok);
+  return ok;
+}
+
+gboolean pipeline_builder_add_encoder(GstElement *pipeline, guint stream,
+                                      const EncoderConfig *encoder, const gchar *sink,
+                                      const gchar *pad_template, GError **error) {
+  Branch branch = {GST_BIN(pipeline), NULL, error};
+  GstElement *sink_element = NULL;
+  if (sink) {
+    sink_element = gst_bin_get_by_name(GST_BIN(pipeline), sink);
+    if (!sink_element) {
+      g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "no element named %s", sink);
+      return FALSE;
+    }
+  }
+  GList *before = list_children(pipeline);
+
+  gchar *ring = pipeline_builder_element_name("video_ring", stream);
+  gboolean ok = build_encoder(&branch, encoder, stream) &&
+                finish(&branch, sink_element, pad_template, ring);
+  g_free(ring);
+  if (sink_element) gst_object_unref(sink_element);
+  settle_children(pipeline, before, ok);
+  return ok;
+}
+
+gchar *pipeline_builder_element_name(const gchar *base, guint stream) {
+  return stream ? g_strdup_printf("%s_%u", base, stream) : g_strdup(base);
+}
+
+static gboolean print_startup(gpointer user_data) {
+  FirstBuffer *first = user_data;
+  startup_timeline_print(first->timeline);
+  if (first->fastpath) video_fastpath_report(first->fastpath);
+  return G_SOURCE_REMOVE;
+}
+
+// The probe and the idle source each hold a reference.
+static GstPadProbeReturn on_first_buffer(GstPad *pad, GstPadProbeInfo *info,
+                                         gpointer user_data) {
+  FirstBuffer *first = user_data;
+  startup_timeline_mark(first->timeline, "first encoded buffer");
+  g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, print_startup, g_rc_box_acquire(first),
+                  g_rc_box_release);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+void pipeline_builder_on_first_buffer(GstElement *pipeline, StartupTimeline *timeline,
+                                      const VideoFastPath *fastpath) {
+  FirstBuffer *first = g_rc_box_new(FirstBuffer);
+  first->timeline = timeline;
+  first->fastpath = fastpath;
+
+  GstElement *venc = gst_bin_get_by_name(GST_BIN(pipeline), "venc");
+  GstPad *pad = gst_element_get_static_pad(venc, "src");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_first_buffer, first, g_rc_box_release);
+  gst_object_unref(pad);
+  gst_object_unref(venc);
+}
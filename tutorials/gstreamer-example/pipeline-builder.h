@@ -0,0 +1,129 @@
+#ifndef PIPELINE_BUILDER_H
+#define PIPELINE_BUILDER_H
+
+#include "audio-profile.h"
+#include "startup-timeline.h"
+#include "video-encoder.h"
+#include "video-fastpath.h"
+#include <glib.h>
+#include <gst/gst.h>
+
+// Builds the capture pipelines of screencast and screencast-webrtc from typed
+// configs, creating and linking elements directly instead of going through a
+// gst_parse_launch string. Both share this shape:
+//
+//   pipewiresrc ! queue ! <raw chain> ! encoder [! parser] [! caps] [! pay]
+//     ! queue ! sink     pulsesrc ! audioconvert ! audioresample ! opusenc
+//     [! pay] ! queue ! sink
+//
+// The checks swap the two sources for test sources, see `test_source`.
+// Elements other code looks up by name: "capture" (pipewiresrc),
+// "capture_queue", "video_caps" (the capsfilter in front of the encoder),
+// "venc", "aenc" (opusenc), "apay" (rtpopuspay), and "video_ring" / "audio_ring" when there is no sink element.
+// With simulcast, the raw chain ends in a tee "simulcast" and the lower
+// layers are encoded by "venc_m" and "venc_l"; "venc" is the top layer.
+// Additional video streams get their own branch with the same names plus
+// the stream index: "capture_1", "venc_1", ...
+
+typedef struct {
+  guint32 node_id;
+  const VideoFastPath *fastpath;
+  const VideoTarget *target;
+  guint queue_buffers; // leaky queue between capture and conversion
+  guint stream;        // 0, or the index of an additional stream
+  gboolean test_source; // a videotestsrc with the fast path's source caps
+                        // instead of pipewiresrc, for the checks and bench
+  guint test_frames;    // with test_source: EOS after this many, made as fast
+                        // as they are taken; 0 for a live, endless source
+} VideoConfig;
+
+typedef struct {
+  const VideoEncoder *encoder;
+  guint bitrate_kbps;
+  gint gop_size;
+  const gchar *caps; // forced after the encoder (and parser), may be NULL
+  gboolean rtp;      // payload as RTP with payload type 96
+  gboolean twcc;     // with rtp: transport-wide sequence numbers, see congestion-control.h
+  guint layers;      // with rtp: simulcast encodings of stream 0, up to
+                     // PIPELINE_BUILDER_MAX_LAYERS; 0 or 1 for none
+  const VideoTarget *target; // size of the top layer, fixed, when simulcasting
+} EncoderConfig;
+
+typedef struct {
+  const gchar *device; // PulseAudio source, NULL for the default one
+  const AudioProfile *profile;
+  gboolean rtp; // payload as RTP with payload type 97
+  gboolean test_source; // a silent audiotestsrc instead of pulsesrc
+  guint test_buffers;   // with test_source: EOS after this many 20 ms buffers,
+                        // made as fast as they are taken; 0 for a live source
+} AudioConfig;
+
+typedef struct {
+  // Muxer or webrtcbin, taken over by the pipeline. NULL ends both branches
+  // in fakesinks named "video_ring" and "audio_ring".
+  GstElement *element;
+  const gchar *video_pad; // request pad templates of `element`
+  const gchar *audio_pad;
+  GstElement *output; // linked after `element` and taken over, may be NULL
+} SinkConfig;
+
+#define PIPELINE_BUILDER_MAX_LAYERS 3
+#define PIPELINE_BUILDER_WEBRTC_KBPS 8000 // per stream; congestion control only goes lower
+
+// What screencast records with: 10 Mbit/s, a keyframe every 60 frames, and
+// for H.264 the avc stream format Matroska wants, or avc3 if the size can
+// change mid-stream. The replay ring is always avc.
+EncoderConfig pipeline_builder_record_encoder(const VideoEncoder *encoder, gboolean resizable,
+                                              gboolean replay);
+
+// What screencast-webrtc sends: RTP with TWCC, for H.264 the byte-stream
+// constrained baseline every browser decodes, and `layers` simulcast layers
+// of `target`'s size.
+EncoderConfig pipeline_builder_webrtc_encoder(const VideoEncoder *encoder, guint bitrate_kbps,
+                                              gint gop_size, guint layers,
+                                              const VideoTarget *target);
+
+
+// Encoder of simulcast layer `layer`: "venc", "venc_m" or "venc_l".
+const gchar *pipeline_builder_layer_encoder(guint layer);
+
+// Bitrate of simulcast layer `layer` for a top layer at `bitrate_kbps`: a
+// quarter of the layer above it.
+guint pipeline_builder_layer_bitrate(guint bitrate_kbps, guint layer);
+
+// Size of simulcast layer `layer` (0 is the top one, at `width`x`height`):
+// halved once per layer, rounded down to even.
+void pipeline_builder_layer_size(gint width, gint height, guint layer, gint *layer_width,
+                                 gint *layer_height);
+
+// Everything that does not depend on the PipeWire node: the encoder onwards,
+// the audio branch and the sink. Returns the pipeline in NULL, or NULL with
+// `error` set. It can be brought to READY right away, which opens the encoder
+// device, the audio source and the sink while the portal dialog is still up.
+GstElement *pipeline_builder_prepare(const EncoderConfig *encoder,
+                                     const AudioConfig *audio,
+                                     const SinkConfig *sink, GError **error);
+
+// Adds pipewiresrc and the raw chain in front of the stream's "venc" once
+// the node id is known. The new elements are brought to the pipeline's
+// state; on failure they are removed again and `error` is set.
+gboolean pipeline_builder_attach_video(GstElement *pipeline,
+                                       const VideoConfig *video, GError **error);
+
+// Adds the encoder branch of additional stream `stream`, linked to a
+// `pad_template` request pad of the element named `sink`, or to a fakesink
+// "video_ring_<stream>" if `sink` is NULL. Same state handling as above.
+gboolean pipeline_builder_add_encoder(GstElement *pipeline, guint stream,
+                                      const EncoderConfig *encoder, const gchar *sink,
+                                      const gchar *pad_template, GError **error);
+
+// `base` for stream 0, "<base>_<stream>" for the others.
+gchar *pipeline_builder_element_name(const gchar *base, guint stream);
+
+// Marks "first encoded buffer" in `timeline` when the first buffer leaves
+// "venc", then prints the timeline and, if not NULL, the fast path's report
+// from the main loop, off the startup path. Both must outlive the pipeline.
+void pipeline_builder_on_first_buffer(GstElement *pipeline, StartupTimeline *timeline,
+                                      const VideoFastPath *fastpath);
+
+#endif // !PIPELINE_BUILDER_H
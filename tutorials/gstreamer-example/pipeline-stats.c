@@ -0,0 +1,347 @@
+#include "pipeline-stats.h"
+#include "pipeline-builder.h"
+#include <gst/video/video.h>
+#include <json-glib/json-glib.h>
+
+#define REPORT_INTERVAL_SECONDS 10
+#define CAPTURE_STARVED_RATIO 0.9
+
+typedef struct {
+  GstElement *queue;
+  gboolean leaky;
+  guint max_buffers;
+  gint overruns; // atomic, from the streaming thread
+  gint reported_overruns;
+  // Fill level in buffers, sampled once a second; reset every report.
+  guint samples;
+  guint64 fill_sum;
+  guint fill_max;
+} QueueStats;
+
+typedef struct {
+  gchar *element;
+  gboolean encoder;
+  guint messages;
+  guint64 processed;
+  guint64 dropped;
+  guint64 reported_dropped;
+} QosStats;
+
+typedef struct {
+  gchar *name; // of the capture element
+  GstPad *capture_pad;
+  gulong capture_probe;
+  gint captured; // atomic
+  GstPad *encoded_pad;
+  gulong encoded_probe;
+  gint encoded; // atomic
+  // Rates of the last report.
+  gdouble capture_fps;
+  gdouble encoded_fps;
+} StreamStats;
+
+struct _PipelineStats {
+  GstElement *pipeline;
+  StreamStats *streams;
+  guint n_streams;
+  GPtrArray *queues;
+  GPtrArray *qos;
+  gint64 start_time;
+  gint64 report_time;
+  guint tick_id;
+  guint ticks;
+
+  // Result of the last report, also used by the JSON dump.
+  const gchar *bottleneck;
+};
+
+static void queue_stats_free(gpointer data) {
+  QueueStats *queue = data;
+  g_signal_handlers_disconnect_by_data(queue->queue, queue);
+  gst_object_unref(queue->queue);
+  g_free(queue);
+}
+
+static void qos_stats_free(gpointer data) {
+  QosStats *qos = data;
+  g_free(qos->element);
+  g_free(qos);
+}
+
+static void on_overrun(GstElement *queue, gpointer user_data) {
+  QueueStats *stats = user_data;
+  g_atomic_int_inc(&stats->overruns);
+}
+
+static GstPadProbeReturn count_buffer(GstPad *pad, GstPadProbeInfo *info,
+                                      gpointer user_data) {
+  g_atomic_int_inc((gint *)user_data);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPad *probe_src(GstElement *pipeline, const gchar *base, guint stream,
+                         gint *counter, gulong *probe) {
+  gchar *name = pipeline_builder_element_name(base, stream);
+  GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), name);
+  g_free(name);
+  if (!element) return NULL;
+  GstPad *pad = gst_element_get_static_pad(element, "src");
+  *probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, count_buffer, counter, NULL);
+  gst_object_unref(element);
+  return pad;
+}
+
+static void unprobe(GstPad *pad, gulong probe) {
+  if (!pad) return;
+  gst_pad_remove_probe(pad, probe);
+  gst_object_unref(pad);
+}
+
+static gboolean is_queue(GstElement *element) {
+  GstElementFactory *factory = gst_element_get_factory(element);
+  return factory && g_strcmp0(GST_OBJECT_NAME(factory), "queue") == 0;
+}
+
+static gdouble nominal_fps(StreamStats *stream) {
+  if (!stream->capture_pad) return 0;
+  GstCaps *caps = gst_pad_get_current_caps(stream->capture_pad);
+  GstVideoInfo info;
+  gboolean ok = caps && gst_video_info_from_caps(&info, caps);
+  if (caps) gst_caps_unref(caps);
+  if (!ok || GST_VIDEO_INFO_FPS_N(&info) == 0) return 0;
+  return (gdouble)GST_VIDEO_INFO_FPS_N(&info) / GST_VIDEO_INFO_FPS_D(&info);
+}
+
+static void report(PipelineStats *stats) {
+  gint64 now = g_get_monotonic_time();
+  gdouble seconds = (now - stats->report_time) / (gdouble)G_USEC_PER_SEC;
+  stats->report_time = now;
+
+  GString *line = g_string_new("[stats]");
+  gboolean starved = FALSE;
+  for (guint i = 0; i < stats->n_streams; i++) {
+    StreamStats *stream = &stats->streams[i];
+    stream->capture_fps = g_atomic_int_and(&stream->captured, 0) / seconds;
+    stream->encoded_fps = g_atomic_int_and(&stream->encoded, 0) / seconds;
+    gdouble nominal = nominal_fps(stream);
+    starved |= nominal > 0 && stream->capture_fps < nominal * CAPTURE_STARVED_RATIO;
+    g_string_append_printf(line, "%s %s %.1f fps, encoded %.1f fps", i ? " |" : "",
+                           stream->name, stream->capture_fps, stream->encoded_fps);
+  }
+
+  guint new_drops = 0;
+  for (guint i = 0; i < stats->queues->len; i++) {
+    QueueStats *queue = g_ptr_array_index(stats->queues, i);
+    gint overruns = g_atomic_int_get(&queue->overruns);
+    gint delta = overruns - queue->reported_overruns;
+    queue->reported_overruns = overruns;
+    if (queue->leaky) new_drops += delta;
+
+    g_string_append_printf(
+        line, " | %s %.1f/%u (max %u) %s %d (+%d)", GST_OBJECT_NAME(queue->queue),
+        queue->samples ? (gdouble)queue->fill_sum / queue->samples : 0.0,
+        queue->max_buffers, queue->fill_max, queue->leaky ? "dropped" : "full",
+        overruns, delta);
+    queue->samples = 0;
+    queue->fill_sum = 0;
+    queue->fill_max = 0;
+  }
+
+  guint64 encoder_drops = 0;
+  for (guint i = 0; i < stats->qos->len; i++) {
+    QosStats *qos = g_ptr_array_index(stats->qos, i);
+    if (qos->encoder) encoder_drops += qos->dropped - qos->reported_dropped;
+    else new_drops += qos->dropped - qos->reported_dropped;
+    qos->reported_dropped = qos->dropped;
+    g_string_append_printf(line, " | qos %s%s %u (dropped %" G_GUINT64_FORMAT ")",
+                           qos->element, qos->encoder ? " late" : "",
+                           qos->messages, qos->dropped);
+  }
+
+  if (new_drops > 0 || encoder_drops > 0) {
+    stats->bottleneck = "encoder";
+  } else if (starved) {
+    stats->bottleneck = "capture";
+  } else {
+    stats->bottleneck = "none";
+  }
+  g_string_append_printf(line, " | bottleneck: %s", stats->bottleneck);
+  g_print("%s\n", line->str);
+  g_string_free(line, TRUE);
+}
+
+static gboolean tick(gpointer user_data) {
+  PipelineStats *stats = user_data;
+  for (guint i = 0; i < stats->queues->len; i++) {
+    QueueStats *queue = g_ptr_array_index(stats->queues, i);
+    guint level;
+    g_object_get(queue->queue, "current-level-buffers", &level, NULL);
+    queue->samples++;
+    queue->fill_sum += level;
+    queue->fill_max = MAX(queue->fill_max, level);
+  }
+  if (++stats->ticks % REPORT_INTERVAL_SECONDS == 0) report(stats);
+  return G_SOURCE_CONTINUE;
+}
+
+PipelineStats *pipeline_stats_new(GstElement *pipeline, guint streams) {
+  PipelineStats *stats = g_new0(PipelineStats, 1);
+  stats->pipeline = gst_object_ref(pipeline);
+  stats->n_streams = MAX(streams, 1);
+  stats->streams = g_new0(StreamStats, stats->n_streams);
+  stats->queues = g_ptr_array_new_with_free_func(queue_stats_free);
+  stats->qos = g_ptr_array_new_with_free_func(qos_stats_free);
+  stats->bottleneck = "none";
+
+  GstIterator *it = gst_bin_iterate_elements(GST_BIN(pipeline));
+  GValue item = G_VALUE_INIT;
+  while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object(&item);
+    if (is_queue(element)) {
+      QueueStats *queue = g_new0(QueueStats, 1);
+      gint leaky;
+      queue->queue = gst_object_ref(element);
+      g_object_get(element, "leaky", &leaky, "max-size-buffers", &queue->max_buffers, NULL);
+      queue->leaky = leaky != 0;
+      g_signal_connect(element, "overrun", G_CALLBACK(on_overrun), queue);
+      g_ptr_array_add(stats->queues, queue);
+    }
+    g_value_reset(&item);
+  }
+  g_value_unset(&item);
+  gst_iterator_free(it);
+
+  for (guint i = 0; i < stats->n_streams; i++) {
+    StreamStats *stream = &stats->streams[i];
+    stream->name = pipeline_builder_element_name("capture", i);
+    stream->capture_pad = probe_src(pipeline, "capture", i, &stream->captured,
+                                    &stream->capture_probe);
+    stream->encoded_pad = probe_src(pipeline, "venc", i, &stream->encoded,
+                                    &stream->encoded_probe);
+  }
+
+  stats->start_time = stats->report_time = g_get_monotonic_time();
+  stats->tick_id = g_timeout_add_seconds(1, tick, stats);
+  return stats;
+}
+
+void pipeline_stats_handle_message(PipelineStats *stats, GstMessage *msg) {
+  if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_QOS) return;
+
+  GstObject *src = GST_MESSAGE_SRC(msg);
+  QosStats *qos = NULL;
+  for (guint i = 0; i < stats->qos->len && !qos; i++) {
+    QosStats *entry = g_ptr_array_index(stats->qos, i);
+    if (g_strcmp0(entry->element, GST_OBJECT_NAME(src)) == 0) qos = entry;
+  }
+  if (!qos) {
+    qos = g_new0(QosStats, 1);
+    qos->element = g_strdup(GST_OBJECT_NAME(src));
+    qos->encoder = GST_IS_VIDEO_ENCODER(src);
+    g_ptr_array_add(stats->qos, qos);
+  }
+
+  // Both counters are running totals kept by the element itself.
+  GstFormat format;
+  guint64 processed, dropped;
+  gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+  qos->messages++;
+  if (processed != (guint64)-1) qos->processed = processed;
+  if (dropped != (guint64)-1) qos->dropped = dropped;
+}
+
+gchar *pipeline_stats_to_json(PipelineStats *stats) {
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "uptime_s");
+  json_builder_add_double_value(
+      builder, (g_get_monotonic_time() - stats->start_time) / (gdouble)G_USEC_PER_SEC);
+  json_builder_set_member_name(builder, "capture_fps");
+  json_builder_add_double_value(builder, stats->streams[0].capture_fps);
+  json_builder_set_member_name(builder, "nominal_fps");
+  json_builder_add_double_value(builder, nominal_fps(&stats->streams[0]));
+  json_builder_set_member_name(builder, "bottleneck");
+  json_builder_add_string_value(builder, stats->bottleneck);
+
+  json_builder_set_member_name(builder, "streams");
+  json_builder_begin_array(builder);
+  for (guint i = 0; i < stats->n_streams; i++) {
+    StreamStats *stream = &stats->streams[i];
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "capture");
+    json_builder_add_string_value(builder, stream->name);
+    json_builder_set_member_name(builder, "capture_fps");
+    json_builder_add_double_value(builder, stream->capture_fps);
+    json_builder_set_member_name(builder, "encoded_fps");
+    json_builder_add_double_value(builder, stream->encoded_fps);
+    json_builder_set_member_name(builder, "nominal_fps");
+    json_builder_add_double_value(builder, nominal_fps(stream));
+    json_builder_end_object(builder);
+  }
+  json_builder_end_array(builder);
+
+  json_builder_set_member_name(builder, "queues");
+  json_builder_begin_array(builder);
+  for (guint i = 0; i < stats->queues->len; i++) {
+    QueueStats *queue = g_ptr_array_index(stats->queues, i);
+    guint level;
+    g_object_get(queue->queue, "current-level-buffers", &level, NULL);
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "name");
+    json_builder_add_string_value(builder, GST_OBJECT_NAME(queue->queue));
+    json_builder_set_member_name(builder, "leaky");
+    json_builder_add_boolean_value(builder, queue->leaky);
+    json_builder_set_member_name(builder, "level");
+    json_builder_add_int_value(builder, level);
+    json_builder_set_member_name(builder, "max_buffers");
+    json_builder_add_int_value(builder, queue->max_buffers);
+    json_builder_set_member_name(builder, queue->leaky ? "dropped" : "full");
+    json_builder_add_int_value(builder, g_atomic_int_get(&queue->overruns));
+    json_builder_end_object(builder);
+  }
+  json_builder_end_array(builder);
+
+  json_builder_set_member_name(builder, "qos");
+  json_builder_begin_array(builder);
+  for (guint i = 0; i < stats->qos->len; i++) {
+    QosStats *qos = g_ptr_array_index(stats->qos, i);
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "element");
+    json_builder_add_string_value(builder, qos->element);
+    json_builder_set_member_name(builder, "encoder");
+    json_builder_add_boolean_value(builder, qos->encoder);
+    json_builder_set_member_name(builder, "messages");
+    json_builder_add_int_value(builder, qos->messages);
+    json_builder_set_member_name(builder, "processed");
+    json_builder_add_int_value(builder, qos->processed);
+    json_builder_set_member_name(builder, "dropped");
+    json_builder_add_int_value(builder, qos->dropped);
+    json_builder_end_object(builder);
+  }
+  json_builder_end_array(builder);
+  json_builder_end_object(builder);
+
+  JsonNode *root = json_builder_get_root(builder);
+  JsonGenerator *generator = json_generator_new();
+  json_generator_set_root(generator, root);
+  gchar *json = json_generator_to_data(generator, NULL);
+  g_object_unref(generator);
+  json_node_unref(root);
+  g_object_unref(builder);
+  return json;
+}
+
+void pipeline_stats_free(PipelineStats *stats) {
+  g_source_remove(stats->tick_id);
+  for (guint i = 0; i < stats->n_streams; i++) {
+    StreamStats *stream = &stats->streams[i];
+    unprobe(stream->capture_pad, stream->capture_probe);
+    unprobe(stream->encoded_pad, stream->encoded_probe);
+    g_free(stream->name);
+  }
+  g_free(stats->streams);
+  g_ptr_array_unref(stats->queues);
+  g_ptr_array_unref(stats->qos);
+  gst_object_unref(stats->pipeline);
+  g_free(stats);
+}
@@ -0,0 +1,30 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+// Live health accounting for the capture pipelines. Tracks QoS messages per
+// element (encoders separately, as late frames), buffers dropped by leaky
+// queues, queue fill levels and the capture frame rate. A one-line summary is
+// printed every few seconds with a guess at the bottleneck: "encoder" when
+// anything downstream of capture drops, "capture" when a source delivers
+// below its nominal rate. With several video streams, capture and encoded
+// frame rates are kept per stream, so scaling across cores shows up as
+// streams keeping their rate.
+typedef struct _PipelineStats PipelineStats;
+
+// Measures "capture"/"venc" and, for `streams` > 1, "capture_1"/"venc_1" and
+// so on, as named by the pipeline builder.
+PipelineStats *pipeline_stats_new(GstElement *pipeline, guint streams);
+
+// Feed every bus message; QoS messages are accounted, the rest ignored.
+void pipeline_stats_handle_message(PipelineStats *stats, GstMessage *msg);
+
+// Everything collected so far as a JSON object.
+gchar *pipeline_stats_to_json(PipelineStats *stats);
+
+// Call once the pipeline is back in NULL.
+void pipeline_stats_free(PipelineStats *stats);
+
+#endif // !PIPELINE_STATS_H
@@ -0,0 +1,186 @@
+#include "portal-check.h"
+#include "mock-portal.h"
+#include "screencast-portal.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+static gint runs = 3;
+static gint dialog_ms = 300;
+static gint node_id = 42;
+static gchar *dbus_address = NULL;
+static GOptionEntry check_entries[] = {
+    {"runs", 'n', 0, G_OPTION_ARG_INT, &runs, "Handshakes to run (default 3)", "N"},
+    {"dialog-ms", 0, 0, G_OPTION_ARG_INT, &dialog_ms, "How long the mock dialog stays open (default 300)", "MS"},
+    {NULL}};
+static GOptionEntry mock_entries[] = {
+    {"dbus-address", 0, 0, G_OPTION_ARG_STRING, &dbus_address, "Serve on this bus instead of a new private one", "ADDRESS"},
+    {"node-id", 0, 0, G_OPTION_ARG_INT, &node_id, "PipeWire node returned by Start (default 42)", "ID"},
+    {"dialog-ms", 0, 0, G_OPTION_ARG_INT, &dialog_ms, "How long the mock dialog stays open (default 300)", "MS"},
+    {NULL}};
+
+typedef struct {
+  GMainLoop *loop;
+  GArray *streams;
+  GError *error;
+} Handshake;
+
+static void on_started(GObject *source, GAsyncResult *result, gpointer user_data) {
+  Handshake *handshake = user_data;
+  handshake->streams = screencast_portal_start_finish(result, &handshake->error);
+  g_main_loop_quit(handshake->loop);
+}
+
+static gboolean on_deadline(gpointer user_data) {
+  *(gboolean *)user_data = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+// Runs the main context until `mock` is ready or has no sessions left.
+static void wait_for(MockPortal *mock, gboolean (*done)(MockPortal *)) {
+  gboolean expired = FALSE;
+  guint id = g_timeout_add_seconds(2, on_deadline, &expired);
+  while (!done(mock) && !expired) g_main_context_iteration(NULL, TRUE);
+  if (!expired) g_source_remove(id);
+}
+
+static gboolean sessions_closed(MockPortal *mock) {
+  return mock_portal_get_open_sessions(mock) == 0;
+}
+
+// A new connection per run, as if screencast was started again.
+static gboolean run_handshake(const gchar *address, const gchar *token_file,
+                              MockPortal *mock, guint run) {
+  GError *error = NULL;
+  GDBusConnection *connection = screencast_portal_connect(address, &error);
+  if (!connection) {
+    g_printerr("DBus Error: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  guint dialogs = mock_portal_get_dialogs(mock);
+  Handshake handshake = {g_main_loop_new(NULL, FALSE), NULL, NULL};
+  ScreencastPortal *portal = screencast_portal_new(connection);
+  ScreencastPortalOptions options = {1 | 2, 2, NULL, token_file};
+  gint64 start = g_get_monotonic_time();
+  screencast_portal_start_async(portal, &options, NULL, on_started, &handshake);
+  g_main_loop_run(handshake.loop);
+  gdouble ms = (g_get_monotonic_time() - start) / 1000.0;
+  screencast_portal_free(portal);
+  g_dbus_connection_close_sync(connection, NULL, NULL);
+  g_object_unref(connection);
+  g_main_loop_unref(handshake.loop);
+
+  if (!handshake.streams) {
+    g_print("  run %u: %s\n", run, handshake.error->message);
+    g_error_free(handshake.error);
+    return FALSE;
+  }
+  gboolean dialog = mock_portal_get_dialogs(mock) > dialogs;
+  g_print("  run %u: %7.1f ms  %-8s  node %u\n", run, ms, dialog ? "dialog" : "restored",
+          g_array_index(handshake.streams, ScreencastStream, 0).node_id);
+  g_array_unref(handshake.streams);
+  return dialog == (run == 1);
+}
+
+int portal_check_tutorial(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new("- portal restore token check");
+  g_option_context_add_main_entries(context, check_entries, NULL);
+  g_option_context_parse(context, &argc, &argv, NULL);
+  g_option_context_free(context);
+
+  // Needs dbus-daemon; the user's session bus and portal are never touched.
+  GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+  g_test_dbus_up(bus);
+  const gchar *address = g_test_dbus_get_bus_address(bus);
+
+  GError *error = NULL;
+  GDBusConnection *connection = screencast_portal_connect(address, &error);
+  if (!connection) {
+    g_printerr("DBus Error: %s\n", error->message);
+    g_error_free(error);
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+    return 1;
+  }
+  MockPortal *mock = mock_portal_new(connection, node_id, MAX(dialog_ms, 0));
+  wait_for(mock, mock_portal_is_ready);
+
+  gchar *dir = g_dir_make_tmp("portal-check-XXXXXX", NULL);
+  gchar *token_file = g_build_filename(dir, "restore-token", NULL);
+  g_print("Portal handshakes against a mock portal, dialog %d ms:\n", dialog_ms);
+  gboolean ok = mock_portal_is_ready(mock);
+  for (gint run = 1; ok && run <= MAX(runs, 2); run++) {
+    ok = run_handshake(address, token_file, mock, run);
+  }
+  wait_for(mock, sessions_closed);
+  if (!sessions_closed(mock)) {
+    g_print("  %u session(s) left open\n", mock_portal_get_open_sessions(mock));
+    ok = FALSE;
+  }
+  g_print("%s\n", ok ? "PASS" : "FAIL");
+
+  g_unlink(token_file);
+  g_rmdir(dir);
+  g_free(token_file);
+  g_free(dir);
+  mock_portal_free(mock);
+  g_dbus_connection_close_sync(connection, NULL, NULL);
+  g_object_unref(connection);
+  g_test_dbus_down(bus);
+  g_object_unref(bus);
+  return ok ? 0 : 1;
+}
+
+static gboolean on_stdin_input(GIOChannel *channel, GIOCondition condition, gpointer user_data) {
+  gchar *input = NULL;
+  if (g_io_channel_read_line(channel, &input, NULL, NULL, NULL) == G_IO_STATUS_NORMAL) {
+    if (g_strcmp0(g_strchomp(input), "exit") == 0) g_main_loop_quit(user_data);
+    g_free(input);
+  }
+  return TRUE;
+}
+
+int mock_portal_tutorial(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new("- mock screencast portal");
+  g_option_context_add_main_entries(context, mock_entries, NULL);
+  g_option_context_parse(context, &argc, &argv, NULL);
+  g_option_context_free(context);
+
+  GTestDBus *bus = NULL;
+  if (!dbus_address) {
+    bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(bus);
+    dbus_address = g_strdup(g_test_dbus_get_bus_address(bus));
+  }
+
+  GError *error = NULL;
+  GDBusConnection *connection = screencast_portal_connect(dbus_address, &error);
+  int status = connection ? 0 : 1;
+  if (!connection) {
+    g_printerr("DBus Error: %s\n", error->message);
+    g_error_free(error);
+  } else {
+    MockPortal *mock = mock_portal_new(connection, node_id, MAX(dialog_ms, 0));
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    GIOChannel *stdin_ch = g_io_channel_unix_new(0);
+    g_io_add_watch(stdin_ch, G_IO_IN, on_stdin_input, loop);
+    g_io_channel_unref(stdin_ch);
+
+    g_print("Mock portal on %s\n", dbus_address);
+    g_print("Try: screencast --dbus-address '%s'. Type 'exit' to stop.\n", dbus_address);
+    g_main_loop_run(loop);
+    g_print("%u dialog(s) shown\n", mock_portal_get_dialogs(mock));
+
+    g_main_loop_unref(loop);
+    mock_portal_free(mock);
+    g_object_unref(connection);
+  }
+  g_free(dbus_address);
+  if (bus) {
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+  }
+  return status;
+}
@@ -0,0 +1,12 @@
+#ifndef PORTAL_CHECK_H
+#define PORTAL_CHECK_H
+
+// Runs the portal handshake several times against a mock portal on a
+// private bus and checks that only the first run needs the dialog.
+int portal_check_tutorial(int argc, char *argv[]);
+
+// Serves the mock portal on a bus until interrupted, so screencast and
+// screencast-webrtc can be pointed at it with --dbus-address.
+int mock_portal_tutorial(int argc, char *argv[]);
+
+#endif // !PORTAL_CHECK_H
@@ -0,0 +1,285 @@
+#include "replay-buffer.h"
+
+#define SAVE_TIMEOUT (60 * GST_SECOND)
+
+typedef struct {
+  GQueue buffers;
+  gsize bytes;
+  GstCaps *caps;
+} Ring;
+
+struct _ReplayBuffer {
+  GMutex lock; // guards both rings, taken from two streaming threads
+  GstClockTime window;
+  gsize max_bytes;
+  Ring video;
+  Ring audio;
+};
+
+// Decode order is what the muxer needs, so prefer DTS.
+static GstClockTime buffer_time(GstBuffer *buffer) {
+  return GST_BUFFER_DTS_IS_VALID(buffer) ? GST_BUFFER_DTS(buffer)
+                                         : GST_BUFFER_PTS(buffer);
+}
+
+static gboolean is_keyframe(GstBuffer *buffer) {
+  return !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+static void ring_pop(Ring *ring) {
+  GstBuffer *buffer = g_queue_pop_head(&ring->buffers);
+  ring->bytes -= gst_buffer_get_size(buffer);
+  gst_buffer_unref(buffer);
+}
+
+static void ring_clear(Ring *ring) {
+  while (!g_queue_is_empty(&ring->buffers)) ring_pop(ring);
+}
+
+// Called with the lock held after every insert.
+static void trim(ReplayBuffer *replay) {
+  Ring *video = &replay->video;
+  Ring *audio = &replay->audio;
+
+  // Drop the oldest GOP while the rest still covers the window, or while the
+  // byte budget is exceeded.
+  while (!g_queue_is_empty(&video->buffers)) {
+    GList *next = g_queue_peek_head_link(&video->buffers)->next;
+    while (next && !is_keyframe(next->data)) next = next->next;
+
+    gboolean over_budget = video->bytes + audio->bytes > replay->max_bytes;
+    if (!next) {
+      // A single GOP over budget cannot be kept whole; wait for the next one.
+      if (over_budget) ring_clear(video);
+      break;
+    }
+    GstClockTime newest = buffer_time(g_queue_peek_tail(&video->buffers));
+    if (!over_budget && newest - buffer_time(next->data) < replay->window) break;
+    while (g_queue_peek_head_link(&video->buffers) != next) ring_pop(video);
+  }
+
+  // Audio never reaches back further than the first video frame.
+  GstClockTime start = 0;
+  if (!g_queue_is_empty(&video->buffers)) {
+    start = buffer_time(g_queue_peek_head(&video->buffers));
+  } else if (!g_queue_is_empty(&audio->buffers)) {
+    GstClockTime newest = buffer_time(g_queue_peek_tail(&audio->buffers));
+    start = newest > replay->window ? newest - replay->window : 0;
+  }
+  while (!g_queue_is_empty(&audio->buffers) &&
+         (buffer_time(g_queue_peek_head(&audio->buffers)) < start ||
+          video->bytes + audio->bytes > replay->max_bytes)) {
+    ring_pop(audio);
+  }
+}
+
+static void store(ReplayBuffer *replay, Ring *ring, GstPadProbeInfo *info) {
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) return;
+
+    // Old buffers may not decode with new caps (codec_data), so start over.
+    GstCaps *caps;
+    gst_event_parse_caps(event, &caps);
+    g_mutex_lock(&replay->lock);
+    if (!ring->caps || !gst_caps_is_equal(ring->caps, caps)) {
+      ring_clear(ring);
+      gst_caps_replace(&ring->caps, caps);
+    }
+    g_mutex_unlock(&replay->lock);
+    return;
+  }
+
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (!GST_CLOCK_TIME_IS_VALID(buffer_time(buffer))) return;
+
+  g_mutex_lock(&replay->lock);
+  if (!g_queue_is_empty(&ring->buffers) || is_keyframe(buffer)) {
+    g_queue_push_tail(&ring->buffers, gst_buffer_ref(buffer));
+    ring->bytes += gst_buffer_get_size(buffer);
+    trim(replay);
+  }
+  g_mutex_unlock(&replay->lock);
+}
+
+static GstPadProbeReturn on_video(GstPad *pad, GstPadProbeInfo *info,
+                                  gpointer user_data) {
+  ReplayBuffer *replay = user_data;
+  store(replay, &replay->video, info);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn on_audio(GstPad *pad, GstPadProbeInfo *info,
+                                  gpointer user_data) {
+  ReplayBuffer *replay = user_data;
+  store(replay, &replay->audio, info);
+  return GST_PAD_PROBE_OK;
+}
+
+ReplayBuffer *replay_buffer_new(guint seconds, gsize max_bytes) {
+  ReplayBuffer *replay = g_rc_box_new0(ReplayBuffer);
+  g_mutex_init(&replay->lock);
+  replay->window = seconds * GST_SECOND;
+  replay->max_bytes = max_bytes;
+  g_queue_init(&replay->video.buffers);
+  g_queue_init(&replay->audio.buffers);
+  return replay;
+}
+
+void replay_buffer_attach(ReplayBuffer *replay, GstPad *video, GstPad *audio) {
+  GstPadProbeType mask =
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM;
+  gst_pad_add_probe(video, mask, on_video, g_rc_box_acquire(replay),
+                    (GDestroyNotify)replay_buffer_unref);
+  if (audio) {
+    gst_pad_add_probe(audio, mask, on_audio, g_rc_box_acquire(replay),
+                      (GDestroyNotify)replay_buffer_unref);
+  }
+}
+
+static GstClockTime rebase(GstClockTime time, GstClockTime base) {
+  if (!GST_CLOCK_TIME_IS_VALID(time)) return time;
+  return time > base ? time - base : 0;
+}
+
+// Pushes copies of `buffers` shifted to start at zero; memory stays shared.
+static void push_all(GstElement *pipeline, const gchar *name, GstCaps *caps,
+                     GList *buffers, GstClockTime base) {
+  GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), name);
+  GstFlowReturn ret;
+  g_object_set(src, "caps", caps, NULL);
+
+  for (GList *l = buffers; l; l = l->next) {
+    if (buffer_time(l->data) < base) continue;
+    GstBuffer *buffer = gst_buffer_copy(l->data);
+    GST_BUFFER_PTS(buffer) = rebase(GST_BUFFER_PTS(buffer), base);
+    GST_BUFFER_DTS(buffer) = rebase(GST_BUFFER_DTS(buffer), base);
+    g_signal_emit_by_name(src, "push-buffer", buffer, &ret);
+    gst_buffer_unref(buffer);
+  }
+  g_signal_emit_by_name(src, "end-of-stream", &ret);
+  gst_object_unref(src);
+}
+
+static gboolean write_file(const gchar *path, GList *video, GstCaps *video_caps,
+                           GList *audio, GstCaps *audio_caps, GError **error) {
+  gchar *desc = g_strdup_printf(
+      "matroskamux name=mux ! filesink name=sink "
+      "appsrc name=video format=time ! queue ! mux.video_0 %s",
+      audio ? "appsrc name=audio format=time ! queue ! mux.audio_0" : "");
+  GError *parse_error = NULL;
+  GstElement *pipeline = gst_parse_launch(desc, &parse_error);
+  g_free(desc);
+  if (parse_error) {
+    g_propagate_error(error, parse_error);
+    if (pipeline) gst_object_unref(pipeline);
+    return FALSE;
+  }
+
+  GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+  g_object_set(sink, "location", path, NULL);
+  gst_object_unref(sink);
+
+  GstClockTime base = buffer_time(video->data);
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  push_all(pipeline, "video", video_caps, video, base);
+  if (audio) push_all(pipeline, "audio", audio_caps, audio, base);
+
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(
+      bus, SAVE_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gst_object_unref(bus);
+
+  gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+  if (msg && !ok) {
+    gst_message_parse_error(msg, error, NULL);
+  } else if (!msg) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "timed out writing %s", path);
+  }
+  if (msg) gst_message_unref(msg);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return ok;
+}
+
+// What save_async() took from the rings, written on a worker thread.
+typedef struct {
+  gchar *path;
+  GList *video;
+  GList *audio;
+  GstCaps *video_caps;
+  GstCaps *audio_caps;
+  gsize bytes;
+} Snapshot;
+
+static void snapshot_free(gpointer data) {
+  Snapshot *snapshot = data;
+  g_free(snapshot->path);
+  g_list_free_full(snapshot->video, (GDestroyNotify)gst_buffer_unref);
+  g_list_free_full(snapshot->audio, (GDestroyNotify)gst_buffer_unref);
+  if (snapshot->video_caps) gst_caps_unref(snapshot->video_caps);
+  if (snapshot->audio_caps) gst_caps_unref(snapshot->audio_caps);
+  g_free(snapshot);
+}
+
+static void save_snapshot(GTask *task, gpointer source, gpointer task_data,
+                          GCancellable *cancellable) {
+  Snapshot *snapshot = task_data;
+  GError *error = NULL;
+  if (write_file(snapshot->path, snapshot->video, snapshot->video_caps, snapshot->audio,
+                 snapshot->audio_caps, &error)) {
+    g_task_return_boolean(task, TRUE);
+  } else {
+    g_task_return_error(task, error);
+  }
+}
+
+void replay_buffer_save_async(ReplayBuffer *replay, const gchar *path,
+                              GAsyncReadyCallback callback, gpointer user_data) {
+  // Snapshot under the lock; the rings keep filling while we write.
+  Snapshot *snapshot = g_new0(Snapshot, 1);
+  snapshot->path = g_strdup(path);
+  g_mutex_lock(&replay->lock);
+  snapshot->video = g_list_copy_deep(replay->video.buffers.head, (GCopyFunc)gst_buffer_ref,
+                                     NULL);
+  snapshot->audio = g_list_copy_deep(replay->audio.buffers.head, (GCopyFunc)gst_buffer_ref,
+                                     NULL);
+  if (replay->video.caps) snapshot->video_caps = gst_caps_ref(replay->video.caps);
+  if (replay->audio.caps) snapshot->audio_caps = gst_caps_ref(replay->audio.caps);
+  snapshot->bytes = replay->video.bytes + replay->audio.bytes;
+  g_mutex_unlock(&replay->lock);
+
+  GTask *task = g_task_new(NULL, NULL, callback, user_data);
+  g_task_set_task_data(task, snapshot, snapshot_free);
+  if (!snapshot->video) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                            "the replay buffer is empty");
+  } else {
+    g_task_run_in_thread(task, save_snapshot);
+  }
+  g_object_unref(task);
+}
+
+gboolean replay_buffer_save_finish(GAsyncResult *result, ReplaySaveInfo *info,
+                                   GError **error) {
+  if (!g_task_propagate_boolean(G_TASK(result), error)) return FALSE;
+  Snapshot *snapshot = g_task_get_task_data(G_TASK(result));
+  info->path = snapshot->path;
+  info->duration = buffer_time(g_list_last(snapshot->video)->data) -
+                   buffer_time(snapshot->video->data);
+  info->bytes = snapshot->bytes;
+  return TRUE;
+}
+
+static void replay_buffer_clear(gpointer data) {
+  ReplayBuffer *replay = data;
+  ring_clear(&replay->video);
+  ring_clear(&replay->audio);
+  if (replay->video.caps) gst_caps_unref(replay->video.caps);
+  if (replay->audio.caps) gst_caps_unref(replay->audio.caps);
+  g_mutex_clear(&replay->lock);
+}
+
+void replay_buffer_unref(ReplayBuffer *replay) {
+  g_rc_box_release_full(replay, replay_buffer_clear);
+}
@@ -0,0 +1,39 @@
+#ifndef REPLAY_BUFFER_H
+#define REPLAY_BUFFER_H
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <gst/gst.h>
+
+// Instant replay: keeps the last few seconds of already-encoded video and
+// audio in memory and writes them to a file only when asked. The video ring
+// always starts on a keyframe; whole GOPs are evicted from the front once the
+// ring holds more than `seconds` of video or more than `max_bytes` in total.
+typedef struct _ReplayBuffer ReplayBuffer;
+
+ReplayBuffer *replay_buffer_new(guint seconds, gsize max_bytes);
+
+// Both pads carry encoded buffers (the sink pads of the ring's fakesinks).
+// `audio` may be NULL.
+void replay_buffer_attach(ReplayBuffer *replay, GstPad *video, GstPad *audio);
+
+typedef struct {
+  const gchar *path; // valid as long as the GAsyncResult
+  GstClockTime duration; // of the video written
+  gsize bytes;
+} ReplaySaveInfo;
+
+// Takes the current contents and muxes them into a Matroska file at `path`
+// on a worker thread, so neither capture nor the caller's main loop wait for
+// the disk. `callback` runs on the calling thread's main context.
+void replay_buffer_save_async(ReplayBuffer *replay, const gchar *path,
+                              GAsyncReadyCallback callback, gpointer user_data);
+
+// FALSE with `error` set if nothing was saved, e.g. G_IO_ERROR_NOT_FOUND for
+// an empty buffer.
+gboolean replay_buffer_save_finish(GAsyncResult *result, ReplaySaveInfo *info,
+                                   GError **error);
+
+void replay_buffer_unref(ReplayBuffer *replay);
+
+#endif // !REPLAY_BUFFER_H
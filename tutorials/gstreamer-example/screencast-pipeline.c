@@ -0,0 +1,116 @@
+#include "screencast-pipeline.h"
+#include "frame-dedup.h"
+#include "screencast-portal.h"
+#include "../sound-exclusion/pulse_control.h"
+
+#define VFR_STATS_INTERVAL_SECONDS 10
+
+struct _ScreencastVfr {
+  GPtrArray *dedups; // one FrameDedup per stream
+  guint stats_id;
+};
+
+gchar *screencast_pipeline_default_monitor(void) {
+  PulseControl *pulse = pulse_control_get_default();
+  gchar *sink = pulse ? pulse_control_get_default_sink(pulse) : NULL;
+  if (!sink) return NULL;
+  gchar *monitor = g_strdup_printf("%s.monitor", sink);
+  g_free(sink);
+  return monitor;
+}
+
+GstElement *screencast_pipeline_prewarm(const EncoderConfig *encoder, const AudioConfig *audio,
+                                        const SinkConfig *sink, StartupTimeline *timeline) {
+  GError *error = NULL;
+  GstElement *pipeline = pipeline_builder_prepare(encoder, audio, sink, &error);
+  if (!pipeline) {
+    g_printerr("Pipeline Error: %s\n", error->message);
+    g_error_free(error);
+    return NULL;
+  }
+  startup_timeline_mark(timeline, "pipeline built");
+
+  if (gst_element_set_state(pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+    g_printerr("Pipeline Error: could not bring the encoder and sinks to READY\n");
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return NULL;
+  }
+  startup_timeline_mark(timeline, "pipeline READY");
+  return pipeline;
+}
+
+gboolean screencast_pipeline_attach(GstElement *pipeline, GArray *streams, guint n,
+                                    const ScreencastStreams *config,
+                                    StartupTimeline *timeline, VideoFastPath *fastpath,
+                                    GError **error) {
+  guint32 *nodes = g_new(guint32, n);
+  VideoTarget *targets = g_new(VideoTarget, n);
+  VideoFastPath *paths = g_new0(VideoFastPath, n);
+  for (guint i = 0; i < n; i++) {
+    nodes[i] = g_array_index(streams, ScreencastStream, i).node_id;
+    targets[i] = *config->target;
+    if (i > 0) targets[i].crop_width = targets[i].crop_height = 0;
+  }
+  video_fastpath_probe_all(n, nodes, targets, config->encoder->encoder->name, paths);
+  for (guint i = 0; i < n; i++) {
+    if ((i == 0 && config->resize) ||
+        g_array_index(streams, ScreencastStream, i).source_type == SCREENCAST_SOURCE_WINDOW) {
+      video_fastpath_keep_scaler(&paths[i], &targets[i]);
+    }
+  }
+  *fastpath = paths[0];
+  startup_timeline_mark(timeline, "caps probed");
+
+  gboolean ok = TRUE;
+  for (guint i = 0; ok && i < n; i++) {
+    VideoConfig video = {nodes[i], &paths[i], &targets[i], 3, i};
+    ok = (i == 0 || pipeline_builder_add_encoder(pipeline, i, config->encoder, config->sink,
+                                                 config->pad_template, error)) &&
+         pipeline_builder_attach_video(pipeline, &video, error);
+  }
+  g_free(paths);
+  g_free(targets);
+  g_free(nodes);
+  return ok;
+}
+
+static gboolean print_vfr_stats(gpointer user_data) {
+  GPtrArray *dedups = user_data;
+  for (guint i = 0; i < dedups->len; i++) frame_dedup_print_stats(dedups->pdata[i]);
+  return G_SOURCE_CONTINUE;
+}
+
+ScreencastVfr *screencast_pipeline_start_vfr(GstElement *pipeline, guint n,
+                                             guint keepalive_fps) {
+  ScreencastVfr *vfr = g_new0(ScreencastVfr, 1);
+  vfr->dedups = g_ptr_array_new_with_free_func((GDestroyNotify)frame_dedup_unref);
+  for (guint i = 0; i < n; i++) {
+    gchar *capture_name = pipeline_builder_element_name("capture", i);
+    gchar *venc_name = pipeline_builder_element_name("venc", i);
+    GstElement *capture = gst_bin_get_by_name(GST_BIN(pipeline), capture_name);
+    GstElement *venc = gst_bin_get_by_name(GST_BIN(pipeline), venc_name);
+    GstPad *raw_pad = gst_element_get_static_pad(capture, "src");
+    GstPad *encoded_pad = gst_element_get_static_pad(venc, "src");
+    FrameDedup *dedup = frame_dedup_new(keepalive_fps);
+    frame_dedup_attach(dedup, raw_pad, encoded_pad);
+    g_ptr_array_add(vfr->dedups, dedup);
+    gst_object_unref(raw_pad);
+    gst_object_unref(encoded_pad);
+    gst_object_unref(venc);
+    gst_object_unref(capture);
+    g_free(venc_name);
+    g_free(capture_name);
+  }
+  vfr->stats_id = g_timeout_add_seconds(VFR_STATS_INTERVAL_SECONDS, print_vfr_stats,
+                                        vfr->dedups);
+  g_print("VFR mode: unchanged frames are dropped, keep-alive %u fps\n", keepalive_fps);
+  return vfr;
+}
+
+void screencast_pipeline_stop_vfr(ScreencastVfr *vfr) {
+  g_source_remove(vfr->stats_id);
+  print_vfr_stats(vfr->dedups);
+  g_ptr_array_unref(vfr->dedups);
+  g_free(vfr);
+}
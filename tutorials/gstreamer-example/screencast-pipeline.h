@@ -0,0 +1,51 @@
+#ifndef SCREENCAST_PIPELINE_H
+#define SCREENCAST_PIPELINE_H
+
+#include "pipeline-builder.h"
+#include "startup-timeline.h"
+#include <glib.h>
+#include <gst/gst.h>
+
+// What screencast and screencast-webrtc do alike around the pipeline
+// builder: the audio source, the pre-warmed pipeline, the capture branches
+// of the portal streams and VFR mode.
+
+// The monitor of the default sink, read from the cached server state, or
+// NULL to leave the choice to pulsesrc.
+gchar *screencast_pipeline_default_monitor(void);
+
+// Everything up to the PipeWire node, built and brought to READY, for the
+// pre-warm thread while the portal handshake runs. Prints the problem and
+// returns NULL on failure.
+GstElement *screencast_pipeline_prewarm(const EncoderConfig *encoder, const AudioConfig *audio,
+                                        const SinkConfig *sink, StartupTimeline *timeline);
+
+typedef struct {
+  const VideoTarget *target; // of every stream; the crop is in the first one's pixels
+  gboolean resize;           // the first stream's size changes mid-stream
+  const EncoderConfig *encoder;
+  const gchar *sink;         // element the other streams' encoders link to, NULL
+                             // for fakesinks; see pipeline_builder_add_encoder()
+  const gchar *pad_template; // request pads of `sink`
+} ScreencastStreams;
+
+// Probes the first `n` of `streams` (ScreencastStream) and attaches their
+// capture branches; the first reuses the pre-warmed encoder, the others get
+// an encoder of their own. Window streams keep their scaler. `fastpath` gets
+// the first stream's plan.
+gboolean screencast_pipeline_attach(GstElement *pipeline, GArray *streams, guint n,
+                                    const ScreencastStreams *config,
+                                    StartupTimeline *timeline, VideoFastPath *fastpath,
+                                    GError **error);
+
+// VFR mode: a FrameDedup between every stream's capture and its encoder,
+// with their stats printed every few seconds.
+typedef struct _ScreencastVfr ScreencastVfr;
+
+ScreencastVfr *screencast_pipeline_start_vfr(GstElement *pipeline, guint n,
+                                             guint keepalive_fps);
+
+// Prints the final stats.
+void screencast_pipeline_stop_vfr(ScreencastVfr *vfr);
+
+#endif // !SCREENCAST_PIPELINE_H
@@ -0,0 +1,424 @@
+#include "screencast-portal.h"
+#include "../common/utils.h"
+#include <glib/gstdio.h>
+
+#define PORTAL_BUS_NAME "org.freedesktop.portal.Desktop"
+#define PORTAL_OBJECT_PATH "/org/freedesktop/portal/desktop"
+#define SCREENCAST_INTERFACE "org.freedesktop.portal.ScreenCast"
+#define REQUEST_INTERFACE "org.freedesktop.portal.Request"
+#define SESSION_INTERFACE "org.freedesktop.portal.Session"
+
+// The methods only hand out a request object; the answer comes as a signal.
+#define CALL_TIMEOUT_MS 5000
+// CreateSession shows no dialog, so a missing Response means a stuck portal.
+// SelectSources and Start wait for the user and have no timeout.
+#define SESSION_TIMEOUT_SECONDS 10
+
+struct _ScreencastPortal {
+  GDBusConnection *connection;
+  gchar *sender; // unique name as it appears in request paths
+  gchar *session_path;
+  guint pending; // tasks not yet finalized
+};
+
+// One org.freedesktop.portal.Request: the method call, then the Response
+// signal on the request object it names.
+typedef struct {
+  ScreencastPortal *portal;
+  const gchar *method;
+  gchar *path;
+  guint signal_id;
+  GSource *timeout;
+  GSource *cancel;
+  gboolean done;
+} Request;
+
+typedef struct {
+  ScreencastPortal *portal;
+  ScreencastPortalOptions options;
+  gchar *token_file; // options.token_file points here
+} Start;
+
+static void request_free(gpointer data) {
+  Request *request = data;
+  request->portal->pending--;
+  g_free(request->path);
+  g_free(request);
+}
+
+static void start_free(gpointer data) {
+  Start *start = data;
+  start->portal->pending--;
+  g_free(start->token_file);
+  g_free(start);
+}
+
+static void drop_source(GSource **source) {
+  if (!*source) return;
+  g_source_destroy(*source);
+  g_source_unref(*source);
+  *source = NULL;
+}
+
+// Everything that could complete the task again goes away first.
+static void request_complete(GTask *task, GVariant *results, GError *error) {
+  Request *request = g_task_get_task_data(task);
+  request->done = TRUE;
+  if (request->signal_id) {
+    g_dbus_connection_signal_unsubscribe(request->portal->connection, request->signal_id);
+    request->signal_id = 0;
+  }
+  drop_source(&request->timeout);
+  drop_source(&request->cancel);
+
+  if (error) {
+    g_task_return_error(task, error);
+  } else {
+    g_task_return_pointer(task, results, (GDestroyNotify)g_variant_unref);
+  }
+  g_object_unref(task); // held while the request was outstanding
+}
+
+// Dismisses the dialog, if any; fails harmlessly if the object is gone.
+static void request_close(Request *request) {
+  g_dbus_connection_call(request->portal->connection, PORTAL_BUS_NAME, request->path,
+                         REQUEST_INTERFACE, "Close", NULL, NULL, G_DBUS_CALL_FLAGS_NONE,
+                         -1, NULL, NULL, NULL);
+}
+
+static void on_response(GDBusConnection *connection, const gchar *sender,
+                        const gchar *path, const gchar *iface, const gchar *signal,
+                        GVariant *params, gpointer user_data) {
+  GTask *task = user_data;
+  Request *request = g_task_get_task_data(task);
+  guint32 code;
+  GVariant *results;
+  g_variant_get(params, "(u@a{sv})", &code, &results);
+  if (code == 0) {
+    request_complete(task, results, NULL);
+    return;
+  }
+  g_variant_unref(results);
+  if (code == 1) {
+    request_complete(task, NULL, g_error_new(G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                                             "%s was denied or cancelled",
+                                             request->method));
+  } else {
+    request_complete(task, NULL, g_error_new(G_IO_ERROR, G_IO_ERROR_FAILED,
+                                             "%s failed", request->method));
+  }
+}
+
+static void subscribe(GTask *task) {
+  Request *request = g_task_get_task_data(task);
+  request->signal_id = g_dbus_connection_signal_subscribe(
+      request->portal->connection, PORTAL_BUS_NAME, REQUEST_INTERFACE, "Response",
+      request->path, NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_response, task, NULL);
+}
+
+static gboolean on_request_timeout(gpointer user_data) {
+  GTask *task = user_data;
+  Request *request = g_task_get_task_data(task);
+  request_close(request);
+  request_complete(task, NULL, g_error_new(G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                           "%s got no response", request->method));
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_request_cancelled(GCancellable *cancellable, gpointer user_data) {
+  GTask *task = user_data;
+  request_close(g_task_get_task_data(task));
+  request_complete(task, NULL, g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                   "Operation was cancelled"));
+  return G_SOURCE_REMOVE;
+}
+
+static void on_request_called(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GTask *task = user_data;
+  Request *request = g_task_get_task_data(task);
+  GError *error = NULL;
+  GVariant *ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+
+  if (request->done) {
+    // Answered, timed out or cancelled while the call was in flight.
+  } else if (!ret) {
+    g_prefix_error(&error, "%s: ", request->method);
+    request_complete(task, NULL, error);
+    error = NULL;
+  } else {
+    // Portals before version 0.9 pick their own path; follow it.
+    const gchar *path;
+    g_variant_get(ret, "(&o)", &path);
+    if (g_strcmp0(path, request->path) != 0) {
+      g_dbus_connection_signal_unsubscribe(request->portal->connection, request->signal_id);
+      g_free(request->path);
+      request->path = g_strdup(path);
+      subscribe(task);
+    }
+  }
+  g_clear_error(&error);
+  if (ret) g_variant_unref(ret);
+  g_object_unref(task); // held by the call
+}
+
+// Starts the options of a request with its handle_token and returns the token.
+static gchar *request_options(GVariantBuilder *options) {
+  gchar *token = generate_token("tk_req");
+  g_variant_builder_init(options, G_VARIANT_TYPE("a{sv}"));
+  g_variant_builder_add(options, "{sv}", "handle_token", g_variant_new_string(token));
+  return token;
+}
+
+// Calls `method` with `parameters` and completes with the Response results
+// (a{sv}). Takes `token`.
+static void request_async(ScreencastPortal *portal, const gchar *method,
+                          GVariant *parameters, gchar *token, guint timeout_seconds,
+                          GCancellable *cancellable, GAsyncReadyCallback callback,
+                          gpointer user_data) {
+  Request *request = g_new0(Request, 1);
+  request->portal = portal;
+  request->method = method;
+  request->path = g_strdup_printf("%s/request/%s/%s", PORTAL_OBJECT_PATH, portal->sender, token);
+  g_free(token);
+  portal->pending++;
+
+  GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, request_async);
+  g_task_set_task_data(task, request, request_free);
+
+  // Subscribed before the call, so a Response sent right away is not lost.
+  subscribe(task);
+  if (timeout_seconds) {
+    request->timeout = g_timeout_source_new_seconds(timeout_seconds);
+    g_task_attach_source(task, request->timeout, on_request_timeout);
+  }
+  if (cancellable) {
+    request->cancel = g_cancellable_source_new(cancellable);
+    g_task_attach_source(task, request->cancel, (GSourceFunc)on_request_cancelled);
+  }
+
+  g_dbus_connection_call(portal->connection, PORTAL_BUS_NAME, PORTAL_OBJECT_PATH,
+                         SCREENCAST_INTERFACE, method, parameters, G_VARIANT_TYPE("(o)"),
+                         G_DBUS_CALL_FLAGS_NONE, CALL_TIMEOUT_MS, cancellable,
+                         on_request_called, g_object_ref(task));
+}
+
+static GVariant *request_finish(GAsyncResult *result, GError **error) {
+  return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+// Restore tokens are single-use, so a file is read once per session and
+// then replaced by the token Start hands out, or removed if there is none.
+static gchar *load_restore_token(const gchar *file) {
+  gchar *token = NULL;
+  if (!g_file_get_contents(file, &token, NULL, NULL)) return NULL;
+  g_strstrip(token);
+  if (*token) return token;
+  g_free(token);
+  return NULL;
+}
+
+static void save_restore_token(const gchar *file, const gchar *token) {
+  if (!token) {
+    g_unlink(file);
+    return;
+  }
+  // The token grants screen access without asking, so keep it private.
+  gchar *dir = g_path_get_dirname(file);
+  g_mkdir_with_parents(dir, 0700);
+  g_free(dir);
+  GError *error = NULL;
+  if (!g_file_set_contents_full(file, token, -1, G_FILE_SET_CONTENTS_CONSISTENT, 0600, &error)) {
+    g_printerr("Restore token not saved: %s\n", error->message);
+    g_error_free(error);
+  }
+}
+
+static GArray *parse_streams(GVariant *results) {
+  GArray *streams = g_array_new(FALSE, TRUE, sizeof(ScreencastStream));
+  GVariant *list = g_variant_lookup_value(results, "streams", G_VARIANT_TYPE("a(ua{sv})"));
+  if (!list) return streams;
+
+  GVariantIter iter;
+  guint32 node_id;
+  GVariant *props;
+  g_variant_iter_init(&iter, list);
+  while (g_variant_iter_next(&iter, "(u@a{sv})", &node_id, &props)) {
+    ScreencastStream stream = {node_id};
+    g_variant_lookup(props, "position", "(ii)", &stream.x, &stream.y);
+    g_variant_lookup(props, "size", "(ii)", &stream.width, &stream.height);
+    g_variant_lookup(props, "source_type", "u", &stream.source_type);
+    g_array_append_val(streams, stream);
+    g_variant_unref(props);
+  }
+  g_variant_unref(list);
+  return streams;
+}
+
+static void on_started(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GTask *task = user_data;
+  Start *start = g_task_get_task_data(task);
+  GError *error = NULL;
+  GVariant *results = request_finish(result, &error);
+  if (!results) {
+    g_task_return_error(task, error);
+    g_object_unref(task);
+    return;
+  }
+
+  if (start->options.token_file) {
+    const gchar *restore_token = NULL;
+    g_variant_lookup(results, "restore_token", "&s", &restore_token);
+    save_restore_token(start->options.token_file, restore_token);
+  }
+  GArray *streams = parse_streams(results);
+  g_variant_unref(results);
+  if (streams->len == 0) {
+    g_array_unref(streams);
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                            "the portal returned no streams");
+  } else {
+    g_task_return_pointer(task, streams, (GDestroyNotify)g_array_unref);
+  }
+  g_object_unref(task);
+}
+
+static void on_sources_selected(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GTask *task = user_data;
+  Start *start = g_task_get_task_data(task);
+  GError *error = NULL;
+  GVariant *results = request_finish(result, &error);
+  if (!results) {
+    g_task_return_error(task, error);
+    g_object_unref(task);
+    return;
+  }
+  g_variant_unref(results);
+  if (start->options.timeline) startup_timeline_mark(start->options.timeline, "sources selected");
+
+  g_print("Sources selected. Starting screencast...\n");
+  GVariantBuilder options;
+  gchar *token = request_options(&options);
+  request_async(start->portal, "Start",
+                g_variant_new("(osa{sv})", start->portal->session_path, "", &options),
+                token, 0, g_task_get_cancellable(task), on_started, task);
+}
+
+static void on_session_created(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GTask *task = user_data;
+  Start *start = g_task_get_task_data(task);
+  ScreencastPortal *portal = start->portal;
+  GError *error = NULL;
+  GVariant *results = request_finish(result, &error);
+  if (!results) {
+    g_task_return_error(task, error);
+    g_object_unref(task);
+    return;
+  }
+
+  // An object path since portal version 0.9, a string before.
+  GVariant *handle = g_variant_lookup_value(results, "session_handle", NULL);
+  if (handle && (g_variant_is_of_type(handle, G_VARIANT_TYPE_STRING) ||
+                 g_variant_is_of_type(handle, G_VARIANT_TYPE_OBJECT_PATH))) {
+    g_free(portal->session_path);
+    portal->session_path = g_variant_dup_string(handle, NULL);
+  }
+  if (handle) g_variant_unref(handle);
+  g_variant_unref(results);
+  if (start->options.timeline) startup_timeline_mark(start->options.timeline, "session created");
+
+  g_print("Session created: %s. Now selecting sources...\n", portal->session_path);
+  GVariantBuilder options;
+  gchar *token = request_options(&options);
+  g_variant_builder_add(&options, "{sv}", "types", g_variant_new_uint32(start->options.types));
+  g_variant_builder_add(&options, "{sv}", "cursor_mode",
+                        g_variant_new_uint32(start->options.cursor_mode));
+  g_variant_builder_add(&options, "{sv}", "multiple",
+                        g_variant_new_boolean(start->options.multiple));
+  if (start->options.token_file) {
+    g_variant_builder_add(&options, "{sv}", "persist_mode", g_variant_new_uint32(2));
+    gchar *restore_token = load_restore_token(start->options.token_file);
+    if (restore_token) {
+      g_print("Restoring the previous source selection...\n");
+      g_variant_builder_add(&options, "{sv}", "restore_token",
+                            g_variant_new_take_string(restore_token));
+    }
+  }
+  request_async(portal, "SelectSources",
+                g_variant_new("(oa{sv})", portal->session_path, &options), token, 0,
+                g_task_get_cancellable(task), on_sources_selected, task);
+}
+
+GDBusConnection *screencast_portal_connect(const gchar *address, GError **error) {
+  if (!address) return g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
+  return g_dbus_connection_new_for_address_sync(
+      address,
+      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+      NULL, NULL, error);
+}
+
+gchar *screencast_portal_token_file(const gchar *command) {
+  gchar *name = g_strconcat(command, ".restore-token", NULL);
+  gchar *file = g_build_filename(g_get_user_state_dir(), "glib-tutorials", name, NULL);
+  g_free(name);
+  return file;
+}
+
+ScreencastPortal *screencast_portal_new(GDBusConnection *connection) {
+  ScreencastPortal *portal = g_new0(ScreencastPortal, 1);
+  portal->connection = g_object_ref(connection);
+  portal->sender = sanitize_sender_name(g_dbus_connection_get_unique_name(connection));
+  return portal;
+}
+
+void screencast_portal_start_async(ScreencastPortal *portal,
+                                   const ScreencastPortalOptions *options,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback, gpointer user_data) {
+  Start *start = g_new0(Start, 1);
+  start->portal = portal;
+  start->options = *options;
+  start->options.token_file = start->token_file = g_strdup(options->token_file);
+  portal->pending++;
+
+  GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, screencast_portal_start_async);
+  g_task_set_task_data(task, start, start_free);
+
+  // Used as is by portals before 0.9, which do not return session_handle.
+  gchar *session_token = generate_token("tk_sess");
+  g_free(portal->session_path);
+  portal->session_path = g_strdup_printf("%s/session/%s/%s", PORTAL_OBJECT_PATH,
+                                         portal->sender, session_token);
+
+  g_print("Creating Session...\n");
+  GVariantBuilder opts;
+  gchar *token = request_options(&opts);
+  g_variant_builder_add(&opts, "{sv}", "session_handle_token",
+                        g_variant_new_string(session_token));
+  g_free(session_token);
+  request_async(portal, "CreateSession", g_variant_new("(a{sv})", &opts), token,
+                SESSION_TIMEOUT_SECONDS, cancellable, on_session_created, task);
+}
+
+GArray *screencast_portal_start_finish(GAsyncResult *result, GError **error) {
+  g_return_val_if_fail(g_async_result_is_tagged(result, screencast_portal_start_async), NULL);
+  return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+void screencast_portal_free(ScreencastPortal *portal) {
+  while (portal->pending) g_main_context_iteration(NULL, TRUE);
+
+  if (portal->session_path) {
+    g_dbus_connection_call(portal->connection, PORTAL_BUS_NAME, portal->session_path,
+                           SESSION_INTERFACE, "Close", NULL, NULL, G_DBUS_CALL_FLAGS_NONE,
+                           -1, NULL, NULL, NULL);
+    // The call would otherwise be dropped with the connection.
+    g_dbus_connection_flush_sync(portal->connection, NULL, NULL);
+  }
+  g_object_unref(portal->connection);
+  g_free(portal->sender);
+  g_free(portal->session_path);
+  g_free(portal);
+}
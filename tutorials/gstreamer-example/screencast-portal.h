@@ -0,0 +1,60 @@
+#ifndef SCREENCAST_PORTAL_H
+#define SCREENCAST_PORTAL_H
+
+#include "startup-timeline.h"
+#include <gio/gio.h>
+#include <glib.h>
+
+// Asynchronous client for org.freedesktop.portal.ScreenCast, shared by
+// screencast and screencast-webrtc. CreateSession, SelectSources and Start
+// are chained without blocking the main loop. Each request subscribes to its
+// Response signal before the method is called, so a fast reply cannot be
+// missed, and unsubscribes as soon as it completes, fails or is cancelled.
+typedef struct _ScreencastPortal ScreencastPortal;
+
+typedef struct {
+  guint32 node_id; // PipeWire node
+  gint x, y;       // position in the compositor space, 0 if unknown
+  gint width, height;
+  guint32 source_type; // 1 monitor, 2 window, 4 virtual
+} ScreencastStream;
+
+#define SCREENCAST_SOURCE_WINDOW 2
+
+typedef struct {
+  guint32 types;       // source types offered in the dialog
+  guint32 cursor_mode; // 1 hidden, 2 embedded, 4 metadata
+  StartupTimeline *timeline; // gets "session created" and "sources selected", may be NULL
+  // With a file, the selection is kept until revoked (persist_mode 2): the
+  // restore token saved there by the last run is passed to SelectSources,
+  // which then shows no dialog, and the new token Start returns replaces it.
+  const gchar *token_file;
+  gboolean multiple; // let the user pick several sources at once
+} ScreencastPortalOptions;
+
+// The session bus for a NULL `address`, otherwise the bus at `address`,
+// e.g. a private one running a mock portal.
+GDBusConnection *screencast_portal_connect(const gchar *address, GError **error);
+
+// $XDG_STATE_HOME/glib-tutorials/<command>.restore-token
+gchar *screencast_portal_token_file(const gchar *command);
+
+ScreencastPortal *screencast_portal_new(GDBusConnection *connection);
+
+// Creates a session, lets the user select sources and starts it. Cancelling
+// `cancellable` closes the outstanding request and ends the task with
+// G_IO_ERROR_CANCELLED; a dismissed dialog ends it with
+// G_IO_ERROR_PERMISSION_DENIED.
+void screencast_portal_start_async(ScreencastPortal *portal,
+                                   const ScreencastPortalOptions *options,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback, gpointer user_data);
+
+// The streams in portal order (ScreencastStream), or NULL with `error` set.
+GArray *screencast_portal_start_finish(GAsyncResult *result, GError **error);
+
+// Closes the session if one was created. Cancel pending starts first: this
+// runs the main context until they have wound down.
+void screencast_portal_free(ScreencastPortal *portal);
+
+#endif // !SCREENCAST_PORTAL_H
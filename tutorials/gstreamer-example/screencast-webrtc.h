@@ -1,6 +1,6 @@
 #ifndef SCREENCAST_WEBRTC_H
 #define SCREENCAST_WEBRTC_H
 
-void screencast_webrtc_tutorial(int argc, char *argv[]);
+int screencast_webrtc_tutorial(int argc, char *argv[]);
 
 #endif // !SCREENCAST_WEBRTC_H
@@ -1,31 +1,70 @@
 #include "screencast.h"
-#include "../common/utils.h"
+#include "adaptive-controller.h"
+#include "audio-latency.h"
+#include "audio-profile.h"
+#include "fast-convert-scale.h"
+#include "latency-tracer.h"
+#include "pipeline-builder.h"
+#include "pipeline-stats.h"
+#include "screencast-pipeline.h"
+#include "screencast-portal.h"
+#include "replay-buffer.h"
+#include "segment-writer.h"
+#include "startup-timeline.h"
+#include "video-encoder.h"
+#include "video-fastpath.h"
+#include "write-behind-sink.h"
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gst/gst.h>
-#include <stdio.h>
-#include <string.h>
 
-#define PORTAL_BUS_NAME "org.freedesktop.portal.Desktop"
-#define PORTAL_OBJECT_PATH "/org/freedesktop/portal/desktop"
-#define SCREENCAST_INTERFACE "org.freedesktop.portal.ScreenCast"
-#define REQUEST_INTERFACE "org.freedesktop.portal.Request"
+#define EOS_TIMEOUT_SECONDS 5
 
 typedef struct {
   GMainLoop *loop;
   GDBusConnection *connection;
-  gchar *sanitized_name;
-  gchar *session_path;
-  gchar *session_token; // Token'ı saklıyoruz
+  ScreencastPortal *portal;
+  GCancellable *cancellable; // cancels the portal handshake on exit
   gchar *output_path;
+  const VideoEncoder *encoder;
+  GstElement *pipeline;
+  guint encoder_monitor_id;
+  gboolean vfr;
+  guint keepalive_fps;
+  ScreencastVfr *dedup; // VFR mode only
+  guint replay_seconds; // 0: record everything to output_path
+  guint replay_max_mb;
+  ReplayBuffer *replay;
+  gboolean segmented;
+  SegmentConfig segments;
+  guint eos_timeout_id;
+  WriteBehindSink *writer;
+  guint writer_stats_id;
+  gboolean trace;
+  LatencyTracer *tracer;
+  AudioProfile audio;
+  AudioLatency *audio_latency;
+  PipelineStats *stats;
+  gboolean adaptive;
+  AdaptiveController *controller;
+  VideoTarget target;
+  VideoTarget chain_target; // target as built, e.g. without a rate in VFR mode
+  VideoFastPath fastpath;
+  StartupTimeline *timeline;
+  GThread *prewarm; // builds the node-independent pipeline, joined once
 } ScreencastState;
 
-static void select_sources(ScreencastState *state);
-
+static gboolean quit_loop(gpointer loop) {
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
 
 static gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data) {
-  GMainLoop *loop = (GMainLoop *)data;
+  ScreencastState *state = data;
+  GMainLoop *loop = state->loop;
+  if (state->stats) pipeline_stats_handle_message(state->stats, msg);
+  if (state->controller) adaptive_controller_handle_message(state->controller, msg);
   switch (GST_MESSAGE_TYPE(msg)) {
   case GST_MESSAGE_ERROR: {
     gchar *debug;
@@ -38,249 +77,247 @@ static gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data) {
     g_main_loop_quit(loop);
     break;
   }
+  case GST_MESSAGE_EOS:
+    // Muxers have written their index. The last segment may still be on its
+    // way to disk, and that can take longer than the drain timeout.
+    if (state->eos_timeout_id) {
+      g_source_remove(state->eos_timeout_id);
+      state->eos_timeout_id = 0;
+    }
+    segment_writer_when_synced(quit_loop, loop);
+    break;
+  case GST_MESSAGE_ELEMENT:
+    segment_writer_handle_message(msg);
+    break;
   default: break;
   }
   return TRUE;
 }
 
-static gchar *get_default_monitor_source() {
-  FILE *fp;
-  char path[1024];
-  fp = popen("pactl get-default-sink", "r");
-  if (fp == NULL) return NULL;
-  if (fgets(path, sizeof(path) - 1, fp) != NULL) {
-    path[strcspn(path, "\n")] = 0;
-    path[strcspn(path, "\r")] = 0;
-  } else {
-    pclose(fp);
-    return NULL;
-  }
-  pclose(fp);
-  return g_strdup_printf("%s.monitor", path);
-}
-
-
-static void start_stream(guint32 id, ScreencastState *state) {
-  g_print("\n>>> Starting Recording Pipeline... Node ID: %d\n", id);
-  GstElement *pipeline;
-  gst_init(NULL, NULL);
-  gchar *audio_device = get_default_monitor_source();
-  
-  char *pipeline_str = g_strdup_printf(
-      "matroskamux name=mux ! filesink location=%s "
-
-      // --- VIDEO ---
-      "pipewiresrc path=%u do-timestamp=true ! "
-      "queue max-size-buffers=3 leaky=downstream ! "
-      "videoconvert ! "
-      "videoscale ! videorate ! "
-      "video/x-raw,width=1920,height=1080,framerate=60/1 ! "
-      "nvh264enc "
-      "bitrate=10000 "          
-      "rc-mode=cbr "            
-      "preset=low-latency-hq "  
-      "tune=ultra-low-latency " 
-      "gop-size=60 "            
-      "zerolatency=true ! "     
-      "h264parse ! "
-      "queue ! mux.video_0 "
-
-      // --- AUDIO ---
-      "pulsesrc device=%s do-timestamp=true buffer-time=200000 ! "
-      "audioconvert ! "
-      "audioresample ! " 
-      "opusenc ! "
-      "queue ! mux.audio_0",
-      state->output_path, id, audio_device ? audio_device : "0");
-      
-  if (audio_device) g_free(audio_device);
-
-  GError *error = NULL;
-  pipeline = gst_parse_launch(pipeline_str, &error);
-  g_free(pipeline_str);
+static const VideoTarget video_target = {1920, 1080, 60, 1, NULL, NULL};
 
-  if (error) {
-    g_printerr("Pipeline Error: %s\n", error->message);
-    g_error_free(error);
-    g_main_loop_quit(state->loop);
-    return;
-  }
+#define WRITER_STATS_INTERVAL_SECONDS 10
 
-  GstBus *bus = gst_element_get_bus(pipeline);
-  gst_bus_add_watch(bus, bus_call, state->loop);
-  gst_object_unref(bus);
+static gboolean print_writer_stats(gpointer user_data) {
+  gchar *stats = write_behind_sink_stats(user_data);
+  g_print("%s\n", stats);
+  g_free(stats);
+  return G_SOURCE_CONTINUE;
+}
 
-  gst_element_set_state(pipeline, GST_STATE_PLAYING);
-  g_print("Recording started! Check: %s\n", state->output_path);
+// Adaptive resizing needs a scaler in the chain, and both it and native mode
+// need a muxer that takes size changes mid-stream: Matroska does for avc3
+// H.264 and VP8/VP9, MP4 does not, and the replay ring would start over on
+// every change.
+static gboolean adaptive_resize(ScreencastState *state) {
+  return state->adaptive && state->target.width > 0 && !state->replay_seconds &&
+         !(state->segmented && state->segments.format == SEGMENT_FORMAT_FMP4);
 }
 
+// The same for every stream.
+static EncoderConfig encoder_config(ScreencastState *state) {
+  return pipeline_builder_record_encoder(state->encoder,
+                                         adaptive_resize(state) || state->target.width == 0,
+                                         state->replay_seconds > 0);
+}
 
-static void on_start_response(GDBusConnection *conn, const gchar *sender, const gchar *path, const gchar *iface, const gchar *signal, GVariant *params, gpointer user_data) {
+// Everything up to the PipeWire node, built and brought to READY on its own
+// thread while the portal handshake runs. start_stream() joins it.
+static gpointer prewarm_pipeline(gpointer user_data) {
   ScreencastState *state = user_data;
-  guint32 response_code;
-  GVariant *res;
-  
-  g_variant_get(params, "(u@a{sv})", &response_code, &res);
-  if (response_code != 0) {
-    g_printerr("Start request denied/cancelled.\n");
-    g_main_loop_quit(state->loop);
-    g_variant_unref(res);
-    return;
-  }
-
-  GVariant *streams = g_variant_lookup_value(res, "streams", G_VARIANT_TYPE("a(ua{sv})"));
-  if (streams) {
-    GVariantIter iter;
-    g_variant_iter_init(&iter, streams);
-    guint32 stream_id;
-    if (g_variant_iter_next(&iter, "(u@a{sv})", &stream_id, NULL)) {
-      start_stream(stream_id, state);
+  gchar *audio_device = screencast_pipeline_default_monitor();
+
+  EncoderConfig encoder = encoder_config(state);
+  AudioConfig audio = {audio_device, &state->audio, FALSE};
+  SinkConfig sink = {NULL, "video_%u", "audio_%u", NULL};
+
+  // Replay mode keeps encoded packets in memory instead of muxing them.
+  if (!state->replay_seconds) {
+    GstElement *writer = gst_element_factory_make("writebehindsink", "writer");
+    if (state->segmented) {
+      // splitmuxsink only adds its sink once the first segment opens.
+      sink.element = gst_element_factory_make("splitmuxsink", "mux");
+      sink.video_pad = "video";
+      g_object_set(sink.element, "sink", writer, NULL);
+      segment_writer_configure(sink.element, &state->segments, state->output_path);
+    } else {
+      sink.element = gst_element_factory_make("matroskamux", "mux");
+      sink.output = writer;
+      g_object_set(writer, "location", state->output_path, NULL);
     }
-    g_variant_unref(streams);
   }
-  g_variant_unref(res);
+
+  GstElement *pipeline = screencast_pipeline_prewarm(&encoder, &audio, &sink, state->timeline);
+  g_free(audio_device);
+  return pipeline;
 }
 
-static void start_screencast(ScreencastState *state) {
-  gchar *token = generate_token("tk_start");
-  GVariantBuilder opts;
-  g_variant_builder_init(&opts, G_VARIANT_TYPE("a{sv}"));
-  g_variant_builder_add(&opts, "{sv}", "handle_token", g_variant_new_string(token));
+static void start_stream(GArray *streams, ScreencastState *state) {
+  // The replay ring holds a single video track.
+  guint n = state->replay_seconds ? 1 : streams->len;
+  g_print("\n>>> Starting Recording Pipeline... Node ID:");
+  for (guint i = 0; i < n; i++) {
+    g_print(" %u", g_array_index(streams, ScreencastStream, i).node_id);
+  }
+  g_print("\n");
+  if (n < streams->len) {
+    g_print("Replay mode records the first of %u streams only.\n", streams->len);
+  }
+  state->pipeline = g_thread_join(state->prewarm);
+  state->prewarm = NULL;
+  if (!state->pipeline) {
+    g_main_loop_quit(state->loop);
+    return;
+  }
 
-  g_print("Requesting Start...\n");
+  // In VFR mode videorate would only re-insert the frames we drop.
+  state->chain_target = state->target;
+  if (state->vfr) state->chain_target.fps_n = 0;
 
+  // The crop is in the first stream's pixels and the adaptive controller only
+  // drives the first encoder; the others are extra Matroska tracks.
+  gboolean resize = adaptive_resize(state);
+  EncoderConfig encoder = encoder_config(state);
+  ScreencastStreams config = {&state->chain_target, resize, &encoder, "mux",
+                              state->segmented ? "video_aux_%u" : "video_%u"};
   GError *error = NULL;
-  GVariant *ret = g_dbus_connection_call_sync(
-      state->connection, PORTAL_BUS_NAME, PORTAL_OBJECT_PATH, SCREENCAST_INTERFACE, "Start",
-      g_variant_new("(osa{sv})", state->session_path, "", &opts),
-      NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
-
-  if (error) {
-    g_printerr("Start Call Failed: %s\n", error->message);
+  gboolean ok = screencast_pipeline_attach(state->pipeline, streams, n, &config,
+                                           state->timeline, &state->fastpath, &error);
+  if (!ok) {
+    g_printerr("Pipeline Error: %s\n", error->message);
     g_error_free(error);
-    g_free(token);
+    g_main_loop_quit(state->loop);
     return;
   }
+  startup_timeline_mark(state->timeline, "capture attached");
 
-  gchar *req_path;
-  g_variant_get(ret, "(o)", &req_path);
-  g_variant_unref(ret);
+  GstElement *writer = NULL;
+  GstElement *mux = gst_bin_get_by_name(GST_BIN(state->pipeline), "mux");
+  if (mux && state->segmented) {
+    g_object_get(mux, "sink", &writer, NULL);
+  } else {
+    writer = gst_bin_get_by_name(GST_BIN(state->pipeline), "writer");
+  }
+  if (mux) gst_object_unref(mux);
 
-  g_dbus_connection_signal_subscribe(state->connection, PORTAL_BUS_NAME, REQUEST_INTERFACE, "Response",
-                                     req_path, NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_start_response, state, NULL);
-  g_free(req_path);
-  g_free(token);
-}
+  // Disk stalls show up here long before they reach the capture queue.
+  if (writer) {
+    state->writer = WRITE_BEHIND_SINK(writer);
+    state->writer_stats_id = g_timeout_add_seconds(WRITER_STATS_INTERVAL_SECONDS,
+                                                   print_writer_stats, state->writer);
+  }
 
-static void on_select_response(GDBusConnection *conn, const gchar *sender, const gchar *path, const gchar *iface, const gchar *signal, GVariant *params, gpointer user_data) {
-  ScreencastState *state = user_data;
-  guint32 response_code;
-  g_variant_get(params, "(u@a{sv})", &response_code, NULL);
+  GstBus *bus = gst_element_get_bus(state->pipeline);
+  gst_bus_add_watch(bus, bus_call, state);
+  gst_object_unref(bus);
 
-  if (response_code != 0) {
-    g_printerr("Source selection failed.\n");
-    g_main_loop_quit(state->loop);
-    return;
+  state->tracer = latency_tracer_new(state->pipeline);
+  state->stats = pipeline_stats_new(state->pipeline, n);
+  state->audio_latency = audio_latency_new(state->pipeline, &state->audio);
+  if (state->trace) latency_tracer_set_enabled(state->tracer, TRUE);
+  if (state->adaptive) {
+    state->controller = adaptive_controller_new(state->pipeline, state->encoder, resize);
   }
-  
-  g_print("Sources selected. Starting screencast...\n");
-  start_screencast(state);
-}
 
-static void select_sources(ScreencastState *state) {
-  gchar *token = generate_token("tk_slct");
-  GVariantBuilder opts;
-  g_variant_builder_init(&opts, G_VARIANT_TYPE("a{sv}"));
-  g_variant_builder_add(&opts, "{sv}", "handle_token", g_variant_new_string(token));
-  g_variant_builder_add(&opts, "{sv}", "types", g_variant_new_uint32(1 | 2)); // Monitor | Window
-  g_variant_builder_add(&opts, "{sv}", "cursor_mode", g_variant_new_uint32(2)); // Embedded
+  GstElement *venc = gst_bin_get_by_name(GST_BIN(state->pipeline), "venc");
+  state->encoder_monitor_id = video_encoder_monitor(state->encoder, venc);
 
-  g_print("Requesting Source Selection...\n");
+  gst_object_unref(venc);
 
-  GError *error = NULL;
-  GVariant *ret = g_dbus_connection_call_sync(
-      state->connection, PORTAL_BUS_NAME, PORTAL_OBJECT_PATH, SCREENCAST_INTERFACE, "SelectSources",
-      g_variant_new("(oa{sv})", state->session_path, &opts),
-      NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
-
-  if (error) {
-    g_printerr("SelectSources Call Failed: %s\n", error->message);
-    g_error_free(error);
-    g_free(token);
-    return;
+  if (state->vfr) {
+    state->dedup = screencast_pipeline_start_vfr(state->pipeline, n, state->keepalive_fps);
   }
 
-  gchar *req_path;
-  g_variant_get(ret, "(o)", &req_path);
-  g_variant_unref(ret);
-
-  g_print("Portal assigned Select path: %s\n", req_path);
+  if (state->replay_seconds) {
+    GstElement *video_ring = gst_bin_get_by_name(GST_BIN(state->pipeline), "video_ring");
+    GstElement *audio_ring = gst_bin_get_by_name(GST_BIN(state->pipeline), "audio_ring");
+    GstPad *video_pad = gst_element_get_static_pad(video_ring, "sink");
+    GstPad *audio_pad = gst_element_get_static_pad(audio_ring, "sink");
+    state->replay = replay_buffer_new(state->replay_seconds,
+                                      (gsize)state->replay_max_mb * 1024 * 1024);
+    replay_buffer_attach(state->replay, video_pad, audio_pad);
+    gst_object_unref(video_pad);
+    gst_object_unref(audio_pad);
+    gst_object_unref(video_ring);
+    gst_object_unref(audio_ring);
+  }
 
-  g_dbus_connection_signal_subscribe(state->connection, PORTAL_BUS_NAME, REQUEST_INTERFACE, "Response",
-                                     req_path, NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_select_response, state, NULL);
-  g_free(req_path);
-  g_free(token);
+  pipeline_builder_on_first_buffer(state->pipeline, state->timeline, &state->fastpath);
+  gst_element_set_state(state->pipeline, GST_STATE_PLAYING);
+  startup_timeline_mark(state->timeline, "PLAYING");
+  if (state->replay) {
+    g_print("Replay buffer started: last %u s, at most %u MiB. Type 'save' to write it.\n",
+            state->replay_seconds, state->replay_max_mb);
+  } else if (!state->segmented) {
+    g_print("Recording started! Check: %s\n", state->output_path);
+  }
 }
 
-static void on_create_session_response(GDBusConnection *conn, const gchar *sender, const gchar *path, const gchar *iface, const gchar *signal, GVariant *params, gpointer user_data) {
+static gboolean on_eos_timeout(gpointer user_data) {
   ScreencastState *state = user_data;
-  guint32 response_code;
-  GVariant *results;
-  g_variant_get(params, "(u@a{sv})", &response_code, &results);
+  g_printerr("Pipeline did not drain in %d s, stopping anyway.\n", EOS_TIMEOUT_SECONDS);
+  state->eos_timeout_id = 0;
+  g_main_loop_quit(state->loop);
+  return G_SOURCE_REMOVE;
+}
 
-  if (response_code != 0) {
-    g_printerr("CreateSession Failed.\n");
+// Lets the muxer finish its index instead of cutting the file off.
+static void stop_recording(ScreencastState *state) {
+  if (!state->pipeline) {
     g_main_loop_quit(state->loop);
     return;
   }
+  if (state->eos_timeout_id) return;
+  gst_element_send_event(state->pipeline, gst_event_new_eos());
+  state->eos_timeout_id = g_timeout_add_seconds(EOS_TIMEOUT_SECONDS, on_eos_timeout, state);
+}
 
-  gchar *remote_handle = NULL;
-  if (g_variant_lookup(results, "session_handle", "s", &remote_handle)) {
-      g_free(state->session_path);
-      state->session_path = g_strdup(remote_handle);
-      g_free(remote_handle);
+static void on_replay_saved(GObject *source, GAsyncResult *result, gpointer user_data) {
+  ReplaySaveInfo info;
+  GError *error = NULL;
+  if (replay_buffer_save_finish(result, &info, &error)) {
+    g_print("Saved %.1f s of replay (%.1f MiB) to %s\n", (gdouble)info.duration / GST_SECOND,
+            info.bytes / (1024.0 * 1024.0), info.path);
+  } else {
+    g_printerr("Replay save failed: %s\n", error->message);
+    g_error_free(error);
   }
-  g_variant_unref(results);
-
-  g_print("Session created: %s. Now selecting sources...\n", state->session_path);
-  select_sources(state); // ZİNCİRLEME GEÇİŞ
 }
 
-static void create_session(ScreencastState *state) {
-  state->session_token = generate_token("tk_sess");
-  const gchar *unique = g_dbus_connection_get_unique_name(state->connection);
-  state->sanitized_name = sanitize_sender_name(unique);
-  state->session_path = g_strdup_printf("%s/session/%s/%s", PORTAL_OBJECT_PATH, state->sanitized_name, state->session_token);
-
-  gchar *token = generate_token("tk_crt");
-  GVariantBuilder opts;
-  g_variant_builder_init(&opts, G_VARIANT_TYPE("a{sv}"));
-  g_variant_builder_add(&opts, "{sv}", "handle_token", g_variant_new_string(token));
-  g_variant_builder_add(&opts, "{sv}", "session_handle_token", g_variant_new_string(state->session_token));
-
-  g_print("Creating Session...\n");
+// replay-YYYYMMDD-HHMMSS.mkv next to the regular output file, written in the
+// background.
+static void save_replay(ScreencastState *state) {
+  if (!state->replay) {
+    g_printerr("Replay mode is off, start with --replay SECONDS.\n");
+    return;
+  }
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *name = g_date_time_format(now, "replay-%Y%m%d-%H%M%S.mkv");
+  gchar *dir = g_path_get_dirname(state->output_path);
+  gchar *path = g_build_filename(dir, name, NULL);
+  replay_buffer_save_async(state->replay, path, on_replay_saved, NULL);
+  g_free(path);
+  g_free(dir);
+  g_free(name);
+  g_date_time_unref(now);
+}
 
+static void on_portal_started(GObject *source, GAsyncResult *result, gpointer user_data) {
+  ScreencastState *state = user_data;
   GError *error = NULL;
-  GVariant *ret = g_dbus_connection_call_sync(
-      state->connection, PORTAL_BUS_NAME, PORTAL_OBJECT_PATH, SCREENCAST_INTERFACE, "CreateSession",
-      g_variant_new("(a{sv})", &opts),
-      NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
-
-  if (error) {
-    g_printerr("CreateSession Call Failed: %s\n", error->message);
+  GArray *streams = screencast_portal_start_finish(result, &error);
+  if (!streams) {
+    // Cancelled only on the way out, when the loop has already stopped.
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_printerr("Portal Error: %s\n", error->message);
+      g_main_loop_quit(state->loop);
+    }
     g_error_free(error);
-    g_free(token);
     return;
   }
-
-  gchar *req_path;
-  g_variant_get(ret, "(o)", &req_path);
-  g_variant_unref(ret);
-
-  g_dbus_connection_signal_subscribe(state->connection, PORTAL_BUS_NAME, REQUEST_INTERFACE, "Response",
-                                     req_path, NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_create_session_response, state, NULL);
-  g_free(req_path);
-  g_free(token);
+  startup_timeline_mark(state->timeline, "Start response");
+  start_stream(streams, state);
+  g_array_unref(streams);
 }
 
 // --- Main ---
@@ -289,20 +326,101 @@ static gboolean on_stdin_input(GIOChannel *channel, GIOCondition condition, gpoi
   ScreencastState *state = user_data;
   gchar *input = NULL;
   if (g_io_channel_read_line(channel, &input, NULL, NULL, NULL) == G_IO_STATUS_NORMAL) {
-    if (g_strcmp0(g_strchomp(input), "exit") == 0) {
-      g_main_loop_quit(state->loop);
+    g_strchomp(input);
+    if (g_strcmp0(input, "exit") == 0) {
+      stop_recording(state);
+    } else if (g_strcmp0(input, "save") == 0) {
+      save_replay(state);
+    } else if (g_strcmp0(input, "stats") == 0 && state->stats) {
+      gchar *json = pipeline_stats_to_json(state->stats);
+      g_print("%s\n", json);
+      g_free(json);
+    } else if (state->tracer) {
+      latency_tracer_command(state->tracer, input);
     }
     g_free(input);
   }
   return TRUE;
 }
 
+// Also after a failed start: whatever was not set up yet is skipped.
+static void screencast_state_free(ScreencastState *state) {
+  if (state->cancellable) g_cancellable_cancel(state->cancellable);
+  if (state->prewarm) {
+    GstElement *unused = g_thread_join(state->prewarm);
+    if (unused) {
+      gst_element_set_state(unused, GST_STATE_NULL);
+      gst_object_unref(unused);
+    }
+  }
+  if (state->eos_timeout_id) g_source_remove(state->eos_timeout_id);
+  if (state->encoder_monitor_id) g_source_remove(state->encoder_monitor_id);
+  if (state->writer) {
+      g_source_remove(state->writer_stats_id);
+      print_writer_stats(state->writer);
+  }
+  if (state->tracer) latency_tracer_free(state->tracer);
+  audio_latency_free(state->audio_latency);
+  if (state->pipeline) {
+      gst_element_set_state(state->pipeline, GST_STATE_NULL);
+      gst_object_unref(state->pipeline);
+  }
+  if (state->stats) pipeline_stats_free(state->stats);
+  if (state->controller) adaptive_controller_free(state->controller);
+  if (state->dedup) screencast_pipeline_stop_vfr(state->dedup);
+  if (state->writer) gst_object_unref(state->writer);
+  if (state->replay) replay_buffer_unref(state->replay);
+  if (state->portal) screencast_portal_free(state->portal);
+  if (state->cancellable) g_object_unref(state->cancellable);
+  if (state->connection) g_object_unref(state->connection);
+  if (state->loop) g_main_loop_unref(state->loop);
+  g_free(state->output_path);
+  if (state->timeline) startup_timeline_free(state->timeline);
+  g_free(state);
+}
+
 static gchar *output_file = NULL;
+static gchar *encoder_name = NULL;
+static gboolean vfr = FALSE;
+static gint keepalive_fps = 1;
+static gint replay_seconds = 0;
+static gint replay_max_mb = 512;
+static gint segment_time = 0;
+static gint segment_size = 0;
+static gchar *segment_format = NULL;
+static gboolean trace = FALSE;
+static gboolean adaptive = FALSE;
+static gchar *resolution = NULL;
+static gchar *crop = NULL;
+static gchar *dbus_address = NULL;
+static gboolean no_persist = FALSE;
+static gchar *audio_profile = NULL;
+static gchar *audio_frame = NULL;
+static gchar *audio_type = NULL;
+static gboolean dtx = FALSE;
 static GOptionEntry entries[] = {
     {"output", 'o', 0, G_OPTION_ARG_STRING, &output_file, "Output file path", "FILE"},
+    {"encoder", 'e', 0, G_OPTION_ARG_STRING, &encoder_name, "Video encoder (auto, nvh264enc, vah264enc, x264enc, openh264enc, vp8enc, vp9enc)", "NAME"},
+    {"vfr", 0, 0, G_OPTION_ARG_NONE, &vfr, "Variable frame rate: drop frames whose content did not change", NULL},
+    {"keepalive-fps", 0, 0, G_OPTION_ARG_INT, &keepalive_fps, "Minimum frame rate in --vfr mode (default 1)", "FPS"},
+    {"replay", 0, 0, G_OPTION_ARG_INT, &replay_seconds, "Keep only the last SECONDS in memory; 'save' writes them to disk", "SECONDS"},
+    {"replay-max-mb", 0, 0, G_OPTION_ARG_INT, &replay_max_mb, "Memory cap of the replay buffer (default 512)", "MB"},
+    {"segment-time", 0, 0, G_OPTION_ARG_INT, &segment_time, "Start a new file every SECONDS, cut on a keyframe", "SECONDS"},
+    {"segment-size", 0, 0, G_OPTION_ARG_INT, &segment_size, "Start a new file every MB megabytes, cut on a keyframe", "MB"},
+    {"segment-format", 0, 0, G_OPTION_ARG_STRING, &segment_format, "Segment container: mkv (default) or fmp4", "FORMAT"},
+    {"trace", 0, 0, G_OPTION_ARG_NONE, &trace, "Print per-element latency from the start ('trace on/off' toggles it)", NULL},
+    {"adaptive", 0, 0, G_OPTION_ARG_NONE, &adaptive, "Lower bitrate, frame rate and size under sustained overload, raise them again once it clears", NULL},
+    {"resolution", 0, 0, G_OPTION_ARG_STRING, &resolution, "Output size: native (follows the stream) or WxH (default 1920x1080)", "SIZE"},
+    {"crop", 0, 0, G_OPTION_ARG_STRING, &crop, "Record only this region of the stream, before any conversion", "X,Y,W,H"},
+    {"dbus-address", 0, 0, G_OPTION_ARG_STRING, &dbus_address, "Talk to the portal on this bus instead of the session bus (see mock-portal)", "ADDRESS"},
+    {"no-persist", 0, 0, G_OPTION_ARG_NONE, &no_persist, "Always show the source dialog; do not keep the selection for the next run", NULL},
+    {"audio-profile", 0, 0, G_OPTION_ARG_STRING, &audio_profile, "Audio capture and Opus settings: default (200 ms buffer, 20 ms frames) or low-latency (20 ms buffer, 10 ms frames)", "PROFILE"},
+    {"audio-frame", 0, 0, G_OPTION_ARG_STRING, &audio_frame, "Opus frame length, overriding the profile: 2.5, 5, 10, 20, 40 or 60", "MS"},
+    {"audio-type", 0, 0, G_OPTION_ARG_STRING, &audio_type, "Opus tuning, overriding the profile: generic, voice or restricted-lowdelay", "TYPE"},
+    {"dtx", 0, 0, G_OPTION_ARG_NONE, &dtx, "Send almost nothing while the audio is silent", NULL},
     {NULL}};
 
-void screencast_tutorial(int argc, char *argv[]) {
+int screencast_tutorial(int argc, char *argv[]) {
   ScreencastState *state = g_new0(ScreencastState, 1);
   GError *error = NULL;
 
@@ -313,9 +431,61 @@ void screencast_tutorial(int argc, char *argv[]) {
 
   state->output_path = output_file ? g_strdup(output_file) : g_build_filename(g_get_current_dir(), "capture.mkv", NULL);
   if (output_file) g_free(output_file);
+  state->vfr = vfr;
+  state->keepalive_fps = MAX(keepalive_fps, 1);
+  state->replay_seconds = MAX(replay_seconds, 0);
+  state->replay_max_mb = MAX(replay_max_mb, 1);
+  state->trace = trace;
+  state->adaptive = adaptive;
+  state->segments.max_time = (guint64)MAX(segment_time, 0) * GST_SECOND;
+  state->segments.max_bytes = (guint64)MAX(segment_size, 0) * 1024 * 1024;
+  gboolean format_ok = !segment_format ||
+                       segment_format_parse(segment_format, &state->segments.format);
+  g_free(segment_format);
+  state->target = video_target;
+  format_ok = video_target_parse(resolution, crop, &state->target) && format_ok;
+  g_free(resolution);
+  g_free(crop);
+  format_ok = audio_profile_parse(audio_profile, audio_frame, audio_type, dtx, &state->audio) &&
+              format_ok;
+  g_free(audio_profile);
+  g_free(audio_frame);
+  g_free(audio_type);
+  state->segmented = state->segments.max_time || state->segments.max_bytes ||
+                     state->segments.format == SEGMENT_FORMAT_FMP4;
+  // See adaptive_resize(): MP4 cannot take the size changes of native mode.
+  if (format_ok && state->target.width == 0 &&
+      state->segments.format == SEGMENT_FORMAT_FMP4) {
+    g_printerr("--resolution native needs Matroska segments, not --segment-format fmp4\n");
+    format_ok = FALSE;
+  }
+  if (!format_ok) {
+    screencast_state_free(state);
+    return 1;
+  }
 
-  state->connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
-  if (error) { g_printerr("DBus Error: %s\n", error->message); return; }
+  state->timeline = startup_timeline_new();
+  gst_init(NULL, NULL);
+  fast_convert_scale_register();
+  write_behind_sink_register();
+  startup_timeline_mark(state->timeline, "GStreamer initialized");
+  state->encoder = video_encoder_select(encoder_name);
+  g_free(encoder_name);
+  if (!state->encoder) {
+    screencast_state_free(state);
+    return 1;
+  }
+  startup_timeline_mark(state->timeline, "encoder selected");
+  g_print("Video encoder: %s\n", state->encoder->name);
+
+  state->connection = screencast_portal_connect(dbus_address, &error);
+  g_free(dbus_address);
+  if (error) {
+    g_printerr("DBus Error: %s\n", error->message);
+    g_error_free(error);
+    screencast_state_free(state);
+    return 1;
+  }
 
   state->loop = g_main_loop_new(NULL, FALSE);
 
@@ -324,22 +494,23 @@ void screencast_tutorial(int argc, char *argv[]) {
   g_io_add_watch(stdin_ch, G_IO_IN, on_stdin_input, state);
   g_io_channel_unref(stdin_ch);
 
-  // BAŞLAT
-  create_session(state);
+  // The encoder, audio source and muxer open while the user picks a screen.
+  state->prewarm = g_thread_new("prewarm", prewarm_pipeline, state);
 
-  g_print("Running... Type 'exit' to stop.\n");
+  // BAŞLAT
+  state->portal = screencast_portal_new(state->connection);
+  state->cancellable = g_cancellable_new();
+  gchar *token_file = no_persist ? NULL : screencast_portal_token_file("screencast");
+  // Monitor | Window, embedded cursor; every selected source is recorded.
+  ScreencastPortalOptions portal_options = {1 | 2, 2, state->timeline, token_file, TRUE};
+  screencast_portal_start_async(state->portal, &portal_options, state->cancellable,
+                                on_portal_started, state);
+  g_free(token_file);
+
+  g_print("Running... Type 'exit' to stop%s.\n",
+          state->replay_seconds ? ", 'save' to write the replay buffer" : "");
   g_main_loop_run(state->loop);
 
-  // Temizlik
-  if (state->session_path) {
-      g_dbus_connection_call(state->connection, PORTAL_BUS_NAME, state->session_path,
-                             "org.freedesktop.portal.Session", "Close", NULL, NULL,
-                             G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
-  }
-  g_object_unref(state->connection);
-  g_main_loop_unref(state->loop);
-  g_free(state->sanitized_name);
-  g_free(state->session_path);
-  g_free(state->output_path);
-  g_free(state);
+  screencast_state_free(state);
+  return 0;
 }
\ No newline at end of file
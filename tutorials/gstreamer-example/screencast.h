@@ -1,6 +1,6 @@
 #ifndef SCREENCAST_H
 #define SCREENCAST_H
 
-void screencast_tutorial(int argc, char *argv[]);
+int screencast_tutorial(int argc, char *argv[]);
 
 #endif // !SCREENCAST_H
@@ -0,0 +1,139 @@
+// O_DIRECTORY is not visible under -std=c23 otherwise.
+#define _GNU_SOURCE
+
+#include "segment-writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// fMP4 fragment length; a crash loses at most this much of a segment.
+#define FRAGMENT_DURATION_MS 1000
+
+// Main context only.
+static guint pending; // segments being flushed
+static GSourceFunc synced_callback;
+static gpointer synced_data;
+
+gboolean segment_format_parse(const gchar *name, SegmentFormat *format) {
+  if (g_strcmp0(name, "mkv") == 0) {
+    *format = SEGMENT_FORMAT_MKV;
+  } else if (g_strcmp0(name, "fmp4") == 0) {
+    *format = SEGMENT_FORMAT_FMP4;
+  } else {
+    g_printerr("Unknown segment format '%s' (expected mkv or fmp4)\n", name);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void segment_writer_configure(GstElement *splitmuxsink,
+                              const SegmentConfig *config,
+                              const gchar *output_path) {
+  gboolean fmp4 = config->format == SEGMENT_FORMAT_FMP4;
+
+  gchar *stem = g_strdup(output_path);
+  gchar *dot = strrchr(stem, '.');
+  if (dot && !strchr(dot, G_DIR_SEPARATOR)) *dot = '\0';
+  gchar *location = g_strdup_printf("%s-%%05d.%s", stem, fmp4 ? "mp4" : "mkv");
+
+  g_object_set(splitmuxsink, "location", location, "max-size-time",
+               config->max_time, "max-size-bytes", config->max_bytes,
+               "muxer-factory", fmp4 ? "mp4mux" : "matroskamux", NULL);
+
+  // Keyframe requests only work for time-based splits.
+  if (config->max_time && !config->max_bytes) {
+    g_object_set(splitmuxsink, "send-keyframe-requests", TRUE, NULL);
+  }
+
+  if (fmp4) {
+    GstStructure *props = gst_structure_new(
+        "properties", "fragment-duration", G_TYPE_UINT, FRAGMENT_DURATION_MS, NULL);
+    g_object_set(splitmuxsink, "muxer-properties", props, NULL);
+    gst_structure_free(props);
+  }
+
+  g_print("Segmented output: %s", location);
+  if (config->max_time) {
+    g_print(", %" G_GUINT64_FORMAT " s", config->max_time / GST_SECOND);
+  }
+  if (config->max_bytes) {
+    g_print(", %" G_GUINT64_FORMAT " MiB", config->max_bytes / (1024 * 1024));
+  }
+  g_print(" per segment\n");
+
+  g_free(location);
+  g_free(stem);
+}
+
+static gboolean sync_path(const gchar *path, int flags, GError **error) {
+  int fd = g_open(path, flags, 0);
+  if (fd < 0 || fsync(fd) != 0) {
+    int saved_errno = errno;
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno), "%s: %s",
+                path, g_strerror(saved_errno));
+    if (fd >= 0) close(fd);
+    return FALSE;
+  }
+  close(fd);
+  return TRUE;
+}
+
+static void sync_segment(GTask *task, gpointer source, gpointer task_data,
+                         GCancellable *cancellable) {
+  const gchar *location = task_data;
+  GError *error = NULL;
+  // The directory entry has to be durable too, or the file may vanish.
+  gchar *dir = g_path_get_dirname(location);
+  if (sync_path(location, O_RDONLY, &error) &&
+      sync_path(dir, O_RDONLY | O_DIRECTORY, &error)) {
+    g_task_return_boolean(task, TRUE);
+  } else {
+    g_task_return_error(task, error);
+  }
+  g_free(dir);
+}
+
+static void on_segment_synced(GObject *source, GAsyncResult *result,
+                              gpointer user_data) {
+  GError *error = NULL;
+  if (g_task_propagate_boolean(G_TASK(result), &error)) {
+    g_print("Segment finalized: %s\n",
+            (const gchar *)g_task_get_task_data(G_TASK(result)));
+  } else {
+    g_printerr("Segment fsync failed: %s\n", error->message);
+    g_error_free(error);
+  }
+  if (--pending == 0 && synced_callback) {
+    GSourceFunc callback = synced_callback;
+    synced_callback = NULL;
+    callback(synced_data);
+  }
+}
+
+gboolean segment_writer_handle_message(GstMessage *msg) {
+  if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_ELEMENT) return FALSE;
+  const GstStructure *s = gst_message_get_structure(msg);
+  if (!gst_structure_has_name(s, "splitmuxsink-fragment-closed")) return FALSE;
+
+  const gchar *location = gst_structure_get_string(s, "location");
+  if (!location) return TRUE;
+
+  GTask *task = g_task_new(NULL, NULL, on_segment_synced, NULL);
+  g_task_set_task_data(task, g_strdup(location), g_free);
+  pending++;
+  g_task_run_in_thread(task, sync_segment);
+  g_object_unref(task);
+  return TRUE;
+}
+
+void segment_writer_when_synced(GSourceFunc callback, gpointer user_data) {
+  if (pending == 0) {
+    callback(user_data);
+    return;
+  }
+  synced_callback = callback;
+  synced_data = user_data;
+}
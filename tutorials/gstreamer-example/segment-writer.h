@@ -0,0 +1,39 @@
+#ifndef SEGMENT_WRITER_H
+#define SEGMENT_WRITER_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+// Segmented recording through splitmuxsink. Segments are cut on keyframes,
+// each one gets its own muxer (so only one segment of index is ever held in
+// memory) and is fsync'd as soon as it is closed.
+typedef enum {
+  SEGMENT_FORMAT_MKV,
+  SEGMENT_FORMAT_FMP4,
+} SegmentFormat;
+
+typedef struct {
+  guint64 max_time;  // nanoseconds, 0 for no limit
+  guint64 max_bytes; // 0 for no limit
+  SegmentFormat format;
+} SegmentConfig;
+
+// "mkv" or "fmp4"
+gboolean segment_format_parse(const gchar *name, SegmentFormat *format);
+
+// Sets location, limits and muxer on a splitmuxsink. `output_path` is the
+// single-file name; segments are written as "<stem>-00000.<ext>" next to it.
+void segment_writer_configure(GstElement *splitmuxsink,
+                              const SegmentConfig *config,
+                              const gchar *output_path);
+
+// Call for every bus message. Returns TRUE if `msg` was a closed segment,
+// which is then flushed to disk on a worker thread.
+gboolean segment_writer_handle_message(GstMessage *msg);
+
+// Calls `callback` once every closed segment is on disk, right away if none
+// is still being flushed. Only the last call before that point is kept.
+// Call on the main context, like segment_writer_handle_message().
+void segment_writer_when_synced(GSourceFunc callback, gpointer user_data);
+
+#endif // !SEGMENT_WRITER_H
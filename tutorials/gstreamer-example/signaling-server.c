@@ -0,0 +1,311 @@
+#include "signaling-server.h"
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+
+#define PAGE_RESOURCE "/glib-tutorials/screen_webrtc.html"
+
+struct _SignalingServer {
+  SoupServer *soup;
+  GBytes *page;
+  SignalingCallbacks callbacks;
+  gpointer data;
+  gchar *url;
+  GList *peers; // SignalingPeer, one reference each
+};
+
+struct _SignalingPeer {
+  SignalingServer *server; // NULL once the WebSocket closed
+  SoupWebsocketConnection *connection;
+  GMainContext *context;
+  gchar *name;
+  gboolean joined;
+  // Monotonic times in us, 0 until they happen; main context only.
+  gint64 offer_time;
+  gint64 answer_time;
+  gint64 connected_time;
+};
+
+typedef struct {
+  SignalingPeer *peer;
+  gchar *text;
+  gboolean offer;
+  gboolean close;
+} Outgoing;
+
+static void peer_clear(gpointer data) {
+  SignalingPeer *peer = data;
+  g_object_unref(peer->connection);
+  g_main_context_unref(peer->context);
+  g_free(peer->name);
+}
+
+SignalingPeer *signaling_peer_ref(SignalingPeer *peer) {
+  return g_rc_box_acquire(peer);
+}
+
+void signaling_peer_unref(SignalingPeer *peer) {
+  g_rc_box_release_full(peer, peer_clear);
+}
+
+const gchar *signaling_peer_get_name(SignalingPeer *peer) {
+  return peer->name;
+}
+
+static gboolean is_open(SignalingPeer *peer) {
+  return soup_websocket_connection_get_state(peer->connection) == SOUP_WEBSOCKET_STATE_OPEN;
+}
+
+static gboolean send_now(gpointer user_data) {
+  Outgoing *out = user_data;
+  if (is_open(out->peer)) {
+    if (out->offer) out->peer->offer_time = g_get_monotonic_time();
+    if (out->text) soup_websocket_connection_send_text(out->peer->connection, out->text);
+    if (out->close) {
+      soup_websocket_connection_close(out->peer->connection, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    }
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static void outgoing_free(gpointer data) {
+  Outgoing *out = data;
+  signaling_peer_unref(out->peer);
+  g_free(out->text);
+  g_free(out);
+}
+
+// Right away on the main context, queued behind the earlier messages from
+// any other thread.
+static void send_on_context(SignalingPeer *peer, gchar *text, gboolean offer, gboolean close) {
+  Outgoing *out = g_new0(Outgoing, 1);
+  out->peer = signaling_peer_ref(peer);
+  out->text = text;
+  out->offer = offer;
+  out->close = close;
+  g_main_context_invoke_full(peer->context, G_PRIORITY_DEFAULT, send_now, out, outgoing_free);
+}
+
+void signaling_peer_send(SignalingPeer *peer, const SignalingMessage *message) {
+  send_on_context(peer, signaling_message_to_json(message),
+                  g_strcmp0(message->type, "offer") == 0, FALSE);
+}
+
+void signaling_peer_close(SignalingPeer *peer, const gchar *reason) {
+  SignalingMessage message = {"error", NULL, 0, NULL, (gchar *)reason};
+  send_on_context(peer, reason ? signaling_message_to_json(&message) : NULL, FALSE, TRUE);
+}
+
+static gdouble ms_after_offer(SignalingPeer *peer, gint64 time) {
+  return time && peer->offer_time ? (time - peer->offer_time) / 1000.0 : -1;
+}
+
+static void on_first_frame(SignalingServer *server, SignalingPeer *peer) {
+  gdouble offer_ms = ms_after_offer(peer, g_get_monotonic_time());
+  g_print("[signaling] %s: after the offer, answer %.1f ms, connected %.1f ms, "
+          "first frame %.1f ms\n",
+          peer->name, ms_after_offer(peer, peer->answer_time),
+          ms_after_offer(peer, peer->connected_time), offer_ms);
+  if (server->callbacks.first_frame) server->callbacks.first_frame(peer, offer_ms, server->data);
+}
+
+static void on_message(SoupWebsocketConnection *connection, gint type, GBytes *bytes,
+                       gpointer user_data) {
+  SignalingPeer *peer = user_data;
+  SignalingServer *server = peer->server;
+  if (!server || !peer->joined || type != SOUP_WEBSOCKET_DATA_TEXT) return;
+
+  gsize size;
+  const gchar *text = g_bytes_get_data(bytes, &size);
+  SignalingMessage message;
+  if (!signaling_message_parse(text, size, &message)) {
+    g_printerr("[signaling] %s: ignoring a message that is not JSON\n", peer->name);
+    return;
+  }
+  const SignalingCallbacks *callbacks = &server->callbacks;
+  if (g_strcmp0(message.type, "answer") == 0 && message.sdp) {
+    peer->answer_time = g_get_monotonic_time();
+    if (callbacks->answer) callbacks->answer(peer, message.sdp, server->data);
+  } else if (g_strcmp0(message.type, "candidate") == 0 && message.candidate) {
+    if (callbacks->candidate) {
+      callbacks->candidate(peer, message.mline, message.candidate, server->data);
+    }
+  } else if (g_strcmp0(message.type, "connected") == 0) {
+    if (!peer->connected_time) peer->connected_time = g_get_monotonic_time();
+  } else if (g_strcmp0(message.type, "first-frame") == 0) {
+    on_first_frame(server, peer);
+  } else {
+    g_printerr("[signaling] %s: unknown message \"%s\"\n", peer->name, message.type);
+  }
+  signaling_message_clear(&message);
+}
+
+static void on_closed(SoupWebsocketConnection *connection, gpointer user_data) {
+  SignalingPeer *peer = user_data;
+  SignalingServer *server = peer->server;
+  if (!server) return;
+  peer->server = NULL;
+  server->peers = g_list_remove(server->peers, peer);
+  if (peer->joined) {
+    g_print("[signaling] %s left\n", peer->name);
+    if (server->callbacks.left) server->callbacks.left(peer, server->data);
+  }
+  signaling_peer_unref(peer);
+}
+
+static void on_websocket(SoupServer *soup, SoupServerMessage *msg, const char *path,
+                         SoupWebsocketConnection *connection, gpointer user_data) {
+  SignalingServer *server = user_data;
+  SignalingPeer *peer = g_rc_box_new0(SignalingPeer);
+  peer->server = server;
+  peer->connection = g_object_ref(connection);
+  peer->context = g_main_context_ref_thread_default();
+  GSocketAddress *remote = soup_server_message_get_remote_address(msg);
+  peer->name = remote ? g_socket_connectable_to_string(G_SOCKET_CONNECTABLE(remote))
+                      : g_strdup("viewer");
+  server->peers = g_list_prepend(server->peers, peer);
+  g_signal_connect(connection, "message", G_CALLBACK(on_message), peer);
+  g_signal_connect(connection, "closed", G_CALLBACK(on_closed), peer);
+
+  g_print("[signaling] %s connected\n", peer->name);
+  peer->joined = !server->callbacks.joined || server->callbacks.joined(peer, server->data);
+  if (!peer->joined && is_open(peer)) {
+    soup_websocket_connection_close(connection, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+  }
+}
+
+static void on_page(SoupServer *soup, SoupServerMessage *msg, const char *path,
+                    GHashTable *query, gpointer user_data) {
+  SignalingServer *server = user_data;
+  if (g_strcmp0(soup_server_message_get_method(msg), SOUP_METHOD_GET) != 0) {
+    soup_server_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+    return;
+  }
+  if (g_strcmp0(path, "/") != 0 && g_strcmp0(path, "/index.html") != 0) {
+    soup_server_message_set_status(msg, SOUP_STATUS_NOT_FOUND, NULL);
+    return;
+  }
+  gsize size;
+  const gchar *page = g_bytes_get_data(server->page, &size);
+  soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+  soup_server_message_set_response(msg, "text/html; charset=utf-8", SOUP_MEMORY_STATIC, page,
+                                   size);
+}
+
+SignalingServer *signaling_server_new(const gchar *address, guint port,
+                                      const SignalingCallbacks *callbacks, gpointer data,
+                                      GError **error) {
+  GBytes *page = g_resources_lookup_data(PAGE_RESOURCE, G_RESOURCE_LOOKUP_FLAGS_NONE, error);
+  if (!page) return NULL;
+  GSocketAddress *socket_address = g_inet_socket_address_new_from_string(address, port);
+  if (!socket_address) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                "\"%s\" is not an IP address", address);
+    g_bytes_unref(page);
+    return NULL;
+  }
+
+  SoupServer *soup = soup_server_new("server-header", "glib-tutorials ", NULL);
+  gboolean ok = soup_server_listen(soup, socket_address, 0, error);
+  g_object_unref(socket_address);
+  if (!ok) {
+    g_object_unref(soup);
+    g_bytes_unref(page);
+    return NULL;
+  }
+
+  SignalingServer *server = g_new0(SignalingServer, 1);
+  server->soup = soup;
+  server->page = page;
+  if (callbacks) server->callbacks = *callbacks;
+  server->data = data;
+  soup_server_add_handler(soup, NULL, on_page, server, NULL);
+  soup_server_add_websocket_handler(soup, "/ws", NULL, NULL, on_websocket, server, NULL);
+
+  // With port 0 only the listening socket knows which one it got.
+  GSList *uris = soup_server_get_uris(soup);
+  server->url = uris ? g_uri_to_string(uris->data) : g_strdup_printf("http://%s:%u/", address, port);
+  g_slist_free_full(uris, (GDestroyNotify)g_uri_unref);
+  return server;
+}
+
+const gchar *signaling_server_get_url(SignalingServer *server) {
+  return server->url;
+}
+
+void signaling_server_free(SignalingServer *server) {
+  for (GList *l = server->peers; l; l = l->next) {
+    SignalingPeer *peer = l->data;
+    peer->server = NULL;
+    g_signal_handlers_disconnect_by_data(peer->connection, peer);
+    if (is_open(peer)) {
+      soup_websocket_connection_close(peer->connection, SOUP_WEBSOCKET_CLOSE_GOING_AWAY, NULL);
+    }
+    signaling_peer_unref(peer);
+  }
+  g_list_free(server->peers);
+  soup_server_disconnect(server->soup);
+  g_object_unref(server->soup);
+  g_bytes_unref(server->page);
+  g_free(server->url);
+  g_free(server);
+}
+
+gboolean signaling_message_parse(const gchar *text, gssize length, SignalingMessage *message) {
+  *message = (SignalingMessage){0};
+  JsonParser *parser = json_parser_new();
+  gboolean ok = json_parser_load_from_data(parser, text, length, NULL);
+  JsonNode *root = ok ? json_parser_get_root(parser) : NULL;
+  if (root && JSON_NODE_HOLDS_OBJECT(root)) {
+    JsonObject *object = json_node_get_object(root);
+    message->type = g_strdup(json_object_get_string_member_with_default(object, "type", NULL));
+    message->sdp = g_strdup(json_object_get_string_member_with_default(object, "sdp", NULL));
+    message->candidate =
+        g_strdup(json_object_get_string_member_with_default(object, "candidate", NULL));
+    message->mline = (guint)json_object_get_int_member_with_default(object, "mlineindex", 0);
+    message->message =
+        g_strdup(json_object_get_string_member_with_default(object, "message", NULL));
+  }
+  g_object_unref(parser);
+  if (message->type) return TRUE;
+  signaling_message_clear(message);
+  return FALSE;
+}
+
+gchar *signaling_message_to_json(const SignalingMessage *message) {
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "type");
+  json_builder_add_string_value(builder, message->type);
+  if (message->sdp) {
+    json_builder_set_member_name(builder, "sdp");
+    json_builder_add_string_value(builder, message->sdp);
+  }
+  if (message->candidate) {
+    json_builder_set_member_name(builder, "mlineindex");
+    json_builder_add_int_value(builder, message->mline);
+    json_builder_set_member_name(builder, "candidate");
+    json_builder_add_string_value(builder, message->candidate);
+  }
+  if (message->message) {
+    json_builder_set_member_name(builder, "message");
+    json_builder_add_string_value(builder, message->message);
+  }
+  json_builder_end_object(builder);
+
+  JsonNode *root = json_builder_get_root(builder);
+  JsonGenerator *generator = json_generator_new();
+  json_generator_set_root(generator, root);
+  gchar *json = json_generator_to_data(generator, NULL);
+  g_object_unref(generator);
+  json_node_unref(root);
+  g_object_unref(builder);
+  return json;
+}
+
+void signaling_message_clear(SignalingMessage *message) {
+  g_free(message->type);
+  g_free(message->sdp);
+  g_free(message->candidate);
+  g_free(message->message);
+  *message = (SignalingMessage){0};
+}
@@ -0,0 +1,74 @@
+#ifndef SIGNALING_SERVER_H
+#define SIGNALING_SERVER_H
+
+#include <glib.h>
+
+// The HTTP and WebSocket endpoint of screencast-webrtc. GET / serves the
+// viewer page (screen_webrtc.html, compiled in as a resource) and every
+// WebSocket on /ws is one viewer. Messages are JSON objects:
+//
+//   to the viewer:   {"type": "offer", "sdp": ...}
+//                    {"type": "candidate", "mlineindex": N, "candidate": ...}
+//                    {"type": "error", "message": ...}
+//   from the viewer: {"type": "answer", "sdp": ...}
+//                    {"type": "candidate", "mlineindex": N, "candidate": ...}
+//                    {"type": "connected"}, {"type": "first-frame"}
+//
+// Candidates go both ways as soon as they are gathered (trickle ICE), so no
+// side waits for its slowest STUN or TURN server before the other can start
+// connecting. The server runs on the main context it was created on.
+typedef struct _SignalingServer SignalingServer;
+typedef struct _SignalingPeer SignalingPeer;
+
+typedef struct {
+  gchar *type;
+  gchar *sdp;       // offer and answer
+  guint mline;      // candidate
+  gchar *candidate; // candidate
+  gchar *message;   // error
+} SignalingMessage;
+
+// All optional; called on the server's main context.
+typedef struct {
+  // A viewer connected. Returning FALSE closes its WebSocket again.
+  gboolean (*joined)(SignalingPeer *peer, gpointer data);
+  void (*answer)(SignalingPeer *peer, const gchar *sdp, gpointer data);
+  void (*candidate)(SignalingPeer *peer, guint mline, const gchar *candidate, gpointer data);
+  // The viewer reported its first decoded frame, `offer_ms` after the offer went out.
+  void (*first_frame)(SignalingPeer *peer, gdouble offer_ms, gpointer data);
+  // The WebSocket of a joined viewer closed.
+  void (*left)(SignalingPeer *peer, gpointer data);
+} SignalingCallbacks;
+
+// Listens on `address` (an IP, e.g. 127.0.0.1 or 0.0.0.0) and `port`, 0 for
+// any free one. NULL with `error` set if it cannot.
+SignalingServer *signaling_server_new(const gchar *address, guint port,
+                                      const SignalingCallbacks *callbacks, gpointer data,
+                                      GError **error);
+
+// The page's address, e.g. "http://127.0.0.1:8080/".
+const gchar *signaling_server_get_url(SignalingServer *server);
+
+// Closes every viewer's WebSocket without calling `left`.
+void signaling_server_free(SignalingServer *server);
+
+SignalingPeer *signaling_peer_ref(SignalingPeer *peer);
+void signaling_peer_unref(SignalingPeer *peer);
+
+// The viewer's remote address, for logs.
+const gchar *signaling_peer_get_name(SignalingPeer *peer);
+
+// May be called from any thread; messages to a closed viewer are dropped.
+void signaling_peer_send(SignalingPeer *peer, const SignalingMessage *message);
+
+// Tells the viewer why and closes its WebSocket.
+void signaling_peer_close(SignalingPeer *peer, const gchar *reason);
+
+// FALSE if `text` is not a JSON object with a "type".
+gboolean signaling_message_parse(const gchar *text, gssize length, SignalingMessage *message);
+
+gchar *signaling_message_to_json(const SignalingMessage *message);
+
+void signaling_message_clear(SignalingMessage *message);
+
+#endif // !SIGNALING_SERVER_H
@@ -0,0 +1,55 @@
+#include "startup-timeline.h"
+
+typedef struct {
+  const gchar *phase;
+  gint64 time; // monotonic, in us
+} Mark;
+
+struct _StartupTimeline {
+  GMutex lock;
+  gint64 start;
+  GArray *marks;
+};
+
+StartupTimeline *startup_timeline_new(void) {
+  StartupTimeline *timeline = g_new0(StartupTimeline, 1);
+  g_mutex_init(&timeline->lock);
+  timeline->start = g_get_monotonic_time();
+  timeline->marks = g_array_new(FALSE, FALSE, sizeof(Mark));
+  return timeline;
+}
+
+void startup_timeline_mark(StartupTimeline *timeline, const gchar *phase) {
+  Mark mark = {phase, g_get_monotonic_time()};
+  g_mutex_lock(&timeline->lock);
+  g_array_append_val(timeline->marks, mark);
+  g_mutex_unlock(&timeline->lock);
+}
+
+static gint compare_mark(gconstpointer a, gconstpointer b) {
+  gint64 x = ((const Mark *)a)->time, y = ((const Mark *)b)->time;
+  return x < y ? -1 : x > y;
+}
+
+void startup_timeline_print(StartupTimeline *timeline) {
+  g_mutex_lock(&timeline->lock);
+  GArray *marks = g_array_copy(timeline->marks);
+  g_mutex_unlock(&timeline->lock);
+  g_array_sort(marks, compare_mark);
+
+  g_print("[startup] %10s %10s  phase\n", "at ms", "+ms");
+  gint64 previous = timeline->start;
+  for (guint i = 0; i < marks->len; i++) {
+    Mark *mark = &g_array_index(marks, Mark, i);
+    g_print("[startup] %10.1f %10.1f  %s\n", (mark->time - timeline->start) / 1000.0,
+            (mark->time - previous) / 1000.0, mark->phase);
+    previous = mark->time;
+  }
+  g_array_unref(marks);
+}
+
+void startup_timeline_free(StartupTimeline *timeline) {
+  g_mutex_clear(&timeline->lock);
+  g_array_unref(timeline->marks);
+  g_free(timeline);
+}
@@ -0,0 +1,21 @@
+#ifndef STARTUP_TIMELINE_H
+#define STARTUP_TIMELINE_H
+
+#include <glib.h>
+
+// Timestamps of the startup phases of a screencast command, from process
+// start to the first encoded frame. Phases may be marked from any thread;
+// the pre-warm thread runs alongside the portal handshake, so the printout
+// is sorted by time and shows each phase's distance to the one before it.
+typedef struct _StartupTimeline StartupTimeline;
+
+// Time zero is now.
+StartupTimeline *startup_timeline_new(void);
+
+void startup_timeline_mark(StartupTimeline *timeline, const gchar *phase);
+
+void startup_timeline_print(StartupTimeline *timeline);
+
+void startup_timeline_free(StartupTimeline *timeline);
+
+#endif // !STARTUP_TIMELINE_H
@@ -0,0 +1,161 @@
+#include "video-encoder.h"
+
+#define MONITOR_INTERVAL_SECONDS 5
+
+// Ordered fastest first; the first usable entry wins in "auto" mode.
+static const VideoEncoder encoders[] = {
+    {"nvh264enc", VIDEO_CODEC_H264, "bitrate", 1, "gop-size", -1, NULL,
+     "rc-mode=cbr preset=low-latency-hq tune=ultra-low-latency "
+     "zerolatency=true"},
+    {"vah264enc", VIDEO_CODEC_H264, "bitrate", 1, "key-int-max", 1024, NULL,
+     "rate-control=cbr target-usage=7 b-frames=0"},
+    {"x264enc", VIDEO_CODEC_H264, "bitrate", 1, "key-int-max", 1 << 30, NULL,
+     "tune=zerolatency speed-preset=ultrafast sliced-threads=true bframes=0"},
+    {"openh264enc", VIDEO_CODEC_H264, "bitrate", 1000, "gop-size", 0, NULL,
+     "rate-control=bitrate complexity=low usage-type=screen"},
+    {"vp8enc", VIDEO_CODEC_VP8, "target-bitrate", 1000, "keyframe-max-dist", G_MAXINT,
+     "threads", "deadline=1 end-usage=cbr cpu-used=8 lag-in-frames=0"},
+    {"vp9enc", VIDEO_CODEC_VP9, "target-bitrate", 1000, "keyframe-max-dist", G_MAXINT,
+     "threads",
+     "deadline=1 end-usage=cbr cpu-used=8 lag-in-frames=0 row-mt=true"},
+};
+
+static gboolean available[G_N_ELEMENTS(encoders)];
+
+// A factory can be registered while its device is missing or busy, so the
+// element also has to make it to READY before it counts as usable.
+static gboolean probe_encoder(const VideoEncoder *encoder) {
+  GstElementFactory *factory = gst_element_factory_find(encoder->name);
+  if (!factory) return FALSE;
+
+  GstElement *element = gst_element_factory_create(factory, NULL);
+  gst_object_unref(factory);
+  if (!element) return FALSE;
+
+  gboolean ok = gst_element_set_state(element, GST_STATE_READY) !=
+                GST_STATE_CHANGE_FAILURE;
+  gst_element_set_state(element, GST_STATE_NULL);
+  gst_object_unref(element);
+  return ok;
+}
+
+static void probe_all(void) {
+  static gsize probed = 0;
+  if (!g_once_init_enter(&probed)) return;
+
+  for (guint i = 0; i < G_N_ELEMENTS(encoders); i++) {
+    available[i] = probe_encoder(&encoders[i]);
+  }
+  g_once_init_leave(&probed, 1);
+}
+
+const VideoEncoder *video_encoder_select(const gchar *name) {
+  probe_all();
+
+  gboolean automatic = name == NULL || g_strcmp0(name, "auto") == 0;
+  for (guint i = 0; i < G_N_ELEMENTS(encoders); i++) {
+    if (!automatic && g_strcmp0(name, encoders[i].name) != 0) continue;
+    if (available[i]) return &encoders[i];
+    if (!automatic) break;
+  }
+
+  g_printerr("No usable video encoder%s%s. Available:",
+             automatic ? "" : " named ", automatic ? "" : name);
+  for (guint i = 0; i < G_N_ELEMENTS(encoders); i++) {
+    if (available[i]) g_printerr(" %s", encoders[i].name);
+  }
+  g_printerr("\n");
+  return NULL;
+}
+
+gchar *video_encoder_describe(const VideoEncoder *encoder, guint bitrate_kbps,
+                              gint gop_size) {
+  return video_encoder_describe_named(encoder, "venc", bitrate_kbps, gop_size);
+}
+
+static gint gop_value(const VideoEncoder *encoder, gint gop_size) {
+  return gop_size == VIDEO_ENCODER_INFINITE_GOP ? encoder->longest_gop : gop_size;
+}
+
+gchar *video_encoder_describe_named(const VideoEncoder *encoder, const gchar *name,
+                                    guint bitrate_kbps, gint gop_size) {
+  GString *desc = g_string_new(NULL);
+  g_string_append_printf(desc, "%s name=%s %s=%u %s=%d ", encoder->name, name,
+                         encoder->bitrate_property,
+                         bitrate_kbps * encoder->bitrate_scale,
+                         encoder->gop_property, gop_value(encoder, gop_size));
+  if (encoder->threads_property) {
+    g_string_append_printf(desc, "%s=%u ", encoder->threads_property,
+                           g_get_num_processors());
+  }
+  g_string_append(desc, encoder->options);
+  if (encoder->codec == VIDEO_CODEC_H264) g_string_append(desc, " ! h264parse");
+  return g_string_free(desc, FALSE);
+}
+
+// Properties go through their string form, like gst_parse_launch does, so
+// gint and guint bitrates alike take the same code.
+static void set_arg(GstElement *element, const gchar *property, gint64 value) {
+  gchar *str = g_strdup_printf("%" G_GINT64_FORMAT, value);
+  gst_util_set_object_arg(G_OBJECT(element), property, str);
+  g_free(str);
+}
+
+GstElement *video_encoder_create(const VideoEncoder *encoder, guint bitrate_kbps,
+                                 gint gop_size) {
+  GstElement *element = gst_element_factory_make(encoder->name, "venc");
+  if (!element) return NULL;
+
+  set_arg(element, encoder->bitrate_property, bitrate_kbps * encoder->bitrate_scale);
+  set_arg(element, encoder->gop_property, gop_value(encoder, gop_size));
+  if (encoder->threads_property) {
+    set_arg(element, encoder->threads_property, g_get_num_processors());
+  }
+  gchar **options = g_strsplit(encoder->options, " ", -1);
+  for (gchar **option = options; *option; option++) {
+    gchar **pair = g_strsplit(*option, "=", 2);
+    if (pair[0] && pair[1]) gst_util_set_object_arg(G_OBJECT(element), pair[0], pair[1]);
+    g_strfreev(pair);
+  }
+  g_strfreev(options);
+  return element;
+}
+
+typedef struct {
+  const VideoEncoder *encoder;
+  gint frames; // atomic, written from the streaming thread
+  gint64 last_time;
+} EncoderMonitor;
+
+static GstPadProbeReturn count_frame(GstPad *pad, GstPadProbeInfo *info,
+                                     gpointer user_data) {
+  EncoderMonitor *monitor = user_data;
+  g_atomic_int_inc(&monitor->frames);
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean print_fps(gpointer user_data) {
+  EncoderMonitor *monitor = user_data;
+  gint64 now = g_get_monotonic_time();
+  gint frames = g_atomic_int_and(&monitor->frames, 0);
+  gdouble seconds = (now - monitor->last_time) / (gdouble)G_USEC_PER_SEC;
+  monitor->last_time = now;
+
+  g_print("[encoder] %s: %.1f fps\n", monitor->encoder->name, frames / seconds);
+  return G_SOURCE_CONTINUE;
+}
+
+guint video_encoder_monitor(const VideoEncoder *encoder, GstElement *element) {
+  // Shared by the pad probe and the timer, whichever goes away last frees it.
+  EncoderMonitor *monitor = g_rc_box_new0(EncoderMonitor);
+  monitor->encoder = encoder;
+  monitor->last_time = g_get_monotonic_time();
+
+  GstPad *pad = gst_element_get_static_pad(element, "src");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, count_frame,
+                    g_rc_box_acquire(monitor), g_rc_box_release);
+  gst_object_unref(pad);
+
+  return g_timeout_add_seconds_full(G_PRIORITY_DEFAULT, MONITOR_INTERVAL_SECONDS,
+                                    print_fps, monitor, g_rc_box_release);
+}
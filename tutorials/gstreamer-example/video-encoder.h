@@ -0,0 +1,50 @@
+#ifndef VIDEO_ENCODER_H
+#define VIDEO_ENCODER_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+typedef enum {
+  VIDEO_CODEC_H264,
+  VIDEO_CODEC_VP8,
+  VIDEO_CODEC_VP9,
+} VideoCodec;
+
+typedef struct {
+  const gchar *name; // element factory name, also the --encoder value
+  VideoCodec codec;
+  const gchar *bitrate_property;
+  guint bitrate_scale; // kbit/s -> unit of bitrate_property
+  const gchar *gop_property;
+  gint longest_gop;              // gop_property value for VIDEO_ENCODER_INFINITE_GOP
+  const gchar *threads_property; // NULL if the encoder picks its own
+  const gchar *options;          // fixed low-latency settings
+} VideoEncoder;
+
+// A `gop_size` of no periodic keyframes at all, or the longest interval the
+// encoder allows; keyframes then only come when they are asked for with a
+// force-key-unit event.
+#define VIDEO_ENCODER_INFINITE_GOP -1
+
+// Probes the registry once (gst_init() must have been called) and returns the
+// fastest usable backend, or the one named by `name` unless it is NULL or
+// "auto". Returns NULL if nothing usable was found.
+const VideoEncoder *video_encoder_select(const gchar *name);
+
+// gst_parse_launch fragment "<enc> name=venc ... [! parser]"
+gchar *video_encoder_describe(const VideoEncoder *encoder, guint bitrate_kbps,
+                              gint gop_size);
+
+// The same with another element name, e.g. for simulcast layers.
+gchar *video_encoder_describe_named(const VideoEncoder *encoder, const gchar *name,
+                                    guint bitrate_kbps, gint gop_size);
+
+// The same encoder as a new element named "venc", without the parser.
+GstElement *video_encoder_create(const VideoEncoder *encoder, guint bitrate_kbps,
+                                 gint gop_size);
+
+// Logs the measured output frame rate of `element` every few seconds.
+// Returns the GSource id of the log timer.
+guint video_encoder_monitor(const VideoEncoder *encoder, GstElement *element);
+
+#endif // !VIDEO_ENCODER_H
@@ -0,0 +1,305 @@
+#include "video-fastpath.h"
+#include "fast-convert-scale.h"
+#include <stdio.h>
+
+#define PROBE_TIMEOUT (3 * GST_SECOND)
+
+// Runs `desc` until EOS and returns the pipeline still in PLAYING, or NULL.
+static GstElement *run_to_eos(const gchar *desc, GstClockTime timeout) {
+  GError *error = NULL;
+  GstElement *pipeline = gst_parse_launch(desc, &error);
+  if (error) {
+    g_printerr("Fast path probe error: %s\n", error->message);
+    g_error_free(error);
+    if (pipeline) gst_object_unref(pipeline);
+    return NULL;
+  }
+
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered(
+      bus, timeout, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gst_object_unref(bus);
+
+  gboolean eos = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+  if (msg) gst_message_unref(msg);
+  if (!eos) {
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return NULL;
+  }
+  return pipeline;
+}
+
+static gboolean probe_source(guint32 node_id, GstVideoInfo *info) {
+  // Plain video/x-raw keeps pipewiresrc on system memory, like the real chain.
+  gchar *desc = g_strdup_printf("pipewiresrc path=%u num-buffers=1 ! "
+                                "video/x-raw ! fakesink name=sink sync=false",
+                                node_id);
+  GstElement *pipeline = run_to_eos(desc, PROBE_TIMEOUT);
+  g_free(desc);
+  if (!pipeline) return FALSE;
+
+  GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+  GstPad *pad = gst_element_get_static_pad(sink, "sink");
+  GstCaps *caps = gst_pad_get_current_caps(pad);
+  gboolean ok = caps && gst_video_info_from_caps(info, caps);
+
+  if (caps) gst_caps_unref(caps);
+  gst_object_unref(pad);
+  gst_object_unref(sink);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  return ok;
+}
+
+static gboolean encoder_accepts(const gchar *encoder_factory,
+                                GstVideoFormat format) {
+  if (!encoder_factory) return FALSE;
+  GstElementFactory *factory = gst_element_factory_find(encoder_factory);
+  if (!factory) return FALSE;
+
+  GstCaps *caps = gst_caps_new_simple(
+      "video/x-raw", "format", G_TYPE_STRING, gst_video_format_to_string(format),
+      NULL);
+  gboolean ok = gst_element_factory_can_sink_any_caps(factory, caps);
+  gst_caps_unref(caps);
+  gst_object_unref(factory);
+  return ok;
+}
+
+void video_fastpath_probe(guint32 node_id, VideoTarget *target,
+                          const gchar *encoder_factory, VideoFastPath *path) {
+  GstVideoInfo source;
+  if (probe_source(node_id, &source)) {
+    video_fastpath_plan(&source, target, encoder_factory, path);
+    return;
+  }
+  g_printerr("Could not read PipeWire caps, keeping the full video chain.\n");
+  path->convert = path->scale = path->rate = TRUE;
+  path->fused = FALSE;
+  path->have_source = FALSE;
+}
+
+typedef struct {
+  guint32 node_id;
+  VideoTarget *target;
+  const gchar *encoder_factory;
+  VideoFastPath *path;
+} ProbeJob;
+
+static gpointer probe_thread(gpointer data) {
+  ProbeJob *job = data;
+  video_fastpath_probe(job->node_id, job->target, job->encoder_factory, job->path);
+  return NULL;
+}
+
+void video_fastpath_probe_all(guint n, const guint32 *node_ids, VideoTarget *targets,
+                              const gchar *encoder_factory, VideoFastPath *paths) {
+  ProbeJob *jobs = g_new(ProbeJob, n);
+  GThread **threads = g_new0(GThread *, n);
+  for (guint i = 0; i < n; i++) {
+    jobs[i] = (ProbeJob){node_ids[i], &targets[i], encoder_factory, &paths[i]};
+    if (i > 0) threads[i] = g_thread_new("fastpath-probe", probe_thread, &jobs[i]);
+  }
+  if (n > 0) probe_thread(&jobs[0]);
+  for (guint i = 1; i < n; i++) g_thread_join(threads[i]);
+  g_free(threads);
+  g_free(jobs);
+}
+
+// The part of the crop rectangle that lies inside the source, with even
+// sizes; videocrop would otherwise fail to negotiate.
+static void clamp_crop(VideoTarget *target, gint width, gint height) {
+  gint x = MIN(target->crop_x, MAX(width - 2, 0));
+  gint y = MIN(target->crop_y, MAX(height - 2, 0));
+  gint crop_width = MIN(target->crop_width, width - x) & ~1;
+  gint crop_height = MIN(target->crop_height, height - y) & ~1;
+  if (x == target->crop_x && y == target->crop_y && crop_width == target->crop_width &&
+      crop_height == target->crop_height) {
+    return;
+  }
+  g_printerr("Crop %d,%d,%d,%d does not fit the %dx%d source, using %d,%d,%d,%d.\n",
+             target->crop_x, target->crop_y, target->crop_width, target->crop_height, width,
+             height, x, y, crop_width, crop_height);
+  target->crop_x = x;
+  target->crop_y = y;
+  target->crop_width = crop_width;
+  target->crop_height = crop_height;
+}
+
+void video_fastpath_plan(const GstVideoInfo *source, VideoTarget *target,
+                         const gchar *encoder_factory, VideoFastPath *path) {
+  path->source = *source;
+  path->have_source = TRUE;
+
+  GstVideoInfo *src = &path->source;
+  GstVideoFormat format = GST_VIDEO_INFO_FORMAT(src);
+  if (target->format) {
+    path->convert = format != gst_video_format_from_string(target->format);
+  } else {
+    path->convert = !encoder_accepts(encoder_factory, format);
+  }
+
+  // Everything after the crop only sees the region of interest.
+  gint width = GST_VIDEO_INFO_WIDTH(src), height = GST_VIDEO_INFO_HEIGHT(src);
+  if (target->crop_width > 0) {
+    clamp_crop(target, width, height);
+    width = target->crop_width;
+    height = target->crop_height;
+  }
+  path->scale = target->width > 0 &&
+                (width != target->width || height != target->height);
+
+  // The fused element only writes 4:2:0 YUV, check someone takes it.
+  gboolean yuv420_ok;
+  if (target->format) {
+    yuv420_ok = g_strcmp0(target->format, "NV12") == 0 ||
+                g_strcmp0(target->format, "I420") == 0;
+  } else {
+    yuv420_ok = encoder_accepts(encoder_factory, GST_VIDEO_FORMAT_NV12) ||
+                encoder_accepts(encoder_factory, GST_VIDEO_FORMAT_I420);
+  }
+  GstElementFactory *fused = gst_element_factory_find("fastconvertscale");
+  path->fused = fused && path->convert && yuv420_ok &&
+                fast_convert_scale_accepts(format);
+  if (fused) gst_object_unref(fused);
+
+  // A variable-rate source (0/1) still needs videorate for a fixed target.
+  path->rate = target->fps_n > 0 &&
+               (GST_VIDEO_INFO_FPS_N(src) == 0 ||
+                (gint64)GST_VIDEO_INFO_FPS_N(src) * target->fps_d !=
+                    (gint64)target->fps_n * GST_VIDEO_INFO_FPS_D(src));
+}
+
+void video_fastpath_keep_scaler(VideoFastPath *path, const VideoTarget *target) {
+  // fastconvertscale scales whatever size comes in.
+  if (target->width > 0 && !path->fused) path->scale = TRUE;
+}
+
+gboolean video_target_parse(const gchar *resolution, const gchar *crop,
+                            VideoTarget *target) {
+  gint n = 0;
+  if (g_strcmp0(resolution, "native") == 0) {
+    target->width = target->height = 0;
+  } else if (resolution) {
+    gint width, height;
+    if (sscanf(resolution, "%dx%d%n", &width, &height, &n) != 2 ||
+        resolution[n] || width <= 0 || height <= 0 || width % 2 || height % 2) {
+      g_printerr("Invalid resolution '%s' (native or WxH, even sizes)\n", resolution);
+      return FALSE;
+    }
+    target->width = width;
+    target->height = height;
+  }
+
+  if (crop) {
+    gint x, y, width, height;
+    if (sscanf(crop, "%d,%d,%d,%d%n", &x, &y, &width, &height, &n) != 4 ||
+        crop[n] || x < 0 || y < 0 || width <= 0 || height <= 0 ||
+        width % 2 || height % 2) {
+      g_printerr("Invalid crop '%s' (X,Y,W,H, even sizes)\n", crop);
+      return FALSE;
+    }
+    target->crop_x = x;
+    target->crop_y = y;
+    target->crop_width = width;
+    target->crop_height = height;
+  }
+  return TRUE;
+}
+
+// Size of what reaches the scaler, 0 if unknown.
+static gint64 scaler_input_area(const VideoFastPath *path, const VideoTarget *target) {
+  if (target->crop_width > 0) return (gint64)target->crop_width * target->crop_height;
+  if (!path->have_source) return 0;
+  return (gint64)GST_VIDEO_INFO_WIDTH(&path->source) * GST_VIDEO_INFO_HEIGHT(&path->source);
+}
+
+guint video_fastpath_chain(const VideoFastPath *path, const VideoTarget *target,
+                           const gchar *factories[4]) {
+  const GstVideoInfo *src = &path->source;
+  gboolean early_rate = path->rate && path->have_source && target->fps_n > 0 &&
+                        GST_VIDEO_INFO_FPS_N(src) > 0 &&
+                        (gint64)GST_VIDEO_INFO_FPS_N(src) * target->fps_d >
+                            (gint64)target->fps_n * GST_VIDEO_INFO_FPS_D(src);
+  gboolean early_scale = path->scale && target->width > 0 &&
+                         (gint64)target->width * target->height <
+                             scaler_input_area(path, target);
+
+  guint n = 0;
+  if (early_rate) factories[n++] = "videorate";
+  if (path->fused) {
+    factories[n++] = "fastconvertscale";
+  } else if (early_scale) {
+    factories[n++] = "videoscale";
+    if (path->convert) factories[n++] = "videoconvert";
+  } else {
+    if (path->convert) factories[n++] = "videoconvert";
+    if (path->scale) factories[n++] = "videoscale";
+  }
+  if (path->rate && !early_rate) factories[n++] = "videorate";
+  return n;
+}
+
+GstCaps *video_target_caps(const VideoTarget *target) {
+  GstCaps *caps = gst_caps_new_empty_simple("video/x-raw");
+  if (target->format) {
+    gst_caps_set_simple(caps, "format", G_TYPE_STRING, target->format, NULL);
+  }
+  if (target->width > 0) {
+    gst_caps_set_simple(caps, "width", G_TYPE_INT, target->width, "height",
+                        G_TYPE_INT, target->height, NULL);
+  }
+  if (target->fps_n > 0) {
+    gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, target->fps_n,
+                        target->fps_d, NULL);
+  }
+  if (target->features) {
+    gst_caps_set_features(caps, 0, gst_caps_features_new(target->features, NULL));
+  }
+  return caps;
+}
+
+gchar *video_fastpath_describe(const VideoFastPath *path,
+                               const VideoTarget *target) {
+  GString *desc = g_string_new(NULL);
+  if (target->crop_width > 0) {
+    // -1 takes the rest from the capsfilter, so the crop survives resizes.
+    g_string_append_printf(
+        desc, "videocrop left=%d top=%d right=-1 bottom=-1 ! "
+              "video/x-raw,width=%d,height=%d ! ",
+        target->crop_x, target->crop_y, target->crop_width, target->crop_height);
+  }
+
+  const gchar *factories[4];
+  guint n = video_fastpath_chain(path, target, factories);
+  for (guint i = 0; i < n; i++) g_string_append_printf(desc, "%s ! ", factories[i]);
+
+  g_string_append(desc, "video/x-raw");
+  if (target->features) g_string_append_printf(desc, "(%s)", target->features);
+  if (target->format) g_string_append_printf(desc, ",format=%s", target->format);
+  if (target->width > 0) {
+    g_string_append_printf(desc, ",width=%d,height=%d", target->width,
+                           target->height);
+  }
+  if (target->fps_n > 0) {
+    g_string_append_printf(desc, ",framerate=%d/%d", target->fps_n,
+                           target->fps_d);
+  }
+  return g_string_free(desc, FALSE);
+}
+
+void video_fastpath_report(const VideoFastPath *path) {
+  if (!path->have_source) return;
+
+  const GstVideoInfo *src = &path->source;
+  g_print("[fastpath] source %s %dx%d @ %d/%d,%s elided:%s%s%s%s\n",
+          gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(src)),
+          GST_VIDEO_INFO_WIDTH(src), GST_VIDEO_INFO_HEIGHT(src),
+          GST_VIDEO_INFO_FPS_N(src), GST_VIDEO_INFO_FPS_D(src),
+          path->fused ? " fused convert+scale," : "",
+          path->convert ? "" : " videoconvert", path->scale ? "" : " videoscale",
+          path->rate ? "" : " videorate",
+          path->convert && path->scale && path->rate ? " none" : "");
+}
@@ -0,0 +1,78 @@
+#ifndef VIDEO_FASTPATH_H
+#define VIDEO_FASTPATH_H
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+typedef struct {
+  gint width; // 0 keeps the source size
+  gint height;
+  gint fps_n; // 0 keeps the source rate
+  gint fps_d;
+  const gchar *format;   // NULL: anything the encoder accepts
+  const gchar *features; // caps features for the capsfilter, may be NULL
+  gint crop_x;           // region of interest in source pixels,
+  gint crop_y;           // applied before anything else touches the frame
+  gint crop_width;       // 0: the whole frame
+  gint crop_height;
+} VideoTarget;
+
+// Resolution policy from the command line: `resolution` is "native" (follow
+// the stream, including window resizes) or "WxH" (scaled as early as
+// possible); `crop` is "X,Y,W,H" or NULL. Either may be NULL to keep what
+// `target` already has. Prints the problem and returns FALSE if unparsable.
+gboolean video_target_parse(const gchar *resolution, const gchar *crop,
+                            VideoTarget *target);
+
+typedef struct {
+  GstVideoInfo source; // what pipewiresrc negotiated on its own
+  gboolean have_source;
+  gboolean convert;
+  gboolean scale;
+  gboolean rate;
+  gboolean fused; // fastconvertscale replaces videoconvert ! videoscale
+} VideoFastPath;
+
+// Negotiates caps with the PipeWire node once and decides which of
+// videoconvert/videoscale/videorate actually change something. On failure
+// every element is kept, which matches the old fixed pipeline.
+void video_fastpath_probe(guint32 node_id, VideoTarget *target,
+                          const gchar *encoder_factory, VideoFastPath *path);
+
+// video_fastpath_probe() for `n` nodes at once, one thread per node, so the
+// startup cost does not grow with the number of streams.
+void video_fastpath_probe_all(guint n, const guint32 *node_ids, VideoTarget *targets,
+                              const gchar *encoder_factory, VideoFastPath *paths);
+
+// Same decision for a source whose caps are already known, e.g. a synthetic
+// one in the benchmarks. A crop reaching past the source is clamped to it.
+void video_fastpath_plan(const GstVideoInfo *source, VideoTarget *target,
+                         const gchar *encoder_factory, VideoFastPath *path);
+
+// Keeps the scaler for a fixed target size even if the source has that size
+// now, for sources that can change size mid-stream: windows being resized,
+// or a chain the adaptive controller rescales. Without it the fixed caps
+// would fail to negotiate on the first change.
+void video_fastpath_keep_scaler(VideoFastPath *path, const VideoTarget *target);
+
+// Element factories of the raw video chain in link order, between the crop
+// (if any) and the final capsfilter; returns how many were written. videorate
+// goes before the pixel work when it drops frames, and videoscale before
+// videoconvert when it shrinks the frame.
+guint video_fastpath_chain(const VideoFastPath *path, const VideoTarget *target,
+                           const gchar *factories[4]);
+
+// Caps of the capsfilter that ends the raw video chain.
+GstCaps *video_target_caps(const VideoTarget *target);
+
+// gst_parse_launch fragment for the raw video chain, ending in a capsfilter.
+gchar *video_fastpath_describe(const VideoFastPath *path,
+                               const VideoTarget *target);
+
+// Logs the source caps and the elided elements. What they save is measured
+// by `bench --full-chain`, not in the live process, whose capture and
+// encoder threads would be counted too.
+void video_fastpath_report(const VideoFastPath *path);
+
+#endif // !VIDEO_FASTPATH_H
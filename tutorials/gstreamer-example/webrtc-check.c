@@ -0,0 +1,303 @@
+#include "webrtc-check.h"
+#include "congestion-control.h"
+#include "fast-convert-scale.h"
+#include "pipeline-builder.h"
+#include "signaling-server.h"
+#include "webrtc-fanout.h"
+#include "webrtc-viewer.h"
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <sys/resource.h>
+
+static gint timeout_seconds = 20;
+static gint viewers = 1;
+static gint settle_seconds = 3;
+static gchar *netsim = NULL;
+static gchar *encoder_name = NULL;
+static GOptionEntry entries[] = {
+    {"encoder", 'e', 0, G_OPTION_ARG_STRING, &encoder_name, "Video encoder, as in screencast-webrtc (default auto)", "NAME"},
+    {"timeout", 't', 0, G_OPTION_ARG_INT, &timeout_seconds, "Give up on a viewer after SECONDS (default 20)", "SECONDS"},
+    {"viewers", 'n', 0, G_OPTION_ARG_INT, &viewers, "Add this many viewers, one at a time (default 1)", "N"},
+    {"settle", 0, 0, G_OPTION_ARG_INT, &settle_seconds, "Measure CPU over SECONDS after each viewer (default 3)", "SECONDS"},
+    {"netsim", 0, 0, G_OPTION_ARG_STRING, &netsim, "Send through a simulated link, e.g. \"max-kbps=1500 min-delay=20 max-delay=40 drop-probability=0.01\"", "PROPERTIES"},
+    {NULL}};
+
+static gchar *viewer_url = NULL;
+static gint viewer_count = 1;
+static GOptionEntry viewer_entries[] = {
+    {"url", 'u', 0, G_OPTION_ARG_STRING, &viewer_url, "Page address of the sender, e.g. http://127.0.0.1:8080/", "URL"},
+    {"count", 'n', 0, G_OPTION_ARG_INT, &viewer_count, "Headless viewers to run (default 1)", "N"},
+    {NULL}};
+
+#define VIDEO_KBPS 4000
+#define VIDEO_WIDTH 1280
+#define VIDEO_HEIGHT 720
+#define VIDEO_FPS 30
+
+// What screencast-webrtc sends with signaling, from the same pipeline builder
+// with test sources instead of the screen and PulseAudio: payloaded branches
+// ending in the fakesinks the fan-out tees.
+static GstElement *build_sender(const VideoEncoder *encoder, GError **error) {
+  // What pipewiresrc would have negotiated for a screen of this size.
+  GstVideoInfo source;
+  gst_video_info_set_format(&source, GST_VIDEO_FORMAT_BGRx, VIDEO_WIDTH, VIDEO_HEIGHT);
+  GST_VIDEO_INFO_FPS_N(&source) = VIDEO_FPS;
+  GST_VIDEO_INFO_FPS_D(&source) = 1;
+  VideoTarget target = {VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS, 1, NULL, NULL};
+  VideoFastPath fastpath;
+  video_fastpath_plan(&source, &target, encoder->name, &fastpath);
+
+  AudioProfile profile;
+  audio_profile_parse("default", NULL, NULL, FALSE, &profile);
+  EncoderConfig video_encoder =
+      pipeline_builder_webrtc_encoder(encoder, VIDEO_KBPS, VIDEO_FPS, 1, &target);
+  AudioConfig audio = {NULL, &profile, TRUE, TRUE};
+  SinkConfig sink = {NULL, NULL, NULL, NULL};
+  GstElement *sender = pipeline_builder_prepare(&video_encoder, &audio, &sink, error);
+
+  VideoConfig video = {0, &fastpath, &target, 3, 0, TRUE};
+  if (sender && !pipeline_builder_attach_video(sender, &video, error)) {
+    gst_object_unref(sender);
+    return NULL;
+  }
+  return sender;
+}
+
+typedef struct {
+  WebRTCFanout *fanout;
+  CongestionControl *congestion;
+  GArray *first_frames; // ms after the offer, in the order viewers got one
+} Check;
+
+static gboolean on_joined(SignalingPeer *peer, gpointer data) {
+  GError *error = NULL;
+  if (!webrtc_fanout_add(((Check *)data)->fanout, peer, &error)) {
+    g_printerr("Fan-out Error: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static void on_answer(SignalingPeer *peer, const gchar *sdp, gpointer data) {
+  webrtc_fanout_set_answer(((Check *)data)->fanout, peer, sdp);
+}
+
+static void on_candidate(SignalingPeer *peer, guint mline, const gchar *candidate,
+                         gpointer data) {
+  webrtc_fanout_add_candidate(((Check *)data)->fanout, peer, mline, candidate);
+}
+
+static void on_first_frame(SignalingPeer *peer, gdouble offer_ms, gpointer data) {
+  g_array_append_val(((Check *)data)->first_frames, offer_ms);
+}
+
+static void on_left(SignalingPeer *peer, gpointer data) {
+  webrtc_fanout_remove(((Check *)data)->fanout, peer);
+}
+
+static gboolean on_deadline(gpointer data) {
+  *(gboolean *)data = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean wait_for_frames(Check *check, guint frames) {
+  gboolean expired = FALSE;
+  guint id = g_timeout_add_seconds(MAX(timeout_seconds, 1), on_deadline, &expired);
+  while (check->first_frames->len < frames && !expired) g_main_context_iteration(NULL, TRUE);
+  if (!expired) g_source_remove(id);
+  return check->first_frames->len >= frames;
+}
+
+static gdouble cpu_seconds(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Percent of one core the sender used over --settle seconds. The viewers
+// run in their own processes, so their decoding is not counted.
+static gdouble measure_cpu(void) {
+  gboolean expired = FALSE;
+  gdouble cpu = cpu_seconds();
+  gint64 start = g_get_monotonic_time();
+  g_timeout_add_seconds(MAX(settle_seconds, 1), on_deadline, &expired);
+  while (!expired) g_main_context_iteration(NULL, TRUE);
+  return 100 * (cpu_seconds() - cpu) / ((g_get_monotonic_time() - start) / 1e6);
+}
+
+static GSubprocess *spawn_viewer(const gchar *url) {
+  gchar *self = g_file_read_link("/proc/self/exe", NULL);
+  GError *error = NULL;
+  GSubprocess *viewer = NULL;
+  if (self) {
+    viewer = g_subprocess_new(G_SUBPROCESS_FLAGS_STDIN_PIPE, &error, self, "webrtc-viewers",
+                              "--url", url, NULL);
+  }
+  if (error) {
+    g_printerr("Viewer Error: %s\n", error->message);
+    g_error_free(error);
+  }
+  g_free(self);
+  return viewer;
+}
+
+static void stop_viewer(gpointer data) {
+  g_subprocess_force_exit(data);
+  g_subprocess_wait(data, NULL, NULL);
+  g_object_unref(data);
+}
+
+// Adds viewers one at a time and prints what each costs the sender.
+static gboolean run_viewers(Check *check, const gchar *url) {
+  gdouble idle = measure_cpu();
+  g_print("[fanout] 0 viewers: sender %.1f%% CPU\n", idle);
+  GPtrArray *children = g_ptr_array_new_with_free_func(stop_viewer);
+  gdouble cpu = idle;
+  gboolean ok = TRUE;
+  for (gint i = 1; ok && i <= MAX(viewers, 1); i++) {
+    GSubprocess *child = spawn_viewer(url);
+    if (child) g_ptr_array_add(children, child);
+    ok = child && wait_for_frames(check, i);
+    if (!ok) {
+      g_printerr("Viewer %d got no frame within %d s\n", i, timeout_seconds);
+      break;
+    }
+    gdouble now = measure_cpu();
+    g_print("[fanout] %d viewers: sender %.1f%% CPU (%+.1f), first frame %.1f ms after the offer\n",
+            i, now, now - cpu, g_array_index(check->first_frames, gdouble, i - 1));
+    cpu = now;
+  }
+  if (ok) {
+    g_print("Sender CPU per added viewer: %.1f%% of a core, on top of %.1f%% for one encode\n",
+            (cpu - idle) / MAX(viewers, 1), idle);
+  }
+  if (ok && check->congestion) {
+    guint kbps = congestion_control_get_bitrate(check->congestion);
+    g_print("Encoder at %u of %u kbit/s%s%s\n", kbps, VIDEO_KBPS,
+            netsim ? " behind netsim " : "", netsim ? netsim : "");
+    // The link has been limited for at least --settle seconds by now, long
+    // enough for the estimate to pull the encoder down.
+    if (netsim && kbps >= VIDEO_KBPS) {
+      g_printerr("The encoder did not follow the estimate below %u kbit/s\n", VIDEO_KBPS);
+      ok = FALSE;
+    }
+  }
+  g_ptr_array_unref(children);
+  return ok;
+}
+
+static gboolean has_elements(void) {
+  const gchar *factories[] = {"webrtcbin", "nicesrc", "opusenc", "decodebin", "rtpgccbwe",
+                              "netsim"};
+  // The estimator and the simulated link only matter with --netsim.
+  guint needed = netsim ? G_N_ELEMENTS(factories) : G_N_ELEMENTS(factories) - 2;
+  for (guint i = 0; i < needed; i++) {
+    GstElementFactory *factory = gst_element_factory_find(factories[i]);
+    if (!factory) {
+      g_print("SKIP: no element \"%s\"\n", factories[i]);
+      return FALSE;
+    }
+    gst_object_unref(factory);
+  }
+  return TRUE;
+}
+
+int webrtc_check_tutorial(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new("- WebRTC signaling and fan-out check");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_parse(context, &argc, &argv, NULL);
+  g_option_context_free(context);
+  gst_init(NULL, NULL);
+  fast_convert_scale_register();
+  const VideoEncoder *encoder = video_encoder_select(encoder_name);
+  g_free(encoder_name);
+  if (!encoder) {
+    g_print("SKIP: no usable video encoder\n");
+    return 0;
+  }
+  if (!has_elements()) return 0;
+
+  GError *error = NULL;
+  GstElement *sender = build_sender(encoder, &error);
+  if (!sender) {
+    g_printerr("Pipeline Error: %s\n", error->message);
+    g_error_free(error);
+    g_print("FAIL\n");
+    return 1;
+  }
+
+  Check check = {NULL, NULL, g_array_new(FALSE, FALSE, sizeof(gdouble))};
+  check.congestion = congestion_control_new(encoder, VIDEO_KBPS, netsim);
+  if (check.congestion) congestion_control_attach(check.congestion, sender, 1, 1);
+  SignalingServer *server = NULL;
+  WebRTCFanoutConfig config = {NULL, NULL, check.congestion};
+  check.fanout = webrtc_fanout_new(sender, 1, &config, &error);
+  if (check.fanout) {
+    SignalingCallbacks callbacks = {on_joined, on_answer, on_candidate, on_first_frame, on_left};
+    server = signaling_server_new("127.0.0.1", 0, &callbacks, &check, &error);
+  }
+  gboolean ok = FALSE;
+  if (error) {
+    g_printerr("%s Error: %s\n", check.fanout ? "Signaling" : "Fan-out", error->message);
+    g_error_free(error);
+  } else {
+    gst_element_set_state(sender, GST_STATE_PLAYING);
+    g_print("Signaling on %s\n", signaling_server_get_url(server));
+    ok = run_viewers(&check, signaling_server_get_url(server));
+  }
+  g_print("%s\n", ok ? "PASS" : "FAIL");
+
+  gst_element_set_state(sender, GST_STATE_NULL);
+  if (server) signaling_server_free(server);
+  if (check.fanout) webrtc_fanout_free(check.fanout);
+  if (check.congestion) congestion_control_free(check.congestion);
+  g_array_unref(check.first_frames);
+  gst_object_unref(sender);
+  g_free(netsim);
+  return ok ? 0 : 1;
+}
+
+static gboolean on_stdin_input(GIOChannel *channel, GIOCondition condition, gpointer user_data) {
+  gchar *input = NULL;
+  GIOStatus status = g_io_channel_read_line(channel, &input, NULL, NULL, NULL);
+  if (status == G_IO_STATUS_EOF || (input && g_strcmp0(g_strchomp(input), "exit") == 0)) {
+    g_main_loop_quit(user_data);
+  }
+  g_free(input);
+  return status != G_IO_STATUS_EOF;
+}
+
+int webrtc_viewers_tutorial(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new("- headless WebRTC viewers");
+  g_option_context_add_main_entries(context, viewer_entries, NULL);
+  g_option_context_parse(context, &argc, &argv, NULL);
+  g_option_context_free(context);
+  if (!viewer_url) {
+    g_printerr("--url is required\n");
+    return 1;
+  }
+  gst_init(NULL, NULL);
+
+  GPtrArray *list = g_ptr_array_new();
+  for (gint i = 0; i < MAX(viewer_count, 1); i++) {
+    WebRTCViewer *viewer = webrtc_viewer_new(viewer_url);
+    if (viewer) g_ptr_array_add(list, viewer);
+  }
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+  GIOChannel *stdin_ch = g_io_channel_unix_new(0);
+  g_io_add_watch(stdin_ch, G_IO_IN | G_IO_HUP, on_stdin_input, loop);
+  g_io_channel_unref(stdin_ch);
+  g_print("%u viewers on %s. Type 'exit' to stop.\n", list->len, viewer_url);
+  g_main_loop_run(loop);
+
+  for (guint i = 0; i < list->len; i++) {
+    g_print("viewer %u: %u frames\n", i + 1, webrtc_viewer_get_frames(list->pdata[i]));
+    webrtc_viewer_free(list->pdata[i]);
+  }
+  g_ptr_array_unref(list);
+  g_main_loop_unref(loop);
+  g_free(viewer_url);
+  return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef WEBRTC_CHECK_H
+#define WEBRTC_CHECK_H
+
+// Streams a test pattern through the signaling server and the fan-out to
+// headless viewers on loopback, added one at a time in child processes. For
+// each it reports the time from offer to first decoded frame and what the
+// viewer added to the sender's CPU use.
+int webrtc_check_tutorial(int argc, char *argv[]);
+
+// Runs headless viewers against a sender's page until stdin says 'exit' or
+// closes: the check's load generator, usable against screencast-webrtc too.
+int webrtc_viewers_tutorial(int argc, char *argv[]);
+
+#endif // !WEBRTC_CHECK_H
@@ -0,0 +1,245 @@
+#include "webrtc-fanout.h"
+#include "pipeline-builder.h"
+#include "webrtc-session.h"
+#include <gst/video/video.h>
+
+#define VIEWER_QUEUE_MS 200
+
+typedef struct {
+  guint id;
+  GstElement *webrtcbin;
+  GPtrArray *queues;   // one per tee
+  GPtrArray *tee_pads; // the tee's request pad feeding each queue
+  guint video_streams; // the first queues carry video
+  WebRTCSession *session;
+  gint dropped; // atomic, buffers the leaky queues threw away
+} Viewer;
+
+struct _WebRTCFanout {
+  GstElement *pipeline;
+  gchar *stun_server;
+  gchar *turn_server;
+  CongestionControl *congestion;
+  GPtrArray *tees; // video streams first, then audio
+  guint video_streams;
+  GHashTable *viewers; // SignalingPeer -> Viewer
+  guint next_id;
+};
+
+static GstElement *insert_tee(GstElement *pipeline, const gchar *ring_name, GError **error) {
+  GstElement *ring = gst_bin_get_by_name(GST_BIN(pipeline), ring_name);
+  if (!ring) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "no element named %s", ring_name);
+    return NULL;
+  }
+  gchar *name = g_strconcat(ring_name, "_tee", NULL);
+  GstElement *tee = gst_element_factory_make("tee", name);
+  g_free(name);
+  GstPad *ring_pad = gst_element_get_static_pad(ring, "sink");
+  GstPad *upstream = gst_pad_get_peer(ring_pad);
+  gboolean ok = tee && upstream;
+  if (ok) {
+    // The ring stays, so the stream flows and is measured with no viewer.
+    g_object_set(tee, "allow-not-linked", TRUE, NULL);
+    gst_bin_add(GST_BIN(pipeline), tee);
+    gst_pad_unlink(upstream, ring_pad);
+    GstPad *tee_pad = gst_element_get_static_pad(tee, "sink");
+    ok = gst_pad_link(upstream, tee_pad) == GST_PAD_LINK_OK && gst_element_link(tee, ring);
+    gst_object_unref(tee_pad);
+    gst_element_sync_state_with_parent(tee);
+  }
+  if (!ok) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+                "could not put a tee in front of %s", ring_name);
+  }
+  if (upstream) gst_object_unref(upstream);
+  gst_object_unref(ring_pad);
+  gst_object_unref(ring);
+  return ok ? tee : NULL;
+}
+
+WebRTCFanout *webrtc_fanout_new(GstElement *pipeline, guint video_streams,
+                                const WebRTCFanoutConfig *config, GError **error) {
+  WebRTCFanout *fanout = g_new0(WebRTCFanout, 1);
+  fanout->pipeline = gst_object_ref(pipeline);
+  fanout->stun_server = g_strdup(config ? config->stun_server : NULL);
+  fanout->turn_server = g_strdup(config ? config->turn_server : NULL);
+  fanout->congestion = config ? config->congestion : NULL;
+  fanout->tees = g_ptr_array_new();
+  fanout->video_streams = video_streams;
+  fanout->viewers = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  gboolean ok = TRUE;
+  for (guint i = 0; ok && i <= video_streams; i++) {
+    gchar *ring = i < video_streams ? pipeline_builder_element_name("video_ring", i)
+                                    : g_strdup("audio_ring");
+    GstElement *tee = insert_tee(pipeline, ring, error);
+    g_free(ring);
+    if (tee) g_ptr_array_add(fanout->tees, tee);
+    ok = tee != NULL;
+  }
+  if (!ok) {
+    webrtc_fanout_free(fanout);
+    return NULL;
+  }
+  return fanout;
+}
+
+static void on_overrun(GstElement *queue, gpointer user_data) {
+  g_atomic_int_inc(&((Viewer *)user_data)->dropped);
+}
+
+// With a long GOP the next keyframe may be minutes away, so a viewer that
+// just connected asks for one. The request goes up through its video queues
+// and tees to the encoders; PLI and FIR from the viewer take the same path
+// from inside webrtcbin.
+static void on_connection_state(GstElement *webrtcbin, GParamSpec *pspec, gpointer user_data) {
+  Viewer *viewer = user_data;
+  GstWebRTCPeerConnectionState state;
+  g_object_get(webrtcbin, "connection-state", &state, NULL);
+  if (state != GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED) return;
+  for (guint i = 0; i < viewer->video_streams; i++) {
+    GstPad *pad = gst_element_get_static_pad(viewer->queues->pdata[i], "sink");
+    gst_pad_push_event(pad, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE,
+                                                                        TRUE, 0));
+    gst_object_unref(pad);
+  }
+}
+
+static void viewer_destroy(WebRTCFanout *fanout, Viewer *viewer) {
+  g_signal_handlers_disconnect_by_data(viewer->webrtcbin, viewer);
+  if (viewer->session) webrtc_session_free(viewer->session);
+  if (fanout->congestion) congestion_control_unwatch(fanout->congestion, viewer->webrtcbin);
+  // Releasing the tee's pad waits for its push to finish, then unlinks.
+  for (guint i = 0; i < viewer->tee_pads->len; i++) {
+    GstPad *pad = viewer->tee_pads->pdata[i];
+    GstElement *tee = gst_pad_get_parent_element(pad);
+    gst_element_release_request_pad(tee, pad);
+    gst_object_unref(tee);
+  }
+  g_ptr_array_unref(viewer->tee_pads);
+  for (guint i = 0; i < viewer->queues->len; i++) {
+    GstElement *queue = viewer->queues->pdata[i];
+    g_signal_handlers_disconnect_by_data(queue, viewer);
+    gst_element_set_state(queue, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(fanout->pipeline), queue);
+  }
+  g_ptr_array_unref(viewer->queues);
+  gst_element_set_state(viewer->webrtcbin, GST_STATE_NULL);
+  gst_bin_remove(GST_BIN(fanout->pipeline), viewer->webrtcbin);
+  gst_object_unref(viewer->webrtcbin);
+  g_free(viewer);
+}
+
+// queue ! webrtcbin for every tee; the tee pads are only linked once the
+// new elements run, so nothing is pushed into a stopped element.
+static gboolean link_viewer(WebRTCFanout *fanout, Viewer *viewer, GError **error) {
+  GstBin *bin = GST_BIN(fanout->pipeline);
+  gst_bin_add(bin, viewer->webrtcbin);
+  for (guint i = 0; i < fanout->tees->len; i++) {
+    GstElement *queue = gst_element_factory_make("queue", NULL);
+    g_object_set(queue, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time",
+                 (guint64)VIEWER_QUEUE_MS * GST_MSECOND, NULL);
+    gst_util_set_object_arg(G_OBJECT(queue), "leaky", "downstream");
+    g_signal_connect(queue, "overrun", G_CALLBACK(on_overrun), viewer);
+    gst_bin_add(bin, queue);
+    g_ptr_array_add(viewer->queues, queue);
+    if (!gst_element_link_pads(queue, "src", viewer->webrtcbin, "sink_%u")) {
+      g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+                  "could not link a queue to %s", GST_OBJECT_NAME(viewer->webrtcbin));
+      return FALSE;
+    }
+  }
+  gst_element_sync_state_with_parent(viewer->webrtcbin);
+  for (guint i = 0; i < viewer->queues->len; i++) {
+    gst_element_sync_state_with_parent(viewer->queues->pdata[i]);
+  }
+
+  for (guint i = 0; i < fanout->tees->len; i++) {
+    GstPad *tee_pad = gst_element_request_pad_simple(fanout->tees->pdata[i], "src_%u");
+    GstPad *queue_pad = gst_element_get_static_pad(viewer->queues->pdata[i], "sink");
+    if (tee_pad) g_ptr_array_add(viewer->tee_pads, tee_pad);
+    gboolean ok = tee_pad && gst_pad_link(tee_pad, queue_pad) == GST_PAD_LINK_OK;
+    gst_object_unref(queue_pad);
+    if (!ok) {
+      g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+                  "could not link %s to a viewer", GST_OBJECT_NAME(fanout->tees->pdata[i]));
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+gboolean webrtc_fanout_add(WebRTCFanout *fanout, SignalingPeer *peer, GError **error) {
+  guint id = ++fanout->next_id;
+  gchar *name = g_strdup_printf("viewer_%u", id);
+  GstElement *webrtcbin = gst_element_factory_make("webrtcbin", name);
+  g_free(name);
+  if (!webrtcbin) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN, "no element \"webrtcbin\"");
+    return FALSE;
+  }
+  g_object_set(webrtcbin, "latency", 0, NULL);
+  gst_util_set_object_arg(G_OBJECT(webrtcbin), "bundle-policy", "max-bundle");
+  if (fanout->stun_server) g_object_set(webrtcbin, "stun-server", fanout->stun_server, NULL);
+  if (fanout->turn_server) {
+    gboolean added;
+    g_signal_emit_by_name(webrtcbin, "add-turn-server", fanout->turn_server, &added);
+  }
+
+  Viewer *viewer = g_new0(Viewer, 1);
+  viewer->id = id;
+  viewer->webrtcbin = gst_object_ref_sink(webrtcbin);
+  viewer->queues = g_ptr_array_new();
+  viewer->tee_pads = g_ptr_array_new_with_free_func(gst_object_unref);
+  viewer->video_streams = fanout->video_streams;
+  if (fanout->congestion) congestion_control_watch(fanout->congestion, webrtcbin);
+  if (!link_viewer(fanout, viewer, error)) {
+    viewer_destroy(fanout, viewer);
+    return FALSE;
+  }
+  g_signal_connect(webrtcbin, "notify::connection-state", G_CALLBACK(on_connection_state),
+                   viewer);
+  viewer->session = webrtc_session_new(webrtcbin, peer);
+  g_hash_table_insert(fanout->viewers, peer, viewer);
+  g_print("[fanout] viewer_%u is %s, %u watching\n", id, signaling_peer_get_name(peer),
+          g_hash_table_size(fanout->viewers));
+  return TRUE;
+}
+
+void webrtc_fanout_remove(WebRTCFanout *fanout, SignalingPeer *peer) {
+  Viewer *viewer = g_hash_table_lookup(fanout->viewers, peer);
+  if (!viewer) return;
+  g_hash_table_remove(fanout->viewers, peer);
+  g_print("[fanout] viewer_%u left after its queues dropped %d buffers, %u watching\n",
+          viewer->id, g_atomic_int_get(&viewer->dropped), g_hash_table_size(fanout->viewers));
+  viewer_destroy(fanout, viewer);
+}
+
+void webrtc_fanout_set_answer(WebRTCFanout *fanout, SignalingPeer *peer, const gchar *sdp) {
+  Viewer *viewer = g_hash_table_lookup(fanout->viewers, peer);
+  if (viewer) webrtc_session_set_answer(viewer->session, sdp);
+}
+
+void webrtc_fanout_add_candidate(WebRTCFanout *fanout, SignalingPeer *peer, guint mline,
+                                 const gchar *candidate) {
+  Viewer *viewer = g_hash_table_lookup(fanout->viewers, peer);
+  if (viewer) webrtc_session_add_candidate(viewer->session, mline, candidate);
+}
+
+guint webrtc_fanout_get_viewers(WebRTCFanout *fanout) {
+  return g_hash_table_size(fanout->viewers);
+}
+
+void webrtc_fanout_free(WebRTCFanout *fanout) {
+  GHashTableIter iter;
+  gpointer viewer;
+  g_hash_table_iter_init(&iter, fanout->viewers);
+  while (g_hash_table_iter_next(&iter, NULL, &viewer)) viewer_destroy(fanout, viewer);
+  g_hash_table_unref(fanout->viewers);
+  g_ptr_array_unref(fanout->tees);
+  gst_object_unref(fanout->pipeline);
+  g_free(fanout->stun_server);
+  g_free(fanout->turn_server);
+  g_free(fanout);
+}
@@ -0,0 +1,42 @@
+#ifndef WEBRTC_FANOUT_H
+#define WEBRTC_FANOUT_H
+
+#include "congestion-control.h"
+#include "signaling-server.h"
+#include <glib.h>
+#include <gst/gst.h>
+
+// One capture and encode, many viewers. The payloaded RTP of every video
+// stream and of the audio is teed to a webrtcbin per viewer, each fed
+// through its own leaky queue, so a viewer whose link or DTLS thread falls
+// behind loses packets instead of holding up the tee and everybody else.
+typedef struct _WebRTCFanout WebRTCFanout;
+
+typedef struct {
+  const gchar *stun_server; // may be NULL
+  const gchar *turn_server; // may be NULL
+  CongestionControl *congestion; // watches every viewer's webrtcbin, may be NULL
+} WebRTCFanoutConfig;
+
+// Puts a tee in front of the fakesinks pipeline_builder_prepare() ends the
+// branches in without a sink element: "video_ring", "video_ring_1", ... for
+// `video_streams` streams and "audio_ring". Call before PLAYING.
+WebRTCFanout *webrtc_fanout_new(GstElement *pipeline, guint video_streams,
+                                const WebRTCFanoutConfig *config, GError **error);
+
+// A webrtcbin for `peer`, linked to every tee and negotiating right away.
+gboolean webrtc_fanout_add(WebRTCFanout *fanout, SignalingPeer *peer, GError **error);
+
+// Unlinks and drops the viewer's webrtcbin; the others keep streaming.
+void webrtc_fanout_remove(WebRTCFanout *fanout, SignalingPeer *peer);
+
+void webrtc_fanout_set_answer(WebRTCFanout *fanout, SignalingPeer *peer, const gchar *sdp);
+
+void webrtc_fanout_add_candidate(WebRTCFanout *fanout, SignalingPeer *peer, guint mline,
+                                 const gchar *candidate);
+
+guint webrtc_fanout_get_viewers(WebRTCFanout *fanout);
+
+void webrtc_fanout_free(WebRTCFanout *fanout);
+
+#endif // !WEBRTC_FANOUT_H
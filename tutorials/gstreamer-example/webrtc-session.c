@@ -0,0 +1,113 @@
+#include "webrtc-session.h"
+
+struct _WebRTCSession {
+  GstElement *webrtcbin;
+  SignalingPeer *peer;
+  gint offering; // atomic: an offer is out and not answered yet
+  gulong negotiation_id;
+  gulong candidate_id;
+};
+
+static void session_clear(gpointer data) {
+  WebRTCSession *session = data;
+  gst_object_unref(session->webrtcbin);
+  signaling_peer_unref(session->peer);
+}
+
+static WebRTCSession *session_ref(WebRTCSession *session) {
+  return g_rc_box_acquire(session);
+}
+
+static void session_unref(gpointer data) {
+  g_rc_box_release_full(data, session_clear);
+}
+
+static void on_offer_created(GstPromise *promise, gpointer user_data) {
+  WebRTCSession *session = user_data;
+  GstWebRTCSessionDescription *offer = NULL;
+  const GstStructure *reply = gst_promise_get_reply(promise);
+  if (reply) gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
+  gst_promise_unref(promise);
+  if (!offer) {
+    g_printerr("[signaling] %s: webrtcbin could not create an offer\n",
+               signaling_peer_get_name(session->peer));
+    g_atomic_int_set(&session->offering, 0);
+    return;
+  }
+
+  // ICE gathering starts here; every candidate follows the offer on its own.
+  g_signal_emit_by_name(session->webrtcbin, "set-local-description", offer, NULL);
+  gchar *sdp = gst_sdp_message_as_text(offer->sdp);
+  SignalingMessage message = {"offer", sdp, 0, NULL, NULL};
+  signaling_peer_send(session->peer, &message);
+  g_free(sdp);
+  gst_webrtc_session_description_free(offer);
+}
+
+static void create_offer(WebRTCSession *session) {
+  if (!g_atomic_int_compare_and_exchange(&session->offering, 0, 1)) return;
+  GstPromise *promise =
+      gst_promise_new_with_change_func(on_offer_created, session_ref(session), session_unref);
+  g_signal_emit_by_name(session->webrtcbin, "create-offer", NULL, promise);
+}
+
+static void on_negotiation_needed(GstElement *webrtcbin, gpointer user_data) {
+  create_offer(user_data);
+}
+
+static void on_ice_candidate(GstElement *webrtcbin, guint mline, gchar *candidate,
+                             gpointer user_data) {
+  WebRTCSession *session = user_data;
+  SignalingMessage message = {"candidate", NULL, mline, candidate, NULL};
+  signaling_peer_send(session->peer, &message);
+}
+
+WebRTCSession *webrtc_session_new(GstElement *webrtcbin, SignalingPeer *peer) {
+  WebRTCSession *session = g_rc_box_new0(WebRTCSession);
+  session->webrtcbin = gst_object_ref(webrtcbin);
+  session->peer = signaling_peer_ref(peer);
+  // The handlers hold a reference, so one running on a streaming thread
+  // outlives webrtc_session_free().
+  session->negotiation_id =
+      g_signal_connect_data(webrtcbin, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed),
+                            session_ref(session), (GClosureNotify)session_unref, 0);
+  session->candidate_id =
+      g_signal_connect_data(webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate),
+                            session_ref(session), (GClosureNotify)session_unref, 0);
+  create_offer(session);
+  return session;
+}
+
+SignalingPeer *webrtc_session_get_peer(WebRTCSession *session) {
+  return session->peer;
+}
+
+GstWebRTCSessionDescription *webrtc_session_parse_description(GstWebRTCSDPType type,
+                                                              const gchar *sdp) {
+  GstSDPMessage *message;
+  if (gst_sdp_message_new_from_text(sdp, &message) != GST_SDP_OK) return NULL;
+  return gst_webrtc_session_description_new(type, message);
+}
+
+void webrtc_session_set_answer(WebRTCSession *session, const gchar *sdp) {
+  GstWebRTCSessionDescription *answer =
+      webrtc_session_parse_description(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
+  if (!answer) {
+    g_printerr("[signaling] %s: the answer is not valid SDP\n",
+               signaling_peer_get_name(session->peer));
+    return;
+  }
+  g_signal_emit_by_name(session->webrtcbin, "set-remote-description", answer, NULL);
+  gst_webrtc_session_description_free(answer);
+  g_atomic_int_set(&session->offering, 0);
+}
+
+void webrtc_session_add_candidate(WebRTCSession *session, guint mline, const gchar *candidate) {
+  g_signal_emit_by_name(session->webrtcbin, "add-ice-candidate", mline, candidate);
+}
+
+void webrtc_session_free(WebRTCSession *session) {
+  g_signal_handler_disconnect(session->webrtcbin, session->negotiation_id);
+  g_signal_handler_disconnect(session->webrtcbin, session->candidate_id);
+  session_unref(session);
+}
@@ -0,0 +1,31 @@
+#ifndef WEBRTC_SESSION_H
+#define WEBRTC_SESSION_H
+
+#include "signaling-server.h"
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/webrtc/webrtc.h>
+
+// Negotiates one webrtcbin with one viewer. The offer is created as soon as
+// the session is, and again whenever webrtcbin asks for renegotiation, which
+// it only does once the previous answer is in. Local ICE candidates are sent
+// the moment they are gathered, remote ones added as they arrive.
+typedef struct _WebRTCSession WebRTCSession;
+
+// `webrtcbin` must already have its send pads linked.
+WebRTCSession *webrtc_session_new(GstElement *webrtcbin, SignalingPeer *peer);
+
+SignalingPeer *webrtc_session_get_peer(WebRTCSession *session);
+
+void webrtc_session_set_answer(WebRTCSession *session, const gchar *sdp);
+
+void webrtc_session_add_candidate(WebRTCSession *session, guint mline, const gchar *candidate);
+
+// NULL if `sdp` is not valid SDP. Shared with the copy-paste mode of
+// screencast-webrtc.
+GstWebRTCSessionDescription *webrtc_session_parse_description(GstWebRTCSDPType type,
+                                                              const gchar *sdp);
+
+void webrtc_session_free(WebRTCSession *session);
+
+#endif // !WEBRTC_SESSION_H
@@ -0,0 +1,240 @@
+#include "webrtc-viewer.h"
+#include "signaling-server.h"
+#include "webrtc-session.h"
+#include <gst/gst.h>
+#include <gst/webrtc/webrtc.h>
+#include <libsoup/soup.h>
+
+struct _WebRTCViewer {
+  GMainContext *context;
+  SoupSession *session;
+  SoupWebsocketConnection *connection; // NULL until connected
+  GstElement *pipeline;
+  GstElement *webrtcbin;
+  gint connected; // atomic, reported once
+  gint frames;    // atomic
+};
+
+typedef struct {
+  WebRTCViewer *viewer;
+  gchar *text;
+} Outgoing;
+
+static void viewer_clear(gpointer data) {
+  WebRTCViewer *viewer = data;
+  if (viewer->connection) g_object_unref(viewer->connection);
+  g_object_unref(viewer->session);
+  g_main_context_unref(viewer->context);
+}
+
+static void viewer_unref(gpointer data) {
+  g_rc_box_release_full(data, viewer_clear);
+}
+
+static gboolean is_open(SoupWebsocketConnection *connection) {
+  return connection &&
+         soup_websocket_connection_get_state(connection) == SOUP_WEBSOCKET_STATE_OPEN;
+}
+
+static gboolean send_now(gpointer user_data) {
+  Outgoing *out = user_data;
+  if (is_open(out->viewer->connection)) {
+    soup_websocket_connection_send_text(out->viewer->connection, out->text);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static void outgoing_free(gpointer data) {
+  Outgoing *out = data;
+  viewer_unref(out->viewer);
+  g_free(out->text);
+  g_free(out);
+}
+
+// The WebSocket belongs to the main context; webrtcbin calls from its own.
+static void send_message(WebRTCViewer *viewer, const SignalingMessage *message) {
+  Outgoing *out = g_new(Outgoing, 1);
+  out->viewer = g_rc_box_acquire(viewer);
+  out->text = signaling_message_to_json(message);
+  g_main_context_invoke_full(viewer->context, G_PRIORITY_DEFAULT, send_now, out, outgoing_free);
+}
+
+static void send_event(WebRTCViewer *viewer, const gchar *type) {
+  SignalingMessage message = {(gchar *)type, NULL, 0, NULL, NULL};
+  send_message(viewer, &message);
+}
+
+static GstPadProbeReturn on_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  WebRTCViewer *viewer = user_data;
+  if (g_atomic_int_add(&viewer->frames, 1) == 0) send_event(viewer, "first-frame");
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean is_video(GstPad *pad) {
+  GstCaps *caps = gst_pad_query_caps(pad, NULL);
+  const gchar *media = NULL;
+  if (!gst_caps_is_empty(caps)) {
+    media = gst_structure_get_string(gst_caps_get_structure(caps, 0), "media");
+  }
+  gboolean video = g_strcmp0(media, "video") == 0;
+  gst_caps_unref(caps);
+  return video;
+}
+
+// Video is decoded, as the browser would; audio is only received.
+static void on_pad_added(GstElement *webrtcbin, GstPad *pad, gpointer user_data) {
+  WebRTCViewer *viewer = user_data;
+  if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC) return;
+  gboolean video = is_video(pad);
+  GstElement *bin = gst_parse_bin_from_description(
+      video ? "queue ! decodebin ! fakesink name=frames sync=false"
+            : "queue ! fakesink sync=false",
+      TRUE, NULL);
+  if (!bin) return;
+  gst_bin_add(GST_BIN(viewer->pipeline), bin);
+  if (video) {
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), "frames");
+    GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(sinkpad, GST_PAD_PROBE_TYPE_BUFFER, on_frame, viewer, NULL);
+    gst_object_unref(sinkpad);
+    gst_object_unref(sink);
+  }
+  gst_element_sync_state_with_parent(bin);
+  GstPad *binpad = gst_element_get_static_pad(bin, "sink");
+  gst_pad_link(pad, binpad);
+  gst_object_unref(binpad);
+}
+
+static void on_ice_candidate(GstElement *webrtcbin, guint mline, gchar *candidate,
+                             gpointer user_data) {
+  SignalingMessage message = {"candidate", NULL, mline, candidate, NULL};
+  send_message(user_data, &message);
+}
+
+static void on_ice_connection_state(GstElement *webrtcbin, GParamSpec *pspec,
+                                    gpointer user_data) {
+  WebRTCViewer *viewer = user_data;
+  GstWebRTCICEConnectionState state;
+  g_object_get(webrtcbin, "ice-connection-state", &state, NULL);
+  if ((state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED ||
+       state == GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED) &&
+      g_atomic_int_compare_and_exchange(&viewer->connected, 0, 1)) {
+    send_event(viewer, "connected");
+  }
+}
+
+static void on_answer_created(GstPromise *promise, gpointer user_data) {
+  WebRTCViewer *viewer = user_data;
+  GstWebRTCSessionDescription *answer = NULL;
+  const GstStructure *reply = gst_promise_get_reply(promise);
+  if (reply) gst_structure_get(reply, "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+  gst_promise_unref(promise);
+  if (!answer) {
+    g_printerr("[viewer] webrtcbin could not create an answer\n");
+    return;
+  }
+  g_signal_emit_by_name(viewer->webrtcbin, "set-local-description", answer, NULL);
+  gchar *sdp = gst_sdp_message_as_text(answer->sdp);
+  SignalingMessage message = {"answer", sdp, 0, NULL, NULL};
+  send_message(viewer, &message);
+  g_free(sdp);
+  gst_webrtc_session_description_free(answer);
+}
+
+static void on_offer(WebRTCViewer *viewer, const gchar *sdp) {
+  GstWebRTCSessionDescription *offer =
+      webrtc_session_parse_description(GST_WEBRTC_SDP_TYPE_OFFER, sdp);
+  if (!offer) {
+    g_printerr("[viewer] the offer is not valid SDP\n");
+    return;
+  }
+  g_signal_emit_by_name(viewer->webrtcbin, "set-remote-description", offer, NULL);
+  gst_webrtc_session_description_free(offer);
+  GstPromise *promise = gst_promise_new_with_change_func(
+      on_answer_created, g_rc_box_acquire(viewer), viewer_unref);
+  g_signal_emit_by_name(viewer->webrtcbin, "create-answer", NULL, promise);
+}
+
+static void on_message(SoupWebsocketConnection *connection, gint type, GBytes *bytes,
+                       gpointer user_data) {
+  WebRTCViewer *viewer = user_data;
+  gsize size;
+  const gchar *text = g_bytes_get_data(bytes, &size);
+  SignalingMessage message;
+  if (type != SOUP_WEBSOCKET_DATA_TEXT || !signaling_message_parse(text, size, &message)) return;
+  if (g_strcmp0(message.type, "offer") == 0 && message.sdp) {
+    on_offer(viewer, message.sdp);
+  } else if (g_strcmp0(message.type, "candidate") == 0 && message.candidate) {
+    g_signal_emit_by_name(viewer->webrtcbin, "add-ice-candidate", message.mline,
+                          message.candidate);
+  } else if (g_strcmp0(message.type, "error") == 0) {
+    g_printerr("[viewer] server: %s\n", message.message ? message.message : "error");
+  }
+  signaling_message_clear(&message);
+}
+
+static void on_connected(GObject *source, GAsyncResult *result, gpointer user_data) {
+  WebRTCViewer *viewer = user_data;
+  GError *error = NULL;
+  SoupWebsocketConnection *connection =
+      soup_session_websocket_connect_finish(SOUP_SESSION(source), result, &error);
+  if (connection) {
+    viewer->connection = connection;
+    g_signal_connect(connection, "message", G_CALLBACK(on_message), viewer);
+  } else {
+    g_printerr("[viewer] %s\n", error->message);
+    g_error_free(error);
+  }
+  viewer_unref(viewer);
+}
+
+WebRTCViewer *webrtc_viewer_new(const gchar *url) {
+  GUri *page = g_uri_parse(url, G_URI_FLAGS_NONE, NULL);
+  if (!page) return NULL;
+  GstElement *webrtcbin = gst_element_factory_make("webrtcbin", NULL);
+  if (!webrtcbin) {
+    g_uri_unref(page);
+    return NULL;
+  }
+
+  WebRTCViewer *viewer = g_rc_box_new0(WebRTCViewer);
+  viewer->context = g_main_context_ref_thread_default();
+  viewer->session = soup_session_new();
+  viewer->pipeline = gst_pipeline_new(NULL);
+  viewer->webrtcbin = webrtcbin;
+  gst_util_set_object_arg(G_OBJECT(webrtcbin), "bundle-policy", "max-bundle");
+  gst_bin_add(GST_BIN(viewer->pipeline), webrtcbin);
+  g_signal_connect(webrtcbin, "pad-added", G_CALLBACK(on_pad_added), viewer);
+  g_signal_connect(webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate), viewer);
+  g_signal_connect(webrtcbin, "notify::ice-connection-state",
+                   G_CALLBACK(on_ice_connection_state), viewer);
+  gst_element_set_state(viewer->pipeline, GST_STATE_PLAYING);
+
+  GUri *socket = g_uri_build(G_URI_FLAGS_NONE, "ws", NULL, g_uri_get_host(page),
+                             g_uri_get_port(page), "/ws", NULL, NULL);
+  SoupMessage *msg = soup_message_new_from_uri(SOUP_METHOD_GET, socket);
+  soup_session_websocket_connect_async(viewer->session, msg, NULL, NULL, G_PRIORITY_DEFAULT,
+                                       NULL, on_connected, g_rc_box_acquire(viewer));
+  g_object_unref(msg);
+  g_uri_unref(socket);
+  g_uri_unref(page);
+  return viewer;
+}
+
+guint webrtc_viewer_get_frames(WebRTCViewer *viewer) {
+  return (guint)g_atomic_int_get(&viewer->frames);
+}
+
+void webrtc_viewer_free(WebRTCViewer *viewer) {
+  // Joins the streaming threads, so no callback runs after this.
+  gst_element_set_state(viewer->pipeline, GST_STATE_NULL);
+  g_signal_handlers_disconnect_by_data(viewer->webrtcbin, viewer);
+  gst_object_unref(viewer->pipeline);
+  if (viewer->connection) {
+    g_signal_handlers_disconnect_by_data(viewer->connection, viewer);
+    if (is_open(viewer->connection)) {
+      soup_websocket_connection_close(viewer->connection, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    }
+  }
+  viewer_unref(viewer);
+}
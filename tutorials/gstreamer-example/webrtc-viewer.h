@@ -0,0 +1,20 @@
+#ifndef WEBRTC_VIEWER_H
+#define WEBRTC_VIEWER_H
+
+#include <glib.h>
+
+// A headless stand-in for screen_webrtc.html: connects to a signaling
+// server's WebSocket, answers its offer with a webrtcbin of its own, trickles
+// candidates both ways and decodes what arrives into fakesinks. It tells the
+// server "connected" and "first-frame" just like the page does.
+typedef struct _WebRTCViewer WebRTCViewer;
+
+// `url` is the page address of the server, e.g. "http://127.0.0.1:8080/".
+WebRTCViewer *webrtc_viewer_new(const gchar *url);
+
+// Decoded video frames so far.
+guint webrtc_viewer_get_frames(WebRTCViewer *viewer);
+
+void webrtc_viewer_free(WebRTCViewer *viewer);
+
+#endif // !WEBRTC_VIEWER_H
@@ -0,0 +1,508 @@
+// fallocate() and FALLOC_FL_KEEP_SIZE are GNU extensions.
+#define _GNU_SOURCE
+
+#include "write-behind-sink.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_ALIGN 4096
+#define MAX_BLOCK_AGE_US (500 * G_TIME_SPAN_MILLISECOND)
+#define LATENCY_SAMPLES 4096
+#define MAX_FREE_BLOCKS 4
+
+typedef struct {
+  guint64 offset;
+  gsize len;
+  gsize capacity; // block_size, less what it takes to end on a BLOCK_ALIGN file offset
+  gint64 created;
+  guint8 *data; // block_size bytes, BLOCK_ALIGN aligned
+} Block;
+
+struct _WriteBehindSink {
+  GstBaseSink parent_instance;
+  gchar *location;
+  guint block_size;
+  guint64 preallocate;
+  guint64 max_backlog;
+
+  // Streaming thread only.
+  int fd;
+  guint64 position;
+  Block *block; // being filled
+
+  // Shared with the I/O thread, guarded by lock.
+  GMutex lock;
+  GCond work;    // a block was queued, or quit
+  GCond drained; // a block was written
+  GQueue queue;
+  GQueue free_blocks;
+  guint64 backlog; // queued plus in flight
+  gboolean flushing;
+  gboolean quit;
+  int error; // errno of the first failed write
+  GThread *thread;
+
+  // I/O thread only.
+  guint64 allocated;
+  guint64 end; // of the data written; muxers seek back, so not bytes_written
+  gboolean can_preallocate;
+
+  // Stats, guarded by lock.
+  guint64 bytes_written;
+  guint64 writes;
+  guint64 peak_backlog;
+  guint stalls;
+  gint64 latencies[LATENCY_SAMPLES]; // microseconds, ring
+  guint n_latencies;
+};
+
+G_DEFINE_TYPE(WriteBehindSink, write_behind_sink, GST_TYPE_BASE_SINK)
+
+enum { PROP_0, PROP_LOCATION, PROP_BLOCK_SIZE, PROP_PREALLOCATE, PROP_MAX_BACKLOG, LAST_PROP };
+
+static GParamSpec *properties[LAST_PROP];
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE(
+    "sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static Block *block_new(WriteBehindSink *self) {
+  g_mutex_lock(&self->lock);
+  Block *block = g_queue_pop_head(&self->free_blocks);
+  g_mutex_unlock(&self->lock);
+
+  if (!block) {
+    block = g_new0(Block, 1);
+    if (posix_memalign((void **)&block->data, BLOCK_ALIGN, self->block_size) != 0) {
+      g_free(block);
+      return NULL;
+    }
+  }
+  // After a partial block or a seek, a shorter block puts the following
+  // ones back on page-aligned file offsets.
+  block->offset = self->position;
+  block->len = 0;
+  block->capacity = self->block_size - self->position % BLOCK_ALIGN;
+  block->created = g_get_monotonic_time();
+  return block;
+}
+
+static void block_free(Block *block) {
+  free(block->data);
+  g_free(block);
+}
+
+static gboolean write_all(int fd, const Block *block) {
+  gsize done = 0;
+  while (done < block->len) {
+    gssize n = pwrite(fd, block->data + done, block->len - done, block->offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    done += n;
+  }
+  return TRUE;
+}
+
+// Reserves space in large steps so the filesystem can lay the file out
+// contiguously; KEEP_SIZE leaves the visible file length alone.
+static void preallocate(WriteBehindSink *self, guint64 end) {
+  if (!self->can_preallocate || !self->preallocate || end <= self->allocated) return;
+  guint64 len = MAX(self->preallocate, end - self->allocated);
+  if (fallocate(self->fd, FALLOC_FL_KEEP_SIZE, self->allocated, len) == 0) {
+    self->allocated += len;
+  } else {
+    self->can_preallocate = FALSE;
+    GST_WARNING_OBJECT(self, "fallocate failed: %s", g_strerror(errno));
+  }
+}
+
+static gpointer io_thread(gpointer user_data) {
+  WriteBehindSink *self = user_data;
+
+  g_mutex_lock(&self->lock);
+  while (TRUE) {
+    while (g_queue_is_empty(&self->queue) && !self->quit) {
+      g_cond_wait(&self->work, &self->lock);
+    }
+    Block *block = g_queue_pop_head(&self->queue);
+    if (!block) break;
+    g_mutex_unlock(&self->lock);
+
+    preallocate(self, block->offset + block->len);
+    gint64 start = g_get_monotonic_time();
+    gboolean ok = write_all(self->fd, block);
+    int saved_errno = errno;
+    if (ok) self->end = MAX(self->end, block->offset + block->len);
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    g_mutex_lock(&self->lock);
+    if (!ok && !self->error) self->error = saved_errno ? saved_errno : EIO;
+    self->backlog -= block->len;
+    self->bytes_written += block->len;
+    self->writes++;
+    self->latencies[self->n_latencies++ % LATENCY_SAMPLES] = elapsed;
+    if (g_queue_get_length(&self->free_blocks) < MAX_FREE_BLOCKS) {
+      g_queue_push_tail(&self->free_blocks, block);
+    } else {
+      block_free(block);
+    }
+    g_cond_broadcast(&self->drained);
+  }
+  g_mutex_unlock(&self->lock);
+  return NULL;
+}
+
+static GstFlowReturn report_error(WriteBehindSink *self, int error) {
+  GST_ELEMENT_ERROR(self, RESOURCE, WRITE, ("Could not write to file \"%s\".", self->location),
+                    ("%s", g_strerror(error)));
+  return GST_FLOW_ERROR;
+}
+
+// Hands the current block to the I/O thread. Only blocks if the backlog is
+// over max-backlog, which is the one place the disk can push back.
+static GstFlowReturn submit_block(WriteBehindSink *self) {
+  Block *block = self->block;
+  if (!block) return GST_FLOW_OK;
+  self->block = NULL;
+
+  g_mutex_lock(&self->lock);
+  if (self->backlog + block->len > self->max_backlog) self->stalls++;
+  while (!self->error && !self->flushing &&
+         self->backlog > 0 && self->backlog + block->len > self->max_backlog) {
+    g_cond_wait(&self->drained, &self->lock);
+  }
+  int error = self->error;
+  gboolean flushing = self->flushing;
+  if (!error && !flushing) {
+    g_queue_push_tail(&self->queue, block);
+    self->backlog += block->len;
+    self->peak_backlog = MAX(self->peak_backlog, self->backlog);
+    g_cond_signal(&self->work);
+    block = NULL;
+  }
+  g_mutex_unlock(&self->lock);
+
+  if (block) block_free(block);
+  if (error) return report_error(self, error);
+  return flushing ? GST_FLOW_FLUSHING : GST_FLOW_OK;
+}
+
+// Waits until everything queued so far is on disk.
+static GstFlowReturn drain(WriteBehindSink *self, gboolean sync) {
+  GstFlowReturn ret = submit_block(self);
+  if (ret != GST_FLOW_OK) return ret;
+
+  g_mutex_lock(&self->lock);
+  while (self->backlog > 0 && !self->error && !self->flushing) {
+    g_cond_wait(&self->drained, &self->lock);
+  }
+  int error = self->error;
+  g_mutex_unlock(&self->lock);
+
+  if (!error && sync && fdatasync(self->fd) != 0) error = errno;
+  return error ? report_error(self, error) : GST_FLOW_OK;
+}
+
+static GstFlowReturn write_behind_sink_render(GstBaseSink *sink, GstBuffer *buffer) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(sink);
+  GstMapInfo map;
+  if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) return GST_FLOW_ERROR;
+
+  GstFlowReturn ret = GST_FLOW_OK;
+  const guint8 *data = map.data;
+  gsize left = map.size;
+  while (left > 0 && ret == GST_FLOW_OK) {
+    if (!self->block && !(self->block = block_new(self))) {
+      ret = report_error(self, ENOMEM);
+      break;
+    }
+    gsize n = MIN(left, self->block->capacity - self->block->len);
+    memcpy(self->block->data + self->block->len, data, n);
+    self->block->len += n;
+    self->position += n;
+    data += n;
+    left -= n;
+    if (self->block->len == self->block->capacity) ret = submit_block(self);
+  }
+  gst_buffer_unmap(buffer, &map);
+
+  // Do not sit on a partial block for long at low bitrates.
+  if (ret == GST_FLOW_OK && self->block &&
+      g_get_monotonic_time() - self->block->created > MAX_BLOCK_AGE_US) {
+    ret = submit_block(self);
+  }
+  return ret;
+}
+
+static gboolean write_behind_sink_event(GstBaseSink *sink, GstEvent *event) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(sink);
+
+  switch (GST_EVENT_TYPE(event)) {
+  case GST_EVENT_SEGMENT: {
+    // Muxers seek back with a byte segment to rewrite their headers.
+    const GstSegment *segment;
+    gst_event_parse_segment(event, &segment);
+    if (segment->format == GST_FORMAT_BYTES && segment->start != self->position) {
+      if (submit_block(self) != GST_FLOW_OK) {
+        gst_event_unref(event);
+        return FALSE;
+      }
+      self->position = segment->start;
+    }
+    break;
+  }
+  case GST_EVENT_EOS:
+    if (drain(self, TRUE) != GST_FLOW_OK) {
+      gst_event_unref(event);
+      return FALSE;
+    }
+    break;
+  case GST_EVENT_FLUSH_STOP:
+    if (self->block) {
+      block_free(self->block);
+      self->block = NULL;
+    }
+    break;
+  default:
+    break;
+  }
+  return GST_BASE_SINK_CLASS(write_behind_sink_parent_class)->event(sink, event);
+}
+
+static gboolean write_behind_sink_query(GstBaseSink *sink, GstQuery *query) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(sink);
+  GstFormat format;
+
+  switch (GST_QUERY_TYPE(query)) {
+  case GST_QUERY_SEEKING:
+    gst_query_parse_seeking(query, &format, NULL, NULL, NULL);
+    gst_query_set_seeking(query, format, format == GST_FORMAT_BYTES, 0, -1);
+    return TRUE;
+  case GST_QUERY_POSITION:
+    gst_query_parse_position(query, &format, NULL);
+    if (format != GST_FORMAT_BYTES && format != GST_FORMAT_DEFAULT) break;
+    gst_query_set_position(query, GST_FORMAT_BYTES, self->position);
+    return TRUE;
+  default:
+    break;
+  }
+  return GST_BASE_SINK_CLASS(write_behind_sink_parent_class)->query(sink, query);
+}
+
+static gboolean write_behind_sink_start(GstBaseSink *sink) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(sink);
+  if (!self->location) {
+    GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND, ("No file name specified for writing."), (NULL));
+    return FALSE;
+  }
+
+  self->fd = g_open(self->location, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (self->fd < 0) {
+    GST_ELEMENT_ERROR(self, RESOURCE, OPEN_WRITE, ("Could not open file \"%s\" for writing.", self->location),
+                      ("%s", g_strerror(errno)));
+    return FALSE;
+  }
+
+  self->position = 0;
+  self->allocated = self->end = 0;
+  self->can_preallocate = TRUE;
+  self->backlog = self->peak_backlog = 0;
+  self->bytes_written = self->writes = 0;
+  self->stalls = self->n_latencies = 0;
+  self->error = 0;
+  self->quit = FALSE;
+  self->thread = g_thread_new("writebehind", io_thread, self);
+  return TRUE;
+}
+
+static gboolean write_behind_sink_stop(GstBaseSink *sink) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(sink);
+
+  // Whatever is still queued gets written; only a failed disk loses data.
+  if (self->block) {
+    g_mutex_lock(&self->lock);
+    g_queue_push_tail(&self->queue, self->block);
+    self->backlog += self->block->len;
+    g_mutex_unlock(&self->lock);
+    self->block = NULL;
+  }
+
+  g_mutex_lock(&self->lock);
+  self->quit = TRUE;
+  g_cond_signal(&self->work);
+  g_mutex_unlock(&self->lock);
+  g_thread_join(self->thread);
+  self->thread = NULL;
+
+  g_queue_clear_full(&self->free_blocks, (GDestroyNotify)block_free);
+  // Gives back what was reserved past the end of the data, up to
+  // `preallocate` bytes that would otherwise stay allocated to the file.
+  if (self->allocated > self->end && ftruncate(self->fd, self->end) != 0) {
+    GST_WARNING_OBJECT(self, "ftruncate failed: %s", g_strerror(errno));
+  }
+  close(self->fd);
+  self->fd = -1;
+  return TRUE;
+}
+
+static gboolean write_behind_sink_unlock(GstBaseSink *sink) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(sink);
+  g_mutex_lock(&self->lock);
+  self->flushing = TRUE;
+  g_cond_broadcast(&self->drained);
+  g_mutex_unlock(&self->lock);
+  return TRUE;
+}
+
+static gboolean write_behind_sink_unlock_stop(GstBaseSink *sink) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(sink);
+  g_mutex_lock(&self->lock);
+  self->flushing = FALSE;
+  g_mutex_unlock(&self->lock);
+  return TRUE;
+}
+
+static gint compare_latency(gconstpointer a, gconstpointer b) {
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return x < y ? -1 : x > y;
+}
+
+gchar *write_behind_sink_stats(WriteBehindSink *self) {
+  gint64 samples[LATENCY_SAMPLES];
+
+  g_mutex_lock(&self->lock);
+  guint n = MIN(self->n_latencies, LATENCY_SAMPLES);
+  memcpy(samples, self->latencies, n * sizeof(*samples));
+  guint64 bytes = self->bytes_written, writes = self->writes;
+  guint64 backlog = self->backlog, peak = self->peak_backlog;
+  guint stalls = self->stalls;
+  g_mutex_unlock(&self->lock);
+
+  qsort(samples, n, sizeof(*samples), compare_latency);
+#define PERCENTILE_MS(p) (n ? samples[MIN(n - 1, n * (p) / 100)] / 1000.0 : 0.0)
+  gchar *stats = g_strdup_printf(
+      "[writer] %.1f MiB in %" G_GUINT64_FORMAT " writes, backlog %.1f MiB "
+      "(peak %.1f MiB), latency p50 %.1f ms p95 %.1f ms p99 %.1f ms max %.1f ms, "
+      "%u stalls",
+      bytes / 1048576.0, writes, backlog / 1048576.0, peak / 1048576.0,
+      PERCENTILE_MS(50), PERCENTILE_MS(95), PERCENTILE_MS(99),
+      PERCENTILE_MS(100), stalls);
+#undef PERCENTILE_MS
+  return stats;
+}
+
+static void write_behind_sink_get_property(GObject *object, guint prop_id,
+                                           GValue *value, GParamSpec *pspec) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(object);
+  switch (prop_id) {
+  case PROP_LOCATION:
+    g_value_set_string(value, self->location);
+    break;
+  case PROP_BLOCK_SIZE:
+    g_value_set_uint(value, self->block_size);
+    break;
+  case PROP_PREALLOCATE:
+    g_value_set_uint64(value, self->preallocate);
+    break;
+  case PROP_MAX_BACKLOG:
+    g_value_set_uint64(value, self->max_backlog);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+  }
+}
+
+static void write_behind_sink_set_property(GObject *object, guint prop_id,
+                                           const GValue *value,
+                                           GParamSpec *pspec) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(object);
+  switch (prop_id) {
+  case PROP_LOCATION:
+    g_free(self->location);
+    self->location = g_value_dup_string(value);
+    break;
+  case PROP_BLOCK_SIZE:
+    // Whole pages, so every full block lands on a page boundary.
+    self->block_size = GST_ROUND_UP_N(g_value_get_uint(value), BLOCK_ALIGN);
+    g_queue_clear_full(&self->free_blocks, (GDestroyNotify)block_free);
+    break;
+  case PROP_PREALLOCATE:
+    self->preallocate = g_value_get_uint64(value);
+    break;
+  case PROP_MAX_BACKLOG:
+    self->max_backlog = g_value_get_uint64(value);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+  }
+}
+
+static void write_behind_sink_finalize(GObject *object) {
+  WriteBehindSink *self = WRITE_BEHIND_SINK(object);
+  g_free(self->location);
+  g_queue_clear_full(&self->free_blocks, (GDestroyNotify)block_free);
+  g_mutex_clear(&self->lock);
+  g_cond_clear(&self->work);
+  g_cond_clear(&self->drained);
+  G_OBJECT_CLASS(write_behind_sink_parent_class)->finalize(object);
+}
+
+static void write_behind_sink_class_init(WriteBehindSinkClass *klass) {
+  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+  GstBaseSinkClass *sink_class = GST_BASE_SINK_CLASS(klass);
+
+  object_class->get_property = write_behind_sink_get_property;
+  object_class->set_property = write_behind_sink_set_property;
+  object_class->finalize = write_behind_sink_finalize;
+
+  properties[PROP_LOCATION] = g_param_spec_string(
+      "location", "File Location", "Location of the file to write", NULL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  properties[PROP_BLOCK_SIZE] = g_param_spec_uint(
+      "block-size", "Block size", "Bytes coalesced into one write", 64 * 1024,
+      64 * 1024 * 1024, 4 * 1024 * 1024, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  properties[PROP_PREALLOCATE] = g_param_spec_uint64(
+      "preallocate", "Preallocate", "Bytes reserved ahead of the write position (0 = off)",
+      0, G_MAXUINT64, 256 * 1024 * 1024, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  properties[PROP_MAX_BACKLOG] = g_param_spec_uint64(
+      "max-backlog", "Max backlog", "Bytes queued for the I/O thread before upstream blocks",
+      0, G_MAXUINT64, 512 * 1024 * 1024, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_properties(object_class, LAST_PROP, properties);
+
+  gst_element_class_add_static_pad_template(element_class, &sink_template);
+  gst_element_class_set_static_metadata(
+      element_class, "Write-behind file sink", "Sink/File",
+      "Writes to a file from a separate I/O thread in large preallocated blocks",
+      "glib-tutorials");
+
+  sink_class->render = write_behind_sink_render;
+  sink_class->event = write_behind_sink_event;
+  sink_class->query = write_behind_sink_query;
+  sink_class->start = write_behind_sink_start;
+  sink_class->stop = write_behind_sink_stop;
+  sink_class->unlock = write_behind_sink_unlock;
+  sink_class->unlock_stop = write_behind_sink_unlock_stop;
+}
+
+static void write_behind_sink_init(WriteBehindSink *self) {
+  self->fd = -1;
+  self->block_size = 4 * 1024 * 1024;
+  self->preallocate = 256 * 1024 * 1024;
+  self->max_backlog = 512 * 1024 * 1024;
+  g_mutex_init(&self->lock);
+  g_cond_init(&self->work);
+  g_cond_init(&self->drained);
+  g_queue_init(&self->queue);
+  g_queue_init(&self->free_blocks);
+  // Like filesink: written files are not synchronised to the clock.
+  gst_base_sink_set_sync(GST_BASE_SINK(self), FALSE);
+}
+
+gboolean write_behind_sink_register(void) {
+  return gst_element_register(NULL, "writebehindsink", GST_RANK_NONE,
+                              WRITE_BEHIND_SINK_TYPE);
+}
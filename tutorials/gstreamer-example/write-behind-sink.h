@@ -0,0 +1,23 @@
+#ifndef WRITE_BEHIND_SINK_H
+#define WRITE_BEHIND_SINK_H
+
+#include <gst/base/gstbasesink.h>
+
+// "writebehindsink": a filesink replacement that copies buffers into large
+// page-aligned blocks and hands them to its own I/O thread, so a slow write()
+// does not stall the streaming thread. Blocks end on page boundaries of the
+// file too, also after a partial block was flushed or a muxer seeked. File space is preallocated with
+// fallocate() ahead of the write position; what is left unused is released
+// on stop. Byte seeks from muxers rewriting their headers are supported.
+#define WRITE_BEHIND_SINK_TYPE (write_behind_sink_get_type())
+G_DECLARE_FINAL_TYPE(WriteBehindSink, write_behind_sink, WRITE_BEHIND, SINK,
+                     GstBaseSink)
+
+// Registers the element with the static plugin registry, after gst_init().
+gboolean write_behind_sink_register(void);
+
+// "[writer] 812.4 MiB in 204 writes, backlog 0.0 MiB (peak 12.0 MiB),
+//  latency p50 1.8 ms p95 4.1 ms p99 9.7 ms max 31.2 ms, 0 stalls"
+gchar *write_behind_sink_stats(WriteBehindSink *self);
+
+#endif // !WRITE_BEHIND_SINK_H
@@ -0,0 +1,89 @@
+#include "exclusion_rules.h"
+
+typedef enum { RULE_APP, RULE_BINARY, RULE_PID } RuleKind;
+
+typedef struct {
+  RuleKind kind;
+  GPatternSpec *pattern; // lower case, for RULE_APP and RULE_BINARY
+  guint32 pid;
+} Rule;
+
+struct _ExclusionRules {
+  GArray *rules; // Rule
+};
+
+static void rule_clear(gpointer data) {
+  Rule *rule = data;
+  if (rule->pattern) g_pattern_spec_free(rule->pattern);
+}
+
+ExclusionRules *exclusion_rules_new(void) {
+  ExclusionRules *rules = g_new0(ExclusionRules, 1);
+  rules->rules = g_array_new(FALSE, TRUE, sizeof(Rule));
+  g_array_set_clear_func(rules->rules, rule_clear);
+  return rules;
+}
+
+gboolean exclusion_rules_add(ExclusionRules *rules, const gchar *text) {
+  Rule rule = {RULE_APP, NULL, 0};
+  const gchar *value = text;
+  if (g_str_has_prefix(text, "app:")) {
+    value = text + 4;
+  } else if (g_str_has_prefix(text, "binary:")) {
+    rule.kind = RULE_BINARY;
+    value = text + 7;
+  } else if (g_str_has_prefix(text, "pid:")) {
+    rule.kind = RULE_PID;
+    value = text + 4;
+  }
+  if (!*value) {
+    g_printerr("Empty exclusion rule \"%s\"\n", text);
+    return FALSE;
+  }
+
+  if (rule.kind == RULE_PID) {
+    guint64 pid;
+    if (!g_ascii_string_to_unsigned(value, 10, 1, G_MAXUINT32, &pid, NULL)) {
+      g_printerr("Exclusion rule \"%s\" needs a process id\n", text);
+      return FALSE;
+    }
+    rule.pid = (guint32)pid;
+  } else {
+    gchar *lower = g_ascii_strdown(value, -1);
+    rule.pattern = g_pattern_spec_new(lower);
+    g_free(lower);
+  }
+  g_array_append_val(rules->rules, rule);
+  return TRUE;
+}
+
+static gboolean pattern_matches(GPatternSpec *pattern, const gchar *value) {
+  if (!value) return FALSE;
+  gchar *lower = g_ascii_strdown(value, -1);
+  gboolean match = g_pattern_spec_match_string(pattern, lower);
+  g_free(lower);
+  return match;
+}
+
+gboolean exclusion_rules_match(const ExclusionRules *rules, const PulseSinkInput *input) {
+  for (guint i = 0; i < rules->rules->len; i++) {
+    const Rule *rule = &g_array_index(rules->rules, Rule, i);
+    switch (rule->kind) {
+    case RULE_APP:
+      if (pattern_matches(rule->pattern, input->application)) return TRUE;
+      break;
+    case RULE_BINARY:
+      if (pattern_matches(rule->pattern, input->binary)) return TRUE;
+      break;
+    case RULE_PID:
+      if (input->pid == rule->pid) return TRUE;
+      break;
+    }
+  }
+  return FALSE;
+}
+
+void exclusion_rules_free(ExclusionRules *rules) {
+  g_array_unref(rules->rules);
+  g_free(rules);
+}
@@ -0,0 +1,22 @@
+#ifndef EXCLUSION_RULES_H
+#define EXCLUSION_RULES_H
+
+#include "pulse_control.h"
+#include <glib.h>
+
+// Which sink inputs stay out of the broadcast. A rule is "app:PATTERN"
+// (application.name), "binary:PATTERN" (application.process.binary) or
+// "pid:N"; a bare pattern means "app:". Patterns are case-insensitive
+// globs, e.g. "app:*spotify*".
+typedef struct _ExclusionRules ExclusionRules;
+
+ExclusionRules *exclusion_rules_new(void);
+
+// Prints the problem and returns FALSE if `rule` cannot be parsed.
+gboolean exclusion_rules_add(ExclusionRules *rules, const gchar *rule);
+
+gboolean exclusion_rules_match(const ExclusionRules *rules, const PulseSinkInput *input);
+
+void exclusion_rules_free(ExclusionRules *rules);
+
+#endif // !EXCLUSION_RULES_H
@@ -0,0 +1,298 @@
+#include "pulse_check.h"
+#include "pulse_control.h"
+#include "sound_exclusion.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#define PHYSICAL_SINK "check_physical"
+#define PACTL_SINK "check_pactl"
+
+static gint runs = 5;
+static gchar *server = NULL;
+static GOptionEntry entries[] = {
+    {"runs", 'n', 0, G_OPTION_ARG_INT, &runs, "Setup/teardown cycles to time (default 5)", "N"},
+    {"server", 0, 0, G_OPTION_ARG_STRING, &server, "Use this running server instead of starting pulseaudio; its default sink counts as the physical one", "ADDRESS"},
+    {NULL}};
+
+// pulseaudio without any config, a null sink standing in for the sound card
+// and its socket in `dir`.
+static GSubprocess *start_daemon(const gchar *dir, gchar **address) {
+  gchar *program = g_find_program_in_path("pulseaudio");
+  if (!program) return NULL;
+  g_free(program);
+
+  gchar *socket = g_build_filename(dir, "native", NULL);
+  gchar *protocol = g_strdup_printf("module-native-protocol-unix auth-anonymous=1 socket=%s", socket);
+  GSubprocessLauncher *launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_STDOUT_SILENCE |
+                                                            G_SUBPROCESS_FLAGS_STDERR_SILENCE);
+  g_subprocess_launcher_setenv(launcher, "XDG_RUNTIME_DIR", dir, TRUE);
+  g_subprocess_launcher_setenv(launcher, "PULSE_RUNTIME_PATH", dir, TRUE);
+  GError *error = NULL;
+  GSubprocess *daemon = g_subprocess_launcher_spawn(
+      launcher, &error, "pulseaudio", "--daemonize=no", "-n", "--exit-idle-time=-1",
+      "--use-pid-file=no", "-L", protocol, "-L", "module-null-sink sink_name=" PHYSICAL_SINK,
+      NULL);
+  if (daemon) {
+    *address = g_strdup_printf("unix:%s", socket);
+  } else {
+    g_printerr("pulseaudio: %s\n", error->message);
+    g_error_free(error);
+  }
+  g_object_unref(launcher);
+  g_free(protocol);
+  g_free(socket);
+  return daemon;
+}
+
+static gboolean wait_for_server(const gchar *address) {
+  for (gint i = 0; i < 50; i++) {
+    PulseControl *probe = pulse_control_new(address, NULL);
+    if (probe) {
+      pulse_control_free(probe);
+      return TRUE;
+    }
+    g_usleep(100 * 1000);
+  }
+  return FALSE;
+}
+
+// A silent stream whose sink input carries `name` as application.name.
+static GstElement *start_app(const gchar *name) {
+  gchar *desc = g_strdup_printf("audiotestsrc is-live=true wave=silence ! "
+                                "pulsesink client-name=%s",
+                                name);
+  GstElement *pipeline = gst_parse_launch(desc, NULL);
+  g_free(desc);
+  if (!pipeline) return NULL;
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  gst_element_get_state(pipeline, NULL, NULL, 5 * GST_SECOND);
+  return pipeline;
+}
+
+static void stop_app(GstElement *pipeline) {
+  if (!pipeline) return;
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+}
+
+// The cached sink input of `application`, NULL if there is none.
+static PulseSinkInput *find_app(PulseControl *pulse, const gchar *application) {
+  GPtrArray *inputs = pulse_control_list_sink_inputs(pulse);
+  PulseSinkInput *found = NULL;
+  for (guint i = 0; i < inputs->len && !found; i++) {
+    PulseSinkInput *input = inputs->pdata[i];
+    if (g_strcmp0(input->application, application) == 0) {
+      found = g_ptr_array_steal_index(inputs, i);
+    }
+  }
+  g_ptr_array_unref(inputs);
+  return found;
+}
+
+// Rule moves are answered on the connection's thread, so give them a moment.
+static gboolean app_on(PulseControl *pulse, const gchar *application, const gchar *sink) {
+  gboolean ok = FALSE;
+  for (gint i = 0; i < 20 && !ok; i++) {
+    if (i > 0) g_usleep(50 * 1000);
+    pulse_control_refresh(pulse);
+    PulseSinkInput *input = find_app(pulse, application);
+    ok = input && g_strcmp0(input->sink, sink) == 0;
+    if (input) pulse_sink_input_free(input);
+  }
+  g_print("  %s on %s: %s\n", application, sink, ok ? "yes" : "no");
+  return ok;
+}
+
+static gboolean default_is(PulseControl *pulse, const gchar *sink) {
+  pulse_control_refresh(pulse);
+  gchar *current = pulse_control_get_default_sink(pulse);
+  gboolean ok = g_strcmp0(current, sink) == 0;
+  g_print("  default sink %s: %s\n", sink, ok ? "yes" : "no");
+  g_free(current);
+  return ok;
+}
+
+// Exclusion setup, one app moved out of the broadcast by id and one by a
+// rule as soon as it starts, teardown.
+static gboolean check_exclusion(PulseControl *pulse, const gchar *physical) {
+  if (!sound_exclusion_start()) return FALSE;
+  gboolean ok = default_is(pulse, SOUND_EXCLUSION_SINK);
+  ok = sound_exclusion_add_rule("app:check-late*") && ok;
+
+  GstElement *kept = start_app("check-broadcast");
+  GstElement *hidden = start_app("check-hidden");
+  ok = ok && app_on(pulse, "check-broadcast", SOUND_EXCLUSION_SINK);
+  PulseSinkInput *input = find_app(pulse, "check-hidden");
+  if (input) {
+    ok = sound_exclusion_exclude(&input->index, 1) == 1 && ok;
+    pulse_sink_input_free(input);
+  } else {
+    ok = FALSE;
+  }
+  ok = ok && app_on(pulse, "check-hidden", physical) &&
+       app_on(pulse, "check-broadcast", SOUND_EXCLUSION_SINK);
+  GstElement *late = start_app("check-late");
+  ok = ok && app_on(pulse, "check-late", physical);
+  stop_app(late);
+  stop_app(kept);
+  stop_app(hidden);
+
+  restore_system();
+  return default_is(pulse, physical) && ok;
+}
+
+static gboolean pactl(const gchar *args, guint32 *index) {
+  gchar *cmd = g_strdup_printf("pactl %s", args);
+  gchar *output = NULL;
+  gint status = 0;
+  gboolean ok = g_spawn_command_line_sync(cmd, &output, NULL, &status, NULL) && status == 0;
+  if (ok && index) *index = (guint32)g_ascii_strtoull(output, NULL, 10);
+  g_free(output);
+  g_free(cmd);
+  return ok;
+}
+
+// The same setup and teardown with one pactl process per step, as before.
+static gboolean pactl_cycle(const gchar *physical, gdouble *setup_ms, gdouble *teardown_ms) {
+  guint32 null_module = 0, loop_module = 0;
+  gchar *loop_args = g_strdup_printf("load-module module-loopback source=" PACTL_SINK
+                                     ".monitor sink=%s",
+                                     physical);
+  gchar *restore_args = g_strdup_printf("set-default-sink %s", physical);
+  gint64 start = g_get_monotonic_time();
+  gchar *sink = NULL;
+  gboolean ok = g_spawn_command_line_sync("pactl get-default-sink", &sink, NULL, NULL, NULL) &&
+                pactl("load-module module-null-sink sink_name=" PACTL_SINK, &null_module) &&
+                pactl(loop_args, &loop_module) && pactl("set-default-sink " PACTL_SINK, NULL);
+  *setup_ms = (g_get_monotonic_time() - start) / 1000.0;
+
+  start = g_get_monotonic_time();
+  gchar *unload_null = g_strdup_printf("unload-module %u", null_module);
+  gchar *unload_loop = g_strdup_printf("unload-module %u", loop_module);
+  ok = pactl(restore_args, NULL) && pactl(unload_null, NULL) && pactl(unload_loop, NULL) && ok;
+  *teardown_ms = (g_get_monotonic_time() - start) / 1000.0;
+
+  g_free(unload_loop);
+  g_free(unload_null);
+  g_free(sink);
+  g_free(restore_args);
+  g_free(loop_args);
+  return ok;
+}
+
+static gint compare_doubles(gconstpointer a, gconstpointer b) {
+  gdouble x = *(const gdouble *)a, y = *(const gdouble *)b;
+  return x < y ? -1 : x > y;
+}
+
+static gdouble median(GArray *values) {
+  if (values->len == 0) return 0;
+  g_array_sort(values, compare_doubles);
+  return g_array_index(values, gdouble, values->len / 2);
+}
+
+static void time_cycles(const gchar *physical) {
+  GArray *setup = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  GArray *teardown = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  for (gint i = 0; i < runs; i++) {
+    gint64 start = g_get_monotonic_time();
+    if (!sound_exclusion_setup()) break;
+    gdouble ms = (g_get_monotonic_time() - start) / 1000.0;
+    g_array_append_val(setup, ms);
+    start = g_get_monotonic_time();
+    restore_system();
+    ms = (g_get_monotonic_time() - start) / 1000.0;
+    g_array_append_val(teardown, ms);
+  }
+  g_print("\nlibpulse: setup %.1f ms, teardown %.1f ms (median of %u)\n", median(setup),
+          median(teardown), setup->len);
+  g_array_set_size(setup, 0);
+  g_array_set_size(teardown, 0);
+
+  gchar *program = g_find_program_in_path("pactl");
+  for (gint i = 0; program && i < runs; i++) {
+    gdouble setup_ms, teardown_ms;
+    if (!pactl_cycle(physical, &setup_ms, &teardown_ms)) break;
+    g_array_append_val(setup, setup_ms);
+    g_array_append_val(teardown, teardown_ms);
+  }
+  if (setup->len) {
+    g_print("pactl:    setup %.1f ms, teardown %.1f ms (median of %u)\n", median(setup),
+            median(teardown), setup->len);
+  }
+  g_free(program);
+  g_array_unref(setup);
+  g_array_unref(teardown);
+}
+
+static void remove_dir(const gchar *path) {
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir) {
+    const gchar *name;
+    while ((name = g_dir_read_name(dir))) {
+      gchar *child = g_build_filename(path, name, NULL);
+      if (g_file_test(child, G_FILE_TEST_IS_DIR)) {
+        remove_dir(child);
+      } else {
+        g_unlink(child);
+      }
+      g_free(child);
+    }
+    g_dir_close(dir);
+  }
+  g_rmdir(path);
+}
+
+int pulse_check_tutorial(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new("- sound exclusion check");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_parse(context, &argc, &argv, NULL);
+  g_option_context_free(context);
+  gst_init(NULL, NULL);
+
+  gchar *dir = NULL;
+  GSubprocess *daemon = NULL;
+  gchar *address = g_strdup(server);
+  if (!address) {
+    dir = g_dir_make_tmp("pulse-check-XXXXXX", NULL);
+    daemon = start_daemon(dir, &address);
+    if (!daemon) {
+      g_print("SKIP: pulseaudio could not be started, try --server\n");
+      remove_dir(dir);
+      g_free(dir);
+      return 0;
+    }
+  }
+
+  // libpulse, pulsesink and pactl all follow PULSE_SERVER, so the user's
+  // own server is never touched.
+  g_setenv("PULSE_SERVER", address, TRUE);
+  gboolean ok = wait_for_server(address);
+  PulseControl *pulse = ok ? pulse_control_get_default() : NULL;
+  gchar *physical = pulse ? pulse_control_get_default_sink(pulse) : NULL;
+  ok = physical != NULL;
+  if (ok) {
+    g_print("Sound exclusion against %s, physical sink %s:\n", address, physical);
+    ok = check_exclusion(pulse, physical);
+    if (ok) time_cycles(physical);
+  } else {
+    g_printerr("Could not reach the sound server at %s\n", address);
+  }
+  g_print("%s\n", ok ? "PASS" : "FAIL");
+
+  g_free(physical);
+  g_free(address);
+  g_free(server);
+  if (daemon) {
+    g_subprocess_force_exit(daemon);
+    g_subprocess_wait(daemon, NULL, NULL);
+    g_object_unref(daemon);
+  }
+  if (dir) {
+    remove_dir(dir);
+    g_free(dir);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#ifndef PULSE_CHECK_H
+#define PULSE_CHECK_H
+
+// Runs sound exclusion against a headless pulseaudio with null sinks (or the
+// server given with --server): checks that the broadcast sink becomes the
+// default, that excluded apps move to the physical sink, including one that
+// starts after its rule was added, and that teardown restores everything, then times setup and teardown over libpulse
+// against the same steps done with one pactl process each.
+int pulse_check_tutorial(int argc, char *argv[]);
+
+#endif // !PULSE_CHECK_H
@@ -0,0 +1,390 @@
+#include "pulse_control.h"
+#include <gio/gio.h>
+#include <pulse/pulseaudio.h>
+
+struct _PulseControl {
+  pa_threaded_mainloop *mainloop;
+  pa_context *context;
+  // Everything below is only touched with the mainloop lock held.
+  gchar *default_sink;
+  GHashTable *sinks;       // index -> name
+  GHashTable *sink_inputs; // index -> CachedInput
+  PulseRouter router;
+  gpointer router_data;
+  gboolean batch;
+  guint pending; // answers the current batch still waits for
+  guint failures;
+};
+
+typedef struct {
+  gchar *application;
+  gchar *binary;
+  guint32 pid;
+  guint32 sink;
+} CachedInput;
+
+typedef struct {
+  PulseControl *control;
+  gboolean tracked; // part of a batch, not a refresh after a change event
+  guint32 *index;
+  gint64 created;        // monotonic time of a sink input's creation event, or 0
+  PulseSinkInput *input; // being moved by the router
+} Request;
+
+static void cached_input_free(gpointer data) {
+  CachedInput *input = data;
+  g_free(input->application);
+  g_free(input->binary);
+  g_free(input);
+}
+
+static Request *request_new(PulseControl *control, gboolean tracked, guint32 *index) {
+  Request *request = g_new0(Request, 1);
+  request->control = control;
+  request->tracked = tracked;
+  request->index = index;
+  return request;
+}
+
+static void request_done(Request *request, gboolean ok) {
+  PulseControl *control = request->control;
+  if (request->tracked) {
+    if (!ok) control->failures++;
+    control->pending--;
+    pa_threaded_mainloop_signal(control->mainloop, 0);
+  }
+  if (request->input) pulse_sink_input_free(request->input);
+  g_free(request);
+}
+
+// Counts a request that could not even be sent as failed.
+static void track(PulseControl *control, Request *request, pa_operation *operation) {
+  if (!operation) {
+    if (request->tracked) control->failures++;
+    if (request->input) pulse_sink_input_free(request->input);
+    g_free(request);
+    return;
+  }
+  if (request->tracked) control->pending++;
+  pa_operation_unref(operation);
+}
+
+static void on_success(pa_context *context, int success, void *data) {
+  request_done(data, success);
+}
+
+static void on_index(pa_context *context, uint32_t index, void *data) {
+  Request *request = data;
+  if (request->index) *request->index = index;
+  request_done(request, index != PA_INVALID_INDEX);
+}
+
+static void on_server_info(pa_context *context, const pa_server_info *info, void *data) {
+  Request *request = data;
+  if (info) {
+    g_free(request->control->default_sink);
+    request->control->default_sink = g_strdup(info->default_sink_name);
+  }
+  request_done(request, info != NULL);
+}
+
+static void on_sink_info(pa_context *context, const pa_sink_info *info, int eol, void *data) {
+  Request *request = data;
+  if (eol) {
+    request_done(request, eol > 0);
+    return;
+  }
+  g_hash_table_replace(request->control->sinks, GUINT_TO_POINTER(info->index),
+                       g_strdup(info->name));
+}
+
+static PulseSinkInput *sink_input_new(PulseControl *control, guint32 index,
+                                      const CachedInput *cached) {
+  PulseSinkInput *input = g_new0(PulseSinkInput, 1);
+  input->index = index;
+  input->application = g_strdup(cached->application);
+  input->binary = g_strdup(cached->binary);
+  input->pid = cached->pid;
+  input->sink = g_strdup(g_hash_table_lookup(control->sinks, GUINT_TO_POINTER(cached->sink)));
+  return input;
+}
+
+static void on_moved(pa_context *context, int success, void *data) {
+  Request *request = data;
+  PulseControl *control = request->control;
+  if (control->router.moved) {
+    control->router.moved(request->input, success, g_get_monotonic_time() - request->created,
+                          control->router_data);
+  }
+  request_done(request, success);
+}
+
+// Moves a new sink input right away if the router wants it elsewhere.
+static void route(PulseControl *control, guint32 index, const CachedInput *cached,
+                  gint64 created) {
+  if (!control->router.route) return;
+  PulseSinkInput *input = sink_input_new(control, index, cached);
+  const gchar *sink = control->router.route(input, control->router_data);
+  if (!sink || g_strcmp0(sink, input->sink) == 0) {
+    pulse_sink_input_free(input);
+    return;
+  }
+  Request *request = request_new(control, FALSE, NULL);
+  request->created = created;
+  request->input = input;
+  track(control, request,
+        pa_context_move_sink_input_by_name(control->context, index, sink, on_moved, request));
+}
+
+static void on_sink_input_info(pa_context *context, const pa_sink_input_info *info, int eol,
+                               void *data) {
+  Request *request = data;
+  if (eol) {
+    request_done(request, eol > 0);
+    return;
+  }
+  CachedInput *input = g_new0(CachedInput, 1);
+  input->application = g_strdup(pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_NAME));
+  input->binary =
+      g_strdup(pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_PROCESS_BINARY));
+  const gchar *pid = pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_PROCESS_ID);
+  input->pid = pid ? (guint32)g_ascii_strtoull(pid, NULL, 10) : 0;
+  input->sink = info->sink;
+  g_hash_table_replace(request->control->sink_inputs, GUINT_TO_POINTER(info->index), input);
+  if (request->created) route(request->control, info->index, input, request->created);
+}
+
+static void on_subscription_event(pa_context *context, pa_subscription_event_type_t type,
+                                  uint32_t index, void *data) {
+  PulseControl *control = data;
+  pa_subscription_event_type_t facility = type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+  pa_subscription_event_type_t kind = type & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+  gboolean removed = kind == PA_SUBSCRIPTION_EVENT_REMOVE;
+  Request *request = request_new(control, FALSE, NULL);
+  switch (facility) {
+  case PA_SUBSCRIPTION_EVENT_SERVER:
+    track(control, request, pa_context_get_server_info(context, on_server_info, request));
+    return;
+  case PA_SUBSCRIPTION_EVENT_SINK:
+    if (!removed) {
+      track(control, request,
+            pa_context_get_sink_info_by_index(context, index, on_sink_info, request));
+      return;
+    }
+    g_hash_table_remove(control->sinks, GUINT_TO_POINTER(index));
+    break;
+  case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+    if (kind == PA_SUBSCRIPTION_EVENT_NEW) request->created = g_get_monotonic_time();
+    if (!removed) {
+      track(control, request, pa_context_get_sink_input_info(context, index,
+                                                             on_sink_input_info, request));
+      return;
+    }
+    g_hash_table_remove(control->sink_inputs, GUINT_TO_POINTER(index));
+    break;
+  default: break;
+  }
+  g_free(request);
+}
+
+static void on_context_state(pa_context *context, void *data) {
+  PulseControl *control = data;
+  switch (pa_context_get_state(context)) {
+  case PA_CONTEXT_READY:
+  case PA_CONTEXT_FAILED:
+  case PA_CONTEXT_TERMINATED:
+    // Wakes up a connect or a batch waiting for answers that will not come.
+    pa_threaded_mainloop_signal(control->mainloop, 0);
+    break;
+  default: break;
+  }
+}
+
+// Queues a full listing of the cached state.
+static void list_all(PulseControl *control) {
+  g_hash_table_remove_all(control->sinks);
+  g_hash_table_remove_all(control->sink_inputs);
+  Request *request = request_new(control, TRUE, NULL);
+  track(control, request, pa_context_get_server_info(control->context, on_server_info, request));
+  request = request_new(control, TRUE, NULL);
+  track(control, request,
+        pa_context_get_sink_info_list(control->context, on_sink_info, request));
+  request = request_new(control, TRUE, NULL);
+  track(control, request,
+        pa_context_get_sink_input_info_list(control->context, on_sink_input_info, request));
+}
+
+PulseControl *pulse_control_new(const gchar *server, GError **error) {
+  PulseControl *control = g_new0(PulseControl, 1);
+  control->sinks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  control->sink_inputs =
+      g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, cached_input_free);
+  control->mainloop = pa_threaded_mainloop_new();
+  control->context = pa_context_new(pa_threaded_mainloop_get_api(control->mainloop),
+                                    "glib-tutorials");
+  pa_context_set_state_callback(control->context, on_context_state, control);
+  pa_context_set_subscribe_callback(control->context, on_subscription_event, control);
+
+  pa_threaded_mainloop_lock(control->mainloop);
+  gboolean ok = pa_context_connect(control->context, server, PA_CONTEXT_NOAUTOSPAWN, NULL) >= 0 &&
+                pa_threaded_mainloop_start(control->mainloop) >= 0;
+  pa_context_state_t state = pa_context_get_state(control->context);
+  while (ok && PA_CONTEXT_IS_GOOD(state) && state != PA_CONTEXT_READY) {
+    pa_threaded_mainloop_wait(control->mainloop);
+    state = pa_context_get_state(control->context);
+  }
+  if (state != PA_CONTEXT_READY) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED,
+                "could not connect to the sound server: %s",
+                pa_strerror(pa_context_errno(control->context)));
+    pa_threaded_mainloop_unlock(control->mainloop);
+    pulse_control_free(control);
+    return NULL;
+  }
+
+  // Subscribing and the first listing share one round trip.
+  control->batch = TRUE;
+  control->failures = 0;
+  Request *request = request_new(control, TRUE, NULL);
+  track(control, request,
+        pa_context_subscribe(control->context,
+                             PA_SUBSCRIPTION_MASK_SERVER | PA_SUBSCRIPTION_MASK_SINK |
+                                 PA_SUBSCRIPTION_MASK_SINK_INPUT,
+                             on_success, request));
+  list_all(control);
+  if (pulse_control_commit(control) > 0) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "could not read the sound server state");
+    pulse_control_free(control);
+    return NULL;
+  }
+  return control;
+}
+
+PulseControl *pulse_control_get_default(void) {
+  static GMutex lock;
+  static PulseControl *control = NULL;
+  static gboolean tried = FALSE;
+  g_mutex_lock(&lock);
+  if (!tried) {
+    tried = TRUE;
+    GError *error = NULL;
+    control = pulse_control_new(NULL, &error);
+    if (!control) {
+      g_printerr("Sound server: %s\n", error->message);
+      g_error_free(error);
+    }
+  }
+  g_mutex_unlock(&lock);
+  return control;
+}
+
+gchar *pulse_control_get_default_sink(PulseControl *control) {
+  pa_threaded_mainloop_lock(control->mainloop);
+  gchar *sink = g_strdup(control->default_sink);
+  pa_threaded_mainloop_unlock(control->mainloop);
+  return sink;
+}
+
+static gint compare_inputs(gconstpointer a, gconstpointer b) {
+  const PulseSinkInput *x = *(PulseSinkInput *const *)a;
+  const PulseSinkInput *y = *(PulseSinkInput *const *)b;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+GPtrArray *pulse_control_list_sink_inputs(PulseControl *control) {
+  GPtrArray *inputs = g_ptr_array_new_with_free_func((GDestroyNotify)pulse_sink_input_free);
+  pa_threaded_mainloop_lock(control->mainloop);
+  GHashTableIter iter;
+  gpointer key;
+  CachedInput *cached;
+  g_hash_table_iter_init(&iter, control->sink_inputs);
+  while (g_hash_table_iter_next(&iter, &key, (gpointer *)&cached)) {
+    g_ptr_array_add(inputs, sink_input_new(control, GPOINTER_TO_UINT(key), cached));
+  }
+  pa_threaded_mainloop_unlock(control->mainloop);
+  g_ptr_array_sort(inputs, compare_inputs);
+  return inputs;
+}
+
+gboolean pulse_control_refresh(PulseControl *control) {
+  pulse_control_begin(control);
+  list_all(control);
+  return pulse_control_commit(control) == 0;
+}
+
+void pulse_control_set_router(PulseControl *control, const PulseRouter *router,
+                              gpointer data) {
+  pa_threaded_mainloop_lock(control->mainloop);
+  control->router = router ? *router : (PulseRouter){NULL, NULL};
+  control->router_data = data;
+  pa_threaded_mainloop_unlock(control->mainloop);
+}
+
+void pulse_control_begin(PulseControl *control) {
+  pa_threaded_mainloop_lock(control->mainloop);
+  control->batch = TRUE;
+  control->failures = 0;
+}
+
+guint pulse_control_commit(PulseControl *control) {
+  while (control->pending > 0 &&
+         pa_context_get_state(control->context) == PA_CONTEXT_READY) {
+    pa_threaded_mainloop_wait(control->mainloop);
+  }
+  // A dropped connection cancels the outstanding answers.
+  guint failures = control->failures + control->pending;
+  control->pending = 0;
+  control->batch = FALSE;
+  pa_threaded_mainloop_unlock(control->mainloop);
+  return failures;
+}
+
+void pulse_control_load_module(PulseControl *control, const gchar *name,
+                               const gchar *args, guint32 *index) {
+  g_return_if_fail(control->batch);
+  if (index) *index = PULSE_CONTROL_NO_INDEX;
+  Request *request = request_new(control, TRUE, index);
+  track(control, request,
+        pa_context_load_module(control->context, name, args, on_index, request));
+}
+
+void pulse_control_unload_module(PulseControl *control, guint32 index) {
+  g_return_if_fail(control->batch);
+  Request *request = request_new(control, TRUE, NULL);
+  track(control, request,
+        pa_context_unload_module(control->context, index, on_success, request));
+}
+
+void pulse_control_set_default_sink(PulseControl *control, const gchar *sink) {
+  g_return_if_fail(control->batch);
+  Request *request = request_new(control, TRUE, NULL);
+  track(control, request,
+        pa_context_set_default_sink(control->context, sink, on_success, request));
+}
+
+void pulse_control_move_sink_input(PulseControl *control, guint32 input, const gchar *sink) {
+  g_return_if_fail(control->batch);
+  Request *request = request_new(control, TRUE, NULL);
+  track(control, request,
+        pa_context_move_sink_input_by_name(control->context, input, sink, on_success, request));
+}
+
+void pulse_control_free(PulseControl *control) {
+  pa_threaded_mainloop_lock(control->mainloop);
+  pa_context_disconnect(control->context);
+  pa_threaded_mainloop_unlock(control->mainloop);
+  pa_threaded_mainloop_stop(control->mainloop);
+  pa_context_unref(control->context);
+  pa_threaded_mainloop_free(control->mainloop);
+  g_hash_table_unref(control->sinks);
+  g_hash_table_unref(control->sink_inputs);
+  g_free(control->default_sink);
+  g_free(control);
+}
+
+void pulse_sink_input_free(PulseSinkInput *input) {
+  g_free(input->application);
+  g_free(input->binary);
+  g_free(input->sink);
+  g_free(input);
+}
@@ -0,0 +1,71 @@
+#ifndef PULSE_CONTROL_H
+#define PULSE_CONTROL_H
+
+#include <glib.h>
+
+// One persistent libpulse connection (PulseAudio, or PipeWire's pulse
+// server) running on its own thread. The default sink, the sinks and the
+// sink inputs are cached and kept current through the server's change
+// events, so reading them costs no round trip. Requests are queued in
+// batches: they go out back to back, the server answers them in order, and
+// the caller waits once for the whole batch instead of once per request.
+typedef struct _PulseControl PulseControl;
+
+#define PULSE_CONTROL_NO_INDEX G_MAXUINT32
+
+typedef struct {
+  guint32 index;
+  gchar *application; // application.name, may be NULL
+  gchar *binary;      // application.process.binary, may be NULL
+  guint32 pid;        // application.process.id, 0 if unknown
+  gchar *sink;        // name of the sink it plays to, may be NULL
+} PulseSinkInput;
+
+// Decides where new sink inputs go. Both run on the connection's thread with
+// its lock held, so they must not begin a batch.
+typedef struct {
+  // The sink to move `input` to, or NULL to leave it where it is.
+  const gchar *(*route)(const PulseSinkInput *input, gpointer data);
+  // The move was answered; `latency_us` counts from the creation event.
+  void (*moved)(const PulseSinkInput *input, gboolean ok, gint64 latency_us, gpointer data);
+} PulseRouter;
+
+// NULL `server` means the default one ($PULSE_SERVER or the user's).
+PulseControl *pulse_control_new(const gchar *server, GError **error);
+
+// A connection shared by the whole process, made on first use. NULL, with
+// the reason printed once, if there is no sound server.
+PulseControl *pulse_control_get_default(void);
+
+gchar *pulse_control_get_default_sink(PulseControl *control);
+
+// Snapshot of the cached sink inputs (PulseSinkInput), ordered by index.
+GPtrArray *pulse_control_list_sink_inputs(PulseControl *control);
+
+// Lists everything again, for when the cache must not trail a change that
+// was just made, e.g. in a test.
+gboolean pulse_control_refresh(PulseControl *control);
+
+// Routes every sink input created from now on, as soon as its properties
+// are known. NULL `router` stops routing.
+void pulse_control_set_router(PulseControl *control, const PulseRouter *router,
+                              gpointer data);
+
+// The requests below are only valid between begin and commit, which hold
+// the connection's lock. commit waits for every answer and returns how many
+// requests failed.
+void pulse_control_begin(PulseControl *control);
+guint pulse_control_commit(PulseControl *control);
+
+// `index` receives the module index at commit, PULSE_CONTROL_NO_INDEX on failure.
+void pulse_control_load_module(PulseControl *control, const gchar *name,
+                               const gchar *args, guint32 *index);
+void pulse_control_unload_module(PulseControl *control, guint32 index);
+void pulse_control_set_default_sink(PulseControl *control, const gchar *sink);
+void pulse_control_move_sink_input(PulseControl *control, guint32 input, const gchar *sink);
+
+void pulse_control_free(PulseControl *control);
+
+void pulse_sink_input_free(PulseSinkInput *input);
+
+#endif // !PULSE_CONTROL_H
@@ -1,186 +1,211 @@
 #include "sound_exclusion.h"
+#include "exclusion_rules.h"
+#include "pulse_control.h"
 #include <glib.h>
 
-#ifndef STDIN_FILENO
-#define STDIN_FILENO 0
-#endif
-
-#define VIRTUAL_SINK_NAME "GStreamer_Broadcast"
 #define VIRTUAL_SINK_DESC "Auto_Channel_For_Broadcast"
 
-gchar *original_sink = NULL;
-gint32 null_module_id = -1;
-gint32 loop_module_id = -1;
-
-void run_command_output(const gchar *cmd, gchar **result) {
-  GError *error = NULL;
-  gchar *stdout_output = NULL;
-  gint exit_status = 0;
-
-  gboolean success = g_spawn_command_line_sync(cmd, &stdout_output,
-                                               NULL,
-                                               &exit_status, &error);
-
-  if (!success) {
-    g_printerr("Error: Failed to execute command -> %s\nMessage: %s\n", cmd,
-               error->message);
-    g_error_free(error);
-    *result = NULL;
-    return;
-  }
-
-  if (stdout_output) {
-    g_strstrip(stdout_output);
-  }
-
-  *result = stdout_output;
+static PulseControl *pulse = NULL;
+static gchar *original_sink = NULL;
+static guint32 null_module_id = PULSE_CONTROL_NO_INDEX;
+static guint32 loop_module_id = PULSE_CONTROL_NO_INDEX;
+// Read by the router on the connection's thread, so only changed with its lock held.
+static ExclusionRules *rules = NULL;
+static guint routed = 0;
+static gint64 routed_total_us = 0;
+static gint64 routed_max_us = 0;
+
+static gdouble elapsed_ms(gint64 start) {
+  return (g_get_monotonic_time() - start) / 1000.0;
 }
 
-void run_command(const gchar *cmd) {
-  GError *error = NULL;
-  if (!g_spawn_command_line_sync(cmd, NULL, NULL, NULL, &error)) {
-    g_printerr("Error executing command: %s\n", error->message);
-    g_error_free(error);
-  }
+static const gchar *route_input(const PulseSinkInput *input, gpointer data) {
+  return rules && exclusion_rules_match(rules, input) ? original_sink : NULL;
 }
 
-gint32 load_module(const gchar *cmd) {
-  gchar *output = NULL;
-  run_command_output(cmd, &output);
-
-  gint32 id = -1;
-  if (output && *output != '\0') {
-    id = (gint32)g_ascii_strtoll(output, NULL, 10);
+static void on_routed(const PulseSinkInput *input, gboolean ok, gint64 latency_us,
+                      gpointer data) {
+  const gchar *name = input->application ? input->application : "?";
+  if (!ok) {
+    g_printerr("[exclusion] could not move #%u %s\n", input->index, name);
+    return;
   }
-
-  g_free(output);
-  return id;
+  routed++;
+  routed_total_us += latency_us;
+  routed_max_us = MAX(routed_max_us, latency_us);
+  g_print("[exclusion] #%u %s moved to %s %.1f ms after it appeared\n", input->index, name,
+          original_sink, latency_us / 1000.0);
 }
 
+static const PulseRouter router = {route_input, on_routed};
+
 void restore_system() {
   g_print("\n[*] Restoring system configuration...\n");
 
-  if (original_sink != NULL && g_utf8_strlen(original_sink, -1) > 0) {
-    gchar *cmd = g_strdup_printf("pactl set-default-sink %s", original_sink);
-    run_command(cmd);
-    g_print(" -> Default sink restored: %s\n", original_sink);
-    g_free(cmd);
-  }
-
-  if (null_module_id != -1) {
-    gchar *cmd = g_strdup_printf("pactl unload-module %d", null_module_id);
-    run_command(cmd);
-    g_print(" -> Virtual sink removed (ID: %d)\n", null_module_id);
-    g_free(cmd);
-    null_module_id = -1;
+  if (pulse) pulse_control_set_router(pulse, NULL, NULL);
+  if (routed) {
+    g_print(" -> %u new stream(s) excluded by rules, %.1f ms on average, %.1f ms at most\n",
+            routed, routed_total_us / 1000.0 / routed, routed_max_us / 1000.0);
   }
-
-  if (loop_module_id != -1) {
-    gchar *cmd = g_strdup_printf("pactl unload-module %d", loop_module_id);
-    run_command(cmd);
-    g_print(" -> Loopback removed (ID: %d)\n", loop_module_id);
-    g_free(cmd);
-    loop_module_id = -1;
+  if (rules) exclusion_rules_free(rules);
+  rules = NULL;
+  routed = 0;
+  routed_total_us = routed_max_us = 0;
+
+  // Default sink first, so nothing new lands on the sink being removed.
+  if (pulse) {
+    gint64 start = g_get_monotonic_time();
+    pulse_control_begin(pulse);
+    if (original_sink && *original_sink) pulse_control_set_default_sink(pulse, original_sink);
+    if (null_module_id != PULSE_CONTROL_NO_INDEX) pulse_control_unload_module(pulse, null_module_id);
+    if (loop_module_id != PULSE_CONTROL_NO_INDEX) pulse_control_unload_module(pulse, loop_module_id);
+    guint failures = pulse_control_commit(pulse);
+
+    if (original_sink && *original_sink) g_print(" -> Default sink restored: %s\n", original_sink);
+    if (null_module_id != PULSE_CONTROL_NO_INDEX) {
+      g_print(" -> Virtual sink removed (ID: %u)\n", null_module_id);
+    }
+    if (loop_module_id != PULSE_CONTROL_NO_INDEX) {
+      g_print(" -> Loopback removed (ID: %u)\n", loop_module_id);
+    }
+    if (failures) g_printerr("Error: %u restore request(s) failed.\n", failures);
+    g_print(" -> Done in %.1f ms\n", elapsed_ms(start));
   }
+  null_module_id = loop_module_id = PULSE_CONTROL_NO_INDEX;
 
   g_print("[OK] Exited successfully.\n");
 
-  if (original_sink) {
-    g_free(original_sink);
-    original_sink = NULL;
-  }
+  g_free(original_sink);
+  original_sink = NULL;
 }
 
-void get_excluded_sound() {
+gboolean sound_exclusion_setup() {
   restore_system();
 
-  run_command_output("pactl get-default-sink", &original_sink);
+  pulse = pulse_control_get_default();
+  if (!pulse) {
+    g_printerr("Error: Could not connect to the sound server.\n");
+    return FALSE;
+  }
+  original_sink = pulse_control_get_default_sink(pulse);
 
   if (original_sink == NULL) {
     g_printerr("Error: Could not determine default sink.\n");
-    return;
+    return FALSE;
   }
 
   g_print("[*] Current Physical Sink: %s\n", original_sink);
 
-  if (g_strcmp0(original_sink, VIRTUAL_SINK_NAME) == 0) {
+  if (g_strcmp0(original_sink, SOUND_EXCLUSION_SINK) == 0) {
     g_printerr("ERROR: Virtual sink is already the default. Please reset the "
                "system first.\n");
-    return;
+    return FALSE;
+  }
+
+  // The server handles one connection's requests in order, so the loopback
+  // and the new default can follow the sink they need without waiting.
+  g_print("[*] Creating virtual sink, loopback and default sink...\n");
+  gint64 start = g_get_monotonic_time();
+  gchar *null_args = g_strdup_printf("sink_name=%s sink_properties=device.description=%s",
+                                     SOUND_EXCLUSION_SINK, VIRTUAL_SINK_DESC);
+  gchar *loop_args = g_strdup_printf("source=%s.monitor sink=%s", SOUND_EXCLUSION_SINK,
+                                     original_sink);
+  pulse_control_begin(pulse);
+  pulse_control_load_module(pulse, "module-null-sink", null_args, &null_module_id);
+  pulse_control_load_module(pulse, "module-loopback", loop_args, &loop_module_id);
+  pulse_control_set_default_sink(pulse, SOUND_EXCLUSION_SINK);
+  guint failures = pulse_control_commit(pulse);
+  g_free(loop_args);
+  g_free(null_args);
+
+  if (failures) {
+    g_printerr("Error: %u setup request(s) failed.\n", failures);
+    return FALSE;
   }
+  g_print(" -> Virtual sink %u, loopback %u, ready in %.1f ms\n", null_module_id,
+          loop_module_id, elapsed_ms(start));
+  return TRUE;
+}
+
+guint sound_exclusion_exclude(const guint32 *ids, guint n) {
+  if (!pulse || !original_sink) return 0;
+  pulse_control_begin(pulse);
+  for (guint i = 0; i < n; i++) pulse_control_move_sink_input(pulse, ids[i], original_sink);
+  return n - pulse_control_commit(pulse);
+}
 
-  g_print("[*] Creating virtual sink...\n");
-  gchar *cmd_null =
-      g_strdup_printf("pactl load-module module-null-sink sink_name=%s "
-                      "sink_properties=device.description=%s",
-                      VIRTUAL_SINK_NAME, VIRTUAL_SINK_DESC);
-  null_module_id = load_module(cmd_null);
-  g_free(cmd_null);
-
-  g_print("[*] Enabling loopback...\n");
-  gchar *cmd_loop = g_strdup_printf(
-      "pactl load-module module-loopback source=%s.monitor sink=%s",
-      VIRTUAL_SINK_NAME, original_sink);
-  loop_module_id = load_module(cmd_loop);
-  g_free(cmd_loop);
-
-  g_print("[*] Setting default sink to VIRTUAL SINK...\n");
-  gchar *cmd_def =
-      g_strdup_printf("pactl set-default-sink %s", VIRTUAL_SINK_NAME);
-  run_command(cmd_def);
-  g_free(cmd_def);
+static void print_sink_inputs() {
+  GPtrArray *inputs = pulse_control_list_sink_inputs(pulse);
+  for (guint i = 0; i < inputs->len; i++) {
+    PulseSinkInput *input = inputs->pdata[i];
+    g_print("Sink Input #%u\n\t\tapplication.name = \"%s\"\n", input->index,
+            input->application ? input->application : "");
+    if (input->binary) g_print("\t\tapplication.process.binary = \"%s\"\n", input->binary);
+    if (input->pid) g_print("\t\tapplication.process.id = \"%u\"\n", input->pid);
+  }
+  g_ptr_array_unref(inputs);
+}
+
+gboolean sound_exclusion_start() {
+  if (!sound_exclusion_setup()) return FALSE;
+  pulse_control_set_router(pulse, &router, NULL);
 
   g_print("-----------------------\n");
 
   g_print("\nAudio Sources:\n");
-  run_command(
-      "pactl list sink-inputs | grep -E 'Sink Input #|application.name'");
-
-  g_print("\n[Waiting for Command]\n");
-  g_print("1. 'exclude {id} {id}...' -> Move given IDs to physical card (Hide "
-          "from broadcast)\n");
-  g_print("2. 'exit'                 -> Restore system and exit\n");
-  g_print("> ");
-
-  GIOChannel *channel = g_io_channel_unix_new(STDIN_FILENO);
-  gchar *input_line = NULL;
-  gsize len = 0;
-  GError *err = NULL;
-
-  if (g_io_channel_read_line(channel, &input_line, &len, NULL, &err) ==
-      G_IO_STATUS_NORMAL) {
-    if (input_line) {
-      g_strstrip(input_line);
-
-      if (g_strcmp0(input_line, "exit") == 0) {
-        restore_system();
-      } else if (g_str_has_prefix(input_line, "exclude ")) {
-        gchar **tokens = g_strsplit(input_line + 8, " ", -1);
-        gchar **current = tokens;
-
-        while (*current != NULL) {
-          guint32 app_id = (guint32)g_ascii_strtoull(*current, NULL, 10);
-          if (app_id > 0) {
-            g_print(" -> Moving App %u to Physical Card...\n", app_id);
-            gchar *move_cmd = g_strdup_printf("pactl move-sink-input %u %s",
-                                              app_id, original_sink);
-            run_command(move_cmd);
-            g_free(move_cmd);
-          }
-          current++;
-        }
-        g_strfreev(tokens);
-      } else {
-        g_print("Unknown command. Type 'exclude ID' or 'exit'.\n");
+  print_sink_inputs();
+
+  g_print("\nType 'exclude RULE|ID...' to keep apps out of the broadcast, e.g.\n"
+          "'exclude app:*spotify*', 'exclude binary:firefox', 'exclude pid:4242' or\n"
+          "'exclude 42' for one sink input. Rules also catch apps that start later.\n");
+  return TRUE;
+}
+
+gboolean sound_exclusion_add_rule(const gchar *rule) {
+  if (!pulse || !original_sink) {
+    g_printerr("Error: Sound exclusion is not set up.\n");
+    return FALSE;
+  }
+  // Under the connection's lock, so no new stream slips in between the
+  // existing ones being moved and the router seeing the rule.
+  pulse_control_begin(pulse);
+  if (!rules) rules = exclusion_rules_new();
+  gboolean ok = exclusion_rules_add(rules, rule);
+  guint matched = 0;
+  if (ok) {
+    GPtrArray *inputs = pulse_control_list_sink_inputs(pulse);
+    for (guint i = 0; i < inputs->len; i++) {
+      PulseSinkInput *input = inputs->pdata[i];
+      if (exclusion_rules_match(rules, input) && g_strcmp0(input->sink, original_sink) != 0) {
+        pulse_control_move_sink_input(pulse, input->index, original_sink);
+        matched++;
       }
-      g_free(input_line);
-    }
-  } else {
-    if (err) {
-      g_printerr("Error reading input: %s\n", err->message);
-      g_error_free(err);
     }
+    g_ptr_array_unref(inputs);
   }
+  guint failures = pulse_control_commit(pulse);
+  if (ok) g_print("[exclusion] rule %s: %u playing stream(s) moved\n", rule, matched - failures);
+  return ok;
+}
 
-  g_io_channel_unref(channel);
+void sound_exclusion_command(const gchar *args) {
+  gchar **tokens = g_strsplit(args, " ", -1);
+  GArray *ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+  for (gchar **current = tokens; *current != NULL; current++) {
+    if (**current == '\0') continue;
+    guint64 app_id;
+    if (g_ascii_string_to_unsigned(*current, 10, 1, G_MAXUINT32, &app_id, NULL)) {
+      g_print(" -> Moving App %u to Physical Card...\n", (guint32)app_id);
+      guint32 id = (guint32)app_id;
+      g_array_append_val(ids, id);
+    } else {
+      sound_exclusion_add_rule(*current);
+    }
+  }
+  // One batch for all of them.
+  guint moved = sound_exclusion_exclude((guint32 *)ids->data, ids->len);
+  if (moved < ids->len) g_printerr("Error: %u app(s) could not be moved.\n", ids->len - moved);
+  g_array_unref(ids);
+  g_strfreev(tokens);
 }
@@ -1,5 +1,32 @@
 #ifndef SOUND_EXCLUSION_H
 #define SOUND_EXCLUSION_H
-void get_excluded_sound();
+
+#include <glib.h>
+
+// The virtual sink everything plays to while excluding; its monitor is what
+// gets broadcast.
+#define SOUND_EXCLUSION_SINK "GStreamer_Broadcast"
+
+// Creates the virtual sink, loops it back to the physical one and makes it
+// the default, in one batch over the shared sound server connection.
+gboolean sound_exclusion_setup();
+
+// Moves sink inputs to the physical sink, out of the broadcast. Returns how
+// many were moved.
+guint sound_exclusion_exclude(const guint32 *ids, guint n);
+
+// Setup plus rule routing: from here on, every new stream that matches a
+// rule is moved to the physical sink as soon as the server announces it.
+// Returns at once; lists the current streams and how to add rules.
+gboolean sound_exclusion_start();
+
+// Adds an exclusion_rules.h rule and moves the playing streams it matches.
+gboolean sound_exclusion_add_rule(const gchar *rule);
+
+// "exclude" arguments: numbers are sink inputs to move once, anything else
+// is a rule.
+void sound_exclusion_command(const gchar *args);
+
+// Stops routing, prints the rule latencies and undoes the setup.
 void restore_system();
-#endif // !SOUND_EXCLUSION_H
\ No newline at end of file
+#endif // !SOUND_EXCLUSION_H
@@ -19,7 +19,7 @@ static gboolean trying_timeout(gpointer user_data) {
   return G_SOURCE_CONTINUE;
 }
 
-void timeout_tutorial(int argc, char *argv[]) {
+int timeout_tutorial(int argc, char *argv[]) {
   G_GNUC_UNUSED int _argc = argc;
   G_GNUC_UNUSED char **_argv = argv;
   GMainLoop *loop = g_main_loop_new(NULL, FALSE);
@@ -32,4 +32,5 @@ void timeout_tutorial(int argc, char *argv[]) {
   g_main_loop_unref(loop);
 
   printf("Timeout tutorial finished.\n");
+  return 0;
 }
@@ -2,6 +2,6 @@
 #define TIMEOUT_EXAMPLE_H
 #include <glib.h>
 
-void timeout_tutorial(int argc, char *argv[]);
+int timeout_tutorial(int argc, char *argv[]);
 
 #endif // !TIMEOUT_EXAMPLE_H